@@ -0,0 +1,48 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "scan.h"
+
+// A checkpoint file (option --checkpoint) records the last PKG file that has
+// been completed: the index of the FILE|DIRECTORY operand it has been found in,
+// the operand, and the file's path relative to the operand. Directories are
+// searched in sorted order, so this position is enough to tell which files
+// have been completed and which subdirectories still have to be searched.
+// Completed files that have been renamed may now come after the position, so
+// they are recorded as well, by device and inode number.
+
+// Prepares a checkpoint file and, with option --resume, loads the position it
+// records, if the file exists.
+// Returns 0 on success and -1 on error.
+int load_checkpoint(const char *filename);
+
+// Option --resume: returns 1 if the operand <name> at index <operand> has been
+// completed in the interrupted run, else 0. If the run has been interrupted
+// while searching the operand, <path> is set to the relative path of the last
+// completed file, else to NULL. Exits the program if the operand differs from
+// the one recorded in the checkpoint file.
+int is_operand_completed(int operand, const char *name, _Bool is_dir,
+    const char **path);
+
+// Option --resume: returns 1 if the file <path> has been renamed or moved in the
+// interrupted run, which means that it has been completed, else 0.
+int is_file_completed(const char *path);
+
+// Records that the file <path> is about to be renamed or moved, to be saved
+// with the next position.
+void record_renamed_file(const char *path);
+
+// Records that a scan has been completed; the checkpoint file is written at
+// most once every CHECKPOINT_INTERVAL seconds.
+#define CHECKPOINT_INTERVAL 1
+void update_checkpoint(const struct scan *scan);
+
+// Writes the checkpoint file right away, after all queued renames have been
+// run.
+// Returns 0 on success and -1 on error.
+int save_checkpoint(void);
+
+// Removes the checkpoint file after a run has been completed.
+void remove_checkpoint(void);
+
+#endif
@@ -39,4 +39,20 @@ extern char *tag_separator;
 void exit_err(int err, const char *function_name, int line)
     __attribute__ ((noreturn));
 
+// Hash functions for the hash tables (FNV-1a). To hash several values, start
+// with HASH_INIT and pass each result on to the next call.
+#define HASH_INIT 2166136261u
+
+static inline unsigned int hash_byte(unsigned int hash, unsigned char c)
+{
+    return (hash ^ c) * 16777619u;
+}
+
+unsigned int hash_string(unsigned int hash, const char *s);
+unsigned int hash_number(unsigned int hash, unsigned long long n);
+
+// Returns the size of a hash table for <n> entries: the smallest power of 2
+// that is not less than <n>.
+size_t get_table_size(size_t n);
+
 #endif
@@ -0,0 +1,27 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "pkg.h"
+#include "scan.h"
+
+// A filter expression (option --where) selects the PKG files that are
+// processed. It is compiled once and then evaluated by the probe threads, in
+// two stages: against the PKG header, before any other data is read, and, if
+// that is not enough to decide, against the PKG's pattern variables.
+
+// Compiles a filter expression, printing a message if it is invalid.
+// Returns 0 on success and -1 on error.
+int compile_filter(const char *expression);
+
+// Returns 1 if a PKG with the given header fields may match the filter, or 0
+// if it can't match, whatever the rest of its data.
+// Returns 1 if no filter has been compiled.
+int match_pkg_header(const struct pkg_header_fields *header);
+
+// Returns 1 if a successful scan, whose header fields have already been
+// matched, matches the filter, else 0.
+// Returns 1 if no filter has been compiled.
+int match_filter(const struct scan *scan,
+    const struct pkg_header_fields *header);
+
+#endif
@@ -81,15 +81,27 @@ int main(int argc, char *argv[])
 
 static char var_HIDEOPT; // Dummy variable to make the HIDEOPT pointer unique.
 
-// Left-shifts array elements by 1, moving the first element to the end.
-static void shift(char *argv[])
+// Reverses the array elements in the range [first, last).
+static void reverse(char **first, char **last)
 {
-    char *first_element = argv[0];
-    while (argv[1] != NULL) {
-        argv[0] = argv[1];
-        argv++;
+    while (first < last - 1) {
+        char *tmp = *first;
+        *first++ = *--last;
+        *last = tmp;
     }
-    argv[0] = first_element;
+}
+
+// Left-rotates the elements of a NULL-terminated array by n, moving the first
+// n elements to the end, in linear time.
+static void rotate(char *argv[], int n)
+{
+    char **end = argv;
+    while (*end != NULL)
+        end++;
+
+    reverse(argv, argv + n);
+    reverse(argv + n, end);
+    reverse(argv, end);
 }
 
 // Return values: 0 when done, '?' on error, otherwise an option's .index value.
@@ -125,12 +137,11 @@ start:
                 (*argv)++;
                 (*argc)--;
 
-                // Shift-hide all remaining operands.
-                if ((*argv)[*argc] != NULL)
-                    while (*argc) {
-                        shift(*argv);
-                        (*argc)--;
-                    }
+                // Rotate-hide all remaining operands.
+                if ((*argv)[*argc] != NULL) {
+                    rotate(*argv, *argc);
+                    *argc = 0;
+                }
 
                 goto parsing_finished;
             }
@@ -222,9 +233,14 @@ not_an_option:
             return '?';
         }
 
-        // Move operand to the end of argv[] and hide it for now.
-        shift(*argv);
-        (*argc)--; // Hide it.
+        // Move the operand, and any operands that directly follow it, to the
+        // end of argv[] and hide them for now. Moving whole runs at once keeps
+        // parsing linear for long operand lists.
+        int n = 1;
+        while (n < *argc && ((*argv)[n][0] != '-' || (*argv)[n][1] == '\0'))
+            n++;
+        rotate(*argv, n);
+        *argc -= n; // Hide them.
 
         if (*argc == 0)
             goto parsing_finished;
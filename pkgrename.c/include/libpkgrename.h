@@ -0,0 +1,43 @@
+#ifndef LIBPKGRENAME_H
+#define LIBPKGRENAME_H
+
+// Public interface of libpkgrename, pkgrename's file name rendering core, for
+// tools that want to compute pkgrename's names without running pkgrename.
+//
+// Typical use:
+//
+//     struct render_context ctx;
+//     init_render_context(&ctx, "%title% [%title_id%]");
+//
+//     struct scan scan = { .filename = path };
+//     scan.error = load_pkg_data(&scan.param_sfo, &scan.changelog,
+//         &scan.fake_status, scan.filename, NULL);
+//
+//     struct pattern_vars vars;
+//     char name[MAX_FORMAT_STRING_LEN];
+//     if (scan.error == 0 && load_pattern_vars(&ctx, &vars, &scan) == 0) {
+//         mixed_case(vars.title); // Optional, like option --mixed-case.
+//         build_filename(&ctx, name, &vars, NULL, NULL);
+//     }
+//
+//     free(scan.param_sfo);
+//     free(scan.changelog);
+//
+// All state that rendering depends on is passed explicitly: the settings and
+// the compiled pattern in a struct render_context, the user's release tags in
+// a struct tag_db, and the results in a struct pattern_vars. Contexts and tag
+// databases are only read, so any number of threads may render with the same
+// ones at the same time. A title database loaded with load_title_db() is
+// shared by all contexts and may not be reloaded while rendering, and words
+// added with load_special_words() must be loaded before mixed_case() is called
+// by multiple threads.
+
+#include "common.h"
+#include "pkg.h"
+#include "releaselists.h"
+#include "render.h"
+#include "scan.h"
+#include "strings.h"
+#include "titledb.h"
+
+#endif
@@ -1,3 +1,9 @@
 #define MAX_FILENAME_LEN 256
 
+// Searches the PlayStation Store for a Content ID's title and, if found, copies
+// it to <title>, a buffer of size MAX_TITLE_LEN.
 void search_online(char *content_id, char *title, int silent);
+
+// Starts looking up a Content ID's title in the background, so that a later
+// call to search_online() can return without waiting.
+void prefetch_online_title(const char *content_id);
@@ -1,24 +1,74 @@
 #ifndef OPTIONS_H
 #define OPTIONS_H
 
+#include "render.h"
+
+#include <sys/types.h>
+
+#define MAX_DEVICE_PROBE_JOBS 16
+
+// Number of concurrent PKG probes for the device that contains a path.
+struct device_probe_jobs {
+    dev_t dev;
+    int jobs;
+};
+
 extern int option_override_tags;
+extern char *option_checkpoint;
+extern int option_collision;
 extern int option_compact;
+extern int option_disk_order;
 extern int option_disable_colors;
+extern char **option_exclude;
+extern int option_n_exclude;
 extern int option_force;
 extern int option_force_backup;
+extern char *option_files_from;
+extern char **option_include;
+extern int option_n_include;
+extern int option_max_depth;
 extern int option_mixed_case;
 extern int option_no_placeholder;
+extern int option_null;
 extern int option_no_to_all;
 extern char option_language_number[3];
 extern int option_leading_zeros;
+extern int option_offline;
 extern int option_online;
+extern char *option_online_cache;
+extern int option_online_jobs;
+extern int option_online_rate;
+extern int option_one_file_system;
+extern char *option_organize;
+extern int option_online_ttl;
+extern int option_probe_jobs;
+extern struct device_probe_jobs option_device_probe_jobs[MAX_DEVICE_PROBE_JOBS];
+extern int option_n_device_probe_jobs;
 extern int option_query;
 extern int option_recursive;
+extern int option_rename_jobs;
+extern int option_report;
+extern int option_resume;
+extern char *option_serve;
+extern int option_shard;
+extern int option_n_shards;
+extern int option_shard_by_directory;
+extern int option_since;
+extern char *option_sort_by;
+extern char *option_state;
 extern char *option_tag_separator;
+extern char *option_title_db;
 extern int option_underscores;
 extern int option_verbose;
+extern char **option_views;
+extern int option_n_views;
+extern int option_watch;
+extern char *option_where;
 extern int option_yes_to_all;
 
+// Render context built from the options by parse_options().
+extern struct render_context render_context;
+
 void print_usage(void);
 void print_prompt_help(void);
 void parse_options(int *argc, char **argv[]);
@@ -0,0 +1,34 @@
+#ifndef ORGANIZE_H
+#define ORGANIZE_H
+
+#include <stddef.h>
+
+#include "render.h"
+#include "scan.h"
+
+// Option --organize moves files into directories that are built from a second
+// pattern (e.g. "%region%/%title_id%/%type%"), one pattern variable based
+// directory name per component.
+
+// Builds the directory, ending with a directory separator, that option
+// --organize moves a scanned file to. <path> is the file's current directory,
+// also ending with a directory separator.
+// Returns the offset of the part that has been built from the pattern, or -1
+// if the directory's path is too long.
+int build_organize_directory(char *dir, size_t size, const struct scan *scan,
+    const char *path, const struct pattern_vars *vars);
+
+// Appends the directories built from <pattern>, each ending with a directory
+// separator, to the buffer <dir> of size <size> that contains <*len>
+// characters. Components whose pattern variables are all empty are skipped.
+// Returns 0 on success and -1 if the buffer is too small.
+int append_pattern_directories(char *dir, size_t size, size_t *len,
+    const char *pattern, const struct pattern_vars *vars);
+
+// Creates a directory and its missing parent directories. Directories that have
+// been created or found before are remembered and not checked again. Must not
+// be called by multiple threads at the same time.
+// Returns 0 on success and -1 on error.
+int create_directory(const char *path);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef PATHFILTER_H
+#define PATHFILTER_H
+
+// Path filters (options --exclude and --include) are glob patterns that are
+// matched against a directory entry's name or, if a pattern contains a
+// directory separator, against the entry's path relative to the DIRECTORY
+// operand it was found in.
+
+// Compiles the patterns of options --exclude and --include.
+void compile_path_filters(void);
+
+// Returns 1 if a subdirectory must not be traversed, else 0.
+int is_excluded_directory(const char *name, const char *relative_path);
+
+// Returns 1 if a PKG file found in a directory must be skipped, else 0.
+int is_excluded_file(const char *name, const char *relative_path);
+
+// Option --shard: returns 1 if a PKG file belongs to this run's shard, else 0.
+// <relative_path> is the file's path relative to its DIRECTORY operand, or the
+// FILE operand itself.
+int is_in_shard(const char *relative_path);
+
+#endif
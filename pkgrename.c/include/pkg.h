@@ -1,17 +1,33 @@
 #ifndef PKG_H
 #define PKG_H
 
+#include <stdio.h>
+
+// PKG header fields that are read before any other data.
+struct pkg_header_fields {
+    char content_id[37];
+    unsigned long content_type;
+    unsigned long content_flags;
+    _Bool filtered; // The PKG does not match the filter.
+
+    // Option --where: decides whether loading continues; may be NULL.
+    int (*match)(const struct pkg_header_fields *header);
+};
+
 // Loads PKG data into dynamically allocated buffers and passes their pointers.
-// Returns 0 on success and -1 on error.
+// If <header> is not NULL, it receives the PKG header's fields, and if these
+// don't match, as decided by header->match(), loading stops: header->filtered
+// is set and no buffers are allocated.
+// Returns 0 on success or a scan error code.
 int load_pkg_data(unsigned char **param_sfo, char **changelog,
-    _Bool *fake_status, const char *filename);
+    _Bool *fake_status, const char *filename, struct pkg_header_fields *header);
 
 // Searches a buffered param.sfo file for a key/value pair and returns a pointer
 // to the value. Returns NULL if the key is not found.
 void *get_param_sfo_value(const unsigned char *param_sfo_buf, const char *key);
 
 // Prints a buffered param.sfo file's keys and values.
-void print_param_sfo(const unsigned char *param_sfo_buf);
+void print_param_sfo(FILE *stream, const unsigned char *param_sfo_buf);
 
 // Loads the true patch version from a string and stores it in a buffer;
 // the buffer must be of size 6.
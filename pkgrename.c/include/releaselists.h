@@ -1,11 +1,22 @@
 #ifndef RELEASELISTS_H
 #define RELEASELISTS_H
 
+#include "common.h"
+
+// User-provided release tags, which are checked before the built-in ones.
+struct tag_db {
+    char **tags;
+    int n_tags;
+};
+
 // Searches the argument for known release groups and returns the first match.
 char *get_release_group(char *string);
 
-// Searches the argument for known releases and returns the first match.
-int get_release(char **release, const char *string);
+// Searches the argument for known releases and stores a pointer to the match
+// in <release>. Multiple matches are joined with commas in <buf>.
+// Returns the number of matches.
+int get_release(const struct tag_db *db, char **release, char buf[MAX_TAG_LEN],
+    const char *string);
 
 // Used as autocomplete function for scan_string() (in terminal.c).
 // Returns the name of a tag if it is found in "string".
@@ -0,0 +1,60 @@
+#ifndef RENAME_H
+#define RENAME_H
+
+#include <stddef.h>
+
+// What rename_file() does if a file with the new name already exists.
+enum collision_policy {
+    COLLISION_ABORT, // Print an error and fail.
+    COLLISION_SKIP,  // Print a warning and keep the old name.
+    COLLISION_SUFFIX // Append " (2)", " (3)", ... to the new name.
+};
+
+// Opens a directory for use with rename_file().
+// Returns a directory file descriptor or -1 on error.
+int open_directory(const char *path);
+
+// Closes a directory file descriptor returned by open_directory().
+void close_directory(int dir_fd);
+
+// Renames file <old_name> to <new_name> inside the directory <dir_fd> (as
+// returned by open_directory()) without ever overwriting an existing file.
+// <dir_path> must end with a directory separator and is used for messages.
+// If option_collision is COLLISION_SUFFIX, the buffer <new_name>, of size
+// <new_name_size>, will be updated to the name that has been used.
+// Returns 0 on success, 1 if the file has been skipped, and -1 on error or if
+// option_collision is COLLISION_ABORT and the new name is taken.
+int rename_file(int dir_fd, const char *dir_path, const char *old_name,
+    char *new_name, size_t new_name_size);
+
+// Renames file <old_name> in the directory <src_fd> to <new_name> in the
+// directory <dst_fd>, like rename_file(). If the directories are on different
+// file systems, the file is copied, verified, and then deleted.
+// Returns the same values as rename_file().
+int move_file(int src_fd, const char *src_path, const char *old_name,
+    int dst_fd, const char *dst_path, char *new_name, size_t new_name_size);
+
+// Starts <n_threads> threads that run queued renames concurrently.
+// Returns 0 on success and -1 on error.
+int start_rename_executor(int n_threads);
+
+// Queues a move of file <old_name> in directory <dir_path> to <new_name> in
+// directory <target_path> for the executor; the strings are copied. Renames
+// that touch the same names in the same directory are run in the order they
+// are queued. Once the move has been run, <done> (if not NULL) is called from
+// an executor thread with <data>, the move's result (as returned by
+// move_file()), and the new name that has been used. Exits the program if a
+// previous rename has failed.
+void queue_move(const char *dir_path, const char *old_name,
+    const char *target_path, const char *new_name,
+    void (*done)(void *data, int result, const char *new_name), void *data);
+
+// Waits until all queued renames have been run; returns right away if the
+// executor is not running. Exits the program if a rename has failed.
+void wait_for_renames(void);
+
+// Waits for all queued renames, stops the executor, and prints statistics.
+// Exits the program if a rename has failed.
+void finish_rename_executor(void);
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "common.h"
+#include "releaselists.h"
+#include "scan.h"
+
+// Pattern variables that are expensive to load, so they are only loaded if
+// a pattern uses them.
+enum pattern_variable {
+    PATTERN_VAR_MSUM = 1 << 0,
+    PATTERN_VAR_RELEASE = 1 << 1,
+    PATTERN_VAR_RELEASE_GROUP = 1 << 2,
+    PATTERN_VAR_SIZE = 1 << 3,
+};
+
+// A file name pattern and the expensive variables it uses.
+struct name_pattern {
+    const char *text;
+    unsigned int variables; // Bitwise OR of enum pattern_variable values.
+};
+
+// Everything that loading pattern variables and rendering patterns depends on.
+// A context is never modified while rendering, so multiple threads may render
+// with the same context at the same time.
+struct render_context {
+    struct name_pattern pattern; // The file name pattern.
+    unsigned int variables; // Expensive variables to load; see above.
+    const struct tag_db *tag_db;
+    struct custom_category categories;
+    char *backport_string;
+    char *fake_string;
+    char *retail_string;
+    const char *language_number; // Empty for the default language.
+    const char *tag_separator; // Replaces commas between releases if not NULL.
+    char placeholder; // Replaces illegal characters.
+    _Bool leading_zeros;
+    _Bool override_tags;
+    _Bool underscores;
+};
+
+// Values of a PKG's pattern variables; NULL pointers and empty strings mean
+// the value is not available.
+struct pattern_vars {
+    char *app;
+    char *app_ver;
+    char *backport;
+    char *category;
+    char *content_id;
+    char *dlc;
+    char *fake;
+    char *fake_status;
+    char file_id_suffix[13];
+    char firmware[9];
+    char *game;
+    char *merged_ver;
+    char msum[7];
+    char *other;
+    char *patch;
+    char *region;
+    char *release_group;
+    char *release;
+    char release_buf[MAX_TAG_LEN]; // Storage for multiple releases.
+    char *retail;
+    char sdk[6];
+    char size[10];
+    char title[MAX_TITLE_LEN];
+    char *title_backup; // The original title, as found in param.sfo.
+    char *title_id;
+    char *true_ver;
+    char true_ver_buf[6];
+    char *type;
+    char *version;
+
+    // Manually entered tags that take precedence over detected ones.
+    char tag_release_group[MAX_TAG_LEN + 1];
+    char tag_release[MAX_TAG_LEN + 1];
+
+    _Bool release_ambiguous; // Multiple releases found in the changelog.
+    _Bool title_from_db; // %title% has been found in the title database.
+};
+
+// Compiles a pattern, which must stay valid as long as the compiled pattern is
+// used.
+void compile_name_pattern(struct name_pattern *pattern, const char *text);
+
+// Initializes a render context with the default settings, no user tags, and
+// <pattern> as file name pattern, which must stay valid as long as the context
+// is used.
+void init_render_context(struct render_context *ctx, const char *pattern);
+
+// Fills a struct pattern_vars with the values from a successful scan.
+// Returns 0 on success and -1 on error.
+int load_pattern_vars(const struct render_context *ctx,
+    struct pattern_vars *vars, const struct scan *scan);
+
+// Copies a struct pattern_vars. Some of its members point to its own buffers,
+// so it must not be copied by assignment.
+void copy_pattern_vars(struct pattern_vars *dst, const struct pattern_vars *src);
+
+// Builds a new file name from a context's pattern and a struct pattern_vars.
+// The buffer <new_basename> must be of size MAX_FORMAT_STRING_LEN.
+// If not NULL, <spec_chars_current> and <spec_chars_total> receive the number
+// of special characters after and before automatic replacements.
+void build_filename(const struct render_context *ctx, char *new_basename,
+    const struct pattern_vars *vars, int *spec_chars_current,
+    int *spec_chars_total);
+
+// Builds a directory name from <pattern>, a single component of option
+// --organize's pattern, and a struct pattern_vars, like build_filename().
+// The buffer <name> must be of size MAX_FORMAT_STRING_LEN.
+void build_directory_name(const struct render_context *ctx, char *name,
+    const char *pattern, const struct pattern_vars *vars);
+
+#endif
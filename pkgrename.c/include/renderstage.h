@@ -0,0 +1,37 @@
+#ifndef RENDERSTAGE_H
+#define RENDERSTAGE_H
+
+#include "common.h"
+#include "render.h"
+#include "scan.h"
+
+// In non-interactive runs (options --no-to-all, --query, and --yes-to-all),
+// nothing can change a file's new name after its PKG data has been loaded, so
+// the probe threads render it right away: pattern variables, option
+// --mixed-case, the file name, and option --organize's directory. The main
+// thread then only prints the results and renames the files, in list order.
+// Option --online needs the main thread's title lookups and disables the stage.
+
+// A file's new name, as rendered by a probe thread.
+struct rendered_name {
+    struct pattern_vars vars;
+    char new_basename[MAX_FORMAT_STRING_LEN];
+    int spec_chars_current;
+    int spec_chars_total;
+    char *target_dir; // Option --organize's directory, or NULL.
+    int target_offset; // Offset of the part built from the pattern.
+};
+
+// Returns 1 if the options allow scans to be rendered by the probe threads,
+// else 0.
+int use_render_stage(void);
+
+// Renders a successfully probed scan's new name.
+// Returns a dynamically allocated result or NULL on error, in which case the
+// main thread renders the name again to report the error.
+struct rendered_name *render_scan(const struct scan *scan);
+
+// Frees a result returned by render_scan(); NULL is ignored.
+void free_rendered_name(struct rendered_name *name);
+
+#endif
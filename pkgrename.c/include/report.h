@@ -0,0 +1,34 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "scan.h"
+
+// Option --report aggregates the scanned PKG files instead of renaming them:
+// number of files and bytes per category, region, SDK, firmware, title,
+// release group, and fake status. Probe threads aggregate into tables of their
+// own, which are merged when the threads finish, and the PKG data is dropped
+// right away, so memory grows with the number of distinct values, not files.
+
+enum report_format {
+    REPORT_NONE,
+    REPORT_TABLE,
+    REPORT_CSV,
+    REPORT_JSON
+};
+
+struct report;
+
+// Creates an empty report for a single thread.
+struct report *create_report(void);
+
+// Adds a probed scan, which may describe an error, to a thread's report, or,
+// if <report> is NULL, to the global report.
+void add_to_report(struct report *report, const struct scan *scan);
+
+// Merges a thread's report into the global report and destroys it.
+void merge_report(struct report *report);
+
+// Prints the global report in the format set by option --report.
+void print_report(void);
+
+#endif
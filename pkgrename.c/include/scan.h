@@ -2,6 +2,10 @@
 #define SCAN_H
 
 #include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct rendered_name;
 
 // Linked list node that stores a PS4 PKG file scan result.
 struct scan {
@@ -10,6 +14,12 @@ struct scan {
     char *changelog;
     _Bool fake_status;
     _Bool filename_allocated;
+    _Bool claimed; // A thread has started to load the PKG's data.
+    _Bool probed; // The PKG's data has been loaded.
+    _Bool filtered; // The PKG does not match option --where's filter.
+    struct rendered_name *rendered; // New name from the render stage, or NULL.
+    int operand; // Index of the FILE|DIRECTORY operand the file was found in.
+    size_t operand_len; // Length of the operand at the start of .filename.
     enum {
         SCAN_ERROR_OPEN_FILE = 1,
         SCAN_ERROR_READ_FILE,
@@ -23,6 +33,8 @@ struct scan {
     } error;
     struct scan *prev;
     struct scan *next;
+    struct scan *probe_next; // Next node in the device's probe queue.
+    struct probe_device *device;
 };
 
 // This is a linked list that does not allocate individual nodes but instead
@@ -33,33 +45,87 @@ struct scan_list {
     struct scan *tail;
     _Bool finished; // True when scanning is complete.
     short n_slots; // Number of remaining slots in the current chunk.
+    short n_released; // Number of released nodes in the first chunk.
+};
+
+// Files are added to the scan list right away and then probed (their PKG data
+// loaded) by probe threads. Each device (st_dev) has its own probe queue,
+// usually in list order, and its own limit of concurrent probes, so that
+// devices are probed in parallel, each at a depth that suits it. The file that
+// is needed next is always probed first (see wait_for_scan()), so the first
+// prompt appears as soon as the first file has been probed, while the rest are
+// probed in the background.
+#define SCAN_PROBE_THREADS 16
+#define PROBE_JOBS_ROTATIONAL 1 // Default limit for hard disk drives.
+#define PROBE_JOBS_NON_ROTATIONAL 8 // Default limit for solid-state drives.
+#define PROBE_JOBS_UNKNOWN 4 // Default limit for other devices.
+
+struct probe_device {
+    dev_t dev;
+    int max_jobs;
+    int n_running;
+    struct scan *next_unclaimed; // First queued node that may be unclaimed.
+    struct scan *probe_tail; // Last node in the probe queue.
+    struct probe_device *next;
 };
 
 struct scan_job {
     struct scan_list scan_list;
     pthread_mutex_t mutex;
     pthread_cond_t cond; // "A new scan result is ready."
+    pthread_cond_t probe_cond; // "A file has been added or probed."
+    pthread_t probe_threads[SCAN_PROBE_THREADS];
+    int n_probe_threads;
+    struct probe_device *devices;
     char **filenames; // May contain both files and directories.
     int n_filenames;
+    int operand; // Index of the operand that is being scanned.
+    size_t operand_len; // Length of the operand that is being scanned.
+    _Bool render; // Probe threads render new names (see renderstage.h).
 };
 
-// Adds a scan result to a job's scan list.
+// Adds a file that is located on device <dev> to a job's scan list; its data
+// will be loaded in the background.
 void add_scan_result(struct scan_job *job, char *filename,
-    _Bool filename_allocated);
+    _Bool filename_allocated, dev_t dev);
+
+// Adds multiple files that are located on device <dev> to a job's scan list,
+// in the given order; the file names must be dynamically allocated. With option
+// --disk-order, the files are probed in the order of their positions on disk.
+void add_scan_results(struct scan_job *job, char **filenames, size_t n,
+    dev_t dev);
+
+// Waits until a scan's data has been loaded, loading it right away if no other
+// thread has started yet.
+void wait_for_scan(struct scan_job *job, struct scan *scan);
+
+// Frees the data of a scan that the caller is done with. Scans must be released
+// in list order, each after wait_for_scan() and after its .next member has been
+// read; memory chunks whose scans have all been released are freed, too.
+void release_scan(struct scan_job *job, struct scan *scan);
+
+// Marks a job's scan list as finished.
+void finish_scan_list(struct scan_job *job);
+
+// Returns a message that describes the value of struct scan's .error member.
+const char *scan_error_string(int error);
 
 // Prints a message that describes the value of struct scan's .error member.
 void print_scan_error(struct scan *scan);
 
-// Finds all .pkg files in a directory and runs a scan on them.
+// Finds all .pkg files in a directory and runs a scan on them. With option
+// --resume, <resume> is the path, relative to the directory, of the last file
+// that has been completed; it and all files before it are skipped.
 // Returns 0 on success and -1 on error.
-int parse_directory(char *directory_name, struct scan_job *job);
+int parse_directory(char *directory_name, struct scan_job *job,
+    const char *resume);
 
 // Initializes a scan job.
 // Returns 0 on success and -1 on error.
 int initialize_scan_job(struct scan_job *job, char **filenames,
     int n_filenames);
 
-// Destroys a scan job.
+// Destroys a scan job; the scan list must have been finished.
 void destroy_scan_job(struct scan_job *job);
 
 #ifdef DEBUG
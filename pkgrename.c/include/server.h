@@ -0,0 +1,24 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#define SERVE_CACHE_SLOTS 65536 // Max. number of cached PKG files.
+
+// Answers file name and metadata queries on a Unix domain socket, using a
+// pool of worker threads and an in-memory cache of scan results.
+//
+// Protocol: clients send one request per line and receive one response line
+// per request, starting with "ok " or "error ":
+//   name PATH   The file name suggestion for PATH (same as --query).
+//   sfo PATH    PATH's param.sfo data as tab-separated KEY=VALUE pairs.
+//   stats       Request and cache statistics.
+// Relative paths are relative to the server's working directory.
+//
+// Connections are served from a single poll loop, and only their requests are
+// handed to the workers, so idle clients don't hold up others. Up to 1024
+// clients can be connected at the same time; a connection without requests for
+// 10 minutes is closed.
+//
+// Only returns on error, with -1.
+int serve(const char *socket_path);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include "scan.h"
+
+// Option --sort-by processes the PKG files in the order of their metadata
+// instead of their paths. All files are scanned first, and only compact
+// records (the sort keys and the file name) are kept. Records are sorted in
+// memory; if they exceed SORT_MEMORY_LIMIT bytes, sorted runs are written to
+// temporary files and merged while the sorted files are being processed.
+// The sorted files are then scanned again by a second scan job, which loads
+// their PKG data in the background, as usual.
+
+#ifndef SORT_MEMORY_LIMIT
+#define SORT_MEMORY_LIMIT (64 * 1024 * 1024)
+#endif
+
+// Compiles option --sort-by's comma-separated list of keys, printing a message
+// if it is invalid.
+// Returns 0 on success and -1 on error.
+int compile_sort_keys(const char *keys);
+
+// Reads all of a job's scan results and records their sort keys, printing
+// errors right away. Returns when the job's scan list has been finished.
+void collect_sort_records(struct scan_job *job);
+
+// Background thread that adds the sorted files to a new scan job, which must
+// have been initialized without operands.
+void *scan_sorted_files(void *job);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// A state file (option --state) records the directories that have been
+// searched: their identity and modification time, their subdirectories, and
+// their PKG files. Directories that have not changed since the previous run are
+// then served from the state file instead of being read again.
+
+// A PKG file as recorded in a state file.
+struct file_state {
+    char *name;
+    ino_t ino;
+    off_t size;
+    long long mtime_sec;
+    long mtime_nsec; // -1 if the file has not been examined.
+    struct file_state *next_ino; // In the directory's inode table.
+};
+
+// A directory as recorded in a state file; the lists are sorted by name.
+struct dir_state {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    nlink_t nlink;
+    long long mtime_sec;
+    long mtime_nsec; // -1 if the directory must be read again next time.
+    char **subdirs;
+    size_t n_subdirs;
+    struct file_state *files;
+    size_t n_files;
+    struct file_state **ino_table; // Files by inode, built when needed.
+    size_t ino_table_size; // A power of 2.
+    _Bool visited; // The directory has been recorded again in this run.
+    struct dir_state *next;
+};
+
+// Loads a state file, if it exists, and prepares the next one.
+// Returns 0 on success and -1 on error.
+int load_state(const char *filename);
+
+// Saves the state file, keeping the recorded directories that have not been
+// visited in this run.
+// Returns 0 on success and -1 on error.
+int save_state(void);
+
+// Returns a directory's state from the previous run, or NULL if there is none.
+struct dir_state *find_dir_state(const char *path);
+
+// Returns 1 if a directory has not changed since it has been recorded, else 0.
+int is_dir_unchanged(const struct dir_state *state, const struct stat *sb);
+
+// Returns 1 if a PKG file has been recorded with the same inode, size, and
+// modification time (under its current name or, if it has been renamed, under
+// its old name), else 0.
+int is_file_unchanged(struct dir_state *state, const char *name,
+    const struct stat *sb);
+
+// Records a directory and its sorted lists of subdirectory and PKG file names
+// for the next run. Files are only examined with option --since, which is the
+// only option that uses their data; without it, file data is taken from <old>
+// if the directory is unchanged.
+void record_dir_state(const char *path, const struct stat *sb,
+    char **subdirs, size_t n_subdirs, char **files, size_t n_files,
+    struct dir_state *old);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef STOREPAGE_H
+#define STOREPAGE_H
+
+#include <stddef.h>
+
+#define MAX_STORE_STRING_LEN 512
+
+// Incremental parser that finds a product's title in a PlayStation Store page,
+// using the page's JSON-LD data (<script type="application/ld+json">).
+struct store_page_parser {
+    enum {
+        STORE_PAGE_SEEK_SCRIPT, // Looking for a JSON-LD script element.
+        STORE_PAGE_SEEK_JSON, // Looking for the end of the script tag.
+        STORE_PAGE_JSON, // Inside the script's JSON data.
+        STORE_PAGE_DONE, // A title has been found.
+    } state;
+    size_t match; // Number of matched characters of the script type.
+
+    // JSON tokenizer
+    int depth;
+    char root; // '{' or '['.
+    _Bool in_string;
+    _Bool escape;
+    int hex_digits; // Remaining hex digits of a "\u" escape sequence.
+    unsigned long code_point;
+    unsigned long high_surrogate;
+    _Bool expect_value; // The next top-level string is a value, not a key.
+    char string[MAX_STORE_STRING_LEN];
+    size_t string_len;
+
+    // Top-level members of the current JSON object.
+    char key[8];
+    _Bool is_product;
+    _Bool has_name;
+    char name[MAX_STORE_STRING_LEN];
+
+    _Bool found_product; // A product without a name has been found.
+};
+
+// Initializes a parser.
+void init_store_page_parser(struct store_page_parser *parser);
+
+// Parses the next <len> bytes of a store page.
+// Returns 1 if the title has been found and no more data is needed, else 0.
+int parse_store_page(struct store_page_parser *parser, const char *data,
+    size_t len);
+
+// Returns the title found by the parser, or NULL if there is none (yet).
+const char *get_store_page_title(const struct store_page_parser *parser);
+
+#endif
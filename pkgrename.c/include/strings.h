@@ -5,6 +5,12 @@ void trim_string(char *string, char *ltrim, char *rtrim);
 char *strwrd(const char *string, char *word);
 char *strreplace(char *string, char *search, char *replace);
 void mixed_case(char *string);
+
+// Adds the words and phrases of a text file, one per line, to those whose
+// spelling mixed_case() keeps. Must be called before mixed_case() is used by
+// multiple threads.
+// Returns 0 on success and -1 on error.
+int load_special_words(const char *filename);
 int lower_strcmp(char *string1, char *string2);
 
 #endif
@@ -0,0 +1,18 @@
+#ifndef TITLEDB_H
+#define TITLEDB_H
+
+// A title database maps Content IDs to titles. It is created from a text file
+// that contains one "CONTENT_ID TITLE" pair per line (separated by a tab or a
+// space; lines starting with '#' are comments). The text file is compiled into
+// a perfect-hashed table that is saved as "<FILE>.db" and memory-mapped in
+// later runs, as long as the text file does not change.
+
+// Loads a title database from a text file or a compiled table.
+// Returns 0 on success and -1 on error.
+int load_title_db(const char *filename);
+
+// Returns a Content ID's title, or NULL if the database does not contain it or
+// no database has been loaded.
+const char *lookup_title_db(const char *content_id);
+
+#endif
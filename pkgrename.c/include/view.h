@@ -0,0 +1,48 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include <sys/stat.h>
+
+#include "render.h"
+
+// Option --view DIR=PATTERN builds a browsable tree of links to the PKG files
+// in directory DIR, with paths built from PATTERN (like option --organize's,
+// but the last component is the file name). Links are hard links if possible
+// and symbolic links otherwise. Multiple views are built from the same scan.
+//
+// Views are updated incrementally: links that already point to the right file
+// are kept, links to processed files whose view path has changed and dangling
+// symbolic links are removed, and missing links are created. Links to files
+// that have not been processed in the current run are left alone.
+
+// Parses the DIR=PATTERN arguments of option --view.
+// Returns 0 on success and -1 on error.
+int initialize_views(void);
+
+// Returns 1 if a directory is the root of a view, which must not be searched
+// for PKG files, else 0.
+int is_view_directory(const struct stat *sb);
+
+struct view_file;
+
+// Records a processed PKG file for the views. <old_filename> is the file's
+// path before and <new_filename> its path after processing: the name it has
+// actually been renamed to, its unchanged name, or, in dry runs, the name it
+// would be renamed to. If <queued> is 1, the file's rename has been queued for
+// the rename executor, and the file is left out of the views until
+// finish_queued_view_file() has been called for it.
+// Returns the file's entry.
+struct view_file *add_view_file(const char *old_filename,
+    const char *new_filename, const struct pattern_vars *vars, _Bool queued);
+
+// Completes the entry of a file whose queued rename has been run. <new_basename>
+// is the name the file has been renamed to, or NULL if the rename has been
+// skipped, which leaves the file out of the views. May be called from the
+// rename executor's threads.
+void finish_queued_view_file(struct view_file *file, const char *new_basename);
+
+// Updates the views after all files have been processed and renamed. If
+// <dry_run> is 1, only prints what would be done.
+void update_views(int dry_run);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "scan.h"
+
+#define WATCH_SETTLE_TIME 100 // Milliseconds a file must stay unmodified.
+
+// Starts watching directories (the current directory if <n_dirs> is 0) and,
+// with option_recursive, their subdirectories. Must be called before the
+// directories are searched, so that no file that arrives during the search is
+// missed.
+// Returns 0 on success and -1 on error.
+int start_watching(char **dirs, int n_dirs);
+
+// Remembers a file that a directory search has added to the scan list, so
+// that events that arrive for it later are not taken for a new file.
+void remember_scanned_file(const char *path);
+
+// Watches the directories passed to start_watching() for new or completely
+// written .pkg files and adds them to a scan job's scan list, after they have
+// settled. With option_recursive, new subdirectories are watched and searched,
+// too. If events have been lost, the directories are searched again. Only
+// returns on error, with -1.
+int watch_directories(struct scan_job *job);
+
+#endif
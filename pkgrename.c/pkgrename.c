@@ -5,24 +5,42 @@
 #endif
 
 #include "include/characters.h"
+#include "include/checkpoint.h"
 #include "include/colors.h"
 #include "include/common.h"
+#include "include/filter.h"
 #include "include/onlinesearch.h"
 #include "include/options.h"
+#include "include/organize.h"
+#include "include/pathfilter.h"
 #include "include/pkg.h"
 #include "include/releaselists.h"
+#include "include/rename.h"
+#include "include/render.h"
+#include "include/renderstage.h"
+#include "include/report.h"
 #include "include/scan.h"
+#include "include/server.h"
+#include "include/sort.h"
+#include "include/state.h"
 #include "include/strings.h"
 #include "include/terminal.h"
+#include "include/titledb.h"
+#include "include/view.h"
+#include "include/watch.h"
 
 #include <ctype.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef _WIN32
@@ -35,86 +53,127 @@
 #define DIR_SEPARATOR '/'
 #endif
 
-char format_string[MAX_FORMAT_STRING_LEN] =
-    "%title% [%dlc%] [{v%app_ver%}{ + v%merged_ver%}] [%title_id%] [%release_group%] [%release%] [%backport%]";
-struct custom_category custom_category =
-    {"Game", "Update", "DLC", "App", "Other"};
-char *tags[MAX_TAGS];
-int tagc;
 int multiple_directories; // If 1, pkgrename() prints dir names on dir change.
+static struct timespec start_time; // Used to measure time-to-first-prompt.
+static volatile sig_atomic_t interrupted; // Option --checkpoint: SIGINT received.
+
+// A directory file descriptor that is reused while the directory stays the
+// same (see get_directory()).
+struct directory_cache {
+    char path[PATH_MAX];
+    int fd;
+};
+
+// State that pkgrename() carries over from one file to the next during a run.
+struct run_context {
+    int first_run; // Used to decide when to print newlines.
+    int error_streak; // Consecutive errors are printed as a block.
+    int first_prompt; // Option --verbose: time-to-first-prompt not printed yet.
+    int a_primed; // [A]ll has been pressed; Shift-[A] confirms.
+    struct scan *scan_backup; // Used to return to current scan (space).
+    char dir_realpath[PATH_MAX]; // The directory printed last.
+    struct directory_cache source; // For rename_pkg().
+    struct directory_cache target; // Option --organize's, for rename_pkg().
+};
 
-static void rename_file(char *filename, char *new_basename, char *path)
+// Companion function for pkgrename().
+// Returns a file descriptor for the directory <path>, reusing the cached one
+// while the directory stays the same. Returns -1 on error.
+static int get_directory(struct directory_cache *cache, const char *path)
 {
-    FILE *file;
-    char new_filename[MAX_FILENAME_LEN];
-
-    strcpy(new_filename, path);
-    strcat(new_filename, new_basename);
-
-    file = fopen(new_filename, "rb");
+    if (cache->fd != -1 && strcmp(path, cache->path) == 0)
+        return cache->fd;
 
-    // File already exists.
-    if (file != NULL) {
-        fclose(file);
-        // Use temporary file to force-rename on (case-insensitive) exFAT.
-        if (lower_strcmp(filename, new_filename) == 0) {
-            char temp[MAX_FILENAME_LEN];
-            strcpy(temp, new_filename);
-            strcat(temp, ".pkgrename");
-            if (rename(filename, temp)) goto error;
-            if (rename(temp, new_filename)) goto error;
-        } else {
-            fprintf(stderr, "File already exists: \"%s\".\n", new_filename);
-            exit(EXIT_FAILURE);
-        }
-    // File does not exist yet.
-    } else {
-        if (rename(filename, new_filename)) goto error;
+    close_directory(cache->fd);
+    cache->fd = open_directory(path);
+    if (cache->fd == -1) {
+        fprintf(stderr, "Could not open directory \"%s\".\n", path);
+        return -1;
     }
+    strcpy(cache->path, path);
 
-    return;
+    return cache->fd;
+}
 
-error:
-    fprintf(stderr, "Could not rename file %s.\n", filename);
-    exit(EXIT_FAILURE);
+// Companion function for rename_pkg().
+// Option --view: records a file once its queued rename has been run.
+static void finish_queued_rename(void *view_file, int result,
+    const char *new_basename)
+{
+    finish_queued_view_file(view_file, result == 0 ? new_basename : NULL);
 }
 
-// Returns the size of a file in bytes or -1 on error.
-static ssize_t get_file_size(const char *filename)
+// Companion function for pkgrename().
+// Renames a file according to option --collision; exits on error. With option
+// --organize, the file is moved to directory <target_path>, which is created
+// if necessary. Automatic renames are handed to the rename executor if it is
+// running. With option --view, the file is recorded under the name it has been
+// renamed to, using the pattern variables <vars>.
+static void rename_pkg(struct run_context *run, const char *path,
+    const char *basename, char *new_basename, size_t new_basename_size,
+    const char *target_path, const struct pattern_vars *vars)
 {
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL)
-        return -1;
-    if (fseek(file, 0, SEEK_END)) {
-        fclose(file);
-        return -1;
+    if (target_path && create_directory(target_path))
+        exit(EXIT_FAILURE);
+    if (target_path == NULL)
+        target_path = path;
+
+    char filename[PATH_MAX], new_filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s%s", path, basename);
+
+    // Option --checkpoint: the file will not be found by its old name again.
+    if (option_checkpoint)
+        record_renamed_file(filename);
+
+    if (option_yes_to_all && option_rename_jobs > 1) {
+        struct view_file *view_file = NULL;
+        if (option_n_views) {
+            snprintf(new_filename, sizeof(new_filename), "%s%s", target_path,
+                new_basename);
+            view_file = add_view_file(filename, new_filename, vars, 1);
+        }
+        queue_move(path, basename, target_path, new_basename,
+            view_file ? finish_queued_rename : NULL, view_file);
+        return;
+    }
+
+    int src_fd = get_directory(&run->source, path);
+    int dst_fd = strcmp(target_path, path) == 0
+        ? src_fd : get_directory(&run->target, target_path);
+    int ret = -1;
+    if (src_fd == -1 || dst_fd == -1
+        || (ret = move_file(src_fd, path, basename, dst_fd, target_path,
+            new_basename, new_basename_size)) == -1)
+        exit(EXIT_FAILURE);
+
+    // A skipped file keeps its old name and is left out of the views.
+    if (option_n_views && ret == 0) {
+        snprintf(new_filename, sizeof(new_filename), "%s%s", target_path,
+            new_basename);
+        add_view_file(filename, new_filename, vars, 0);
     }
-    ssize_t ret = ftello(file);
-    fclose(file);
-    return ret;
 }
 
 // Companion function for pkgrename().
 // Prints a message if a path has changed during pkgrename() calls.
-static void print_dir_change(const char *path)
+static void print_dir_change(struct run_context *run, const char *path)
 {
 #ifdef _WIN32
 #define realpath(name, resolved) _fullpath(resolved, name, PATH_MAX)
 #endif
-    static char old_realpath[PATH_MAX];
-    static char new_realpath[PATH_MAX];
+    char new_realpath[PATH_MAX];
 
     if (realpath(*path ? path : ".", new_realpath) == NULL)
         return;
 
-    if (strcmp(new_realpath, old_realpath) == 0)
+    if (strcmp(new_realpath, run->dir_realpath) == 0)
         return;
 
     set_color(GRAY, stdout);
     printf("Current directory: %s\n\n", new_realpath);
     set_color(RESET, stdout);
 
-    strcpy(old_realpath, new_realpath);
+    strcpy(run->dir_realpath, new_realpath);
 #ifdef _WIN32
 #undef realpath
 #endif
@@ -123,12 +182,8 @@ static void print_dir_change(const char *path)
 // Uses information retreived by a previous scan to rename a PS4 PKG file.
 // The .next member may not be accessed without a mutex lock.
 // Returns NULL or a pointer to a scan it needs to be called again with.
-static struct scan *pkgrename(struct scan *scan)
+static struct scan *pkgrename(struct run_context *run, struct scan *scan)
 {
-    static int first_run = 1; // Used to decide when to print newlines.
-    static struct scan *scan_backup; // Used to return to current scan (space).
-    static int error_streak = 0;
-
     // Don't proceed if the scan describes an error.
     if (scan->error) {
         if (option_query == 1) {
@@ -138,10 +193,10 @@ static struct scan *pkgrename(struct scan *scan)
         }
 
         // Make sure to print consecutive errors as a block.
-        if (error_streak == 0) {
-            error_streak = 1;
-            if (first_run == 1)
-                first_run = 0;
+        if (run->error_streak == 0) {
+            run->error_streak = 1;
+            if (run->first_run == 1)
+                run->first_run = 0;
             else
                 putchar('\n');
         }
@@ -155,63 +210,34 @@ static struct scan *pkgrename(struct scan *scan)
 
         return NULL;
     } else {
-        error_streak = 0;
+        run->error_streak = 0;
     }
 
     // Reset option_force if the current PKG is reached again.
-    if (scan_backup && scan == scan_backup) {
-        scan_backup = NULL;
+    if (run->scan_backup && scan == run->scan_backup) {
+        run->scan_backup = NULL;
         option_force = option_force_backup;
     }
 
     if (option_query == 0 && option_compact == 0) {
-        if (first_run == 1)
-            first_run = 0;
+        if (run->first_run == 1)
+            run->first_run = 0;
         else
             putchar('\n');
     }
 
     char new_basename[MAX_FORMAT_STRING_LEN]; // Used to build the new filename.
+    char target_dir[PATH_MAX]; // Option --organize's directory.
+    const char *new_dir = ""; // The part of <target_dir> that is printed.
+    int unchanged; // The file already has its new name (and directory).
     char *filename = scan->filename;
     char *basename; // "filename" without path.
-    char lowercase_basename[MAX_FILENAME_LEN];
     char path[PATH_MAX]; // "filename" without file.
-    char tag_release_group[MAX_TAG_LEN + 1] = "";
-    char tag_release[MAX_TAG_LEN + 1] = "";
     int spec_chars_current, spec_chars_total;
     int prompted_once = 0;
     int changelog_patch_detection = 1;
     int print_ambiguity_warning = 0;
-
-    // Internal pattern variables.
-    char *app = NULL;
-    char *app_ver = NULL;
-    char *backport = NULL;
-    char *category = NULL;
-    char *content_id = NULL;
-    char *dlc = NULL;
-    char *fake = NULL;
-    char *fake_status = NULL;
-    char file_id_suffix[13] = "-A0000-V0000";
-    char firmware[9] = "";
-    char *game = NULL;
-    char true_ver_buf[5] = "";
-    char *merged_ver = NULL;
-    char msum[7] = "";
-    char *other = NULL;
-    char *patch = NULL;
-    char *region = NULL;
-    char *release_group = NULL;
-    char *release = NULL;
-    char *retail = NULL;
-    char sdk[6] = "";
-    char size[10];
-    char title[MAX_TITLE_LEN] = "";
-    char *title_backup = NULL;
-    char *title_id = NULL;
-    char *true_ver = NULL;
-    char *type = NULL;
-    char *version = NULL;
+    struct pattern_vars vars; // Internal pattern variables.
 
     // Define the file's basename and path.
     basename = strrchr(filename, DIR_SEPARATOR);
@@ -228,226 +254,35 @@ static struct scan *pkgrename(struct scan *scan)
 
     // Print directory if it's different (early).
     if (multiple_directories && option_compact == 0)
-        print_dir_change(path);
-
-    // Create a lowercase copy of "basename".
-    strcpy(lowercase_basename, basename);
-    for (size_t i = 0; i < strlen(lowercase_basename); i++)
-        lowercase_basename[i] = tolower(lowercase_basename[i]);
+        print_dir_change(run, path);
 
     // Print current basename (early).
     if (option_query == 0 && option_compact == 0)
         printf("   \"%s\"\n", basename);
 
-    // Load PKG data.
+    // Load PKG data, unless the render stage has already done it.
     unsigned char *param_sfo = scan->param_sfo;
     char *changelog = scan->changelog;
-    // APP_VER
-    app_ver = (char *) get_param_sfo_value(param_sfo, "APP_VER");
-    if (app_ver && strlen(app_ver) >= 3) {
-        if (app_ver[2] == '.' && strlen(app_ver) >= 5) {
-            file_id_suffix[2] = app_ver[0];
-            file_id_suffix[3] = app_ver[1];
-            file_id_suffix[4] = app_ver[3];
-            file_id_suffix[5] = app_ver[4];
-        } else if (app_ver[1] == '.') { // Some homebrew apps got it wrong.
-            file_id_suffix[2] = '0';
-            file_id_suffix[3] = app_ver[0];
-            file_id_suffix[4] = app_ver[2];
-            if (app_ver[3])
-                file_id_suffix[5] = app_ver[3];
-            else
-                file_id_suffix[5] = '0';
-        }
-    }
-    if (app_ver && option_leading_zeros == 0 && app_ver[0] == '0')
-        app_ver++;
-    // CATEGORY
-    category = (char *) get_param_sfo_value(param_sfo, "CATEGORY");
-    if (category) {
-        if (strcmp(category, "gd") == 0) {
-            type = custom_category.game;
-            game = type;
-        } else if (strstr(category, "gp") != NULL) {
-            type = custom_category.patch;
-            patch = type;
-        } else if (strcmp(category, "ac") == 0) {
-            type = custom_category.dlc;
-            dlc = type;
-        } else if (category[0] == 'g' && category[1] == 'd') {
-            type = custom_category.app;
-            app = type;
-        } else {
-            type = custom_category.other;
-            other = type;
-        }
-    }
-    // CONTENT_ID
-    content_id = (char *) get_param_sfo_value(param_sfo, "CONTENT_ID");
-    if (content_id) {
-        switch (content_id[0]) {
-            case 'E': region = "EU"; break;
-            case 'H': region = "AS"; break;
-            case 'I': region = "IN"; break;
-            case 'J': region = "JP"; break;
-            case 'U': region = "US"; break;
-        }
-    }
-    // PUBTOOLINFO
-    char *pubtoolinfo = (char *) get_param_sfo_value(param_sfo, "PUBTOOLINFO");
-    if (pubtoolinfo) {
-        char *p = strstr(pubtoolinfo, "sdk_ver=");
-        if (p) {
-            p += 8;
-            memcpy(sdk, p, 4);
-            if (sdk[0] == '0' && option_leading_zeros == 0) {
-                sdk[0] = sdk[1];
-                sdk[1] = '.';
-                sdk[4] = '\0';
-            } else {
-                sdk[4] = sdk[3];
-                sdk[3] = sdk[2];
-                sdk[2] = '.';
-            }
-        }
-    }
-    // SYSTEM_VER
-    uint32_t *system_ver = (uint32_t *) get_param_sfo_value(param_sfo,
-        "SYSTEM_VER");
-    if (system_ver) {
-        sprintf(firmware, "%08x", *system_ver);
-        if (firmware[0] == '0' && option_leading_zeros == 0) {
-            firmware[0] = firmware[1];
-            firmware[1] = '.';
-            firmware[4] = '\0';
-        } else {
-            firmware[5] = '\0';
-            firmware[4] = firmware[3];
-            firmware[3] = firmware[2];
-            firmware[2] = '.';
-        }
-    }
-    // TITLE
-    if (option_language_number[0] != '\0') {
-        char query[9];
-        snprintf(query, sizeof(query), "TITLE_%s", option_language_number);
-        title_backup = (char *) get_param_sfo_value(param_sfo, query);
-        if (title_backup)
-            goto title_found;
-    }
-    title_backup = (char *) get_param_sfo_value(param_sfo, "TITLE");
-    if (title_backup) {
-title_found:
-        strncpy(title, title_backup, MAX_TITLE_LEN);
-        title[MAX_TITLE_LEN - 1] = '\0';
-    }
-    // TITLE_ID
-    title_id = (char *) get_param_sfo_value(param_sfo, "TITLE_ID");
-    // VERSION
-    version = (char *) get_param_sfo_value(param_sfo, "VERSION");
-    if (version && strlen(version) >= 3) {
-        if (version[2] == '.' && strlen(version) >= 5) {
-            file_id_suffix[8] = version[0];
-            file_id_suffix[9] = version[1];
-            file_id_suffix[10] = version[3];
-            file_id_suffix[11] = version[4];
-        } else if (version[1] == '.') { // Some homebrew apps got it wrong.
-            file_id_suffix[8] = '0';
-            file_id_suffix[9] =  version[0];
-            file_id_suffix[10] = version[2];
-            if (version[3])
-                file_id_suffix[11] = version[3];
-            else
-                file_id_suffix[11] = '0';
-        }
-    }
-    if (option_leading_zeros == 0 && version[0] == '0')
-        version++;
-
-    // Handle fake status.
-    if (scan->fake_status) {
-        fake = FAKE_STRING;
-        retail = "";
-        fake_status = FAKE_STRING;
-    } else {
-        fake = "";
-        retail = RETAIL_STRING;
-        fake_status = RETAIL_STRING;
-    }
-
-    // Get compatibility checksum.
-    if (strstr(format_string, "%msum%"))
-        get_checksum(msum, filename);
-
-    // Detect changelog patch level.
-    if (changelog && store_patch_version(true_ver_buf, changelog)) {
-        if (option_leading_zeros == 0 && true_ver_buf[0] == '0')
-            true_ver = true_ver_buf + 1;
-        else
-            true_ver = true_ver_buf;
-        if (category[1] == 'd' && strcmp(true_ver_buf, "01.00") != 0)
-            merged_ver = true_ver;
-    } else {
-        true_ver = app_ver;
-    }
-
-    // Detect backport.
-    if ((category && category[0] == 'g' && category[1] == 'p'
-        && ((option_leading_zeros == 0 && strcmp(sdk, "5.05") == 0 )
-        || (option_leading_zeros == 1 && strcmp(sdk, "05.05") == 0)))
-        || strwrd(basename, BACKPORT_STRING)
-        || strstr(lowercase_basename, "backport")
-        || strwrd(lowercase_basename, "bp")
-        || (changelog && changelog[0] ? strcasestr(changelog, "backport") : 0))
-    {
-        backport = BACKPORT_STRING;
-    }
-
-    // Detect releases.
-    if (strstr(format_string, "%release_group%"))
-        release_group = get_release_group(lowercase_basename);
-    if (strstr(format_string, "%release%")) {
-        int n = get_release(&release, lowercase_basename);
-        if (changelog && (release == NULL || option_override_tags == 1)) {
-            n = get_release(&release, changelog);
-            if (n > 1) {
-                // Remove all tags but the 1st.
-                // Note: if there ever is demand, this line can be removed to
-                // automatically retreive all tags from the changelog.
-                *(strchr(release, ',')) = '\0';
-
-                if (! option_query)
-                    print_ambiguity_warning = 1;
-           }
-        }
-
-        if (release && n > 1 && option_tag_separator)
-            replace_commas_in_tag(release, option_tag_separator);
-    }
-
-    // Get file size in GiB.
-    if (strstr(format_string, "%size%")) {
-        ssize_t file_size = get_file_size(filename);
-        if (file_size == -1) {
-            fprintf(stderr, "Error while getting the size of file \"%s\".\n",
-                filename);
-            exit(EXIT_FAILURE);
-        }
-
-        snprintf(size, sizeof(size), "%.2f GiB", file_size / 1073741824.0);
-    }
+    struct rendered_name *rendered = scan->rendered;
+    scan->rendered = NULL;
+    if (rendered)
+        copy_pattern_vars(&vars, &rendered->vars);
+    else if (load_pattern_vars(&render_context, &vars, scan))
+        exit(EXIT_FAILURE);
+    if (vars.release_ambiguous && option_query == 0)
+        print_ambiguity_warning = 1;
 
-    // Option "online".
-    if (option_online == 1) {
+    // Option "online", if option "title-db" has not found the title.
+    if (option_online == 1 && vars.title_from_db == 0) {
         if (option_compact)
-            search_online(content_id, title, 1); // Silent search.
+            search_online(vars.content_id, vars.title, 1); // Silent search.
         else
-            search_online(content_id, title, 0);
+            search_online(vars.content_id, vars.title, 0);
     }
 
     // Option "mixed-case".
-    if (option_mixed_case == 1)
-        mixed_case(title);
+    if (option_mixed_case == 1 && rendered == NULL)
+        mixed_case(vars.title);
 
     // User input loop.
     int first_loop = 1;
@@ -457,119 +292,55 @@ title_found:
         * Build new file name
         ***********************************************************************/
 
-        // Replace pattern variables.
-        strncpy(new_basename, format_string, sizeof(new_basename) - 1);
-        new_basename[sizeof(new_basename) - 1] = '\0';
-        // First, variables that do or may contain other pattern variables.
-        strreplace(new_basename, "%type%", type);
-        strreplace(new_basename, "%app%", app);
-        strreplace(new_basename, "%dlc%", dlc);
-        strreplace(new_basename, "%game%", game);
-        strreplace(new_basename, "%other%", other);
-        strreplace(new_basename, "%patch%", patch);
-        strreplace(new_basename, "%file_id%", "%content_id%%file_id_suffix%");
-
-        strreplace(new_basename, "%app_ver%", app_ver);
-        strreplace(new_basename, "%backport%", backport);
-        strreplace(new_basename, "%category%", category);
-        strreplace(new_basename, "%content_id%", content_id);
-        strreplace(new_basename, "%fake%", fake);
-        strreplace(new_basename, "%fake_status%", fake_status);
-        strreplace(new_basename, "%file_id_suffix%", file_id_suffix);
-        strreplace(new_basename, "%firmware%", firmware);
-        strreplace(new_basename, "%merged_ver%", merged_ver);
-        strreplace(new_basename, "%msum%", msum);
-        strreplace(new_basename, "%region%", region);
-        if (tag_release_group[0] != '\0')
-            strreplace(new_basename, "%release_group%", tag_release_group);
-        else
-            strreplace(new_basename, "%release_group%", release_group);
-        if (tag_release[0] != '\0')
-            strreplace(new_basename, "%release%", tag_release);
-        else
-            strreplace(new_basename, "%release%", release);
-        strreplace(new_basename, "%retail%", retail);
-        strreplace(new_basename, "%sdk%", sdk);
-        if (strstr(format_string, "%size%"))
-            strreplace(new_basename, "%size%", size);
-        strreplace(new_basename, "%title%", title);
-        strreplace(new_basename, "%title_id%", title_id);
-        strreplace(new_basename, "%true_ver%", true_ver);
-        strreplace(new_basename, "%version%", version);
-
-        // Remove empty brackets and parentheses, and curly braces.
-        while (strreplace(new_basename, "[]", "") != NULL)
-            ;
-        while (strreplace(new_basename, "()", "") != NULL)
-            ;
-        while (strreplace(new_basename, "{", "") != NULL)
-            ;
-        while (strreplace(new_basename, "}", "") != NULL)
-            ;
-
-        // Replace illegal characters.
-        replace_illegal_characters(new_basename);
-
-        spec_chars_total = count_spec_chars(new_basename);
-
-        // Replace misused special characters.
-        if (strreplace(new_basename, "＆", "&")) spec_chars_current--;
-        if (strreplace(new_basename, "’", "'")) spec_chars_current--;
-        if (strreplace(new_basename, " ", " ")) spec_chars_current--;
-        if (strreplace(new_basename, "Ⅲ", "III")) spec_chars_current--;
-
-        // Replace potentially annoying special characters.
-        if (strreplace(new_basename, "™_", "_")) spec_chars_current--;
-        if (strreplace(new_basename, "™", " ")) spec_chars_current--;
-        if (strreplace(new_basename, "®_", "_")) spec_chars_current--;
-        if (strreplace(new_basename, "®", " ")) spec_chars_current--;
-        if (strreplace(new_basename, "–", "-")) spec_chars_current--;
-
-        spec_chars_current = count_spec_chars(new_basename);
-
-        // Remove any number of repeated spaces.
-        while (strreplace(new_basename, "  ", " ") != NULL)
-            ;
-
-        // Remove leading whitespace.
-        char *p;
-        p = new_basename;
-        while (isspace(p[0]))
-            p++;
-        memmove(new_basename, p, MAX_FILENAME_LEN);
-
-        // Remove trailing whitespace.
-        p = new_basename + strlen(new_basename) - 1;
-        while (isspace(p[0]))
-            p[0] = '\0';
-
-        // Option --underscores: replace all whitespace with underscores.
-        if (option_underscores == 1) {
-            p = new_basename;
-            while (*p != '\0') {
-                if (isspace(*p))
-                    *p = '_';
-                p++;
+        // The render stage's name is only used once; any later loop
+        // iterations are caused by user input.
+        if (rendered) {
+            strcpy(new_basename, rendered->new_basename);
+            spec_chars_current = rendered->spec_chars_current;
+            spec_chars_total = rendered->spec_chars_total;
+        } else {
+            build_filename(&render_context, new_basename, &vars,
+                &spec_chars_current, &spec_chars_total);
+        }
+        unchanged = strcmp(basename, new_basename) == 0;
+
+        // Option --organize: build the new directory.
+        if (option_organize) {
+            int offset;
+            if (rendered) {
+                strcpy(target_dir, rendered->target_dir);
+                offset = rendered->target_offset;
+            } else {
+                offset = build_organize_directory(target_dir,
+                    sizeof(target_dir), scan, path, &vars);
             }
+            if (offset == -1) {
+                fprintf(stderr, "Option --organize: directory name too long for"
+                    " file \"%s\".\n", filename);
+                exit(EXIT_FAILURE);
+            }
+            new_dir = target_dir + offset;
+            if (strcmp(target_dir, path) != 0)
+                unchanged = 0;
         }
-
-        strcat(new_basename, ".pkg");
+        free_rendered_name(rendered);
+        rendered = NULL;
 
         /**********************************************************************/
 
         // Print current basename (late).
         if (option_query == 0 && option_compact == 1 && first_loop == 1) {
-            if (option_force == 0 && strcmp(basename, new_basename) == 0) {
-                goto exit;
+            if (option_force == 0 && unchanged) {
+                goto record_view;
             } else {
-                if (first_run)
-                    first_run = 0;
+                if (run->first_run)
+                    run->first_run = 0;
                 else
                     putchar('\n');
 
                 // Print directory if it's different (late).
                 if (multiple_directories)
-                    print_dir_change(path);
+                    print_dir_change(run, path);
 
                 printf("   \"%s\"\n", basename);
             }
@@ -578,10 +349,10 @@ title_found:
 
         // Print new basename.
         if (option_query == 1) {
-            printf("%s\n", new_basename);
+            printf("%s%s\n", new_dir, new_basename);
             return NULL;
         }
-        printf("=> \"%s\"", new_basename);
+        printf("=> \"%s%s\"", new_dir, new_basename);
 
         // Print number of special characters.
         if (option_verbose) {
@@ -623,20 +394,20 @@ title_found:
 
         // Option -n: don't do anything else.
         if (option_no_to_all == 1)
-            goto exit;
+            goto record_view;
 
         // Quit if already renamed.
-        if (prompted_once == 0 && option_force == 0
-            && strcmp(basename, new_basename) == 0) {
+        if (prompted_once == 0 && option_force == 0 && unchanged) {
             puts("Nothing to do.");
-            goto exit;
+            goto record_view;
         } else {
             prompted_once = 1;
         }
 
         // Rename now if option_yes_to_all enabled.
         if (option_yes_to_all == 1) {
-            rename_file(filename, new_basename, path);
+            rename_pkg(run, path, basename, new_basename, sizeof(new_basename),
+                option_organize ? target_dir : NULL, &vars);
             goto exit;
         }
 
@@ -649,6 +420,21 @@ title_found:
         __fpurge(stdin);
 #endif
 
+        // Option --verbose: report how long the user had to wait for the
+        // first prompt.
+        if (run->first_prompt) {
+            run->first_prompt = 0;
+            if (option_verbose) {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                set_color(GRAY, stdout);
+                printf("Time to first prompt: %.3f seconds.\n",
+                    (now.tv_sec - start_time.tv_sec)
+                    + (now.tv_nsec - start_time.tv_nsec) / 1e9);
+                set_color(RESET, stdout);
+            }
+        }
+
         // Read user input.
         fputs("[Y/N/A] [E]dit [T]ag [M]ix [O]nline [R]eset [C]hars [S]FO [L]og [H]elp [Q]uit: ", stdout);
         do {
@@ -666,23 +452,23 @@ title_found:
 #endif
                 // Find the previous non-error scan.
                 struct scan *prev = scan->prev;
-                while (prev && prev->error)
+                while (prev && (prev->error || prev->filtered))
                     prev = prev->prev;
                 if (prev == NULL)
                     continue;
 
                 // Go back.
-                if (scan_backup == NULL)
-                    scan_backup = scan;
+                if (run->scan_backup == NULL)
+                    run->scan_backup = scan;
                 option_force = 1;
                 putchar('\n');
                 return prev;
             }
 
             // Return to the current scan if space was pressed.
-            if (c == 32 && scan_backup != NULL) {
-                scan = scan_backup;
-                scan_backup = NULL;
+            if (c == 32 && run->scan_backup != NULL) {
+                scan = run->scan_backup;
+                run->scan_backup = NULL;
                 option_force = option_force_backup;
                 putchar('\n');
                 return scan;
@@ -690,27 +476,29 @@ title_found:
         } while (strchr("ynaAetmorcslhqbpT", c) == NULL);
         printf("%c\n", c);
 
-        static int a_primed;
         if (c != 'a' && c != 'A')
-            a_primed = 0;
+            run->a_primed = 0;
 
         // Evaluate user input,
         switch (c) {
             case 'y': // [Y]es: rename the file.
-                rename_file(filename, new_basename, path);
+                rename_pkg(run, path, basename, new_basename, sizeof(new_basename),
+                    option_organize ? target_dir : NULL, &vars);
                 goto exit;
             case 'n': // [No]: skip file
                 goto exit;
             case 'a': // [A]ll: rename files automatically.
-                a_primed = 1;
+                run->a_primed = 1;
                 set_color(BRIGHT_YELLOW, stdout);
                 puts("\nPress Shift-[A] now if you really want to automatically rename all remaining files.\n");
                 set_color(RESET, stdout);
                 break;
             case 'A':
-                if (a_primed) {
+                if (run->a_primed) {
                     option_yes_to_all = 1;
-                    rename_file(filename, new_basename, path);
+                    rename_pkg(run, path, basename, new_basename,
+                        sizeof(new_basename),
+                        option_organize ? target_dir : NULL, &vars);
                     goto exit;
                 } else {
                     set_color(BRIGHT_YELLOW, stdout);
@@ -721,22 +509,22 @@ title_found:
             case 'e': // [E]dit: let user manually enter a new title.
                 ;
                 char backup[MAX_TITLE_LEN];
-                strcpy(backup, title);
+                strcpy(backup, vars.title);
                 reset_terminal();
                 printf("\nEnter new title: ");
-                fgets(title, MAX_TITLE_LEN, stdin);
-                title[strlen(title) - 1] = '\0'; // Remove Enter character.
+                fgets(vars.title, MAX_TITLE_LEN, stdin);
+                vars.title[strlen(vars.title) - 1] = '\0'; // Remove Enter character.
                 // Remove entered control characters.
-                for (size_t i = 0; i < strlen(title); i++) {
-                    if (iscntrl(title[i])) {
-                        memmove(&title[i], &title[i + 1], strlen(title) - i);
+                for (size_t i = 0; i < strlen(vars.title); i++) {
+                    if (iscntrl(vars.title[i])) {
+                        memmove(&vars.title[i], &vars.title[i + 1], strlen(vars.title) - i);
                         i--;
                     }
                 }
                 // Restore title if nothing has been entered.
-                if (title[0] == '\0') {
-                    strcpy(title, backup);
-                    printf("Using title \"%s\".\n", title);
+                if (vars.title[0] == '\0') {
+                    strcpy(vars.title, backup);
+                    printf("Using title \"%s\".\n", vars.title);
                 }
                 printf("\n");
                 raw_terminal();
@@ -753,15 +541,17 @@ title_found:
                     // Get entered known release groups.
                     if ((result = get_release_group(tag)) != NULL) {
                         printf("Using \"%s\" as release group.\n", result);
-                        strncpy(tag_release_group, result, MAX_TAG_LEN);
-                        tag_release_group[MAX_TAG_LEN] = '\0';
+                        strncpy(vars.tag_release_group, result, MAX_TAG_LEN);
+                        vars.tag_release_group[MAX_TAG_LEN] = '\0';
                     }
 
                     // Get entered known releases.
-                    if ((n_results = get_release(&result, tag)) != 0) {
+                    char release_buf[MAX_TAG_LEN];
+                    if ((n_results = get_release(render_context.tag_db,
+                        &result, release_buf, tag)) != 0) {
                         printf("Using \"%s\" as release.\n", result);
-                        strncpy(tag_release, result, MAX_TAG_LEN);
-                        tag_release[MAX_TAG_LEN] = '\0';
+                        strncpy(vars.tag_release, result, MAX_TAG_LEN);
+                        vars.tag_release[MAX_TAG_LEN] = '\0';
                     }
 
                     // Get Backport tags and unknown tags.
@@ -771,17 +561,17 @@ title_found:
                     while (tok) {
                         trim_string(tok, " ", " ");
                         if (strcasecmp(tok, BACKPORT_STRING) == 0) {
-                            if (backport) {
+                            if (vars.backport) {
                                 printf("Backport tag disabled.\n");
-                                backport = NULL;
+                                vars.backport = NULL;
                             } else {
                                 printf("Backport tag enabled.\n");
-                                backport = BACKPORT_STRING;
+                                vars.backport = BACKPORT_STRING;
                             }
                         } else {
-                            if (tag_release_group[0]
+                            if (vars.tag_release_group[0]
                                     && get_release_group(tok)) {
-                                if (strcasecmp(tag_release_group, tok) != 0)
+                                if (strcasecmp(vars.tag_release_group, tok) != 0)
                                     printf("Cannot enter multiple release groups (\"%s\").\n", tok);
                             } else {
                                 // Make sure existing releases reset when a new
@@ -789,31 +579,31 @@ title_found:
                                 if (unknown_tag_entered == 0) {
                                     unknown_tag_entered = 1;
                                     if (n_results == 0)
-                                        tag_release[0] = '\0';
+                                        vars.tag_release[0] = '\0';
                                 }
 
-                                if (strwrd(tag_release, tok) == NULL) { // Ignore duplicates.
+                                if (strwrd(vars.tag_release, tok) == NULL) { // Ignore duplicates.
                                     printf("Using \"%s\" as release. ", tok);
                                     set_color(BRIGHT_YELLOW, stdout);
                                     printf("%s", "<- MISSING FROM DATABASE\n");
                                     set_color(RESET, stdout);
                                     show_database_hint = 1;
 
-                                    if (tag_release[0]) {
+                                    if (vars.tag_release[0]) {
                                         // Add current tok in alphabetic order.
                                         char buf[MAX_TAG_LEN] = "";
-                                        char *next_tag_start = tag_release;
+                                        char *next_tag_start = vars.tag_release;
                                         while(1) {
                                             char *next_tag_end = strchr(next_tag_start, ',');
                                             if (next_tag_end == NULL)
-                                                next_tag_end = tag_release + strlen(tag_release);
+                                                next_tag_end = vars.tag_release + strlen(vars.tag_release);
                                             memcpy(buf, next_tag_start, next_tag_end - next_tag_start);
                                             buf[next_tag_end - next_tag_start] = '\0';
 
                                             // Found correct order -> insert.
                                             if (strcasecmp(buf, tok) > 0) {
                                                 memset(buf, 0, MAX_TAG_LEN);
-                                                strncpy(buf, tag_release, next_tag_start - tag_release);
+                                                strncpy(buf, vars.tag_release, next_tag_start - vars.tag_release);
                                                 strncat(buf, tok, MAX_TAG_LEN - 1 - strlen(buf));
                                                 if (next_tag_start != 0)
                                                     strcat(buf, ",");
@@ -821,14 +611,14 @@ title_found:
 #pragma GCC diagnostic ignored "-Wstringop-truncation"
                                                 strncat(buf, next_tag_start, MAX_TAG_LEN - 1 - strlen(buf));
 #pragma GCC diagnostic pop
-                                                memcpy(tag_release, buf, MAX_TAG_LEN);
+                                                memcpy(vars.tag_release, buf, MAX_TAG_LEN);
                                                 break;
                                             }
 
                                             // Reached the end -> append.
                                             if (*next_tag_end == '\0') {
-                                                size_t len = strlen(tag_release);
-                                                snprintf(tag_release + len, MAX_TAG_LEN - len, ",%s", tok);
+                                                size_t len = strlen(vars.tag_release);
+                                                snprintf(vars.tag_release + len, MAX_TAG_LEN - len, ",%s", tok);
                                                 break;
                                             }
 
@@ -836,8 +626,8 @@ title_found:
                                         }
                                     } else {
                                         // First value; simply copy it.
-                                        strncpy(tag_release + strlen(tag_release), tok, MAX_TAG_LEN);
-                                        tag_release[MAX_TAG_LEN] = '\0';
+                                        strncpy(vars.tag_release + strlen(vars.tag_release), tok, MAX_TAG_LEN);
+                                        vars.tag_release[MAX_TAG_LEN] = '\0';
                                     }
                                 }
                             }
@@ -853,57 +643,57 @@ title_found:
                     }
 
                     if (option_tag_separator)
-                        replace_commas_in_tag(tag_release, option_tag_separator);
+                        replace_commas_in_tag(vars.tag_release, option_tag_separator);
                 }
                 printf("\n");
                 break;
             case 'T': // Shift-t: remove all release tags.
                 printf("\n");
-                if (tag_release[0] || tag_release_group[0]
-                    || release || release_group)
+                if (vars.tag_release[0] || vars.tag_release_group[0]
+                    || vars.release || vars.release_group)
                     puts("Release tags have been removed.");
                 else
                     puts("No release tags to remove.");
                 printf("\n");
-                tag_release[0] = '\0';
-                tag_release_group[0] = '\0';
-                release = NULL;
-                release_group = NULL;
+                vars.tag_release[0] = '\0';
+                vars.tag_release_group[0] = '\0';
+                vars.release = NULL;
+                vars.release_group = NULL;
                 break;
             case 'm': // [M]ix: convert title to mixed-case letter format.
-                mixed_case(title);
+                mixed_case(vars.title);
                 printf("\nConverted letter case to mixed-case style.\n\n");
                 break;
             case 'o': // [O]nline: search the PlayStation store for metadata.
                 printf("\n");
-                search_online(content_id, title, 0);
+                search_online(vars.content_id, vars.title, 0);
                 printf("\n");
                 break;
             case 'r': // [R]eset: undo all changes.
-                strcpy(title, title_backup);
-                printf("\nTitle has been reset to \"%s\".\n", title_backup);
-                if (tag_release_group[0] != '\0') {
+                strcpy(vars.title, vars.title_backup);
+                printf("\nTitle has been reset to \"%s\".\n", vars.title_backup);
+                if (vars.tag_release_group[0] != '\0') {
                     printf("Tagged release group \"%s\" has been reset.\n",
-                        tag_release_group);
-                    tag_release_group[0] = '\0';
+                        vars.tag_release_group);
+                    vars.tag_release_group[0] = '\0';
                 }
-                if (tag_release[0] != '\0') {
+                if (vars.tag_release[0] != '\0') {
                     printf("Tagged release \"%s\" has been reset.\n",
-                        tag_release);
-                    tag_release[0] = '\0';
+                        vars.tag_release);
+                    vars.tag_release[0] = '\0';
                 }
                 printf("\n");
                 break;
             case 'c': // [C]hars: reveal all non-printable characters.
-                printf("\nOriginal: \"%s\"\nRevealed: \"", title);
+                printf("\nOriginal: \"%s\"\nRevealed: \"", vars.title);
                 int count = 0;
-                for (size_t i = 0; i < strlen(title); i++) {
-                    if (isprint(title[i])) {
-                        printf("%c", title[i]);
+                for (size_t i = 0; i < strlen(vars.title); i++) {
+                    if (isprint(vars.title[i])) {
+                        printf("%c", vars.title[i]);
                     } else {
                         count++;
                         set_color(BRIGHT_YELLOW, stdout);
-                        printf("#%u", (unsigned char) title[i]);
+                        printf("#%u", (unsigned char) vars.title[i]);
                         set_color(RESET, stdout);
                     }
                 }
@@ -912,7 +702,7 @@ title_found:
                 break;
             case 's': // [S]FO: print param.sfo information.
                 printf("\n");
-                print_param_sfo(param_sfo);
+                print_param_sfo(stdout, param_sfo);
                 printf("\n");
                 break;
             case 'h': // [H]elp: show help.
@@ -921,11 +711,11 @@ title_found:
                 printf("\n");
                 break;
             case 'b': // [B]ackport: toggle backport tag.
-                if (backport) {
-                    backport = NULL;
+                if (vars.backport) {
+                    vars.backport = NULL;
                     printf("\nBackport tag disabled.\n\n");
                 } else {
-                    backport = BACKPORT_STRING;
+                    vars.backport = BACKPORT_STRING;
                     printf("\nBackport tag enabled.\n\n");
                 }
                 break;
@@ -940,20 +730,20 @@ title_found:
                 break;
             case 'p': // [P]atch: toggle changelog patch detection for app PKGs.
                 if (changelog_patch_detection) {
-                    merged_ver = NULL;
-                    true_ver = app_ver;
+                    vars.merged_ver = NULL;
+                    vars.true_ver = vars.app_ver;
                     changelog_patch_detection = 0;
                     printf("\nChangelog patch detection disabled for the"
                         " current file.\n\n");
                 } else {
-                    if (true_ver_buf[0]) {
-                        if (option_leading_zeros == 0 && true_ver_buf[0] == '0')
-                            true_ver = true_ver_buf + 1;
+                    if (vars.true_ver_buf[0]) {
+                        if (option_leading_zeros == 0 && vars.true_ver_buf[0] == '0')
+                            vars.true_ver = vars.true_ver_buf + 1;
                         else
-                            true_ver = true_ver_buf;
-                        if (category && category[1] == 'd'
-                            && strcmp(true_ver_buf, "01.00") != 0)
-                            merged_ver = true_ver;
+                            vars.true_ver = vars.true_ver_buf;
+                        if (vars.category && vars.category[1] == 'd'
+                            && strcmp(vars.true_ver_buf, "01.00") != 0)
+                            vars.merged_ver = vars.true_ver;
                     }
                     changelog_patch_detection = 1;
                     printf("\nChangelog patch detection enabled for the current"
@@ -965,67 +755,224 @@ title_found:
         }
     }
 
+record_view:
+    // Option --view: record a file that keeps its name or, with option -n, the
+    // name it would be renamed to. Renamed files are recorded by rename_pkg();
+    // files whose renames have been declined are left out.
+    if (option_n_views) {
+        char new_filename[PATH_MAX];
+        snprintf(new_filename, sizeof(new_filename), "%s%s",
+            option_organize ? target_dir : path, new_basename);
+        add_view_file(filename, new_filename, &vars, 0);
+    }
+
 exit:
     return NULL;
 }
 
+// Companion function for scan_files().
+// Scans a single operand, which may be a file or a directory.
+static void scan_operand(struct scan_job *job, char *operand,
+    _Bool operand_allocated)
+{
+    // A single system call tells files and directories apart.
+    struct stat sb;
+#ifdef _WIN32
+    int found = stat(operand, &sb) == 0;
+#else
+    int found = fstatat(AT_FDCWD, operand, &sb, 0) == 0;
+#endif
+    int is_dir = found && S_ISDIR(sb.st_mode);
+
+    // Option --resume: skip what has been completed before.
+    const char *resume = NULL;
+    if (option_resume
+        && is_operand_completed(job->operand, operand, is_dir, &resume))
+    {
+        if (operand_allocated)
+            free(operand);
+        goto done;
+    }
+
+    // File
+    if (!is_dir) {
+        if (option_shard && !is_in_shard(operand)) {
+            if (operand_allocated)
+                free(operand);
+            goto done;
+        }
+        job->operand_len = strlen(operand);
+        add_scan_result(job, operand, operand_allocated, found ? sb.st_dev : 0);
+        goto done;
+    }
+
+    // Directory
+    if (option_query == 1) {
+        puts(operand);
+    } else {
+        if (job->n_filenames > 1 || option_files_from)
+            multiple_directories = 1;
+        if (parse_directory(operand, job, resume))
+            exit(EXIT_FAILURE);
+    }
+    if (operand_allocated)
+        free(operand);
+
+done:
+    job->operand++;
+}
+
+// Companion function for scan_files().
+// Reads a record that ends with <delim> or EOF into a dynamically allocated
+// buffer, without the delimiter. Returns the record's length or -1 on EOF.
+static ssize_t read_record(char **buf, size_t *size, int delim, FILE *stream)
+{
+    size_t len = 0;
+    int c;
+
+    while ((c = getc(stream)) != EOF && c != delim) {
+        if (len + 1 >= *size) {
+            *size = *size ? *size * 2 : 256;
+            if ((*buf = realloc(*buf, *size)) == NULL)
+                exit_err(ENOMEM, __func__, __LINE__);
+        }
+        (*buf)[len++] = c;
+    }
+
+    if (c == EOF && len == 0)
+        return -1;
+    if (*buf == NULL && (*buf = malloc(*size = 1)) == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    (*buf)[len] = '\0';
+    return len;
+}
+
+// Companion function for scan_files().
+// Streams operands from option --files-from's file into the scan.
+static void scan_files_from(struct scan_job *job)
+{
+    FILE *file;
+    if (strcmp(option_files_from, "-") == 0)
+        file = stdin;
+    else if ((file = fopen(option_files_from, "rb")) == NULL) {
+        fprintf(stderr, "Option --files-from: Could not open file \"%s\".\n",
+            option_files_from);
+        exit(EXIT_FAILURE);
+    }
+
+    char *buf = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = read_record(&buf, &size, option_null ? '\0' : '\n', file))
+        != -1)
+    {
+        if (option_null == 0 && len > 0 && buf[len - 1] == '\r')
+            buf[--len] = '\0';
+        if (len == 0)
+            continue;
+
+        char *operand = malloc(len + 1);
+        if (operand == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        memcpy(operand, buf, len + 1);
+        scan_operand(job, operand, 1);
+    }
+
+    free(buf);
+    if (file != stdin)
+        fclose(file);
+}
+
 // Background thread that scans PS4 PKG files for data required for renaming.
 static void *scan_files(void *param)
 {
     struct scan_job *job = (struct scan_job *) param;
 
-    if (job->n_filenames == 0) { // Use current directory.
+    // Option --watch: watch before searching, not to miss files in between.
+    if (option_watch && start_watching(job->filenames, job->n_filenames))
+        exit(EXIT_FAILURE);
+
+    if (job->n_filenames == 0 && option_files_from == NULL) {
+        // Use current directory.
         if (option_query == 1)
             goto done;
-        if (parse_directory(".", job))
-            exit(EXIT_FAILURE);
+        const char *resume = NULL;
+        if (option_resume == 0 || !is_operand_completed(0, ".", 1, &resume))
+            if (parse_directory(".", job, resume))
+                exit(EXIT_FAILURE);
     } else { // Find PKGs and run pkgrename() on them.
-        DIR *dir;
-        for (int i = 0; i < job->n_filenames; i++) {
-            // Directory
-            if ((dir = opendir(job->filenames[i])) != NULL) {
-                closedir(dir);
-                if (option_query == 1) {
-                    puts(job->filenames[i]);
-                    continue;
-                }
-                if (parse_directory(job->filenames[i], job))
-                    exit(EXIT_FAILURE);
-            // File
-            } else {
-                add_scan_result(job, job->filenames[i], 0);
-            }
-        }
+        for (int i = 0; i < job->n_filenames; i++)
+            scan_operand(job, job->filenames[i], 0);
+        if (option_files_from)
+            scan_files_from(job);
+    }
+
+    // Option --watch: keep adding new files.
+    if (option_watch) {
+        watch_directories(job);
+        exit(EXIT_FAILURE);
     }
 
 done:
-    ;
-    int err;
+    finish_scan_list(job);
+
+    return NULL;
+}
 
-    if ((err = pthread_mutex_lock(&job->mutex)) != 0)
-        goto error;
-    job->scan_list.finished = 1;
-    if ((err = pthread_mutex_unlock(&job->mutex)) != 0)
-        goto error;
+// Option --checkpoint: SIGINT handler for non-interactive runs, which stop after
+// the current file instead of in the middle of a rename.
+static void handle_sigint(int sig)
+{
+    (void) sig;
+    interrupted = 1;
+}
 
-    if ((err = pthread_cond_signal(&job->cond)) != 0)
-        goto error;
+// Option --checkpoint: finishes queued renames, saves the checkpoint file, and
+// exits the program.
+static void exit_interrupted(void)
+{
+    if (option_rename_jobs > 1 && option_query == 0 && option_no_to_all == 0)
+        finish_rename_executor();
+    save_checkpoint();
+    fprintf(stderr, "\nInterrupted. Use option --resume to continue.\n");
+    exit(EXIT_FAILURE);
+}
 
-    return NULL;
+// Companion function for parse_scan_results().
+// Waits for a new scan result; the mutex must be locked. With option
+// --checkpoint, wakes up regularly to check for interruptions.
+static void wait_for_scan_result(struct scan_job *job)
+{
+    if (option_checkpoint == NULL) {
+        pthread_cond_wait(&job->cond, &job->mutex);
+        return;
+    }
 
-error:
-     exit_err(err, __func__, __LINE__);
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec++;
+    pthread_cond_timedwait(&job->cond, &job->mutex, &deadline);
+    if (interrupted) {
+        pthread_mutex_unlock(&job->mutex);
+        exit_interrupted();
+    }
 }
 
 // Runs pkgrename() on scan results as they become available.
 static void parse_scan_results(struct scan_job *job)
 {
     struct scan *scan, *known_tail;
+    struct run_context run = {
+        .first_run = 1,
+        .first_prompt = 1,
+        .source = { .fd = -1 },
+        .target = { .fd = -1 },
+    };
 
     // Wait until the list has at least 1 node.
     pthread_mutex_lock(&job->mutex);
     while (job->scan_list.head == NULL && job->scan_list.finished == 0)
-        pthread_cond_wait(&job->cond, &job->mutex);
+        wait_for_scan_result(job);
     known_tail = job->scan_list.tail; // Store tail to skip mutex locks below.
     scan = job->scan_list.head;
     pthread_mutex_unlock(&job->mutex);
@@ -1039,19 +986,38 @@ static void parse_scan_results(struct scan_job *job)
         if (scan->filename == NULL)
             goto next;
 
-        while (1) {
-            struct scan *ret = pkgrename(scan);
+        wait_for_scan(job, scan);
+        while (scan->filtered == 0) { // Option --where skips the file.
+            struct scan *ret = pkgrename(&run, scan);
             if (ret == NULL)
                 break;
             scan = ret;
         } // Call pkgrename() as long as requested.
 
+        // Option --watch runs indefinitely; don't keep the data of old scans.
+        if (option_watch) {
+            free(scan->param_sfo);
+            scan->param_sfo = NULL;
+            free(scan->changelog);
+            scan->changelog = NULL;
+            if (scan->filename_allocated)
+                free(scan->filename);
+            scan->filename = NULL;
+            fflush(stdout);
+        }
+
+        if (option_checkpoint) {
+            update_checkpoint(scan);
+            if (interrupted)
+                exit_interrupted();
+        }
+
 next:
         // Wait until a new scan becomes available.
         if (scan == known_tail) {
             pthread_mutex_lock(&job->mutex);
             while (scan->next == NULL && job->scan_list.finished == 0)
-                pthread_cond_wait(&job->cond, &job->mutex);
+                wait_for_scan_result(job);
             known_tail = job->scan_list.tail;
             pthread_mutex_unlock(&job->mutex);
             if (scan->next == NULL) // Scanning finished.
@@ -1062,17 +1028,9 @@ next:
     }
 }
 
-inline static int is_dir(const char *filename)
-{
-    struct stat sb;
-    if (stat(filename, &sb))
-        return 0;
-
-    return S_ISDIR(sb.st_mode);
-}
-
 int main(int argc, char *argv[])
 {
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
     initialize_terminal();
     raw_terminal();
 
@@ -1084,34 +1042,163 @@ int main(int argc, char *argv[])
 
     parse_options(&argc, &argv);
 
-    struct scan_job job;
-    if (initialize_scan_job(&job, argv, argc))
+    // Setup that option --serve shares with the other modes.
+    if (option_title_db && load_title_db(option_title_db))
+        exit(EXIT_FAILURE);
+    if (option_offline && option_online_cache == NULL) {
+        fputs("Option --offline requires option --online-cache.\n", stderr);
         exit(EXIT_FAILURE);
+    }
 
-    // Check if operands contain directories.
-    if (option_query == 0) {
-        if (option_recursive == 1)
-            multiple_directories = 1;
-        else if (argc > 1) {
-            for (int i = 0; i < argc; i++) {
-                if (is_dir(argv[i])) {
-                    multiple_directories = 1;
-                    break;
-                }
-            }
+    if (option_serve)
+        exit(serve(option_serve) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+    if (option_files_from && strcmp(option_files_from, "-") == 0
+        && option_query == 0 && option_no_to_all == 0
+        && option_yes_to_all == 0)
+    {
+        fputs("Option --files-from -: standard input can only be used with"
+            " options --no-to-all, --query, or --yes-to-all.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    if (option_where && compile_filter(option_where))
+        exit(EXIT_FAILURE);
+
+    compile_path_filters();
+
+    if (option_since && option_state == NULL) {
+        fputs("Option --since requires option --state.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+    if (option_state && load_state(option_state))
+        exit(EXIT_FAILURE);
+
+    if (option_resume && option_checkpoint == NULL) {
+        fputs("Option --resume requires option --checkpoint.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+    if (option_checkpoint && option_watch) {
+        fputs("Options --checkpoint and --watch can't be used together.\n",
+            stderr);
+        exit(EXIT_FAILURE);
+    }
+    if (option_checkpoint) {
+        if (load_checkpoint(option_checkpoint))
+            exit(EXIT_FAILURE);
+        // Interactive runs keep exiting right away.
+        if (option_query || option_no_to_all || option_yes_to_all)
+            signal(SIGINT, handle_sigint);
+    }
+
+    if (option_organize && option_watch) {
+        fputs("Options --organize and --watch can't be used together.\n",
+            stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    if (option_n_views) {
+        if (option_watch) {
+            fputs("Options --view and --watch can't be used together.\n",
+                stderr);
+            exit(EXIT_FAILURE);
         }
+        if (initialize_views())
+            exit(EXIT_FAILURE);
     }
 
+    if (option_report && (option_checkpoint || option_watch)) {
+        fputs("Option --report can't be used with options --checkpoint or"
+            " --watch.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    if (option_sort_by) {
+        if (option_checkpoint || option_watch) {
+            fputs("Option --sort-by can't be used with options --checkpoint or"
+                " --watch.\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+        if (compile_sort_keys(option_sort_by))
+            exit(EXIT_FAILURE);
+    }
+
+    if (option_watch && option_query) {
+        fputs("Options --query and --watch can't be used together.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    struct scan_job job;
+    if (initialize_scan_job(&job, argv, argc))
+        exit(EXIT_FAILURE);
+    // Option --sort-by renders the files of its second scan job.
+    if (option_sort_by == NULL)
+        job.render = use_render_stage();
+
+    // Print directory names; for non-recursive runs, this is decided while
+    // scanning the operands.
+    if (option_query == 0 && option_recursive == 1)
+        multiple_directories = 1;
+
     // Run file scans in a separate thread.
     pthread_t file_thread;
     int err;
     if ((err = pthread_create(&file_thread, NULL, scan_files, &job)) != 0)
         exit_err(err, __func__, __LINE__);
 
+    // Option --report: the probe threads do all the work.
+    if (option_report) {
+        pthread_join(file_thread, NULL);
+        if (option_state)
+            save_state();
+        destroy_scan_job(&job);
+        print_report();
+        exit(EXIT_SUCCESS);
+    }
+
+    // Option --sort-by: collect all scan results first, then scan the files
+    // again in sorted order.
+    struct scan_job *results = &job;
+    struct scan_job sorted_job;
+    if (option_sort_by) {
+        collect_sort_records(&job);
+        pthread_join(file_thread, NULL);
+        destroy_scan_job(&job);
+        if (initialize_scan_job(&sorted_job, NULL, 0))
+            exit(EXIT_FAILURE);
+        sorted_job.render = use_render_stage();
+        if ((err = pthread_create(&file_thread, NULL, scan_sorted_files,
+            &sorted_job)) != 0)
+            exit_err(err, __func__, __LINE__);
+        results = &sorted_job;
+    }
+
+    // Run automatic renames concurrently.
+    if (option_rename_jobs > 1 && option_query == 0 && option_no_to_all == 0
+        && start_rename_executor(option_rename_jobs))
+        option_rename_jobs = 1;
+
     // Parse the scan results in the main thread.
-    parse_scan_results(&job);
+    parse_scan_results(results);
+    pthread_join(file_thread, NULL);
+
+    if (option_rename_jobs > 1 && option_query == 0 && option_no_to_all == 0)
+        finish_rename_executor();
+
+    // The state is only saved after all files have been processed, including
+    // queued renames.
+    if (option_state)
+        save_state();
+
+    // Views link to the files' final names.
+    if (option_n_views && option_query == 0)
+        update_views(option_no_to_all);
+
+    // The run is complete; there is nothing left to resume.
+    if (option_checkpoint)
+        remove_checkpoint();
 
-    destroy_scan_job(&job);
+    destroy_scan_job(results);
 
     exit(EXIT_SUCCESS);
 }
@@ -1,5 +1,4 @@
 #include "../include/characters.h"
-#include "../include/options.h"
 
 #include <ctype.h>
 #include <string.h>
@@ -30,21 +29,17 @@ int count_spec_chars(char *string)
     return count;
 }
 
-// Replaces or hides (skips) illegal characters.
-void replace_illegal_characters(char *string)
+// Replaces illegal characters with <placeholder>.
+void replace_illegal_characters(char *string, char placeholder)
 {
-    char buffer[strlen(string)];
+    char buffer[strlen(string) + 1];
     char *p = buffer;
 
     for (size_t i = 0; i < strlen(string); i++) {
         // Printable character
         if (isprint(string[i])) {
             if (is_in_set(string[i], illegal_characters)) {
-                // Replace illegal character.
-                if (option_no_placeholder)
-                    *(p++) = ' '; // Replace with space.
-                else
-                    *(p++) = placeholder_char; // Replace with placeholder.
+                *(p++) = placeholder; // Replace illegal character.
             } else {
                 *(p++) = string[i];
             }
@@ -0,0 +1,340 @@
+#include "../include/checkpoint.h"
+#include "../include/colors.h"
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/rename.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Checkpoint file format: a header line, followed by records that are
+// appended as the run goes on. A position record is a line "P", followed by a
+// line each for the operand's index, the operand, and the file's relative path
+// (empty if the operand is a file); the last complete one is used. A renamed
+// file record "R <dev> <ino>" identifies a completed file that has been renamed
+// or moved, possibly to a name that comes after the position. Names are not
+// escaped, so positions that contain newline characters are not recorded.
+#define CHECKPOINT_HEADER "pkgrename checkpoint 2"
+
+static const char *checkpoint_filename;
+static char *temp_filename;
+static FILE *checkpoint; // Open for appending after the first write.
+
+// The position that has been loaded by option --resume.
+static int resume_operand = -1;
+static char resume_name[PATH_MAX];
+static char resume_path[PATH_MAX];
+
+// Renamed files of the interrupted run, in a hash table.
+struct completed_file {
+    unsigned long long dev;
+    unsigned long long ino;
+    struct completed_file *next;
+};
+static struct completed_file **completed_table;
+static size_t completed_table_size; // A power of 2.
+
+// The last completed position, copied from its scan.
+static int last_operand = -1;
+static char last_operand_name[PATH_MAX];
+static char last_path[PATH_MAX];
+static _Bool saved; // The last completed position has been written.
+static struct timespec last_write;
+
+// Files renamed in this run that have not been written yet.
+static struct completed_file *renamed_files;
+static size_t n_renamed_files;
+
+static unsigned int hash_file(unsigned long long dev, unsigned long long ino)
+{
+    return hash_number(hash_number(HASH_INIT, ino), dev);
+}
+
+// Reads a line without its newline character.
+// Returns 0 on success and -1 on error.
+static int read_line(char *buf, size_t size, FILE *stream)
+{
+    if (fgets(buf, size, stream) == NULL)
+        return -1;
+    size_t len = strlen(buf);
+    if (len == 0 || buf[len - 1] != '\n')
+        return -1;
+    buf[len - 1] = '\0';
+    return 0;
+}
+
+// Companion function for load_checkpoint().
+// Reads the records of a checkpoint file; an incomplete last record, as left
+// by a crash, is ignored.
+// Returns 0 on success and -1 if the file has no valid position.
+static int read_checkpoint_file(FILE *file)
+{
+    char line[PATH_MAX];
+    if (read_line(line, sizeof(line), file)
+        || strcmp(line, CHECKPOINT_HEADER) != 0)
+        return -1;
+
+    struct completed_file *files = NULL;
+    size_t n_files = 0;
+    char operand[32], name[PATH_MAX], path[PATH_MAX];
+    while (read_line(line, sizeof(line), file) == 0) {
+        if (strcmp(line, "P") == 0) {
+            if (read_line(operand, sizeof(operand), file)
+                || read_line(name, sizeof(name), file)
+                || read_line(path, sizeof(path), file))
+                break;
+            char *end;
+            long n = strtol(operand, &end, 10);
+            if (*end != '\0' || n < 0 || n > INT_MAX)
+                return -1;
+            resume_operand = n;
+            strcpy(resume_name, name);
+            strcpy(resume_path, path);
+        } else if (line[0] == 'R' && line[1] == '\t') {
+            struct completed_file *f = malloc(sizeof(*f));
+            if (f == NULL)
+                exit_err(ENOMEM, __func__, __LINE__);
+            char *end;
+            f->dev = strtoull(line + 2, &end, 10);
+            f->ino = strtoull(end, NULL, 10);
+            f->next = files;
+            files = f;
+            n_files++;
+        } else {
+            return -1;
+        }
+    }
+    if (resume_operand == -1)
+        return -1;
+
+    if (n_files == 0)
+        return 0;
+    completed_table_size = get_table_size(n_files);
+    completed_table = calloc(completed_table_size, sizeof(*completed_table));
+    if (completed_table == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    while (files) {
+        struct completed_file *next = files->next;
+        unsigned int i = hash_file(files->dev, files->ino)
+            & (completed_table_size - 1);
+        files->next = completed_table[i];
+        completed_table[i] = files;
+        files = next;
+    }
+    return 0;
+}
+
+int load_checkpoint(const char *filename)
+{
+    checkpoint_filename = filename;
+    if ((temp_filename = malloc(strlen(filename) + 5)) == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    strcpy(temp_filename, filename);
+    strcat(temp_filename, ".tmp");
+
+    if (option_resume == 0)
+        return 0;
+
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        if (errno == ENOENT) // Nothing to resume; start from the beginning.
+            return 0;
+        fprintf(stderr, "Could not open checkpoint file \"%s\".\n", filename);
+        return -1;
+    }
+
+    int err = read_checkpoint_file(file);
+    fclose(file);
+    if (err) {
+        fprintf(stderr, "Invalid checkpoint file \"%s\".\n", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Returns a path's length without trailing directory separators.
+static size_t operand_length(const char *s)
+{
+    size_t len = strlen(s);
+    while (len > 1 && s[len - 1] == DIR_SEPARATOR)
+        len--;
+    return len;
+}
+
+int is_operand_completed(int operand, const char *name, _Bool is_dir,
+    const char **path)
+{
+    *path = NULL;
+    if (operand < resume_operand)
+        return 1;
+    if (operand > resume_operand)
+        return 0;
+
+    size_t len = operand_length(name);
+    if (len != operand_length(resume_name)
+        || strncmp(name, resume_name, len) != 0)
+    {
+        set_color(BRIGHT_RED, stderr);
+        fprintf(stderr, "Option --resume: operand \"%s\" does not match operand"
+            " \"%s\" of checkpoint file \"%s\".\n", name, resume_name,
+            checkpoint_filename);
+        set_color(RESET, stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    if (is_dir == 0)
+        return 1;
+    if (resume_path[0] != '\0')
+        *path = resume_path;
+    return 0;
+}
+
+int is_file_completed(const char *path)
+{
+    if (completed_table == NULL)
+        return 0;
+
+    struct stat sb;
+    if (stat(path, &sb) != 0)
+        return 0;
+    unsigned long long dev = sb.st_dev, ino = sb.st_ino;
+    struct completed_file *f =
+        completed_table[hash_file(dev, ino) & (completed_table_size - 1)];
+    while (f && (f->dev != dev || f->ino != ino))
+        f = f->next;
+    return f != NULL;
+}
+
+void record_renamed_file(const char *path)
+{
+    struct stat sb;
+    if (stat(path, &sb) != 0)
+        return;
+
+    // Grow in powers of 2.
+    if ((n_renamed_files & (n_renamed_files - 1)) == 0) {
+        renamed_files = realloc(renamed_files, (n_renamed_files
+            ? n_renamed_files * 2 : 8) * sizeof(*renamed_files));
+        if (renamed_files == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+    }
+    renamed_files[n_renamed_files++] = (struct completed_file) {
+        .dev = sb.st_dev,
+        .ino = sb.st_ino,
+    };
+}
+
+static void write_renamed_file(FILE *file, const struct completed_file *f)
+{
+    fprintf(file, "R\t%llu\t%llu\n", f->dev, f->ino);
+}
+
+// Companion function for write_checkpoint().
+// Creates a new checkpoint file that keeps the renamed files of the
+// interrupted run, and leaves it open for appending.
+// Returns 0 on success and -1 on error.
+static int create_checkpoint_file(void)
+{
+    FILE *file = fopen(temp_filename, "wb");
+    if (file == NULL)
+        return -1;
+    fputs(CHECKPOINT_HEADER "\n", file);
+    for (size_t i = 0; i < completed_table_size; i++)
+        for (struct completed_file *f = completed_table[i]; f; f = f->next)
+            write_renamed_file(file, f);
+    int err = ferror(file);
+    if (fclose(file) != 0 || err)
+        return -1;
+#ifdef _WIN32
+    remove(checkpoint_filename); // Windows's rename() doesn't replace files.
+#endif
+    if (rename(temp_filename, checkpoint_filename) != 0)
+        return -1;
+
+    checkpoint = fopen(checkpoint_filename, "ab");
+    return checkpoint ? 0 : -1;
+}
+
+// Appends the files renamed since the last write and the last completed
+// position to the checkpoint file.
+// Returns 0 on success and -1 on error.
+static int write_checkpoint(void)
+{
+    if (checkpoint == NULL && create_checkpoint_file())
+        goto error;
+
+    for (size_t i = 0; i < n_renamed_files; i++)
+        write_renamed_file(checkpoint, &renamed_files[i]);
+    fprintf(checkpoint, "P\n%d\n%s\n%s\n", last_operand, last_operand_name,
+        last_path);
+    if (fflush(checkpoint) != 0 || ferror(checkpoint))
+        goto error;
+
+    n_renamed_files = 0;
+    saved = 1;
+    return 0;
+
+error:
+    set_color(BRIGHT_RED, stderr);
+    fprintf(stderr, "Could not save checkpoint file \"%s\".\n",
+        checkpoint_filename);
+    set_color(RESET, stderr);
+    remove(temp_filename);
+    return -1;
+}
+
+void update_checkpoint(const struct scan *scan)
+{
+    // Error scans have given up their file names; the previous position
+    // stays.
+    if (scan->filename == NULL || strchr(scan->filename, '\n'))
+        return;
+
+    const char *path = scan->filename + scan->operand_len;
+    if (*path == DIR_SEPARATOR)
+        path++;
+    last_operand = scan->operand;
+    snprintf(last_operand_name, sizeof(last_operand_name), "%.*s",
+        (int) scan->operand_len, scan->filename);
+    snprintf(last_path, sizeof(last_path), "%s", path);
+    saved = 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - last_write.tv_sec < CHECKPOINT_INTERVAL)
+        return;
+    last_write = now;
+
+    // Queued renames must not be recorded as completed before they are.
+    wait_for_renames();
+    write_checkpoint();
+}
+
+int save_checkpoint(void)
+{
+    if (last_operand == -1 || saved)
+        return 0;
+
+    wait_for_renames();
+    return write_checkpoint();
+}
+
+void remove_checkpoint(void)
+{
+    if (checkpoint) {
+        fclose(checkpoint);
+        checkpoint = NULL;
+    }
+    if (remove(checkpoint_filename) != 0 && errno != ENOENT) {
+        set_color(BRIGHT_RED, stderr);
+        fprintf(stderr, "Could not remove checkpoint file \"%s\".\n",
+            checkpoint_filename);
+        set_color(RESET, stderr);
+    }
+}
@@ -3,10 +3,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+char format_string[MAX_FORMAT_STRING_LEN] =
+    "%title% [%dlc%] [{v%app_ver%}{ + v%merged_ver%}] [%title_id%] [%release_group%] [%release%] [%backport%]";
+struct custom_category custom_category =
+    {"Game", "Update", "DLC", "App", "Other"};
+char *tags[MAX_TAGS];
+int tagc;
 char *tag_separator = ",";
 char *BACKPORT_STRING = "Backport";
 char *FAKE_STRING = "Fake";
 char *RETAIL_STRING = "Retail";
+int option_disable_colors; // Used by set_color(), so it lives with the library.
 
 void exit_err(int err, const char *function_name, int line)
 {
@@ -15,3 +22,25 @@ void exit_err(int err, const char *function_name, int line)
     fprintf(stderr, "Please report this bug at \"%s\".\n", SUPPORT_LINK);
     exit(err);
 }
+
+unsigned int hash_string(unsigned int hash, const char *s)
+{
+    for (; *s; s++)
+        hash = hash_byte(hash, *s);
+    return hash;
+}
+
+unsigned int hash_number(unsigned int hash, unsigned long long n)
+{
+    for (size_t i = 0; i < sizeof(n); i++)
+        hash = hash_byte(hash, n >> (i * 8));
+    return hash;
+}
+
+size_t get_table_size(size_t n)
+{
+    size_t size = 1;
+    while (size < n)
+        size *= 2;
+    return size;
+}
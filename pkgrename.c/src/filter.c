@@ -0,0 +1,517 @@
+#include "../include/filter.h"
+#include "../include/options.h"
+#include "../include/render.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FILTER_NODES 256
+#define MAX_VALUE_LEN 256
+
+enum field {
+    FIELD_APP,
+    FIELD_APP_VER,
+    FIELD_BACKPORT,
+    FIELD_CATEGORY,
+    FIELD_CONTENT_FLAGS,
+    FIELD_CONTENT_ID,
+    FIELD_CONTENT_TYPE,
+    FIELD_DLC,
+    FIELD_FAKE,
+    FIELD_FIRMWARE,
+    FIELD_GAME,
+    FIELD_OTHER,
+    FIELD_PATCH,
+    FIELD_REGION,
+    FIELD_RETAIL,
+    FIELD_SDK,
+    FIELD_TITLE,
+    FIELD_TITLE_ID,
+    FIELD_TRUE_VER,
+    FIELD_TYPE,
+    FIELD_VERSION,
+};
+
+static const struct {
+    const char *name;
+    enum field field;
+    _Bool in_header; // The value is known from the PKG header alone.
+} fields[] = {
+    { "app",           FIELD_APP,           0 },
+    { "app_ver",       FIELD_APP_VER,       0 },
+    { "backport",      FIELD_BACKPORT,      0 },
+    { "category",      FIELD_CATEGORY,      0 },
+    { "content_flags", FIELD_CONTENT_FLAGS, 1 },
+    { "content_id",    FIELD_CONTENT_ID,    1 },
+    { "content_type",  FIELD_CONTENT_TYPE,  1 },
+    { "dlc",           FIELD_DLC,           0 },
+    { "fake",          FIELD_FAKE,          0 },
+    { "firmware",      FIELD_FIRMWARE,      0 },
+    { "game",          FIELD_GAME,          0 },
+    { "other",         FIELD_OTHER,         0 },
+    { "patch",         FIELD_PATCH,         0 },
+    { "region",        FIELD_REGION,        1 },
+    { "retail",        FIELD_RETAIL,        0 },
+    { "sdk",           FIELD_SDK,           0 },
+    { "title",         FIELD_TITLE,         0 },
+    { "title_id",      FIELD_TITLE_ID,      1 },
+    { "true_ver",      FIELD_TRUE_VER,      0 },
+    { "type",          FIELD_TYPE,          0 },
+    { "version",       FIELD_VERSION,       0 },
+};
+
+// The compiled expression is a tree whose nodes are stored in an array.
+struct node {
+    enum {
+        NODE_AND,
+        NODE_OR,
+        NODE_NOT,
+        NODE_TEST, // True if the field's value is not empty.
+        NODE_COMPARE,
+    } type;
+    int left; // Index of the first operand.
+    int right; // Index of the second operand.
+    enum field field;
+    enum {
+        OP_EQ,
+        OP_NE,
+        OP_LT,
+        OP_LE,
+        OP_GT,
+        OP_GE,
+        OP_CONTAINS,
+    } op;
+    char *value;
+    double number;
+    _Bool is_number; // The value is a number.
+};
+
+static struct {
+    struct node nodes[MAX_FILTER_NODES];
+    int n_nodes;
+    int root; // -1 if no filter has been compiled.
+    _Bool needs_vars; // Some fields are not known from the PKG header.
+} filter = { .root = -1 };
+
+// Results of an evaluation that may lack some of the PKG's data.
+enum result {
+    NO,
+    YES,
+    MAYBE, // Depends on data that is not available (yet).
+};
+
+// The data that an expression is evaluated against.
+struct context {
+    const struct pkg_header_fields *header;
+    const struct pattern_vars *vars; // NULL if only the header is known.
+    _Bool fake;
+};
+
+// Parser state
+static const char *expression;
+static const char *pos;
+
+static int parse_or(void);
+
+// Prints a syntax error message.
+// Returns -1.
+static int syntax_error(const char *message)
+{
+    fprintf(stderr, "Option --where: %s at position %d: \"%s\".\n", message,
+        (int) (pos - expression) + 1, expression);
+    return -1;
+}
+
+static void skip_spaces(void)
+{
+    while (isspace((unsigned char) *pos))
+        pos++;
+}
+
+// Returns the index of a new node, or -1 if there are too many nodes.
+static int new_node(int type)
+{
+    if (filter.n_nodes == MAX_FILTER_NODES)
+        return syntax_error("expression too long");
+
+    struct node *node = &filter.nodes[filter.n_nodes];
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    node->left = node->right = -1;
+    return filter.n_nodes++;
+}
+
+// Returns 1 if <s> is a number, which is then stored in <number>.
+static int parse_number(const char *s, double *number)
+{
+    char *end;
+    *number = strtod(s, &end);
+    return end != s && *end == '\0';
+}
+
+// Parses a comparison value, which is either a quoted string or a word.
+// Returns a dynamically allocated string or NULL on error.
+static char *parse_value(void)
+{
+    char value[MAX_VALUE_LEN];
+    size_t len = 0;
+
+    skip_spaces();
+    if (*pos == '"') {
+        pos++;
+        while (*pos != '"') {
+            if (*pos == '\0') {
+                syntax_error("missing closing quotation mark");
+                return NULL;
+            }
+            if (len == sizeof(value) - 1) {
+                syntax_error("value too long");
+                return NULL;
+            }
+            value[len++] = *pos++;
+        }
+        pos++;
+    } else {
+        while (*pos && !isspace((unsigned char) *pos)
+            && strchr("()&|!<>=~\"", *pos) == NULL)
+        {
+            if (len == sizeof(value) - 1) {
+                syntax_error("value too long");
+                return NULL;
+            }
+            value[len++] = *pos++;
+        }
+        if (len == 0) {
+            syntax_error("value expected");
+            return NULL;
+        }
+    }
+    value[len] = '\0';
+
+    char *copy = strdup(value);
+    if (copy == NULL)
+        fprintf(stderr, "Option --where: out of memory.\n");
+    return copy;
+}
+
+// Parses a field name, optionally followed by an operator and a value.
+static int parse_comparison(void)
+{
+    skip_spaces();
+    const char *start = pos;
+    while (islower((unsigned char) *pos) || *pos == '_')
+        pos++;
+    size_t len = pos - start;
+    if (len == 0)
+        return syntax_error("name expected");
+
+    size_t i;
+    for (i = 0; i < sizeof(fields) / sizeof(*fields); i++)
+        if (strlen(fields[i].name) == len
+            && strncmp(fields[i].name, start, len) == 0)
+            break;
+    if (i == sizeof(fields) / sizeof(*fields)) {
+        pos = start;
+        return syntax_error("unknown name");
+    }
+    if (fields[i].in_header == 0)
+        filter.needs_vars = 1;
+
+    static const struct {
+        const char *token;
+        int op;
+    } ops[] = { // Longer tokens first.
+        { "==", OP_EQ },
+        { "!=", OP_NE },
+        { "<=", OP_LE },
+        { ">=", OP_GE },
+        { "<",  OP_LT },
+        { ">",  OP_GT },
+        { "=",  OP_EQ },
+        { "~",  OP_CONTAINS },
+    };
+    skip_spaces();
+    size_t j;
+    for (j = 0; j < sizeof(ops) / sizeof(*ops); j++)
+        if (strncmp(pos, ops[j].token, strlen(ops[j].token)) == 0)
+            break;
+
+    int n;
+    if (j == sizeof(ops) / sizeof(*ops)) {
+        if ((n = new_node(NODE_TEST)) == -1)
+            return -1;
+    } else {
+        pos += strlen(ops[j].token);
+        char *value = parse_value();
+        if (value == NULL)
+            return -1;
+        if ((n = new_node(NODE_COMPARE)) == -1) {
+            free(value);
+            return -1;
+        }
+        filter.nodes[n].op = ops[j].op;
+        filter.nodes[n].value = value;
+        filter.nodes[n].is_number = parse_number(value,
+            &filter.nodes[n].number);
+    }
+    filter.nodes[n].field = fields[i].field;
+
+    return n;
+}
+
+static int parse_unary(void)
+{
+    skip_spaces();
+    if (*pos == '!' && pos[1] != '=') {
+        pos++;
+        int operand = parse_unary();
+        if (operand == -1)
+            return -1;
+        int n = new_node(NODE_NOT);
+        if (n != -1)
+            filter.nodes[n].left = operand;
+        return n;
+    }
+    if (*pos == '(') {
+        pos++;
+        int n = parse_or();
+        if (n == -1)
+            return -1;
+        skip_spaces();
+        if (*pos != ')')
+            return syntax_error("missing closing parenthesis");
+        pos++;
+        return n;
+    }
+    return parse_comparison();
+}
+
+// Parses a sequence of operands that are joined by a binary operator.
+static int parse_binary(const char *token, int type, int (*parse_operand)(void))
+{
+    int left = parse_operand();
+    if (left == -1)
+        return -1;
+
+    for (;;) {
+        skip_spaces();
+        if (strncmp(pos, token, 2) != 0)
+            return left;
+        pos += 2;
+        int right = parse_operand();
+        if (right == -1)
+            return -1;
+        int n = new_node(type);
+        if (n == -1)
+            return -1;
+        filter.nodes[n].left = left;
+        filter.nodes[n].right = right;
+        left = n;
+    }
+}
+
+static int parse_and(void)
+{
+    return parse_binary("&&", NODE_AND, parse_unary);
+}
+
+static int parse_or(void)
+{
+    return parse_binary("||", NODE_OR, parse_and);
+}
+
+int compile_filter(const char *string)
+{
+    expression = pos = string;
+    int root = parse_or();
+    if (root == -1)
+        return -1;
+
+    skip_spaces();
+    if (*pos != '\0')
+        return syntax_error("unexpected character");
+
+    filter.root = root;
+    return 0;
+}
+
+// Returns a field's value, or NULL if it is not known in this context.
+static const char *get_value(enum field field, const struct context *ctx,
+    char buf[static 16])
+{
+    // Fields that are known from the PKG header.
+    const char *content_id = ctx->header->content_id;
+    switch (field) {
+        case FIELD_CONTENT_FLAGS:
+            snprintf(buf, 16, "%lu", ctx->header->content_flags);
+            return buf;
+        case FIELD_CONTENT_ID:
+            return content_id;
+        case FIELD_CONTENT_TYPE:
+            snprintf(buf, 16, "%lu", ctx->header->content_type);
+            return buf;
+        case FIELD_REGION:
+            switch (content_id[0]) {
+                case 'E': return "EU";
+                case 'H': return "AS";
+                case 'I': return "IN";
+                case 'J': return "JP";
+                case 'U': return "US";
+            }
+            return "";
+        case FIELD_TITLE_ID:
+            if (strlen(content_id) < 16)
+                return "";
+            memcpy(buf, content_id + 7, 9);
+            buf[9] = '\0';
+            return buf;
+        default:
+            break;
+    }
+
+    const struct pattern_vars *vars = ctx->vars;
+    if (vars == NULL)
+        return NULL;
+
+    const char *value = NULL;
+    switch (field) {
+        case FIELD_APP:      value = vars->app ? "1" : NULL; break;
+        case FIELD_APP_VER:  value = vars->app_ver; break;
+        case FIELD_BACKPORT: value = vars->backport ? "1" : NULL; break;
+        case FIELD_CATEGORY: value = vars->category; break;
+        case FIELD_DLC:      value = vars->dlc ? "1" : NULL; break;
+        case FIELD_FAKE:     value = ctx->fake ? "1" : NULL; break;
+        case FIELD_FIRMWARE: value = vars->firmware; break;
+        case FIELD_GAME:     value = vars->game ? "1" : NULL; break;
+        case FIELD_OTHER:    value = vars->other ? "1" : NULL; break;
+        case FIELD_PATCH:    value = vars->patch ? "1" : NULL; break;
+        case FIELD_RETAIL:   value = ctx->fake ? NULL : "1"; break;
+        case FIELD_SDK:      value = vars->sdk; break;
+        case FIELD_TITLE:    value = vars->title; break;
+        case FIELD_TRUE_VER: value = vars->true_ver; break;
+        case FIELD_TYPE:     value = vars->type; break;
+        case FIELD_VERSION:  value = vars->version; break;
+        default:             break;
+    }
+    return value ? value : "";
+}
+
+// Case-insensitive strcmp().
+static int compare_strings(const char *a, const char *b)
+{
+    while (*a && tolower((unsigned char) *a) == tolower((unsigned char) *b)) {
+        a++;
+        b++;
+    }
+    return tolower((unsigned char) *a) - tolower((unsigned char) *b);
+}
+
+// Case-insensitive strstr() that only tells if <needle> has been found.
+static int contains(const char *haystack, const char *needle)
+{
+    size_t len = strlen(needle);
+    for (; *haystack; haystack++) {
+        size_t i = 0;
+        while (i < len && tolower((unsigned char) haystack[i])
+            == tolower((unsigned char) needle[i]))
+            i++;
+        if (i == len)
+            return 1;
+    }
+    return len == 0;
+}
+
+static enum result compare(const struct node *node, const char *value)
+{
+    if (node->op == OP_CONTAINS)
+        return contains(value, node->value);
+
+    // Missing values are neither smaller nor greater than anything.
+    if (value[0] == '\0' && node->op != OP_EQ && node->op != OP_NE)
+        return NO;
+
+    int cmp;
+    double number;
+    if (node->is_number && parse_number(value, &number))
+        cmp = (number > node->number) - (number < node->number);
+    else
+        cmp = compare_strings(value, node->value);
+
+    switch (node->op) {
+        case OP_EQ: return cmp == 0;
+        case OP_NE: return cmp != 0;
+        case OP_LT: return cmp < 0;
+        case OP_LE: return cmp <= 0;
+        case OP_GT: return cmp > 0;
+        case OP_GE: return cmp >= 0;
+        default:    return NO;
+    }
+}
+
+// Evaluates a node with three-valued logic, so that the header stage can
+// decide whenever the known fields are enough, e.g. for "region==EU && sdk<5".
+static enum result evaluate(int n, const struct context *ctx)
+{
+    const struct node *node = &filter.nodes[n];
+    enum result left, right;
+    char buf[16];
+    const char *value;
+
+    switch (node->type) {
+        case NODE_AND:
+            if ((left = evaluate(node->left, ctx)) == NO)
+                return NO;
+            if ((right = evaluate(node->right, ctx)) == NO)
+                return NO;
+            return left == YES && right == YES ? YES : MAYBE;
+        case NODE_OR:
+            if ((left = evaluate(node->left, ctx)) == YES)
+                return YES;
+            if ((right = evaluate(node->right, ctx)) == YES)
+                return YES;
+            return left == NO && right == NO ? NO : MAYBE;
+        case NODE_NOT:
+            left = evaluate(node->left, ctx);
+            return left == MAYBE ? MAYBE : !left;
+        case NODE_TEST:
+            if ((value = get_value(node->field, ctx, buf)) == NULL)
+                return MAYBE;
+            return value[0] != '\0';
+        case NODE_COMPARE:
+            if ((value = get_value(node->field, ctx, buf)) == NULL)
+                return MAYBE;
+            return compare(node, value);
+    }
+
+    return MAYBE;
+}
+
+int match_pkg_header(const struct pkg_header_fields *header)
+{
+    if (filter.root == -1)
+        return 1;
+
+    struct context ctx = { .header = header };
+    return evaluate(filter.root, &ctx) != NO;
+}
+
+int match_filter(const struct scan *scan,
+    const struct pkg_header_fields *header)
+{
+    // Without further fields, the header stage has already decided.
+    if (filter.root == -1 || filter.needs_vars == 0)
+        return 1;
+
+    struct pattern_vars vars;
+    if (load_pattern_vars(&render_context, &vars, scan))
+        return 0;
+
+    struct context ctx = {
+        .header = header,
+        .vars = &vars,
+        .fake = scan->fake_status,
+    };
+    return evaluate(filter.root, &ctx) == YES;
+}
@@ -2,51 +2,71 @@
 #include "../include/common.h"
 #include "../include/onlinesearch.h"
 #include "../include/options.h"
+#include "../include/storepage.h"
 
 #ifndef _WIN32
 #include <curl/curl.h>
+#include <pthread.h>
+#include <time.h>
 #endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifndef _WIN32
+#include <strings.h>
+#endif
 
 #define URL_LEN 128
 
-static int create_url(char url[URL_LEN], char *content_id)
+// The store's base URL can be changed at compile time, e.g. to test against a
+// local web server: -DSTORE_URL='"http://127.0.0.1:8000/"'
+#ifndef STORE_URL
+#define STORE_URL "https://store.playstation.com/"
+#endif
+
+// Returns 0 on success and 1 if the Content ID is not supported.
+static int create_url(char url[URL_LEN], const char *content_id)
 {
     char *prefix;
     switch (content_id[0]) {
         case 'U':
-            prefix = "https://store.playstation.com/en-us/product/";
+            prefix = STORE_URL "en-us/product/";
             break;
         case 'E':
-            prefix = "https://store.playstation.com/en-gb/product/";
+            prefix = STORE_URL "en-gb/product/";
             break;
         case 'H':
-            prefix = "https://store.playstation.com/en-hk/product/";
+            prefix = STORE_URL "en-hk/product/";
             break;
         case 'J':
-            prefix = "https://store.playstation.com/ja-jp/product/";
+            prefix = STORE_URL "ja-jp/product/";
             break;
         default:
-            printf(
-                "Online search not supported for this Content ID (\"%s\").\n",
-                content_id);
-        return 1;
+            return 1;
     }
+    if (strlen(prefix) + strlen(content_id) >= URL_LEN)
+        return 1;
     strcpy(url, prefix);
     strcat(url, content_id);
     return 0;
 }
 
+static void print_unsupported(const char *content_id)
+{
+    printf("Online search not supported for this Content ID (\"%s\").\n",
+        content_id);
+}
+
 #ifdef _WIN32
 void search_online(char *content_id, char *title, int silent)
 {
     char url[URL_LEN];
     char cmd[128];
 
-    if (create_url(url, content_id) != 0)
+    if (create_url(url, content_id) != 0) {
+        print_unsupported(content_id);
         return;
+    }
 
     if (!silent)
         printf("Searching online, please wait...\n");
@@ -62,131 +82,612 @@ void search_online(char *content_id, char *title, int silent)
         fprintf(stderr, "Error while calling curl.exe.\n");
         return;
     }
-    char c;
-    char curl_output[65536];
-    size_t index = 0;
-    while ((c = fgetc(pipe)) != EOF && index < sizeof(curl_output) - 1) {
-        curl_output[index] = c;
-        index++;
-    }
-    curl_output[index] = '\0';
+    struct store_page_parser parser;
+    init_store_page_parser(&parser);
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), pipe)) > 0)
+        if (parse_store_page(&parser, buf, len))
+            break;
     int result = _pclose(pipe);
-    if (result != 0 && result != 23) { // 23: pipe aborted (curl_output is full)
+    if (result != 0 && result != 23) { // 23: pipe aborted (title found)
         fprintf(stderr, "An error occured (error code \"%d\").\n"
             "See \"https://curl.se/libcurl/c/libcurl-errors.html\".\n", result);
     }
 
-    //printf("cURL output: %s\n", curl_output); // DEBUG
-
-    // Search cURL's output for the title
-    char *start = strstr(curl_output, "@type");
-    if (start != NULL && strlen(start) > 25) {
-        start += 25;
-        char *end = strchr(start, '"');
-        if (end != NULL) {
-            end[0] = '\0';
-            if (strcmp(start, "") != 0) {
-                if (!silent)
-                    printf("Online title: \"%s\"\n", start);
-                strncpy(title, start, MAX_FILENAME_LEN);
-                title[MAX_FILENAME_LEN - 1] = '\0';
-            } else goto fail; // String is empty
-        } else {
-            set_color(BRIGHT_RED, stderr);
-            fprintf(stderr,
-                "Error while searching online. Please contact the developer at"
-                " \"https://github.com/hippie68/pkgrename/issues\""
-                " and show him this link: \"%s\".\n", url);
-            set_color(RESET, stderr);
-        }
-    } else {
-fail:
+    const char *online_title = get_store_page_title(&parser);
+    if (online_title != NULL) {
         if (!silent)
-            printf("No online information found.\n");
+            printf("Online title: \"%s\"\n", online_title);
+        strncpy(title, online_title, MAX_TITLE_LEN);
+        title[MAX_TITLE_LEN - 1] = '\0';
+    } else if (parser.state != STORE_PAGE_DONE && parser.found_product) {
+        set_color(BRIGHT_RED, stderr);
+        fprintf(stderr,
+            "Error while searching online. Please contact the developer at"
+            " \"https://github.com/hippie68/pkgrename/issues\""
+            " and show him this link: \"%s\".\n", url);
+        set_color(RESET, stderr);
+    } else if (!silent) {
+        printf("No online information found.\n");
     }
 }
 
+// Prefetching requires libcurl, which is not used on Windows.
+void prefetch_online_title(const char *content_id)
+{
+    (void) content_id;
+}
+
 #else
-static char *curl_output = NULL;
+// Online lookups are run by a background thread that uses a cURL multi handle,
+// so that lookups can run concurrently and share connections and DNS results.
+// Each Content ID is looked up only once; results are kept until exit and, with
+// option --online-cache, in a cache file (see load_cache()).
+
+#define LOOKUP_TABLE_SIZE 1024 // Must be a power of 2.
+#define MAX_CONTENT_ID_LEN 36
+#define POLL_TIMEOUT 1000 // Milliseconds.
+
+struct lookup {
+    char content_id[MAX_CONTENT_ID_LEN + 1];
+    char url[URL_LEN];
+    enum {
+        LOOKUP_QUEUED,
+        LOOKUP_RUNNING,
+        LOOKUP_DONE,
+    } state;
+    CURLcode result;
+    _Bool parse_error; // The store page has an unexpected format.
+    char *title; // NULL if no title has been found.
+    time_t fetched; // When the title has been fetched; 0 if not cacheable.
+    char *etag; // Cache validators sent by the store; may be NULL.
+    char *last_modified;
+    char *new_etag; // Cache validators of the current transfer.
+    char *new_last_modified;
+    struct curl_slist *headers; // Conditional request headers.
+    struct store_page_parser *parser; // Parses the page while it downloads.
+    struct lookup *table_next; // Hash table chain.
+    struct lookup *queue_prev;
+    struct lookup *queue_next;
+};
+
+static struct {
+    pthread_once_t once;
+    _Bool started;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // "A lookup has finished."
+    CURLM *multi;
+    struct lookup *table[LOOKUP_TABLE_SIZE];
+    struct lookup *queue_head;
+    struct lookup *queue_tail;
+    int n_running;
+    struct timespec next_start; // Rate limit: earliest start of next lookup.
+    _Bool cache_changed;
+} engine = {
+    .once = PTHREAD_ONCE_INIT,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
 
 // libcurl callback function
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-parameter"
 static size_t write_callback(char *ptr, size_t size, size_t nmemb,
     void *userdata)
 {
-#pragma GCC diagnostic pop
-    if (curl_output == NULL) {
-        curl_output = malloc(1);
-        curl_output[0] = '\0';
+    struct lookup *lookup = userdata;
+    size_t len = size * nmemb;
+
+    // Abort the transfer once the title has been found.
+    if (parse_store_page(lookup->parser, ptr, len))
+        return 0;
+    return len;
+}
+
+// libcurl callback function
+// Stores the cache validators of the last response.
+static size_t header_callback(char *buffer, size_t size, size_t nitems,
+    void *userdata)
+{
+    struct lookup *lookup = userdata;
+    size_t len = size * nitems;
+    char **header = NULL;
+    size_t name_len;
+
+    if (len >= 5 && strncmp(buffer, "HTTP/", 5) == 0) { // New response.
+        free(lookup->new_etag);
+        free(lookup->new_last_modified);
+        lookup->new_etag = lookup->new_last_modified = NULL;
+        return len;
+    } else if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+        header = &lookup->new_etag;
+        name_len = 5;
+    } else if (len > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+        header = &lookup->new_last_modified;
+        name_len = 14;
+    } else {
+        return len;
+    }
+
+    const char *value = buffer + name_len;
+    const char *end = buffer + len;
+    while (value < end && (*value == ' ' || *value == '\t'))
+        value++;
+    while (end > value && (end[-1] == '\r' || end[-1] == '\n'
+        || end[-1] == ' '))
+        end--;
+    free(*header);
+    *header = end > value ? strndup(value, end - value) : NULL;
+    return len;
+}
+
+// Takes the title from a finished lookup's store page parser.
+static void parse_output(struct lookup *lookup)
+{
+    const char *title = get_store_page_title(lookup->parser);
+
+    if (lookup->parser->state == STORE_PAGE_DONE) {
+        free(lookup->title);
+        lookup->title = title ? strdup(title) : NULL;
+    } else if (lookup->parser->found_product) {
+        lookup->parse_error = 1;
+    }
+}
+
+static unsigned int hash_content_id(const char *content_id)
+{
+    return hash_string(HASH_INIT, content_id) & (LOOKUP_TABLE_SIZE - 1);
+}
+
+// Returns true if a lookup's title has been fetched longer ago than allowed.
+static _Bool is_stale(const struct lookup *lookup)
+{
+    return lookup->fetched != 0
+        && time(NULL) - lookup->fetched > option_online_ttl * 86400L;
+}
+
+// Must be called with the mutex locked.
+static struct lookup *find_lookup(const char *content_id)
+{
+    struct lookup *lookup = engine.table[hash_content_id(content_id)];
+    while (lookup && strcmp(lookup->content_id, content_id) != 0)
+        lookup = lookup->table_next;
+    return lookup;
+}
+
+// Must be called with the mutex locked.
+// Returns NULL on error.
+static struct lookup *add_lookup(const char *content_id, const char *url)
+{
+    struct lookup *lookup = calloc(1, sizeof(*lookup));
+    if (lookup == NULL)
+        return NULL;
+    strcpy(lookup->content_id, content_id);
+    strcpy(lookup->url, url);
+    lookup->state = LOOKUP_DONE;
+
+    unsigned int hash = hash_content_id(content_id);
+    lookup->table_next = engine.table[hash];
+    engine.table[hash] = lookup;
+    return lookup;
+}
+
+// The cache file is a text file with one line per Content ID, each line
+// consisting of these tab-separated fields:
+// Content ID, time fetched, ETag, Last-Modified, title (empty if none).
+// Missing cache validators are written as "-".
+#define CACHE_FIELDS 5
+
+// Loads the cache file, if it exists.
+static void load_cache(void)
+{
+    FILE *file = fopen(option_online_cache, "r");
+    if (file == NULL)
+        return;
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, file)) != -1) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+
+        char *field[CACHE_FIELDS];
+        char *p = line;
+        int n = 0;
+        for (; n < CACHE_FIELDS - 1; n++) {
+            field[n] = p;
+            if ((p = strchr(p, '\t')) == NULL)
+                break;
+            *p++ = '\0';
+        }
+        if (n != CACHE_FIELDS - 1)
+            continue; // Invalid line.
+        field[n] = p;
+
+        char url[URL_LEN];
+        if (strlen(field[0]) > MAX_CONTENT_ID_LEN
+            || create_url(url, field[0]) != 0 || find_lookup(field[0]))
+            continue;
+
+        struct lookup *lookup = add_lookup(field[0], url);
+        if (lookup == NULL)
+            break;
+        lookup->fetched = strtoll(field[1], NULL, 10);
+        if (strcmp(field[2], "-") != 0)
+            lookup->etag = strdup(field[2]);
+        if (strcmp(field[3], "-") != 0)
+            lookup->last_modified = strdup(field[3]);
+        if (field[4][0] != '\0')
+            lookup->title = strdup(field[4]);
+    }
+
+    free(line);
+    fclose(file);
+}
+
+// Writes a cache file field, replacing characters that would break the format.
+static void write_cache_field(const char *value, FILE *file)
+{
+    for (const char *p = value; *p; p++)
+        putc(*p == '\t' || *p == '\n' || *p == '\r' ? ' ' : *p, file);
+}
+
+// Saves the cache file, if lookups have changed it (atexit() function).
+static void save_cache(void)
+{
+    pthread_mutex_lock(&engine.mutex);
+
+    if (!engine.cache_changed)
+        goto unlock;
+
+    char *temp_name = malloc(strlen(option_online_cache) + 5);
+    if (temp_name == NULL)
+        goto unlock;
+    strcpy(temp_name, option_online_cache);
+    strcat(temp_name, ".tmp");
+
+    FILE *file = fopen(temp_name, "w");
+    if (file == NULL)
+        goto error;
+    for (int i = 0; i < LOOKUP_TABLE_SIZE; i++) {
+        for (struct lookup *l = engine.table[i]; l; l = l->table_next) {
+            if (l->fetched == 0)
+                continue;
+            fprintf(file, "%s\t%lld\t", l->content_id, (long long) l->fetched);
+            write_cache_field(l->etag ? l->etag : "-", file);
+            putc('\t', file);
+            write_cache_field(l->last_modified ? l->last_modified : "-", file);
+            putc('\t', file);
+            if (l->title)
+                write_cache_field(l->title, file);
+            putc('\n', file);
+        }
+    }
+    if (fclose(file) != 0 || rename(temp_name, option_online_cache) != 0)
+        goto error;
+
+    engine.cache_changed = 0;
+    free(temp_name);
+    goto unlock;
+
+error:
+    set_color(BRIGHT_RED, stderr);
+    fprintf(stderr, "Could not save online cache file \"%s\".\n",
+        option_online_cache);
+    set_color(RESET, stderr);
+    remove(temp_name);
+    free(temp_name);
+unlock:
+    pthread_mutex_unlock(&engine.mutex);
+}
+
+// Must be called with the mutex locked.
+static void unqueue(struct lookup *lookup)
+{
+    if (lookup->queue_prev)
+        lookup->queue_prev->queue_next = lookup->queue_next;
+    else
+        engine.queue_head = lookup->queue_next;
+    if (lookup->queue_next)
+        lookup->queue_next->queue_prev = lookup->queue_prev;
+    else
+        engine.queue_tail = lookup->queue_prev;
+    lookup->queue_prev = lookup->queue_next = NULL;
+}
+
+// Must be called with the mutex locked.
+static void enqueue(struct lookup *lookup, _Bool urgent)
+{
+    lookup->state = LOOKUP_QUEUED;
+    if (urgent) {
+        lookup->queue_prev = NULL;
+        lookup->queue_next = engine.queue_head;
+        if (engine.queue_head)
+            engine.queue_head->queue_prev = lookup;
+        else
+            engine.queue_tail = lookup;
+        engine.queue_head = lookup;
+    } else {
+        lookup->queue_next = NULL;
+        lookup->queue_prev = engine.queue_tail;
+        if (engine.queue_tail)
+            engine.queue_tail->queue_next = lookup;
+        else
+            engine.queue_head = lookup;
+        engine.queue_tail = lookup;
+    }
+}
+
+// Returns the number of milliseconds from <now> to <then>.
+static long ms_until(const struct timespec *now, const struct timespec *then)
+{
+    return (then->tv_sec - now->tv_sec) * 1000
+        + (then->tv_nsec - now->tv_nsec) / 1000000;
+}
+
+// Starts queued lookups, as allowed by the concurrency and rate limits.
+// Must be called with the mutex locked.
+// Returns the number of milliseconds until the rate limit allows the next
+// lookup, or POLL_TIMEOUT.
+static long start_lookups(void)
+{
+    while (engine.queue_head && engine.n_running < option_online_jobs) {
+        if (option_online_rate > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long wait = ms_until(&now, &engine.next_start);
+            if (wait > 0)
+                return wait < POLL_TIMEOUT ? wait : POLL_TIMEOUT;
+
+            long interval = 1000000000L / option_online_rate;
+            engine.next_start = now;
+            engine.next_start.tv_sec += interval / 1000000000L;
+            engine.next_start.tv_nsec += interval % 1000000000L;
+            if (engine.next_start.tv_nsec >= 1000000000L) {
+                engine.next_start.tv_sec++;
+                engine.next_start.tv_nsec -= 1000000000L;
+            }
+        }
+
+        struct lookup *lookup = engine.queue_head;
+        unqueue(lookup);
+
+        CURL *curl = curl_easy_init();
+        if (curl == NULL
+            || (lookup->parser = malloc(sizeof(*lookup->parser))) == NULL)
+        {
+            curl_easy_cleanup(curl);
+            lookup->result = CURLE_FAILED_INIT;
+            lookup->state = LOOKUP_DONE;
+            pthread_cond_broadcast(&engine.cond);
+            continue;
+        }
+        init_store_page_parser(lookup->parser);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
+        curl_easy_setopt(curl, CURLOPT_URL, lookup->url);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, lookup);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, lookup);
+        if (lookup->fetched) { // Revalidate a cached title.
+            char header[256];
+            if (lookup->etag) {
+                snprintf(header, sizeof(header), "If-None-Match: %s",
+                    lookup->etag);
+                lookup->headers = curl_slist_append(lookup->headers, header);
+            }
+            if (lookup->last_modified) {
+                snprintf(header, sizeof(header), "If-Modified-Since: %s",
+                    lookup->last_modified);
+                lookup->headers = curl_slist_append(lookup->headers, header);
+            }
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, lookup->headers);
+        }
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, lookup);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_multi_add_handle(engine.multi, curl);
+        lookup->state = LOOKUP_RUNNING;
+        engine.n_running++;
+    }
+
+    return POLL_TIMEOUT;
+}
+
+// Background thread that runs all online lookups.
+static void *run_engine(void *param)
+{
+    (void) param;
+
+    for (;;) {
+        pthread_mutex_lock(&engine.mutex);
+        long timeout = start_lookups();
+        pthread_mutex_unlock(&engine.mutex);
+
+        int running;
+        curl_multi_poll(engine.multi, NULL, 0, timeout, NULL);
+        curl_multi_perform(engine.multi, &running);
+
+        CURLMsg *msg;
+        int n_msgs;
+        while ((msg = curl_multi_info_read(engine.multi, &n_msgs))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            CURL *curl = msg->easy_handle;
+            struct lookup *lookup;
+            long response_code = 0;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **) &lookup);
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+            CURLcode result = msg->data.result;
+            if (result == CURLE_WRITE_ERROR
+                && lookup->parser->state == STORE_PAGE_DONE)
+                result = CURLE_OK; // Aborted by write_callback().
+            curl_multi_remove_handle(engine.multi, curl);
+            curl_easy_cleanup(curl);
+            curl_slist_free_all(lookup->headers);
+            lookup->headers = NULL;
+
+            pthread_mutex_lock(&engine.mutex);
+            lookup->result = result;
+            if (result == CURLE_OK && response_code == 304 && lookup->fetched) {
+                lookup->fetched = time(NULL); // Cached title is still valid.
+                engine.cache_changed = 1;
+            } else if (result == CURLE_OK) {
+                parse_output(lookup);
+                if (response_code == 200 && !lookup->parse_error) {
+                    lookup->fetched = time(NULL);
+                    free(lookup->etag);
+                    free(lookup->last_modified);
+                    lookup->etag = lookup->new_etag;
+                    lookup->last_modified = lookup->new_last_modified;
+                    lookup->new_etag = lookup->new_last_modified = NULL;
+                    engine.cache_changed = 1;
+                }
+            }
+            free(lookup->parser);
+            lookup->parser = NULL;
+            free(lookup->new_etag);
+            free(lookup->new_last_modified);
+            lookup->new_etag = lookup->new_last_modified = NULL;
+            lookup->state = LOOKUP_DONE;
+            engine.n_running--;
+            pthread_cond_broadcast(&engine.cond);
+            pthread_mutex_unlock(&engine.mutex);
+        }
+    }
+
+    return NULL;
+}
+
+static void start_engine(void)
+{
+    pthread_t thread;
+
+    if (option_online_cache) {
+        load_cache();
+        atexit(save_cache);
+    }
+    if (option_offline) {
+        engine.started = 1;
+        return;
+    }
+
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+        return;
+    if ((engine.multi = curl_multi_init()) == NULL)
+        return;
+    curl_multi_setopt(engine.multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+        (long) option_online_jobs);
+    curl_multi_setopt(engine.multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    if (pthread_create(&thread, NULL, run_engine, NULL) != 0)
+        return;
+    pthread_detach(thread);
+    engine.started = 1;
+}
+
+// Returns the lookup for a Content ID, queueing a new one if required, or NULL
+// on error. Urgent lookups are run before any prefetched ones.
+static struct lookup *request_lookup(const char *content_id, const char *url,
+    _Bool urgent)
+{
+    pthread_once(&engine.once, start_engine);
+    if (!engine.started)
+        return NULL;
+
+    pthread_mutex_lock(&engine.mutex);
+
+    struct lookup *lookup = find_lookup(content_id);
+    if (lookup == NULL) {
+        if ((lookup = add_lookup(content_id, url)) == NULL || option_offline)
+            goto unlock;
+        enqueue(lookup, urgent);
+    } else if (option_offline || lookup->state == LOOKUP_RUNNING) {
+        goto unlock;
+    } else if (urgent && lookup->state == LOOKUP_QUEUED) {
+        unqueue(lookup);
+        enqueue(lookup, 1);
+    } else if (lookup->state == LOOKUP_DONE && lookup->result == CURLE_OK
+        && is_stale(lookup))
+    {
+        enqueue(lookup, urgent);
+    } else if (urgent && lookup->state == LOOKUP_DONE
+        && lookup->result != CURLE_OK)
+    {
+        lookup->parse_error = 0;
+        enqueue(lookup, 1); // Retry failed lookups.
+    } else {
+        goto unlock;
     }
-    curl_output = realloc(curl_output, strlen(curl_output) + nmemb + 1);
-    strcat(curl_output, ptr);
-    return(nmemb);
+    curl_multi_wakeup(engine.multi);
+
+unlock:
+    pthread_mutex_unlock(&engine.mutex);
+    return lookup;
+}
+
+void prefetch_online_title(const char *content_id)
+{
+    char url[URL_LEN];
+
+    if (content_id == NULL || strlen(content_id) > MAX_CONTENT_ID_LEN
+        || create_url(url, content_id) != 0)
+        return;
+
+    request_lookup(content_id, url, 0);
 }
 
 void search_online(char *content_id, char *title, int silent)
 {
     char url[URL_LEN];
 
-    CURL *curl = curl_easy_init();
-    if (curl == NULL) {
-        fprintf(stderr, "Error while initializing cURL.\n");
+    if (strlen(content_id) > MAX_CONTENT_ID_LEN
+        || create_url(url, content_id) != 0)
+    {
+        print_unsupported(content_id);
         return;
     }
 
-    if (create_url(url, content_id) != 0)
-        goto exit;
+    struct lookup *lookup = request_lookup(content_id, url, 1);
+    if (lookup == NULL) {
+        fprintf(stderr, "Error while initializing cURL.\n");
+        return;
+    }
 
-    if (!silent)
+    pthread_mutex_lock(&engine.mutex);
+    if (lookup->state != LOOKUP_DONE && !silent)
         printf("Searching online, please wait...\n");
+    while (lookup->state != LOOKUP_DONE)
+        pthread_cond_wait(&engine.cond, &engine.mutex);
 
-    CURLcode result;
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5);
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    result = curl_easy_perform(curl);
-    if (result != CURLE_OK) {
-        fprintf(stderr, "An error occured (error code \"%d\").\n"
-            "See https://curl.se/libcurl/c/libcurl-errors.html\n", result);
-        goto exit;
-    }
-
-    //printf("cURL output: %s\n", curl_output); // DEBUG
-
-    // Search cURL's output for the title
-    char *start = strstr(curl_output, "@type");
-    if (start != NULL && strlen(start) > 25) {
-        start += 25;
-        char *end = strchr(start, '"');
-        if (end != NULL) {
-            end[0] = '\0';
-            if (strcmp(start, "") != 0) {
-                if (!silent)
-                    printf("Online title: \"%s\"\n", start);
-                strncpy(title, start, MAX_FILENAME_LEN);
-                title[MAX_FILENAME_LEN - 1] = '\0';
-            } else goto fail; // String is empty
-        } else {
-            set_color(BRIGHT_RED, stderr);
-            fprintf(stderr,
-                "Error while searching online. Please contact the developer at"
-                " \"https://github.com/hippie68/pkgrename/issues\""
-                " and show him this link: \"%s\".\n", url);
-            set_color(RESET, stderr);
+    if (lookup->result != CURLE_OK && lookup->fetched) {
+        // Fall back to the cached title.
+        if (lookup->title) {
+            if (!silent)
+                printf("Online title (cached): \"%s\"\n", lookup->title);
+            strncpy(title, lookup->title, MAX_TITLE_LEN);
+            title[MAX_TITLE_LEN - 1] = '\0';
         }
-    } else {
-fail:
+    } else if (lookup->result != CURLE_OK) {
+        fprintf(stderr, "An error occured (error code \"%d\").\n"
+            "See https://curl.se/libcurl/c/libcurl-errors.html\n",
+            lookup->result);
+    } else if (lookup->parse_error) {
+        set_color(BRIGHT_RED, stderr);
+        fprintf(stderr,
+            "Error while searching online. Please contact the developer at"
+            " \"https://github.com/hippie68/pkgrename/issues\""
+            " and show him this link: \"%s\".\n", lookup->url);
+        set_color(RESET, stderr);
+    } else if (lookup->title) {
         if (!silent)
-            printf("No online information found.\n");
+            printf("Online title: \"%s\"\n", lookup->title);
+        strncpy(title, lookup->title, MAX_TITLE_LEN);
+        title[MAX_TITLE_LEN - 1] = '\0';
+    } else if (!silent) {
+        printf("No online information found.\n");
     }
 
-exit:
-    curl_easy_cleanup(curl);
-    if (curl_output != NULL) {
-        free(curl_output);
-        curl_output = NULL;
-    }
+    pthread_mutex_unlock(&engine.mutex);
 }
 #endif
@@ -2,74 +2,192 @@
 #include "../include/colors.h"
 #include "../include/getopt.h"
 #include "../include/options.h"
+#include "../include/rename.h"
+#include "../include/render.h"
+#include "../include/report.h"
+#include "../include/scan.h"
+#include "../include/strings.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+char *option_checkpoint;
+int option_collision;
 int option_compact;
-int option_disable_colors;
+int option_disk_order;
+char **option_exclude;
+int option_n_exclude;
 int option_force;
 int option_force_backup;
+char *option_files_from;
+char **option_include;
+int option_n_include;
+int option_max_depth = -1;
 int option_mixed_case;
 int option_no_placeholder;
+int option_null;
 int option_no_to_all;
 char option_language_number[3];
 int option_leading_zeros;
+int option_offline;
 int option_online;
+char *option_online_cache;
+int option_online_jobs = 8;
+int option_online_rate;
+int option_one_file_system;
+char *option_organize;
+int option_online_ttl = 30;
+int option_probe_jobs;
+struct device_probe_jobs option_device_probe_jobs[MAX_DEVICE_PROBE_JOBS];
+int option_n_device_probe_jobs;
 int option_override_tags;
 int option_query;
 int option_recursive;
+int option_rename_jobs = 1;
+int option_report;
+int option_resume;
+char *option_serve;
+int option_shard;
+int option_n_shards;
+int option_shard_by_directory;
+int option_since;
+char *option_sort_by;
+char *option_state;
 char *option_tag_separator;
+char *option_title_db;
 int option_underscores;
 int option_verbose;
+char **option_views;
+int option_n_views;
+int option_watch;
+char *option_where;
 int option_yes_to_all;
 
+struct render_context render_context;
+static struct tag_db tag_db;
+
 enum long_only_options {
-    OPT_DISABLE_COLORS = 256,
+    OPT_CHECKPOINT = 256,
+    OPT_COLLISION,
+    OPT_DISABLE_COLORS,
+    OPT_DISK_ORDER,
+    OPT_EXCLUDE,
+    OPT_FILES_FROM,
+    OPT_INCLUDE,
+    OPT_KEEP_CASE,
+    OPT_MAX_DEPTH,
     OPT_NO_PLACEHOLDER,
+    OPT_NULL,
+    OPT_OFFLINE,
+    OPT_ONE_FILE_SYSTEM,
+    OPT_ONLINE_CACHE,
+    OPT_ONLINE_JOBS,
+    OPT_ONLINE_RATE,
+    OPT_ONLINE_TTL,
+    OPT_ORGANIZE,
     OPT_OVERRIDE_TAGS,
     OPT_PLACEHOLDER,
     OPT_PRINT_LANGS,
     OPT_PRINT_TAGS,
+    OPT_PROBE_JOBS,
+    OPT_RENAME_JOBS,
+    OPT_REPORT,
+    OPT_RESUME,
+    OPT_SERVE,
     OPT_SET_BACKPORT,
     OPT_SET_FAKE,
     OPT_SET_TYPE,
+    OPT_SHARD,
+    OPT_SHARD_BY,
+    OPT_SINCE,
+    OPT_SORT_BY,
+    OPT_STATE,
     OPT_TAGFILE,
     OPT_TAGS,
     OPT_TAG_SEPARATOR,
+    OPT_TITLE_DB,
     OPT_VERSION,
+    OPT_VIEW,
+    OPT_WATCH,
+    OPT_WHERE,
 };
 
 static struct option opts[] = {
+    { OPT_CHECKPOINT,     "checkpoint",     "FILE",    "Regularly save the position of the last completed PKG file in file FILE, so that an interrupted run can be continued with option --resume. When renaming automatically or with option --query, Ctrl+C stops after the current file and saves the position. The file is removed when the run completes." },
+    { OPT_COLLISION,      "collision",      "POLICY",  "Set what happens if a file with the new name already exists: \"abort\" (default) exits the program, \"skip\" keeps the old name, \"suffix\" appends a number to the new name." },
     { 'c',                "compact",        NULL,      "Hide files that are already renamed." },
 #ifndef _WIN32
     { OPT_DISABLE_COLORS, "disable-colors", NULL,      "Disable colored text output." },
 #endif
+#ifndef _WIN32
+    { OPT_DISK_ORDER,     "disk-order",     NULL,      "Read the PKG files of each directory in the order of their positions on disk instead of alphabetically, which reduces seeking on hard disk drives. Output order is unchanged." },
+#endif
+    { OPT_EXCLUDE,        "exclude",        "GLOB",    "When searching directories, skip files and subdirectories whose name matches GLOB (e.g. \"*.bak\"), or, if GLOB contains a directory separator, whose path relative to the DIRECTORY operand matches GLOB (e.g. \"backups/old\"). Excluded subdirectories are not searched at all. Can be used multiple times." },
+    { OPT_FILES_FROM,     "files-from",     "FILE",    "Read additional FILE|DIRECTORY operands from text file FILE, one per line. If FILE is \"-\", read from standard input. Scanning starts while the list is still being read." },
     { 'f',                "force",          NULL,      "Force-prompt even when file names match." },
     { 'h',                "help",           NULL,      "Print this help screen." },
+    { OPT_INCLUDE,        "include",        "GLOB",    "When searching directories, only use PKG files that match GLOB (see --exclude). Can be used multiple times." },
+    { OPT_KEEP_CASE,      "keep-case",      "FILE",    "Option --mixed-case: keep the spelling of the words and phrases in text file FILE, one per line (e.g. \"PlayStation\"). Lines starting with '#' are ignored." },
     { 'l',                "language",       "LANG",    "If the PKG supports it, use the language specified by language code LANG (see --print-languages) to retrieve the PKG's title." },
     { '0',                "leading-zeros",  NULL,      "Show leading zeros in pattern variables %app_ver%, %firmware%, %merged_ver%, %sdk%, %true_ver%, %version%." },
+    { OPT_MAX_DEPTH,      "max-depth",      "N",       "Search subdirectories at most N levels below each DIRECTORY operand. Implies --recursive." },
     { 'm',                "mixed-case",     NULL,      "Automatically apply mixed-case letter style." },
     { OPT_NO_PLACEHOLDER, "no-placeholder", NULL,      "Hide characters instead of using placeholders." },
     { 'n',                "no-to-all",      NULL,      "Do not prompt; do not actually rename any files. This can be used to do a test run." },
-    { 'o',                "online",         NULL,      "Automatically search online for %title%." },
+    { OPT_NULL,           "null",           NULL,      "Option --files-from: operands are separated by NUL characters instead of newlines (e.g. \"find -print0\")." },
+#ifndef _WIN32
+    { OPT_OFFLINE,        "offline",        NULL,      "Like --online, but only use titles from the cache file (see --online-cache)." },
+#endif
+#ifndef _WIN32
+    { OPT_ONE_FILE_SYSTEM, "one-file-system", NULL,    "Option --recursive: don't search subdirectories on other file systems than their DIRECTORY operand." },
+#endif
+    { 'o',                "online",         NULL,      "Automatically search online for %title%. Titles are looked up in the background, before they are needed." },
+#ifndef _WIN32
+    { OPT_ONLINE_CACHE,   "online-cache",   "FILE",    "Cache online titles in file FILE and reuse them in later runs." },
+    { OPT_ONLINE_JOBS,    "online-jobs",    "N",       "Run up to N online searches at the same time (default: 8)." },
+    { OPT_ONLINE_RATE,    "online-rate",    "N",       "Start at most N online searches per second (default: unlimited)." },
+    { OPT_ONLINE_TTL,     "online-ttl",     "DAYS",    "Option --online-cache: check cached titles older than DAYS days for changes (default: 30)." },
+#endif
+    { OPT_ORGANIZE,       "organize",       "PATTERN", "Also move files into directories built from PATTERN (e.g. \"%region%/%title_id%/%type%\"), relative to their DIRECTORY operand or, for FILE operands, to their current directory. PATTERN uses the same variables as the file name pattern and may be an absolute path. Missing directories are created. Moving to another file system copies the file (as a reflink if possible), verifies the copy, and then deletes the original; option --rename-jobs sets how many files are moved at the same time." },
     { OPT_OVERRIDE_TAGS,  "override-tags",  NULL,      "Make changelog release tags take precedence over existing file name tags." },
     { 'p',                "pattern",        "PATTERN", "Set the file name pattern to string PATTERN." },
     { OPT_PLACEHOLDER,    "placeholder",    "X",       "Set the placeholder character to X." },
     { OPT_PRINT_LANGS,    "print-languages", NULL,     "Print available language codes." },
     { OPT_PRINT_TAGS,     "print-tags",     NULL,      "Print all built-in release tags." },
+    { OPT_PROBE_JOBS,     "probe-jobs",     "N|PATH=N", "Read up to N PKG files at the same time per storage device (1-16). By default, this is 1 for hard disk drives, 8 for solid-state drives, and 4 for other devices. With PATH, only set N for the device that contains PATH. Can be used multiple times." },
     { 'q',                "query",          NULL,      "For scripts/tools: print file name suggestions, one per line, without renaming the files. A successful query returns exit code 0." },
     { 'r',                "recursive",      NULL,      "Traverse subdirectories recursively." },
+    { OPT_RENAME_JOBS,    "rename-jobs",    "N",       "When renaming automatically, run up to N renames at the same time (default: 1). This speeds up renaming on network file systems." },
+    { OPT_REPORT,         "report",         "FORMAT",  "Do not rename files; instead, print the number of files and their total size per category, region, SDK, firmware, title, release group, and fake status. FORMAT is \"table\", \"csv\", or \"json\". CSV reports of multiple runs (e.g. with option --shard) can be merged by adding up rows with the same dimension and value." },
+    { OPT_RESUME,         "resume",         NULL,      "Option --checkpoint: continue after the last completed PKG file of the interrupted run, without reading the completed files again. The same operands must be used." },
+#ifndef _WIN32
+    { OPT_SERVE,          "serve",          "SOCKET",  "Keep running and answer queries from scripts/tools on Unix domain socket SOCKET. Each request is a line \"name FILE\" (file name suggestion), \"sfo FILE\" (param.sfo data), or \"stats\"; each response is a line that starts with \"ok \" or \"error \"." },
+#endif
     { OPT_SET_BACKPORT,   "set-backport",   "STRING",  "Set %backport% mapping to STRING." },
     { OPT_SET_FAKE,       "set-fake",       "STRINGS", "Set %fake%, %fake_status%, and %retail% mappings to two comma-separated STRINGS. The first string replaces %fake%, the second one %retail%." },
     { OPT_SET_TYPE,       "set-type",       "CATEGORIES", "Set %type% mapping to comma-separated string CATEGORIES (see section \"Pattern variables\")." },
+    { OPT_SHARD,          "shard",          "I/N",     "Split the PKG files into N shards and only use shard I (1 <= I <= N), so that N runs, e.g. on different machines that mount the same share, split a library between them. Files are assigned by a hash of their path relative to their DIRECTORY operand, which is the same on every machine (see --shard-by). When renaming, a temporary lock file \".pkgrename.lock\" in each directory keeps shards from renaming in the same directory at the same time." },
+    { OPT_SHARD_BY,       "shard-by",       "KEY",     "Option --shard: assign files by \"file\" (default) or by \"directory\". The latter keeps each directory's files in the same shard, so that a shard sees all name collisions of its directories." },
+    { OPT_SINCE,          "since",          NULL,      "Option --state: when searching directories, only use PKG files that have been added or changed since the previous run. Renamed files don't count as changed." },
+    { OPT_SORT_BY,        "sort-by",        "KEYS",    "Process the PKG files in the order of comma-separated sort keys KEYS instead of their paths, e.g. \"title,-version\" (a leading \"-\" sorts in descending order). Keys: app_ver, category, content_id, firmware, path, region, sdk, size, title, title_id, version. All files are scanned before the first one is processed; large libraries are sorted with temporary files." },
+    { OPT_STATE,          "state",          "FILE",    "Record the directories that have been searched in file FILE. In later runs, directories that have not changed are not read again." },
     { OPT_TAGFILE,        "tagfile",        "FILE",    "Load additional %release% tags from text file FILE, one tag per line." },
     { OPT_TAGS,           "tags",           "TAGS",    "Load additional %release% tags from comma-separated string TAGS (no spaces before or after commas)." },
     { OPT_TAG_SEPARATOR,  "tag-separator",  "SEP",     "Use the string SEP instead of commas to separate multiple release tags." },
+    { OPT_TITLE_DB,       "title-db",       "FILE",    "Take %title% from text file FILE, which contains one Content ID and title per line, separated by a tab or space. For fast lookups, FILE is compiled into \"FILE.db\" when it has changed. Option --online is only used for titles that FILE does not contain." },
     { 'u',                "underscores",    NULL,      "Use underscores instead of spaces in file names." },
     { 'v',                "verbose",        NULL,      "Display additional infos." },
     { OPT_VERSION,        "version",        NULL,      "Print the current pkgrename version." },
+#ifndef _WIN32
+    { OPT_VIEW,           "view",           "DIR=PATTERN", "Also maintain a tree of links to the PKG files in directory DIR, with paths built from PATTERN like option --organize's, except that the last component is the file name (e.g. \"by-region=%region%/%title% [%title_id%]\"). If PATTERN ends with a directory separator, the files' new names are used. Hard links are created if possible, symbolic links otherwise. Existing views are updated: correct links are kept, outdated ones removed. DIR is not searched for PKG files. Can be used multiple times; all views are built from the same scan. With option --no-to-all, only prints what would be done." },
+#endif
+#ifdef __linux__
+    { OPT_WATCH,          "watch",          NULL,      "Keep running and rename new PKG files in the specified directories as soon as they have been written completely. Implies --yes-to-all." },
+#endif
+    { OPT_WHERE,          "where",          "EXPR",    "Only process PKG files that match expression EXPR, e.g. \"category==gp && sdk<=5.05\", \"region==EU\", or \"fake\". Names: app, app_ver, backport, category, content_flags, content_id, content_type, dlc, fake, firmware, game, other, patch, region, retail, sdk, title, title_id, true_ver, type, version (see section \"Pattern variables\"). Operators: == != < <= > >= ~ (contains) ! && || ( ). Numbers are compared numerically, other values case-insensitively; quote values that contain spaces. Conditions on content_id, content_type, content_flags, region, and title_id are checked before the rest of a file is read." },
     { 'y',                "yes-to-all",     NULL,      "Do not prompt; rename all files automatically." },
     { 0 }
 };
@@ -295,6 +413,58 @@ static int split_string(char *string, char *delims, char *array[], int n_pieces)
     return i;
 }
 
+static inline void optf_shard(char *shard)
+{
+    char c;
+    if (sscanf(shard, "%d/%d%c", &option_shard, &option_n_shards, &c) != 2
+        || option_n_shards < 1 || option_shard < 1
+        || option_shard > option_n_shards)
+    {
+        fprintf(stderr, "Option --shard: invalid shard \"%s\" (must be I/N with 1 <= I <= N).\n", shard);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline void optf_shard_by(char *key)
+{
+    if (strcmp(key, "file") == 0)
+        option_shard_by_directory = 0;
+    else if (strcmp(key, "directory") == 0)
+        option_shard_by_directory = 1;
+    else {
+        fprintf(stderr, "Option --shard-by: unknown key: %s\n", key);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline void optf_collision(char *policy)
+{
+    if (strcmp(policy, "abort") == 0)
+        option_collision = COLLISION_ABORT;
+    else if (strcmp(policy, "skip") == 0)
+        option_collision = COLLISION_SKIP;
+    else if (strcmp(policy, "suffix") == 0)
+        option_collision = COLLISION_SUFFIX;
+    else {
+        fprintf(stderr, "Unknown collision policy: %s\n", policy);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline void optf_report(char *format)
+{
+    if (strcmp(format, "table") == 0)
+        option_report = REPORT_TABLE;
+    else if (strcmp(format, "csv") == 0)
+        option_report = REPORT_CSV;
+    else if (strcmp(format, "json") == 0)
+        option_report = REPORT_JSON;
+    else {
+        fprintf(stderr, "Unknown report format: %s\n", format);
+        exit(EXIT_FAILURE);
+    }
+}
+
 static inline void optf_set_fake(char *arg)
 {
     char *input[2];
@@ -360,6 +530,39 @@ static inline void optf_tags(char *taglist)
     }
 }
 
+// Sets up the global render context from the parsed options.
+static void setup_render_context(void)
+{
+    struct render_context *ctx = &render_context;
+
+    init_render_context(ctx, format_string);
+    if (option_report) {
+        // Option --report only needs %release_group%.
+        ctx->variables = PATTERN_VAR_RELEASE_GROUP;
+    } else {
+        struct name_pattern pattern;
+        if (option_organize) {
+            compile_name_pattern(&pattern, option_organize);
+            ctx->variables |= pattern.variables;
+        }
+        for (int i = 0; i < option_n_views; i++) {
+            compile_name_pattern(&pattern, option_views[i]);
+            ctx->variables |= pattern.variables;
+        }
+    }
+
+    tag_db.tags = tags;
+    tag_db.n_tags = tagc;
+    ctx->tag_db = &tag_db;
+    ctx->language_number = option_language_number;
+    ctx->tag_separator = option_tag_separator;
+    if (option_no_placeholder)
+        ctx->placeholder = ' ';
+    ctx->leading_zeros = option_leading_zeros;
+    ctx->override_tags = option_override_tags;
+    ctx->underscores = option_underscores;
+}
+
 // -----------------------------------------------------------------------------
 
 void parse_options(int *argc, char **argv[])
@@ -368,6 +571,12 @@ void parse_options(int *argc, char **argv[])
     char *optarg;
     while ((opt = getopt(argc, argv, &optarg, opts)) != 0) {
         switch (opt) {
+            case OPT_CHECKPOINT:
+                option_checkpoint = optarg;
+                break;
+            case OPT_COLLISION:
+                optf_collision(optarg);
+                break;
             case 'c':
                 option_compact = 1;
                 break;
@@ -375,7 +584,20 @@ void parse_options(int *argc, char **argv[])
             case OPT_DISABLE_COLORS:
                 option_disable_colors = 1;
                 break;
+            case OPT_DISK_ORDER:
+                option_disk_order = 1;
+                break;
 #endif
+            case OPT_EXCLUDE:
+                option_exclude = realloc(option_exclude,
+                    (option_n_exclude + 1) * sizeof(*option_exclude));
+                if (option_exclude == NULL)
+                    exit_err(errno, __func__, __LINE__);
+                option_exclude[option_n_exclude++] = optarg;
+                break;
+            case OPT_FILES_FROM:
+                option_files_from = optarg;
+                break;
             case 'f':
                 option_force = 1;
                 option_force_backup = 1;
@@ -383,6 +605,17 @@ void parse_options(int *argc, char **argv[])
             case 'h':
                 print_usage();
                 exit(EXIT_SUCCESS);
+            case OPT_INCLUDE:
+                option_include = realloc(option_include,
+                    (option_n_include + 1) * sizeof(*option_include));
+                if (option_include == NULL)
+                    exit_err(errno, __func__, __LINE__);
+                option_include[option_n_include++] = optarg;
+                break;
+            case OPT_KEEP_CASE:
+                if (load_special_words(optarg))
+                    exit(EXIT_FAILURE);
+                break;
             case 'l':
                 for (size_t i = 0; i < sizeof(langs) / sizeof(langs[0]); i++) {
                     if (strcmp(optarg, langs[i].identifier) == 0) {
@@ -401,6 +634,14 @@ language_found:
             case '0':
                 option_leading_zeros = 1;
                 break;
+            case OPT_MAX_DEPTH:
+                option_max_depth = atoi(optarg);
+                if (option_max_depth < 0) {
+                    fprintf(stderr, "Option --max-depth: N must not be negative.\n");
+                    exit(EXIT_FAILURE);
+                }
+                option_recursive = 1;
+                break;
             case 'm':
                 option_mixed_case = 1;
                 break;
@@ -410,9 +651,52 @@ language_found:
             case 'n':
                 option_no_to_all = 1;
                 break;
+            case OPT_NULL:
+                option_null = 1;
+                break;
+#ifndef _WIN32
+            case OPT_OFFLINE:
+                option_offline = 1;
+                option_online = 1;
+                break;
+#endif
+#ifndef _WIN32
+            case OPT_ONE_FILE_SYSTEM:
+                option_one_file_system = 1;
+                break;
+#endif
             case 'o':
                 option_online = 1;
                 break;
+#ifndef _WIN32
+            case OPT_ONLINE_CACHE:
+                option_online_cache = optarg;
+                break;
+            case OPT_ONLINE_JOBS:
+                option_online_jobs = atoi(optarg);
+                if (option_online_jobs < 1 || option_online_jobs > 64) {
+                    fprintf(stderr, "Option --online-jobs: N must be between 1 and 64.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_ONLINE_RATE:
+                option_online_rate = atoi(optarg);
+                if (option_online_rate < 1 || option_online_rate > 1000) {
+                    fprintf(stderr, "Option --online-rate: N must be between 1 and 1000.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_ONLINE_TTL:
+                option_online_ttl = atoi(optarg);
+                if (option_online_ttl < 0) {
+                    fprintf(stderr, "Option --online-ttl: DAYS must not be negative.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+#endif
+            case OPT_ORGANIZE:
+                option_organize = optarg;
+                break;
             case OPT_OVERRIDE_TAGS:
                 option_override_tags = 1;
                 break;
@@ -430,12 +714,53 @@ language_found:
                 extern void print_database();
                 print_database();
                 exit(EXIT_SUCCESS);
+            case OPT_PROBE_JOBS:
+                ;
+                char *equals = strrchr(optarg, '=');
+                int jobs = atoi(equals ? equals + 1 : optarg);
+                if (jobs < 1 || jobs > SCAN_PROBE_THREADS) {
+                    fprintf(stderr, "Option --probe-jobs: N must be between 1 and %d.\n", SCAN_PROBE_THREADS);
+                    exit(EXIT_FAILURE);
+                }
+                if (equals == NULL) {
+                    option_probe_jobs = jobs;
+                    break;
+                }
+                if (option_n_device_probe_jobs == MAX_DEVICE_PROBE_JOBS) {
+                    fprintf(stderr, "Option --probe-jobs: too many devices (max. %d).\n", MAX_DEVICE_PROBE_JOBS);
+                    exit(EXIT_FAILURE);
+                }
+                *equals = '\0';
+                struct stat sb;
+                if (stat(optarg, &sb) != 0) {
+                    fprintf(stderr, "Option --probe-jobs: could not access \"%s\".\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                option_device_probe_jobs[option_n_device_probe_jobs].dev = sb.st_dev;
+                option_device_probe_jobs[option_n_device_probe_jobs].jobs = jobs;
+                option_n_device_probe_jobs++;
+                break;
             case 'q':
                 option_query = 1;
                 break;
             case 'r':
                 option_recursive = 1;
                 break;
+            case OPT_RENAME_JOBS:
+                option_rename_jobs = atoi(optarg);
+                if (option_rename_jobs < 1 || option_rename_jobs > 256) {
+                    fprintf(stderr, "Option --rename-jobs: N must be between 1 and 256.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_REPORT:
+                optf_report(optarg);
+                break;
+#ifndef _WIN32
+            case OPT_SERVE:
+                option_serve = optarg;
+                break;
+#endif
             case OPT_SET_BACKPORT:
                 BACKPORT_STRING = optarg;
                 break;
@@ -445,6 +770,24 @@ language_found:
             case OPT_SET_TYPE:
                 optf_set_type(optarg);
                 break;
+            case OPT_RESUME:
+                option_resume = 1;
+                break;
+            case OPT_SHARD:
+                optf_shard(optarg);
+                break;
+            case OPT_SHARD_BY:
+                optf_shard_by(optarg);
+                break;
+            case OPT_SINCE:
+                option_since = 1;
+                break;
+            case OPT_SORT_BY:
+                option_sort_by = optarg;
+                break;
+            case OPT_STATE:
+                option_state = optarg;
+                break;
             case OPT_TAGFILE:
                 optf_tagfile(optarg);
                 break;
@@ -454,6 +797,9 @@ language_found:
             case OPT_TAG_SEPARATOR:
                 option_tag_separator = optarg;
                 break;
+            case OPT_TITLE_DB:
+                option_title_db = optarg;
+                break;
             case 'u':
                 option_underscores = 1;
                 break;
@@ -463,6 +809,24 @@ language_found:
             case OPT_VERSION:
                 print_version();
                 exit(EXIT_SUCCESS);
+#ifndef _WIN32
+            case OPT_VIEW:
+                option_views = realloc(option_views,
+                    (option_n_views + 1) * sizeof(*option_views));
+                if (option_views == NULL)
+                    exit_err(errno, __func__, __LINE__);
+                option_views[option_n_views++] = optarg;
+                break;
+#endif
+#ifdef __linux__
+            case OPT_WATCH:
+                option_watch = 1;
+                option_yes_to_all = 1;
+                break;
+#endif
+            case OPT_WHERE:
+                option_where = optarg;
+                break;
             case 'y':
                 option_yes_to_all = 1;
                 break;
@@ -470,4 +834,6 @@ language_found:
                 exit(EXIT_FAILURE);
         }
     }
+
+    setup_render_context();
 }
@@ -0,0 +1,192 @@
+#include "../include/colors.h"
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/organize.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define make_directory(path) mkdir(path)
+#else
+#define make_directory(path) mkdir(path, 0777)
+#endif
+
+// Directories that are known to exist, in a hash table.
+#define KNOWN_DIRS_TABLE_SIZE 1024 // A power of 2.
+struct known_dir {
+    char *path;
+    struct known_dir *next;
+};
+static struct known_dir *known_dirs[KNOWN_DIRS_TABLE_SIZE];
+
+static int is_separator(char c)
+{
+    return c == '/' || c == DIR_SEPARATOR;
+}
+
+static int is_absolute(const char *path)
+{
+#ifdef _WIN32
+    if (isalpha((unsigned char) path[0]) && path[1] == ':')
+        return 1;
+#endif
+    return is_separator(path[0]);
+}
+
+// Appends a string to a buffer of size <size> that contains <*len> characters.
+// Returns 0 on success and -1 if the buffer is too small.
+static int append(char *buf, size_t size, size_t *len, const char *s)
+{
+    size_t s_len = strlen(s);
+    if (*len + s_len >= size)
+        return -1;
+    memcpy(buf + *len, s, s_len + 1);
+    *len += s_len;
+    return 0;
+}
+
+int append_pattern_directories(char *dir, size_t size, size_t *len,
+    const char *pattern, const struct pattern_vars *vars)
+{
+    static const char separator[] = { DIR_SEPARATOR, '\0' };
+    const char *p = pattern;
+
+    // Build each component separately, so that pattern variables can't add
+    // directory levels.
+    while (*p) {
+        size_t component_len = 0;
+        while (p[component_len] && !is_separator(p[component_len]))
+            component_len++;
+        if (component_len >= MAX_FORMAT_STRING_LEN)
+            return -1;
+
+        char component[MAX_FORMAT_STRING_LEN];
+        char name[MAX_FORMAT_STRING_LEN];
+        memcpy(component, p, component_len);
+        component[component_len] = '\0';
+        p += component_len;
+        while (is_separator(*p))
+            p++;
+
+        if (strchr(component, '%') == NULL) {
+            strcpy(name, component);
+        } else {
+            build_directory_name(&render_context, name, component, vars);
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                strcpy(name, "_");
+        }
+
+        // Skip components whose variables are all empty.
+        if (name[0] == '\0')
+            continue;
+        if (append(dir, size, len, name)
+            || append(dir, size, len, separator))
+            return -1;
+    }
+
+    return 0;
+}
+
+int build_organize_directory(char *dir, size_t size, const struct scan *scan,
+    const char *path, const struct pattern_vars *vars)
+{
+    static const char separator[] = { DIR_SEPARATOR, '\0' };
+    size_t len = 0;
+    int offset = -1;
+    const char *p = option_organize;
+
+    dir[0] = '\0';
+    if (is_absolute(p)) {
+        offset = 0;
+        if (is_separator(*p)) {
+            append(dir, size, &len, separator);
+            p++;
+        }
+    } else if (scan->operand_len < strlen(scan->filename)) {
+        // Relative to the DIRECTORY operand.
+        if (scan->operand_len >= size)
+            return -1;
+        memcpy(dir, scan->filename, scan->operand_len);
+        dir[len = scan->operand_len] = '\0';
+        if (len && !is_separator(dir[len - 1])
+            && append(dir, size, &len, separator))
+            return -1;
+    } else if (append(dir, size, &len, path)) { // Relative to a FILE operand.
+        return -1;
+    }
+    if (offset == -1)
+        offset = len;
+
+    if (append_pattern_directories(dir, size, &len, p, vars))
+        return -1;
+
+    return offset;
+}
+
+static int is_known_directory(const char *path)
+{
+    struct known_dir *dir =
+        known_dirs[hash_string(HASH_INIT, path) & (KNOWN_DIRS_TABLE_SIZE - 1)];
+    while (dir && strcmp(dir->path, path) != 0)
+        dir = dir->next;
+    return dir != NULL;
+}
+
+static void add_known_directory(const char *path)
+{
+    struct known_dir *dir = malloc(sizeof(*dir));
+    if (dir == NULL || (dir->path = strdup(path)) == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    unsigned int i = hash_string(HASH_INIT, path) & (KNOWN_DIRS_TABLE_SIZE - 1);
+    dir->next = known_dirs[i];
+    known_dirs[i] = dir;
+}
+
+int create_directory(const char *path)
+{
+    char buf[PATH_MAX];
+    size_t len = strlen(path);
+    if (len >= sizeof(buf))
+        return -1;
+    memcpy(buf, path, len + 1);
+    while (len > 1 && is_separator(buf[len - 1]))
+        buf[--len] = '\0';
+
+    if (is_known_directory(buf))
+        return 0;
+
+    if (make_directory(buf) && errno != EEXIST) {
+        if (errno != ENOENT)
+            goto error;
+
+        // Create the missing parent directories first.
+        char *sep = buf + len - 1;
+        while (sep > buf && !is_separator(*sep))
+            sep--;
+        if (sep == buf)
+            goto error;
+        char c = *sep;
+        *sep = '\0';
+        if (create_directory(buf))
+            return -1;
+        *sep = c;
+        if (make_directory(buf) && errno != EEXIST)
+            goto error;
+    }
+
+    add_known_directory(buf);
+    return 0;
+
+error:
+    set_color(BRIGHT_RED, stderr);
+    fprintf(stderr, "Could not create directory \"%s\" (%s).\n", buf,
+        strerror(errno));
+    set_color(RESET, stderr);
+    return -1;
+}
@@ -0,0 +1,146 @@
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/pathfilter.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <shlwapi.h>
+#else
+#include <fnmatch.h>
+#endif
+
+// Most patterns are simple; these are matched without a glob library call.
+struct pattern {
+    enum {
+        PATTERN_LITERAL, // "backup"
+        PATTERN_PREFIX, // "backup*"
+        PATTERN_SUFFIX, // "*.bak"
+        PATTERN_GLOB, // Anything else.
+    } type;
+    const char *string; // The literal part, or the whole glob.
+    size_t len; // Length of the literal part.
+    _Bool match_path; // Matched against the relative path, not the name.
+};
+
+static struct pattern *excludes;
+static struct pattern *includes;
+
+static void compile_pattern(struct pattern *pattern, const char *string)
+{
+    size_t len = strlen(string);
+    size_t literal_len = strcspn(string, "*?[\\"); // Up to the 1st wildcard.
+
+    pattern->match_path = strchr(string, '/') != NULL
+        || strchr(string, DIR_SEPARATOR) != NULL;
+    pattern->string = string;
+    pattern->len = len;
+    pattern->type = PATTERN_GLOB;
+
+    if (literal_len == len) {
+        pattern->type = PATTERN_LITERAL;
+    } else if (len > 1 && string[0] == '*'
+        && strcspn(string + 1, "*?[\\") == len - 1)
+    {
+        pattern->type = PATTERN_SUFFIX;
+        pattern->string = string + 1;
+        pattern->len = len - 1;
+    } else if (literal_len == len - 1 && string[len - 1] == '*') {
+        pattern->type = PATTERN_PREFIX;
+        pattern->len = len - 1;
+    }
+}
+
+// Returns a dynamically allocated array of compiled patterns.
+static struct pattern *compile_patterns(char **strings, int n)
+{
+    if (n == 0)
+        return NULL;
+
+    struct pattern *patterns = malloc(n * sizeof(*patterns));
+    if (patterns == NULL)
+        exit_err(errno, __func__, __LINE__);
+    for (int i = 0; i < n; i++)
+        compile_pattern(&patterns[i], strings[i]);
+    return patterns;
+}
+
+void compile_path_filters(void)
+{
+    excludes = compile_patterns(option_exclude, option_n_exclude);
+    includes = compile_patterns(option_include, option_n_include);
+}
+
+static int match_pattern(const struct pattern *pattern, const char *name,
+    const char *relative_path)
+{
+    const char *s = pattern->match_path ? relative_path : name;
+    size_t len;
+
+    switch (pattern->type) {
+        case PATTERN_LITERAL:
+            return strcmp(s, pattern->string) == 0;
+        case PATTERN_PREFIX:
+            return strncmp(s, pattern->string, pattern->len) == 0;
+        case PATTERN_SUFFIX:
+            len = strlen(s);
+            return len >= pattern->len
+                && memcmp(s + len - pattern->len, pattern->string,
+                    pattern->len) == 0;
+        case PATTERN_GLOB:
+#ifdef _WIN32
+            return PathMatchSpecA(s, pattern->string);
+#else
+            return fnmatch(pattern->string, s,
+                pattern->match_path ? FNM_PATHNAME : 0) == 0;
+#endif
+    }
+
+    return 0;
+}
+
+static int match_any(const struct pattern *patterns, int n, const char *name,
+    const char *relative_path)
+{
+    for (int i = 0; i < n; i++)
+        if (match_pattern(&patterns[i], name, relative_path))
+            return 1;
+    return 0;
+}
+
+int is_excluded_directory(const char *name, const char *relative_path)
+{
+    return match_any(excludes, option_n_exclude, name, relative_path);
+}
+
+int is_excluded_file(const char *name, const char *relative_path)
+{
+    if (match_any(excludes, option_n_exclude, name, relative_path))
+        return 1;
+    return option_n_include
+        && !match_any(includes, option_n_include, name, relative_path);
+}
+
+int is_in_shard(const char *relative_path)
+{
+    // Option --shard-by directory: only hash the directory part.
+    size_t len = strlen(relative_path);
+    if (option_shard_by_directory) {
+        while (len > 0 && relative_path[len - 1] != '/'
+            && relative_path[len - 1] != DIR_SEPARATOR)
+            len--;
+    }
+
+    // FNV-1a; directory separators are hashed as '/', so that machines with
+    // different operating systems agree.
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = relative_path[i];
+        hash ^= c == DIR_SEPARATOR ? '/' : c;
+        hash *= 1099511628211ull;
+    }
+
+    return hash % option_n_shards == (unsigned long long) option_shard - 1;
+}
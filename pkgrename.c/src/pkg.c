@@ -133,9 +133,12 @@ static _Bool is_fake(char *content_id, unsigned char key_checksum[32])
 }
 
 // Loads PKG data into dynamically allocated buffers and passes their pointers.
-// Returns 0 on success and -1 on error.
+// If <header> is not NULL, it receives the PKG header's fields, and if these
+// don't match, as decided by header->match(), loading stops: header->filtered
+// is set and no buffers are allocated.
+// Returns 0 on success or a scan error code.
 int load_pkg_data(unsigned char **param_sfo, char **changelog,
-    _Bool *fake_status, const char *filename)
+    _Bool *fake_status, const char *filename, struct pkg_header_fields *header)
 {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wscalar-storage-order"
@@ -153,6 +156,20 @@ int load_pkg_data(unsigned char **param_sfo, char **changelog,
         goto error;
     }
 
+    // Option --where: skip the rest if the header is enough to rule it out.
+    if (header) {
+        memcpy(header->content_id, pkg_header.content_id,
+            sizeof(pkg_header.content_id));
+        header->content_id[sizeof(pkg_header.content_id)] = '\0';
+        header->content_type = pkg_header.content_type;
+        header->content_flags = pkg_header.content_flags;
+        header->filtered = header->match && header->match(header) == 0;
+        if (header->filtered) {
+            fclose(file);
+            return 0;
+        }
+    }
+
     // Get offsets and file sizes first, not to drop read-ahead cache.
     uint32_t param_sfo_offset, param_sfo_size, changelog_offset, keys_offset,
         changelog_size;
@@ -318,7 +335,7 @@ void *get_param_sfo_value(const unsigned char *param_sfo_buf, const char *key)
 }
 
 // Prints a buffered param.sfo file's keys and values.
-void print_param_sfo(const unsigned char *param_sfo_buf)
+void print_param_sfo(FILE *stream, const unsigned char *param_sfo_buf)
 {
     struct param_sfo_header *header = (struct param_sfo_header *) param_sfo_buf;
     struct param_sfo_entry *entries = (struct param_sfo_entry *)
@@ -333,10 +350,10 @@ void print_param_sfo(const unsigned char *param_sfo_buf)
         switch (entries[i].param_type) {
             case 0x0004:
             case 0x0204:
-                printf("%s=\"%s\"\n", key, (char *) val);
+                fprintf(stream, "%s=\"%s\"\n", key, (char *) val);
                 break;
             case 0x0404:
-                printf("%s=0x%08X\n", key, *(uint32_t *) val);
+                fprintf(stream, "%s=0x%08X\n", key, *(uint32_t *) val);
                 break;
         }
     }
@@ -123,10 +123,10 @@ static int compar_func(const void *s1, const void *s2)
 
 // Companion function for get_release().
 // Returns 1 if a tag matches one of the user-provided tags.
-static int matches_user_tag(const char *tag)
+static int matches_user_tag(const struct tag_db *db, const char *tag)
 {
-    for (int i = 0; i < tagc; i++) {
-        if (strcasecmp(tags[i], tag) == 0)
+    for (int i = 0; i < db->n_tags; i++) {
+        if (strcasecmp(db->tags[i], tag) == 0)
             return 1;
     }
 
@@ -134,23 +134,23 @@ static int matches_user_tag(const char *tag)
 }
 
 // Detects one or multiple releases in a string and stores a pointer to the
-// resulting comma-separated string in <release>. Returns the number of found
-// unique matches.
-int get_release(char **release, const char *string)
+// result in <release>. Multiple releases are stored in <buf> as a
+// comma-separated string. Returns the number of found unique matches.
+int get_release(const struct tag_db *db, char **release, char buf[MAX_TAG_LEN],
+    const char *string)
 {
-    static char *found[MAX_TAGS + 1];
+    char *found[MAX_TAGS + sizeof(releases) / sizeof(*releases)];
     int n_found = 0;
-    static char *retval;
 
     // Check user-specified tags first, so they can override built-in tags.
-    for (int i = 0; i < tagc; i++)
-        if (strwrd(string, tags[i]))
-            found[n_found++] = tags[i];
+    for (int i = 0; i < db->n_tags; i++)
+        if (strwrd(string, db->tags[i]))
+            found[n_found++] = db->tags[i];
 
     // Check built-in tags.
     struct rls_list *p = releases;
     while (p->name != NULL) {
-        if (!matches_user_tag(p->name) && (strwrd(string, p->name)
+        if (!matches_user_tag(db, p->name) && (strwrd(string, p->name)
             || (p->alt_name != NULL && strwrd(string, p->alt_name))
             || (strcmp(p->name, "Fugazi") == 0 && strcasestr(string, "fxd"))))
             found[n_found++] = p->name;
@@ -162,14 +162,13 @@ int get_release(char **release, const char *string)
     } else if (n_found > 1) {
         // Return multiple releases as a comma-separated string.
         qsort(found, n_found, sizeof(char *), compar_func);
-        if (retval == NULL)
-            retval = calloc(MAX_TAG_LEN, 1);
-        strncpy(retval, found[0], MAX_TAG_LEN);
+        strncpy(buf, found[0], MAX_TAG_LEN - 1);
+        buf[MAX_TAG_LEN - 1] = '\0';
         for (int i = 1; i < n_found; i++) {
-            strncat(retval, tag_separator, MAX_TAG_LEN - strlen(retval));
-            strncat(retval, found[i], MAX_TAG_LEN - strlen(retval));
+            strncat(buf, tag_separator, MAX_TAG_LEN - 1 - strlen(buf));
+            strncat(buf, found[i], MAX_TAG_LEN - 1 - strlen(buf));
         }
-        *release = retval;
+        *release = buf;
     }
 
     return n_found;
@@ -0,0 +1,971 @@
+#ifndef _WIN32
+#define _GNU_SOURCE // For renameat2().
+#endif
+
+#include "../include/colors.h"
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/rename.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/file.h>
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#define MAX_SUFFIX 999 // Highest number COLLISION_SUFFIX tries to append.
+#define LOCK_FILENAME ".pkgrename.lock" // Used by option --shard.
+#define COPY_CHUNK_SIZE (8 * 1024 * 1024) // For moves to other file systems.
+
+// Statistics of moves to other file systems.
+static pthread_mutex_t copy_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long n_copied_bytes;
+static unsigned int n_temp_files; // Used to create unique temporary names.
+
+#ifdef _WIN32
+int open_directory(const char *path)
+{
+    (void) path;
+    return 0;
+}
+
+void close_directory(int dir_fd)
+{
+    (void) dir_fd;
+}
+
+// Renames or moves a file unless the new name is already taken.
+// Returns 0 on success or an errno value on error.
+static int rename_noreplace(int src_fd, const char *src_path,
+    const char *old_name, int dst_fd, const char *dst_path,
+    const char *new_name)
+{
+    (void) src_fd;
+    (void) dst_fd;
+    char old_path[PATH_MAX];
+    char new_path[PATH_MAX];
+    snprintf(old_path, sizeof(old_path), "%s%s", src_path, old_name);
+    snprintf(new_path, sizeof(new_path), "%s%s", dst_path, new_name);
+
+    // Windows copies and deletes files that are moved to other volumes.
+    if (strcmp(src_path, dst_path) != 0) {
+        if (MoveFileExA(old_path, new_path,
+            MOVEFILE_COPY_ALLOWED | MOVEFILE_WRITE_THROUGH))
+            return 0;
+        DWORD err = GetLastError();
+        if (err == ERROR_ALREADY_EXISTS || err == ERROR_FILE_EXISTS)
+            return EEXIST;
+        return err == ERROR_PATH_NOT_FOUND ? ENOENT : EIO;
+    }
+
+    if (access(new_path, F_OK) == 0)
+        return EEXIST;
+    if (rename(old_path, new_path))
+        return errno;
+    return 0;
+}
+
+// Not supported on Windows; shards rely on the rename's existence check.
+static int lock_directory(int dir_fd, const char *dir_path)
+{
+    (void) dir_fd;
+    (void) dir_path;
+    return -1;
+}
+
+static void unlock_directory(int dir_fd, int lock_fd)
+{
+    (void) dir_fd;
+    (void) lock_fd;
+}
+
+// Windows file systems are case-insensitive.
+static int is_same_file(int dir_fd, const char *dir_path, const char *name1,
+    const char *name2)
+{
+    (void) dir_fd;
+    (void) dir_path;
+    return strcasecmp(name1, name2) == 0;
+}
+#else
+int open_directory(const char *path)
+{
+    return open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+void close_directory(int dir_fd)
+{
+    if (dir_fd >= 0)
+        close(dir_fd);
+}
+
+// Option --shard: locks a directory against renames by other processes, which
+// may run on other machines, by locking its lock file. <dir_path> is used for
+// messages.
+// Returns the lock file's descriptor or -1 on error, after printing a warning.
+static int lock_directory(int dir_fd, const char *dir_path)
+{
+    while (1) {
+        int fd = openat(dir_fd, LOCK_FILENAME, O_RDWR | O_CREAT | O_CLOEXEC,
+            0666);
+        if (fd == -1)
+            break;
+        int ret;
+        while ((ret = flock(fd, LOCK_EX)) == -1 && errno == EINTR)
+            continue;
+
+        // The lock file is deleted by unlock_directory(); if that has happened
+        // while waiting, the lock is worthless and a new file must be locked.
+        struct stat locked, current;
+        if (ret == 0 && fstat(fd, &locked) == 0) {
+            if (fstatat(dir_fd, LOCK_FILENAME, &current, AT_SYMLINK_NOFOLLOW)
+                == 0)
+            {
+                if (locked.st_dev == current.st_dev
+                    && locked.st_ino == current.st_ino)
+                    return fd;
+                close(fd);
+                continue;
+            }
+            if (errno == ENOENT) {
+                close(fd);
+                continue;
+            }
+        }
+
+        int err = errno;
+        close(fd);
+        errno = err;
+        break;
+    }
+
+    set_color(BRIGHT_YELLOW, stderr);
+    fprintf(stderr, "Could not lock directory \"%s\" (%s); renaming without"
+        " lock.\n", dir_path, strerror(errno));
+    set_color(RESET, stderr);
+    return -1;
+}
+
+// Unlocks a directory locked by lock_directory() and deletes its lock file.
+static void unlock_directory(int dir_fd, int lock_fd)
+{
+    if (lock_fd < 0)
+        return;
+    unlinkat(dir_fd, LOCK_FILENAME, 0);
+    close(lock_fd); // Releases the lock.
+}
+
+// Renames or moves a file unless the new name is already taken.
+// Returns 0 on success or an errno value on error (EXDEV if the directories are
+// on different file systems).
+static int rename_noreplace(int src_fd, const char *src_path,
+    const char *old_name, int dst_fd, const char *dst_path,
+    const char *new_name)
+{
+    (void) src_path;
+    (void) dst_path;
+
+    if (renameat2(src_fd, old_name, dst_fd, new_name, RENAME_NOREPLACE) == 0)
+        return 0;
+    if (errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+        return errno;
+
+    // The file system does not support RENAME_NOREPLACE (e.g. some network
+    // file systems); fall back to a non-atomic check.
+    struct stat sb;
+    if (fstatat(dst_fd, new_name, &sb, AT_SYMLINK_NOFOLLOW) == 0)
+        return EEXIST;
+    if (errno != ENOENT)
+        return errno;
+    if (renameat(src_fd, old_name, dst_fd, new_name))
+        return errno;
+    return 0;
+}
+
+static void add_copied_bytes(size_t n)
+{
+    pthread_mutex_lock(&copy_mutex);
+    n_copied_bytes += n;
+    pthread_mutex_unlock(&copy_mutex);
+}
+
+// Companion function for copy_to_directory().
+// Copies a file's data, as a reflink if the file system supports it.
+// Returns 0 on success or an errno value on error.
+static int copy_data(int in_fd, int out_fd, off_t size, _Bool *reflinked)
+{
+    *reflinked = 0;
+    off_t done = 0;
+
+#ifdef __linux__
+    // Reflinks share the data blocks (e.g. on Btrfs and XFS).
+    if (ioctl(out_fd, FICLONE, in_fd) == 0) {
+        *reflinked = 1;
+        return 0;
+    }
+
+    // Let the kernel copy the data, which is faster and may be done
+    // server-side on network file systems.
+    while (done < size) {
+        size_t len = size - done < COPY_CHUNK_SIZE
+            ? (size_t) (size - done) : COPY_CHUNK_SIZE;
+        ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, len, 0);
+        if (n > 0) {
+            done += n;
+            add_copied_bytes(n);
+        } else if (n == 0) {
+            return EIO; // The file has been truncated.
+        } else if (errno != EINTR) {
+            if (done == 0 && (errno == EXDEV || errno == ENOSYS
+                || errno == EINVAL || errno == EOPNOTSUPP))
+                break; // Not supported; copy the data manually.
+            return errno;
+        }
+    }
+    if (done == size)
+        return 0;
+#endif
+
+    char *buf = malloc(COPY_CHUNK_SIZE);
+    if (buf == NULL)
+        return ENOMEM;
+    int err = 0;
+    while (done < size) {
+        ssize_t n = read(in_fd, buf, COPY_CHUNK_SIZE);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR)
+                continue;
+            err = n == 0 ? EIO : errno;
+            break;
+        }
+        for (ssize_t written = 0; written < n; ) {
+            ssize_t w = write(out_fd, buf + written, n - written);
+            if (w == -1) {
+                if (errno == EINTR)
+                    continue;
+                err = errno;
+                goto done;
+            }
+            written += w;
+        }
+        done += n;
+        add_copied_bytes(n);
+    }
+
+done:
+    free(buf);
+    return err;
+}
+
+// Companion function for copy_to_directory().
+// Compares a copy with the original, reading the copy from the storage device
+// instead of from the cache.
+// Returns 0 if they are equal or an errno value otherwise.
+static int verify_copy(int in_fd, int out_fd, off_t size)
+{
+    struct stat sb;
+    if (fstat(out_fd, &sb) || sb.st_size != size)
+        return EIO;
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(out_fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+    char *buf1 = malloc(COPY_CHUNK_SIZE);
+    char *buf2 = malloc(COPY_CHUNK_SIZE);
+    int err = buf1 && buf2 ? 0 : ENOMEM;
+    for (off_t offset = 0; err == 0 && offset < size; ) {
+        size_t len = size - offset < COPY_CHUNK_SIZE
+            ? (size_t) (size - offset) : COPY_CHUNK_SIZE;
+        ssize_t n1 = pread(in_fd, buf1, len, offset);
+        ssize_t n2 = pread(out_fd, buf2, len, offset);
+        if (n1 == -1 && errno == EINTR)
+            continue;
+        if (n1 <= 0 || n1 != n2 || memcmp(buf1, buf2, n1) != 0)
+            err = EIO;
+        else
+            offset += n1;
+    }
+
+    free(buf1);
+    free(buf2);
+    return err;
+}
+
+// Copies file <old_name> from directory <src_fd> to a new file <temp_name> in
+// directory <dst_fd>, which is on another file system, and verifies the copy.
+// Returns 0 on success or an errno value on error.
+static int copy_to_directory(int src_fd, const char *old_name, int dst_fd,
+    const char *temp_name)
+{
+    int in_fd = openat(src_fd, old_name, O_RDONLY | O_CLOEXEC);
+    if (in_fd == -1)
+        return errno;
+    struct stat sb;
+    if (fstat(in_fd, &sb)) {
+        int err = errno;
+        close(in_fd);
+        return err;
+    }
+    int out_fd = openat(dst_fd, temp_name,
+        O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, sb.st_mode & 0777);
+    if (out_fd == -1) {
+        int err = errno;
+        close(in_fd);
+        return err;
+    }
+
+    _Bool reflinked;
+    int err = copy_data(in_fd, out_fd, sb.st_size, &reflinked);
+    if (err == 0) {
+        struct timespec times[2] = { sb.st_atim, sb.st_mtim };
+        futimens(out_fd, times);
+        if (fsync(out_fd))
+            err = errno;
+    }
+    if (err == 0 && reflinked == 0) // Reflinks don't copy any data.
+        err = verify_copy(in_fd, out_fd, sb.st_size);
+    if (close(out_fd) && err == 0)
+        err = errno;
+    close(in_fd);
+
+    if (err)
+        unlinkat(dst_fd, temp_name, 0);
+    return err;
+}
+
+// Returns 1 if two names refer to the same file, otherwise 0.
+static int is_same_file(int dir_fd, const char *dir_path, const char *name1,
+    const char *name2)
+{
+    (void) dir_path;
+    struct stat sb1, sb2;
+
+    if (fstatat(dir_fd, name1, &sb1, AT_SYMLINK_NOFOLLOW)
+        || fstatat(dir_fd, name2, &sb2, AT_SYMLINK_NOFOLLOW))
+        return 0;
+
+    return sb1.st_dev == sb2.st_dev && sb1.st_ino == sb2.st_ino;
+}
+#endif
+
+// Companion function for move_file_locked().
+// Returns 1 if <name> is <new_name> with a suffix " (2)", " (3)", ... as added
+// by rename_with_suffix(), otherwise 0.
+static int has_collision_suffix(const char *name, const char *new_name)
+{
+    size_t stem_len = strlen(new_name);
+    const char *ext = "";
+    if (stem_len >= 4 && strcasecmp(new_name + stem_len - 4, ".pkg") == 0) {
+        ext = new_name + stem_len - 4;
+        stem_len -= 4;
+    }
+
+    if (strncmp(name, new_name, stem_len) != 0 || name[stem_len] != ' '
+        || name[stem_len + 1] != '(')
+        return 0;
+
+    const char *p = name + stem_len + 2;
+    if (*p < '1' || *p > '9')
+        return 0;
+    char *end;
+    long n = strtol(p, &end, 10);
+    return n >= 2 && n <= MAX_SUFFIX && *end == ')' && strcmp(end + 1, ext) == 0;
+}
+
+// Companion function for move_file().
+// Tries appending " (2)", " (3)", ... to the new name until it is unique.
+// Returns 0 on success or an errno value on error.
+static int rename_with_suffix(int src_fd, const char *src_path,
+    const char *old_name, int dst_fd, const char *dst_path, char *new_name,
+    size_t new_name_size)
+{
+    char candidate[PATH_MAX];
+    size_t stem_len = strlen(new_name);
+    const char *ext = "";
+    if (stem_len >= 4 && strcasecmp(new_name + stem_len - 4, ".pkg") == 0) {
+        ext = new_name + stem_len - 4;
+        stem_len -= 4;
+    }
+
+    for (int n = 2; n <= MAX_SUFFIX; n++) {
+        int len = snprintf(candidate, sizeof(candidate), "%.*s (%d)%s",
+            (int) stem_len, new_name, n, ext);
+        if (len < 0 || (size_t) len >= new_name_size)
+            return ENAMETOOLONG;
+
+        int err = rename_noreplace(src_fd, src_path, old_name, dst_fd,
+            dst_path, candidate);
+        if (err == 0) {
+            memcpy(new_name, candidate, len + 1);
+            return 0;
+        }
+        if (err != EEXIST)
+            return err;
+    }
+
+    return EEXIST;
+}
+
+static int move_file_locked(int src_fd, const char *src_path,
+    const char *old_name, int dst_fd, const char *dst_path, char *new_name,
+    size_t new_name_size);
+
+#ifndef _WIN32
+// Companion function for move_file_locked().
+// Moves a file to a directory on another file system: the file is copied to a
+// temporary name, which is then renamed like any other file, and only then is
+// the original deleted.
+// Returns the same values as move_file().
+static int move_across_file_systems(int src_fd, const char *src_path,
+    const char *old_name, int dst_fd, const char *dst_path, char *new_name,
+    size_t new_name_size)
+{
+    char temp_name[64];
+    pthread_mutex_lock(&copy_mutex);
+    snprintf(temp_name, sizeof(temp_name), ".pkgrename-%ld-%u.part",
+        (long) getpid(), n_temp_files++);
+    pthread_mutex_unlock(&copy_mutex);
+
+    int err = copy_to_directory(src_fd, old_name, dst_fd, temp_name);
+    if (err) {
+        fprintf(stderr, "Could not copy file \"%s%s\" to \"%s\" (%s).\n",
+            src_path, old_name, dst_path, strerror(err));
+        return -1;
+    }
+
+    int ret = move_file_locked(dst_fd, dst_path, temp_name, dst_fd, dst_path,
+        new_name, new_name_size);
+    if (ret) { // Keep the original.
+        unlinkat(dst_fd, temp_name, 0);
+        return ret;
+    }
+
+    if (unlinkat(src_fd, old_name, 0)) {
+        set_color(BRIGHT_RED, stderr);
+        fprintf(stderr, "File \"%s%s\" has been copied to \"%s%s\", but could"
+            " not be deleted (%s).\n", src_path, old_name, dst_path, new_name,
+            strerror(errno));
+        set_color(RESET, stderr);
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
+// Companion function for move_file(), which holds the directory lock if
+// necessary; see there.
+static int move_file_locked(int src_fd, const char *src_path,
+    const char *old_name, int dst_fd, const char *dst_path, char *new_name,
+    size_t new_name_size)
+{
+    int same_dir = strcmp(src_path, dst_path) == 0;
+    if (same_dir && strcmp(old_name, new_name) == 0)
+        return 0;
+
+    // Common case: a single syscall.
+    int err = rename_noreplace(src_fd, src_path, old_name, dst_fd, dst_path,
+        new_name);
+    if (err == 0)
+        return 0;
+#ifndef _WIN32
+    if (err == EXDEV)
+        return move_across_file_systems(src_fd, src_path, old_name, dst_fd,
+            dst_path, new_name, new_name_size);
+#endif
+    if (err != EEXIST)
+        goto error;
+
+    // Case-only change on a case-insensitive file system (e.g. exFAT): the
+    // existing file is the file itself, so use a temporary name in between.
+    if (same_dir && strcasecmp(old_name, new_name) == 0
+        && is_same_file(src_fd, src_path, old_name, new_name))
+    {
+        char temp[PATH_MAX];
+        snprintf(temp, sizeof(temp), "%s.pkgrename", new_name);
+        if ((err = rename_noreplace(src_fd, src_path, old_name, src_fd,
+            src_path, temp)))
+            goto error;
+        if ((err = rename_noreplace(src_fd, src_path, temp, src_fd, src_path,
+            new_name)))
+        {
+            rename_noreplace(src_fd, src_path, temp, src_fd, src_path,
+                old_name);
+            goto error;
+        }
+        return 0;
+    }
+
+    switch (option_collision) {
+        case COLLISION_SKIP:
+            set_color(BRIGHT_YELLOW, stderr);
+            fprintf(stderr, "File already exists: \"%s%s\". Skipped.\n",
+                dst_path, new_name);
+            set_color(RESET, stderr);
+            return 1;
+        case COLLISION_SUFFIX:
+            // A file renamed with a suffix by a previous run already has its
+            // final name; renaming it again would only move it to the next
+            // free suffix.
+            if (same_dir && (has_collision_suffix(old_name, new_name)
+                || is_same_file(src_fd, src_path, old_name, new_name)))
+            {
+                snprintf(new_name, new_name_size, "%s", old_name);
+                printf("File already existed; kept name \"%s\".\n", new_name);
+                return 0;
+            }
+            if ((err = rename_with_suffix(src_fd, src_path, old_name, dst_fd,
+                dst_path, new_name, new_name_size)))
+                goto error;
+            printf("File already existed; used name \"%s\" instead.\n",
+                new_name);
+            return 0;
+        default:
+            fprintf(stderr, "File already exists: \"%s%s\".\n", dst_path,
+                new_name);
+            return -1;
+    }
+
+error:
+    fprintf(stderr, "Could not %s file \"%s%s\" (%s).\n",
+        same_dir ? "rename" : "move", src_path, old_name, strerror(err));
+    return -1;
+}
+
+// Renames file <old_name> in the directory <src_fd> to <new_name> in the
+// directory <dst_fd> (as returned by open_directory()) without ever overwriting
+// an existing file. If the directories are on different file systems, the file
+// is copied, verified, and then deleted. <src_path> and <dst_path> must end
+// with a directory separator and are used for messages.
+// If option_collision is COLLISION_SUFFIX, the buffer <new_name>, of size
+// <new_name_size>, will be updated to the name that has been used.
+// Returns 0 on success, 1 if the file has been skipped, and -1 on error or if
+// option_collision is COLLISION_ABORT and the new name is taken.
+int move_file(int src_fd, const char *src_path, const char *old_name,
+    int dst_fd, const char *dst_path, char *new_name, size_t new_name_size)
+{
+    // Option --shard: other shards may rename files in the same directory, so
+    // the collision checks must not interleave.
+    if (option_shard == 0
+        || (strcmp(src_path, dst_path) == 0 && strcmp(old_name, new_name) == 0))
+        return move_file_locked(src_fd, src_path, old_name, dst_fd, dst_path,
+            new_name, new_name_size);
+
+    int lock_fd = lock_directory(dst_fd, dst_path);
+    int ret = move_file_locked(src_fd, src_path, old_name, dst_fd, dst_path,
+        new_name, new_name_size);
+    unlock_directory(dst_fd, lock_fd);
+    return ret;
+}
+
+// Renames file <old_name> to <new_name> inside the directory <dir_fd> (as
+// returned by open_directory()) without ever overwriting an existing file.
+// <dir_path> must end with a directory separator and is used for messages.
+// If option_collision is COLLISION_SUFFIX, the buffer <new_name>, of size
+// <new_name_size>, will be updated to the name that has been used.
+// Returns 0 on success, 1 if the file has been skipped, and -1 on error or if
+// option_collision is COLLISION_ABORT and the new name is taken.
+int rename_file(int dir_fd, const char *dir_path, const char *old_name,
+    char *new_name, size_t new_name_size)
+{
+    return move_file(dir_fd, dir_path, old_name, dir_fd, dir_path, new_name,
+        new_name_size);
+}
+
+// Rename executor -------------------------------------------------------------
+
+// A directory shared by all queued renames inside of it.
+struct rename_dir {
+    char *path;
+    int fd;
+    int refs; // Protected by executor.mutex.
+};
+
+// A queued rename; the names are stored right behind the struct.
+struct rename_job {
+    struct rename_dir *dir;
+    struct rename_dir *target; // Same as .dir, unless the file is moved.
+    char *old_name;
+    char *new_name;
+    void (*done)(void *data, int result, const char *new_name);
+    void *data;
+    _Bool running;
+    struct rename_job *next;
+};
+
+static struct {
+    pthread_t *threads;
+    int n_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // "The queue or the set of running jobs has changed."
+    struct rename_job *head; // Oldest job, running or not.
+    struct rename_job *tail;
+    size_t n_queued; // Number of jobs in the list.
+    struct rename_dir *current_dir; // Directory of the latest queued rename.
+    struct rename_dir *current_target; // Target of the latest queued move.
+    _Bool stop;
+    _Bool failed;
+    size_t n_done;
+    size_t n_renamed;
+    size_t n_skipped;
+    struct timespec start_time;
+} executor;
+
+#define MAX_QUEUED_RENAMES(n_threads) ((size_t) (n_threads) * 64)
+
+// Companion function for renames_conflict().
+// Returns 1 if two directory entries are the same, otherwise 0.
+static int is_same_entry(struct rename_dir *dir1, const char *name1,
+    struct rename_dir *dir2, const char *name2)
+{
+    // Case-insensitive, for case-insensitive file systems.
+    return (dir1 == dir2 || strcmp(dir1->path, dir2->path) == 0)
+        && strcasecmp(name1, name2) == 0;
+}
+
+// Returns 1 if two renames must not run at the same time, otherwise 0.
+static int renames_conflict(struct rename_job *job1, struct rename_job *job2)
+{
+    return is_same_entry(job1->dir, job1->old_name, job2->dir, job2->old_name)
+        || is_same_entry(job1->dir, job1->old_name, job2->target,
+            job2->new_name)
+        || is_same_entry(job1->target, job1->new_name, job2->dir,
+            job2->old_name)
+        || is_same_entry(job1->target, job1->new_name, job2->target,
+            job2->new_name);
+}
+
+// Companion function for executor threads; executor.mutex must be locked.
+// Returns the first waiting job that does not conflict with an older job, or
+// NULL if there is none or a rename has failed.
+static struct rename_job *next_rename_job(void)
+{
+    if (executor.failed)
+        return NULL;
+
+    for (struct rename_job *job = executor.head; job; job = job->next) {
+        if (job->running)
+            continue;
+
+        struct rename_job *older = executor.head;
+        while (older != job && !renames_conflict(older, job))
+            older = older->next;
+        if (older == job)
+            return job;
+    }
+
+    return NULL;
+}
+
+// Companion function for executor threads; executor.mutex must be locked.
+static void release_rename_dir(struct rename_dir *dir)
+{
+    if (--dir->refs == 0) {
+        close_directory(dir->fd);
+        free(dir->path);
+        free(dir);
+    }
+}
+
+// Companion function for executor threads; executor.mutex must be locked.
+static void remove_rename_job(struct rename_job *job)
+{
+    if (executor.head == job) {
+        executor.head = job->next;
+    } else {
+        struct rename_job *prev = executor.head;
+        while (prev->next != job)
+            prev = prev->next;
+        prev->next = job->next;
+        if (executor.tail == job)
+            executor.tail = prev;
+    }
+    if (executor.head == NULL)
+        executor.tail = NULL;
+    executor.n_queued--;
+
+    release_rename_dir(job->dir);
+    release_rename_dir(job->target);
+    free(job);
+}
+
+// Companion function for executor threads and queue_move(); executor.mutex
+// must be locked. Marks the executor as failed and discards all jobs that have
+// not been started yet.
+static void fail_rename_executor(void)
+{
+    executor.failed = 1;
+
+    struct rename_job *job = executor.head;
+    while (job) {
+        struct rename_job *next = job->next;
+        if (job->running == 0)
+            remove_rename_job(job);
+        job = next;
+    }
+}
+
+static void *rename_thread(void *arg)
+{
+    (void) arg;
+    char new_name[PATH_MAX];
+
+    pthread_mutex_lock(&executor.mutex);
+    while (1) {
+        struct rename_job *job;
+        while ((job = next_rename_job()) == NULL && executor.stop == 0)
+            pthread_cond_wait(&executor.cond, &executor.mutex);
+        if (job == NULL)
+            break;
+        job->running = 1;
+        pthread_mutex_unlock(&executor.mutex);
+
+        int ret = -1;
+        if (strlen(job->new_name) < sizeof(new_name)) {
+            strcpy(new_name, job->new_name);
+            ret = move_file(job->dir->fd, job->dir->path, job->old_name,
+                job->target->fd, job->target->path, new_name,
+                sizeof(new_name));
+        }
+        if (job->done && ret != -1)
+            job->done(job->data, ret, new_name);
+
+        pthread_mutex_lock(&executor.mutex);
+        executor.n_done++;
+        if (ret == 0)
+            executor.n_renamed++;
+        else if (ret == 1)
+            executor.n_skipped++;
+        remove_rename_job(job);
+        if (ret == -1)
+            fail_rename_executor();
+        pthread_cond_broadcast(&executor.cond);
+    }
+    pthread_mutex_unlock(&executor.mutex);
+
+    return NULL;
+}
+
+// Starts <n_threads> threads that run queued renames concurrently.
+// Returns 0 on success and -1 on error.
+int start_rename_executor(int n_threads)
+{
+    if (pthread_mutex_init(&executor.mutex, NULL))
+        return -1;
+    if (pthread_cond_init(&executor.cond, NULL))
+        goto error_mutex;
+    executor.threads = malloc(n_threads * sizeof(pthread_t));
+    if (executor.threads == NULL)
+        goto error_cond;
+
+    clock_gettime(CLOCK_MONOTONIC, &executor.start_time);
+    for (executor.n_threads = 0; executor.n_threads < n_threads;
+        executor.n_threads++)
+    {
+        if (pthread_create(&executor.threads[executor.n_threads], NULL,
+            rename_thread, NULL))
+        {
+            if (executor.n_threads > 0)
+                break; // Use the threads that could be created.
+            free(executor.threads);
+            goto error_cond;
+        }
+    }
+
+    return 0;
+
+error_cond:
+    pthread_cond_destroy(&executor.cond);
+error_mutex:
+    pthread_mutex_destroy(&executor.mutex);
+    return -1;
+}
+
+// Companion function for queue_move(); executor.mutex must be locked.
+// Returns a directory for a queued rename, sharing one directory file
+// descriptor between consecutive renames. <current> is the shared directory.
+// Returns NULL on error.
+static struct rename_dir *get_rename_dir(struct rename_dir **current,
+    const char *path)
+{
+    struct rename_dir *dir = *current;
+    if (dir == NULL || strcmp(dir->path, path)) {
+        if (dir)
+            release_rename_dir(dir);
+        *current = NULL;
+        dir = malloc(sizeof(*dir));
+        if (dir == NULL || (dir->path = strdup(path)) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        dir->fd = open_directory(path);
+        if (dir->fd == -1) {
+            fprintf(stderr, "Could not open directory \"%s\".\n", path);
+            free(dir->path);
+            free(dir);
+            return NULL;
+        }
+        dir->refs = 1; // Held by *current.
+        *current = dir;
+    }
+    dir->refs++;
+    return dir;
+}
+
+// Queues a move of file <old_name> in directory <dir_path> to <new_name> in
+// directory <target_path> for the executor; the strings are copied. Renames
+// that touch the same names in the same directory are run in the order they
+// are queued. Once the move has been run, <done> (if not NULL) is called from
+// an executor thread with <data>, the move's result (as returned by
+// move_file()), and the new name that has been used. Exits the program if a
+// previous rename has failed.
+void queue_move(const char *dir_path, const char *old_name,
+    const char *target_path, const char *new_name,
+    void (*done)(void *data, int result, const char *new_name), void *data)
+{
+    size_t old_len = strlen(old_name) + 1;
+    size_t new_len = strlen(new_name) + 1;
+    struct rename_job *job = malloc(sizeof(*job) + old_len + new_len);
+    if (job == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    job->old_name = (char *) (job + 1);
+    job->new_name = job->old_name + old_len;
+    memcpy(job->old_name, old_name, old_len);
+    memcpy(job->new_name, new_name, new_len);
+    job->done = done;
+    job->data = data;
+    job->running = 0;
+    job->next = NULL;
+
+    pthread_mutex_lock(&executor.mutex);
+
+    // Apply backpressure.
+    while (executor.n_queued >= MAX_QUEUED_RENAMES(executor.n_threads)
+        && executor.failed == 0)
+        pthread_cond_wait(&executor.cond, &executor.mutex);
+    if (executor.failed) {
+        pthread_mutex_unlock(&executor.mutex);
+        finish_rename_executor();
+    }
+
+    job->dir = get_rename_dir(&executor.current_dir, dir_path);
+    if (job->dir && strcmp(target_path, dir_path) == 0) {
+        job->target = job->dir;
+        job->dir->refs++;
+    } else if (job->dir) {
+        job->target = get_rename_dir(&executor.current_target, target_path);
+        if (job->target == NULL)
+            release_rename_dir(job->dir);
+    }
+    if (job->dir == NULL || job->target == NULL) {
+        fail_rename_executor();
+        free(job);
+        pthread_mutex_unlock(&executor.mutex);
+        finish_rename_executor();
+    }
+
+    if (executor.tail)
+        executor.tail->next = job;
+    else
+        executor.head = job;
+    executor.tail = job;
+    executor.n_queued++;
+
+    pthread_cond_broadcast(&executor.cond);
+    pthread_mutex_unlock(&executor.mutex);
+}
+
+// Waits until all queued renames have been run; returns right away if the
+// executor is not running. Exits the program if a rename has failed.
+void wait_for_renames(void)
+{
+    if (executor.n_threads == 0)
+        return;
+
+    pthread_mutex_lock(&executor.mutex);
+    while (executor.n_queued > 0 && executor.failed == 0)
+        pthread_cond_wait(&executor.cond, &executor.mutex);
+    int failed = executor.failed;
+    pthread_mutex_unlock(&executor.mutex);
+
+    if (failed)
+        finish_rename_executor();
+}
+
+// Waits for all queued renames, stops the executor, and prints statistics.
+// Exits the program if a rename has failed.
+void finish_rename_executor(void)
+{
+    pthread_mutex_lock(&executor.mutex);
+
+    // Report progress while waiting for slow file systems.
+    while (executor.n_queued > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec++;
+        if (pthread_cond_timedwait(&executor.cond, &executor.mutex, &deadline)
+            && executor.n_queued > 0 && option_verbose)
+        {
+            pthread_mutex_lock(&copy_mutex);
+            unsigned long long copied = n_copied_bytes;
+            pthread_mutex_unlock(&copy_mutex);
+            if (copied)
+                fprintf(stderr, "Waiting for %zu renames to complete"
+                    " (%.1f MiB copied to other file systems)...\n",
+                    executor.n_queued, copied / 1048576.0);
+            else
+                fprintf(stderr, "Waiting for %zu renames to complete...\n",
+                    executor.n_queued);
+        }
+    }
+
+    executor.stop = 1;
+    if (executor.current_dir) {
+        release_rename_dir(executor.current_dir);
+        executor.current_dir = NULL;
+    }
+    if (executor.current_target) {
+        release_rename_dir(executor.current_target);
+        executor.current_target = NULL;
+    }
+    pthread_cond_broadcast(&executor.cond);
+    pthread_mutex_unlock(&executor.mutex);
+
+    for (int i = 0; i < executor.n_threads; i++)
+        pthread_join(executor.threads[i], NULL);
+    free(executor.threads);
+    executor.n_threads = 0;
+
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double seconds = (end_time.tv_sec - executor.start_time.tv_sec)
+        + (end_time.tv_nsec - executor.start_time.tv_nsec) / 1e9;
+
+    if (executor.n_done) {
+        set_color(GRAY, stdout);
+        printf("\nRenamed %zu file%s (%zu skipped) in %.2f seconds"
+            " (%.1f renames/s).\n", executor.n_renamed,
+            executor.n_renamed == 1 ? "" : "s", executor.n_skipped, seconds,
+            seconds > 0 ? executor.n_done / seconds : 0.0);
+        if (n_copied_bytes)
+            printf("Copied %.2f GiB to other file systems.\n",
+                n_copied_bytes / 1073741824.0);
+        set_color(RESET, stdout);
+    }
+
+    if (executor.failed)
+        exit(EXIT_FAILURE);
+}
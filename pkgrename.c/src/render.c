@@ -0,0 +1,450 @@
+#define _FILE_OFFSET_BITS 64
+
+#ifndef _WIN32
+#define _GNU_SOURCE // For strcasestr(), which is not standard.
+#endif
+
+#include "../include/characters.h"
+#include "../include/common.h"
+#include "../include/pkg.h"
+#include "../include/releaselists.h"
+#include "../include/render.h"
+#include "../include/strings.h"
+#include "../include/titledb.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <shlwapi.h>
+#define strcasestr StrStrIA
+#endif
+
+// Returns the size of a file in bytes or -1 on error.
+static ssize_t get_file_size(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return -1;
+    if (fseek(file, 0, SEEK_END)) {
+        fclose(file);
+        return -1;
+    }
+    ssize_t ret = ftello(file);
+    fclose(file);
+    return ret;
+}
+
+// Compiles a pattern, which must stay valid as long as the compiled pattern is
+// used.
+void compile_name_pattern(struct name_pattern *pattern, const char *text)
+{
+    pattern->text = text;
+    pattern->variables = 0;
+    if (strstr(text, "%msum%"))
+        pattern->variables |= PATTERN_VAR_MSUM;
+    if (strstr(text, "%release%"))
+        pattern->variables |= PATTERN_VAR_RELEASE;
+    if (strstr(text, "%release_group%"))
+        pattern->variables |= PATTERN_VAR_RELEASE_GROUP;
+    if (strstr(text, "%size%"))
+        pattern->variables |= PATTERN_VAR_SIZE;
+}
+
+// Initializes a render context with the default settings, no user tags, and
+// <pattern> as file name pattern.
+void init_render_context(struct render_context *ctx, const char *pattern)
+{
+    static const struct tag_db no_tags;
+
+    memset(ctx, 0, sizeof(*ctx));
+    compile_name_pattern(&ctx->pattern, pattern);
+    ctx->variables = ctx->pattern.variables;
+    ctx->tag_db = &no_tags;
+    ctx->categories = custom_category;
+    ctx->backport_string = BACKPORT_STRING;
+    ctx->fake_string = FAKE_STRING;
+    ctx->retail_string = RETAIL_STRING;
+    ctx->language_number = "";
+    ctx->placeholder = placeholder_char;
+}
+
+// Fills a struct pattern_vars with the values from a successful scan.
+// Returns 0 on success and -1 on error.
+int load_pattern_vars(const struct render_context *ctx,
+    struct pattern_vars *vars, const struct scan *scan)
+{
+    const char *filename = scan->filename;
+    const unsigned char *param_sfo = scan->param_sfo;
+    const char *changelog = scan->changelog;
+
+    memset(vars, 0, sizeof(*vars));
+    strcpy(vars->file_id_suffix, "-A0000-V0000");
+
+    // Create a lowercase copy of the file's basename.
+    const char *basename = strrchr(filename, DIR_SEPARATOR);
+    basename = basename ? basename + 1 : filename;
+    char lowercase_basename[MAX_FILENAME_LEN];
+    strncpy(lowercase_basename, basename, MAX_FILENAME_LEN - 1);
+    lowercase_basename[MAX_FILENAME_LEN - 1] = '\0';
+    for (size_t i = 0; lowercase_basename[i]; i++)
+        lowercase_basename[i] = tolower(lowercase_basename[i]);
+
+    // APP_VER
+    char *app_ver = (char *) get_param_sfo_value(param_sfo, "APP_VER");
+    if (app_ver && strlen(app_ver) >= 3) {
+        if (app_ver[2] == '.' && strlen(app_ver) >= 5) {
+            vars->file_id_suffix[2] = app_ver[0];
+            vars->file_id_suffix[3] = app_ver[1];
+            vars->file_id_suffix[4] = app_ver[3];
+            vars->file_id_suffix[5] = app_ver[4];
+        } else if (app_ver[1] == '.') { // Some homebrew apps got it wrong.
+            vars->file_id_suffix[2] = '0';
+            vars->file_id_suffix[3] = app_ver[0];
+            vars->file_id_suffix[4] = app_ver[2];
+            if (app_ver[3])
+                vars->file_id_suffix[5] = app_ver[3];
+            else
+                vars->file_id_suffix[5] = '0';
+        }
+    }
+    if (app_ver && ctx->leading_zeros == 0 && app_ver[0] == '0')
+        app_ver++;
+    vars->app_ver = app_ver;
+    // CATEGORY
+    char *category = (char *) get_param_sfo_value(param_sfo, "CATEGORY");
+    if (category) {
+        if (strcmp(category, "gd") == 0) {
+            vars->type = ctx->categories.game;
+            vars->game = vars->type;
+        } else if (strstr(category, "gp") != NULL) {
+            vars->type = ctx->categories.patch;
+            vars->patch = vars->type;
+        } else if (strcmp(category, "ac") == 0) {
+            vars->type = ctx->categories.dlc;
+            vars->dlc = vars->type;
+        } else if (category[0] == 'g' && category[1] == 'd') {
+            vars->type = ctx->categories.app;
+            vars->app = vars->type;
+        } else {
+            vars->type = ctx->categories.other;
+            vars->other = vars->type;
+        }
+    }
+    vars->category = category;
+    // CONTENT_ID
+    vars->content_id = (char *) get_param_sfo_value(param_sfo, "CONTENT_ID");
+    if (vars->content_id) {
+        switch (vars->content_id[0]) {
+            case 'E': vars->region = "EU"; break;
+            case 'H': vars->region = "AS"; break;
+            case 'I': vars->region = "IN"; break;
+            case 'J': vars->region = "JP"; break;
+            case 'U': vars->region = "US"; break;
+        }
+    }
+    // PUBTOOLINFO
+    char *pubtoolinfo = (char *) get_param_sfo_value(param_sfo, "PUBTOOLINFO");
+    if (pubtoolinfo) {
+        char *p = strstr(pubtoolinfo, "sdk_ver=");
+        if (p) {
+            char *sdk = vars->sdk;
+            p += 8;
+            memcpy(sdk, p, 4);
+            if (sdk[0] == '0' && ctx->leading_zeros == 0) {
+                sdk[0] = sdk[1];
+                sdk[1] = '.';
+                sdk[4] = '\0';
+            } else {
+                sdk[4] = sdk[3];
+                sdk[3] = sdk[2];
+                sdk[2] = '.';
+            }
+        }
+    }
+    // SYSTEM_VER
+    uint32_t *system_ver = (uint32_t *) get_param_sfo_value(param_sfo,
+        "SYSTEM_VER");
+    if (system_ver) {
+        char *firmware = vars->firmware;
+        sprintf(firmware, "%08x", *system_ver);
+        if (firmware[0] == '0' && ctx->leading_zeros == 0) {
+            firmware[0] = firmware[1];
+            firmware[1] = '.';
+            firmware[4] = '\0';
+        } else {
+            firmware[5] = '\0';
+            firmware[4] = firmware[3];
+            firmware[3] = firmware[2];
+            firmware[2] = '.';
+        }
+    }
+    // TITLE
+    if (ctx->language_number[0] != '\0') {
+        char query[9];
+        snprintf(query, sizeof(query), "TITLE_%s", ctx->language_number);
+        vars->title_backup = (char *) get_param_sfo_value(param_sfo, query);
+    }
+    if (vars->title_backup == NULL)
+        vars->title_backup = (char *) get_param_sfo_value(param_sfo, "TITLE");
+    if (vars->title_backup) {
+        strncpy(vars->title, vars->title_backup, MAX_TITLE_LEN);
+        vars->title[MAX_TITLE_LEN - 1] = '\0';
+    }
+    const char *db_title = lookup_title_db(vars->content_id);
+    if (db_title) {
+        strncpy(vars->title, db_title, MAX_TITLE_LEN);
+        vars->title[MAX_TITLE_LEN - 1] = '\0';
+        vars->title_from_db = 1;
+    }
+    // TITLE_ID
+    vars->title_id = (char *) get_param_sfo_value(param_sfo, "TITLE_ID");
+    // VERSION
+    char *version = (char *) get_param_sfo_value(param_sfo, "VERSION");
+    if (version && strlen(version) >= 3) {
+        if (version[2] == '.' && strlen(version) >= 5) {
+            vars->file_id_suffix[8] = version[0];
+            vars->file_id_suffix[9] = version[1];
+            vars->file_id_suffix[10] = version[3];
+            vars->file_id_suffix[11] = version[4];
+        } else if (version[1] == '.') { // Some homebrew apps got it wrong.
+            vars->file_id_suffix[8] = '0';
+            vars->file_id_suffix[9] =  version[0];
+            vars->file_id_suffix[10] = version[2];
+            if (version[3])
+                vars->file_id_suffix[11] = version[3];
+            else
+                vars->file_id_suffix[11] = '0';
+        }
+    }
+    if (version && ctx->leading_zeros == 0 && version[0] == '0')
+        version++;
+    vars->version = version;
+
+    // Handle fake status.
+    if (scan->fake_status) {
+        vars->fake = ctx->fake_string;
+        vars->retail = "";
+        vars->fake_status = ctx->fake_string;
+    } else {
+        vars->fake = "";
+        vars->retail = ctx->retail_string;
+        vars->fake_status = ctx->retail_string;
+    }
+
+    // Get compatibility checksum.
+    if (ctx->variables & PATTERN_VAR_MSUM)
+        get_checksum(vars->msum, filename);
+
+    // Detect changelog patch level.
+    if (changelog && store_patch_version(vars->true_ver_buf, changelog)) {
+        if (ctx->leading_zeros == 0 && vars->true_ver_buf[0] == '0')
+            vars->true_ver = vars->true_ver_buf + 1;
+        else
+            vars->true_ver = vars->true_ver_buf;
+        if (category && category[1] == 'd'
+            && strcmp(vars->true_ver_buf, "01.00") != 0)
+            vars->merged_ver = vars->true_ver;
+    } else {
+        vars->true_ver = app_ver;
+    }
+
+    // Detect backport.
+    if ((category && category[0] == 'g' && category[1] == 'p'
+        && ((ctx->leading_zeros == 0 && strcmp(vars->sdk, "5.05") == 0 )
+        || (ctx->leading_zeros == 1 && strcmp(vars->sdk, "05.05") == 0)))
+        || strwrd(basename, ctx->backport_string)
+        || strstr(lowercase_basename, "backport")
+        || strwrd(lowercase_basename, "bp")
+        || (changelog && changelog[0] ? strcasestr(changelog, "backport") : 0))
+    {
+        vars->backport = ctx->backport_string;
+    }
+
+    // Detect releases.
+    if (ctx->variables & PATTERN_VAR_RELEASE_GROUP)
+        vars->release_group = get_release_group(lowercase_basename);
+    if (ctx->variables & PATTERN_VAR_RELEASE) {
+        int n = get_release(ctx->tag_db, &vars->release, vars->release_buf,
+            lowercase_basename);
+        if (changelog && (vars->release == NULL || ctx->override_tags)) {
+            n = get_release(ctx->tag_db, &vars->release, vars->release_buf,
+            changelog);
+            if (n > 1) {
+                // Remove all tags but the 1st.
+                // Note: if there ever is demand, this line can be removed to
+                // automatically retreive all tags from the changelog.
+                *(strchr(vars->release, ',')) = '\0';
+
+                vars->release_ambiguous = 1;
+           }
+        }
+
+        if (vars->release && n > 1 && ctx->tag_separator)
+            replace_commas_in_tag(vars->release, ctx->tag_separator);
+    }
+
+    // Get file size in GiB.
+    if (ctx->variables & PATTERN_VAR_SIZE) {
+        ssize_t file_size = get_file_size(filename);
+        if (file_size == -1) {
+            fprintf(stderr, "Error while getting the size of file \"%s\".\n",
+                filename);
+            return -1;
+        }
+
+        snprintf(vars->size, sizeof(vars->size), "%.2f GiB",
+            file_size / 1073741824.0);
+    }
+
+    return 0;
+}
+
+// Copies a struct pattern_vars. Some of its members point to its own buffers,
+// so it must not be copied by assignment.
+void copy_pattern_vars(struct pattern_vars *dst, const struct pattern_vars *src)
+{
+    *dst = *src;
+
+    // Redirect pointers to <src>'s buffers to <dst>'s.
+    if (src->release == src->release_buf)
+        dst->release = dst->release_buf;
+    if (src->true_ver == src->true_ver_buf
+        || src->true_ver == src->true_ver_buf + 1) // Without leading zero.
+        dst->true_ver = dst->true_ver_buf + (src->true_ver - src->true_ver_buf);
+    if (src->merged_ver == src->true_ver)
+        dst->merged_ver = dst->true_ver;
+}
+
+// Builds a name from <pattern> and a struct pattern_vars, like
+// build_filename(), but without the file name extension.
+static void render_pattern(const struct render_context *ctx,
+    char *new_basename, const char *pattern, const struct pattern_vars *vars,
+    int *spec_chars_current, int *spec_chars_total)
+{
+    // Replace pattern variables.
+    strncpy(new_basename, pattern, MAX_FORMAT_STRING_LEN - 1);
+    new_basename[MAX_FORMAT_STRING_LEN - 1] = '\0';
+    // First, variables that do or may contain other pattern variables.
+    strreplace(new_basename, "%type%", vars->type);
+    strreplace(new_basename, "%app%", vars->app);
+    strreplace(new_basename, "%dlc%", vars->dlc);
+    strreplace(new_basename, "%game%", vars->game);
+    strreplace(new_basename, "%other%", vars->other);
+    strreplace(new_basename, "%patch%", vars->patch);
+    strreplace(new_basename, "%file_id%", "%content_id%%file_id_suffix%");
+
+    strreplace(new_basename, "%app_ver%", vars->app_ver);
+    strreplace(new_basename, "%backport%", vars->backport);
+    strreplace(new_basename, "%category%", vars->category);
+    strreplace(new_basename, "%content_id%", vars->content_id);
+    strreplace(new_basename, "%fake%", vars->fake);
+    strreplace(new_basename, "%fake_status%", vars->fake_status);
+    strreplace(new_basename, "%file_id_suffix%",
+        (char *) vars->file_id_suffix);
+    strreplace(new_basename, "%firmware%", (char *) vars->firmware);
+    strreplace(new_basename, "%merged_ver%", vars->merged_ver);
+    strreplace(new_basename, "%msum%", (char *) vars->msum);
+    strreplace(new_basename, "%region%", vars->region);
+    if (vars->tag_release_group[0] != '\0')
+        strreplace(new_basename, "%release_group%",
+            (char *) vars->tag_release_group);
+    else
+        strreplace(new_basename, "%release_group%", vars->release_group);
+    if (vars->tag_release[0] != '\0')
+        strreplace(new_basename, "%release%", (char *) vars->tag_release);
+    else
+        strreplace(new_basename, "%release%", vars->release);
+    strreplace(new_basename, "%retail%", vars->retail);
+    strreplace(new_basename, "%sdk%", (char *) vars->sdk);
+    if (strstr(pattern, "%size%"))
+        strreplace(new_basename, "%size%", (char *) vars->size);
+    strreplace(new_basename, "%title%", (char *) vars->title);
+    strreplace(new_basename, "%title_id%", vars->title_id);
+    strreplace(new_basename, "%true_ver%", vars->true_ver);
+    strreplace(new_basename, "%version%", vars->version);
+
+    // Remove empty brackets and parentheses, and curly braces.
+    while (strreplace(new_basename, "[]", "") != NULL)
+        ;
+    while (strreplace(new_basename, "()", "") != NULL)
+        ;
+    while (strreplace(new_basename, "{", "") != NULL)
+        ;
+    while (strreplace(new_basename, "}", "") != NULL)
+        ;
+
+    // Replace illegal characters.
+    replace_illegal_characters(new_basename, ctx->placeholder);
+
+    if (spec_chars_total)
+        *spec_chars_total = count_spec_chars(new_basename);
+
+    // Replace misused special characters.
+    strreplace(new_basename, "＆", "&");
+    strreplace(new_basename, "’", "'");
+    strreplace(new_basename, " ", " ");
+    strreplace(new_basename, "Ⅲ", "III");
+
+    // Replace potentially annoying special characters.
+    strreplace(new_basename, "™_", "_");
+    strreplace(new_basename, "™", " ");
+    strreplace(new_basename, "®_", "_");
+    strreplace(new_basename, "®", " ");
+    strreplace(new_basename, "–", "-");
+
+    if (spec_chars_current)
+        *spec_chars_current = count_spec_chars(new_basename);
+
+    // Remove any number of repeated spaces.
+    while (strreplace(new_basename, "  ", " ") != NULL)
+        ;
+
+    // Remove leading whitespace.
+    char *p;
+    p = new_basename;
+    while (isspace(p[0]))
+        p++;
+    memmove(new_basename, p, strlen(p) + 1);
+
+    // Remove trailing whitespace.
+    p = new_basename + strlen(new_basename) - 1;
+    while (p >= new_basename && isspace(p[0]))
+        *p-- = '\0';
+
+    // Option --underscores: replace all whitespace with underscores.
+    if (ctx->underscores) {
+        p = new_basename;
+        while (*p != '\0') {
+            if (isspace(*p))
+                *p = '_';
+            p++;
+        }
+    }
+}
+
+// Builds a new file name from a context's pattern and a struct pattern_vars.
+// The buffer <new_basename> must be of size MAX_FORMAT_STRING_LEN.
+// If not NULL, <spec_chars_current> and <spec_chars_total> receive the number
+// of special characters after and before automatic replacements.
+void build_filename(const struct render_context *ctx, char *new_basename,
+    const struct pattern_vars *vars, int *spec_chars_current,
+    int *spec_chars_total)
+{
+    render_pattern(ctx, new_basename, ctx->pattern.text, vars,
+        spec_chars_current, spec_chars_total);
+    strcat(new_basename, ".pkg");
+}
+
+// Builds a directory name from <pattern>, a single component of option
+// --organize's pattern, and a struct pattern_vars, like build_filename().
+// The buffer <name> must be of size MAX_FORMAT_STRING_LEN.
+void build_directory_name(const struct render_context *ctx, char *name,
+    const char *pattern, const struct pattern_vars *vars)
+{
+    render_pattern(ctx, name, pattern, vars, NULL, NULL);
+}
@@ -0,0 +1,69 @@
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/organize.h"
+#include "../include/render.h"
+#include "../include/renderstage.h"
+#include "../include/strings.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+int use_render_stage(void)
+{
+    return (option_query || option_no_to_all || option_yes_to_all)
+        && option_online == 0;
+}
+
+struct rendered_name *render_scan(const struct scan *scan)
+{
+    struct rendered_name *name = malloc(sizeof(*name));
+    if (name == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    name->target_dir = NULL;
+
+    if (load_pattern_vars(&render_context, &name->vars, scan)) {
+        free(name);
+        return NULL;
+    }
+    if (option_mixed_case)
+        mixed_case(name->vars.title);
+    build_filename(&render_context, name->new_basename, &name->vars,
+        &name->spec_chars_current, &name->spec_chars_total);
+
+    if (option_organize) {
+        // The file's current directory, as in pkgrename().
+        char path[PATH_MAX];
+        const char *basename = strrchr(scan->filename, DIR_SEPARATOR);
+        if (basename == NULL) {
+            path[0] = '.';
+            path[1] = DIR_SEPARATOR;
+            path[2] = '\0';
+        } else {
+            size_t len = basename + 1 - scan->filename;
+            memcpy(path, scan->filename, len);
+            path[len] = '\0';
+        }
+
+        char target_dir[PATH_MAX];
+        name->target_offset = build_organize_directory(target_dir,
+            sizeof(target_dir), scan, path, &name->vars);
+        if (name->target_offset == -1) {
+            free(name);
+            return NULL;
+        }
+        if ((name->target_dir = strdup(target_dir)) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+    }
+
+    return name;
+}
+
+void free_rendered_name(struct rendered_name *name)
+{
+    if (name == NULL)
+        return;
+    free(name->target_dir);
+    free(name);
+}
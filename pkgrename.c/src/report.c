@@ -0,0 +1,331 @@
+#define _FILE_OFFSET_BITS 64
+
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/render.h"
+#include "../include/report.h"
+#include "../include/scan.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define REPORT_TABLE_SIZE 1024 // A power of 2.
+#define MAX_KEY_WIDTH 60 // Longer values are shortened in the table.
+
+enum report_dimension {
+    DIM_CATEGORY,
+    DIM_REGION,
+    DIM_SDK,
+    DIM_FIRMWARE,
+    DIM_TITLE,
+    DIM_RELEASE_GROUP,
+    DIM_FAKE_STATUS,
+    N_DIMENSIONS
+};
+
+static const char *dimension_names[N_DIMENSIONS] = {
+    "category", "region", "sdk", "firmware", "title", "release_group",
+    "fake_status"
+};
+
+static const char *dimension_headings[N_DIMENSIONS] = {
+    "Category", "Region", "SDK", "Firmware", "Title", "Release group",
+    "Fake status"
+};
+
+struct report_entry {
+    int dimension;
+    char *key; // Empty if the value is not available.
+    unsigned long long n_files;
+    unsigned long long n_bytes;
+    struct report_entry *next;
+};
+
+struct report {
+    struct report_entry *entries[REPORT_TABLE_SIZE];
+    unsigned long long n_files;
+    unsigned long long n_bytes;
+    unsigned long long n_errors;
+};
+
+static struct report global_report;
+static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Adds files and bytes to a report's entry for a value, creating it if
+// necessary.
+static void add_value(struct report *report, int dimension, const char *key,
+    unsigned long long n_files, unsigned long long n_bytes)
+{
+    if (key == NULL)
+        key = "";
+
+    unsigned int i = hash_string(hash_byte(HASH_INIT, dimension), key)
+        & (REPORT_TABLE_SIZE - 1);
+    struct report_entry *entry = report->entries[i];
+    while (entry && (entry->dimension != dimension
+        || strcmp(entry->key, key) != 0))
+        entry = entry->next;
+
+    if (entry == NULL) {
+        if ((entry = malloc(sizeof(*entry))) == NULL
+            || (entry->key = strdup(key)) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        entry->dimension = dimension;
+        entry->n_files = 0;
+        entry->n_bytes = 0;
+        entry->next = report->entries[i];
+        report->entries[i] = entry;
+    }
+
+    entry->n_files += n_files;
+    entry->n_bytes += n_bytes;
+}
+
+struct report *create_report(void)
+{
+    struct report *report = calloc(1, sizeof(*report));
+    if (report == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    return report;
+}
+
+void add_to_report(struct report *report, const struct scan *scan)
+{
+    struct pattern_vars vars;
+    if (scan->error || load_pattern_vars(&render_context, &vars, scan)) {
+        pthread_mutex_lock(&report_mutex);
+        global_report.n_errors++;
+        if (scan->error)
+            print_scan_error((struct scan *) scan);
+        pthread_mutex_unlock(&report_mutex);
+        return;
+    }
+
+    struct stat sb;
+    unsigned long long size = stat(scan->filename, &sb) == 0 ? sb.st_size : 0;
+
+    char title[MAX_TITLE_LEN + 16];
+    snprintf(title, sizeof(title), "%s %s",
+        vars.title_id ? vars.title_id : "", vars.title);
+
+    if (report == NULL) {
+        pthread_mutex_lock(&report_mutex);
+        report = &global_report;
+    }
+    report->n_files++;
+    report->n_bytes += size;
+    add_value(report, DIM_CATEGORY, vars.type, 1, size);
+    add_value(report, DIM_REGION, vars.region, 1, size);
+    add_value(report, DIM_SDK, vars.sdk, 1, size);
+    add_value(report, DIM_FIRMWARE, vars.firmware, 1, size);
+    add_value(report, DIM_TITLE, title, 1, size);
+    add_value(report, DIM_RELEASE_GROUP, vars.release_group, 1, size);
+    add_value(report, DIM_FAKE_STATUS, vars.fake_status, 1, size);
+    if (report == &global_report)
+        pthread_mutex_unlock(&report_mutex);
+}
+
+void merge_report(struct report *report)
+{
+    pthread_mutex_lock(&report_mutex);
+    global_report.n_files += report->n_files;
+    global_report.n_bytes += report->n_bytes;
+    global_report.n_errors += report->n_errors;
+    for (int i = 0; i < REPORT_TABLE_SIZE; i++) {
+        struct report_entry *entry = report->entries[i];
+        while (entry) {
+            struct report_entry *next = entry->next;
+            add_value(&global_report, entry->dimension, entry->key,
+                entry->n_files, entry->n_bytes);
+            free(entry->key);
+            free(entry);
+            entry = next;
+        }
+    }
+    pthread_mutex_unlock(&report_mutex);
+
+    free(report);
+}
+
+// Companion function for qsort in get_sorted_entries().
+// Sorts by number of files, descending, then by value.
+static int qsort_compare_entries(const void *p, const void *q)
+{
+    const struct report_entry *a = *(const struct report_entry **) p;
+    const struct report_entry *b = *(const struct report_entry **) q;
+    if (a->n_files != b->n_files)
+        return a->n_files < b->n_files ? 1 : -1;
+    return strcmp(a->key, b->key);
+}
+
+// Returns a dynamically allocated, sorted array of a dimension's entries.
+static struct report_entry **get_sorted_entries(int dimension, size_t *n)
+{
+    struct report_entry **entries = NULL;
+    size_t size = 0;
+    *n = 0;
+    for (int i = 0; i < REPORT_TABLE_SIZE; i++) {
+        for (struct report_entry *entry = global_report.entries[i]; entry;
+            entry = entry->next)
+        {
+            if (entry->dimension != dimension)
+                continue;
+            if (*n == size) {
+                size = size ? size * 2 : 64;
+                if ((entries = realloc(entries, size * sizeof(*entries)))
+                    == NULL)
+                    exit_err(ENOMEM, __func__, __LINE__);
+            }
+            entries[(*n)++] = entry;
+        }
+    }
+    if (*n)
+        qsort(entries, *n, sizeof(*entries), qsort_compare_entries);
+    return entries;
+}
+
+// Returns the number of characters in a UTF-8 string.
+static int count_characters(const char *s)
+{
+    int n = 0;
+    for (; *s; s++)
+        if (((unsigned char) *s & 0xC0) != 0x80)
+            n++;
+    return n;
+}
+
+// Companion function for print_table().
+// Prints a value left-aligned in a column of <width> characters; longer values
+// are cut off and end with "...".
+static void print_key(const char *key, int width)
+{
+    int len = count_characters(key);
+    if (len <= width) {
+        printf("%s%*s", key, width - len, "");
+        return;
+    }
+
+    const char *end = key;
+    for (int n = 0; *end; end++)
+        if (((unsigned char) *end & 0xC0) != 0x80 && n++ == width - 3)
+            break;
+    printf("%.*s...", (int) (end - key), key);
+}
+
+static void print_table(void)
+{
+    for (int d = 0; d < N_DIMENSIONS; d++) {
+        size_t n;
+        struct report_entry **entries = get_sorted_entries(d, &n);
+
+        int width = strlen(dimension_headings[d]);
+        for (size_t i = 0; i < n; i++) {
+            int len = entries[i]->key[0]
+                ? count_characters(entries[i]->key) : 6;
+            if (len > width)
+                width = len > MAX_KEY_WIDTH ? MAX_KEY_WIDTH : len;
+        }
+
+        printf("%-*s %10s %10s\n", width, dimension_headings[d], "Files",
+            "GiB");
+        for (size_t i = 0; i < n; i++) {
+            print_key(entries[i]->key[0] ? entries[i]->key : "(none)", width);
+            printf(" %10llu %10.2f\n", entries[i]->n_files,
+                entries[i]->n_bytes / 1073741824.0);
+        }
+        putchar('\n');
+        free(entries);
+    }
+
+    printf("Total: %llu files, %.2f GiB, %llu errors.\n", global_report.n_files,
+        global_report.n_bytes / 1073741824.0, global_report.n_errors);
+}
+
+static void print_csv_field(const char *s)
+{
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        fputs(s, stdout);
+        return;
+    }
+
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"')
+            putchar('"');
+        putchar(*s);
+    }
+    putchar('"');
+}
+
+// Rows of reports from multiple runs (e.g. of option --shard) can be merged by
+// adding up the numbers of rows with the same dimension and value.
+static void print_csv(void)
+{
+    puts("dimension,value,files,bytes");
+    printf("total,,%llu,%llu\n", global_report.n_files, global_report.n_bytes);
+    printf("errors,,%llu,0\n", global_report.n_errors);
+    for (int d = 0; d < N_DIMENSIONS; d++) {
+        size_t n;
+        struct report_entry **entries = get_sorted_entries(d, &n);
+        for (size_t i = 0; i < n; i++) {
+            printf("%s,", dimension_names[d]);
+            print_csv_field(entries[i]->key);
+            printf(",%llu,%llu\n", entries[i]->n_files, entries[i]->n_bytes);
+        }
+        free(entries);
+    }
+}
+
+static void print_json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+static void print_json(void)
+{
+    printf("{\n  \"files\": %llu,\n  \"bytes\": %llu,\n  \"errors\": %llu",
+        global_report.n_files, global_report.n_bytes, global_report.n_errors);
+    for (int d = 0; d < N_DIMENSIONS; d++) {
+        size_t n;
+        struct report_entry **entries = get_sorted_entries(d, &n);
+        printf(",\n  \"%s\": [", dimension_names[d]);
+        for (size_t i = 0; i < n; i++) {
+            printf("%s\n    {\"value\": ", i ? "," : "");
+            print_json_string(entries[i]->key);
+            printf(", \"files\": %llu, \"bytes\": %llu}", entries[i]->n_files,
+                entries[i]->n_bytes);
+        }
+        printf(n ? "\n  ]" : "]");
+        free(entries);
+    }
+    puts("\n}");
+}
+
+void print_report(void)
+{
+    switch (option_report) {
+        case REPORT_TABLE:
+            print_table();
+            break;
+        case REPORT_CSV:
+            print_csv();
+            break;
+        case REPORT_JSON:
+            print_json();
+            break;
+    }
+}
@@ -1,14 +1,37 @@
+#include "../include/checkpoint.h"
 #include "../include/colors.h"
 #include "../include/common.h"
+#include "../include/filter.h"
 #include "../include/scan.h"
+#include "../include/onlinesearch.h"
 #include "../include/options.h"
+#include "../include/pathfilter.h"
 #include "../include/pkg.h"
+#include "../include/renderstage.h"
+#include "../include/report.h"
+#include "../include/state.h"
+#include "../include/titledb.h"
+#include "../include/view.h"
+#include "../include/watch.h"
 
 #ifdef _WIN32
 #include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/sysmacros.h>
 #endif
 
 #include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,10 +63,185 @@ static inline int initialize_scan_list(struct scan_list *list)
     list->head = NULL;
     list->finished = 0;
     list->n_slots = SCAN_LIST_CHUNK_SIZE;
+    list->n_released = 0;
 
     return 0;
 }
 
+// Loads a scan's PKG data. With option --report, the data is added to
+// <report> (or, if NULL, the global report) and dropped right away. If the job
+// uses the render stage, the scan's new name is rendered, too.
+static void probe_scan(struct scan_job *job, struct scan *scan,
+    struct report *report)
+{
+    struct pkg_header_fields header = { .match = match_pkg_header };
+    scan->error = load_pkg_data(&scan->param_sfo, &scan->changelog,
+        &scan->fake_status, scan->filename, &header);
+
+    // Option --where: drop the data of files that don't match.
+    if (scan->error == 0 && (header.filtered || !match_filter(scan, &header))) {
+        scan->filtered = 1;
+        free(scan->param_sfo);
+        scan->param_sfo = NULL;
+        free(scan->changelog);
+        scan->changelog = NULL;
+        return;
+    }
+
+    if (option_report) {
+        add_to_report(report, scan);
+        free(scan->param_sfo);
+        scan->param_sfo = NULL;
+        free(scan->changelog);
+        scan->changelog = NULL;
+        if (scan->filename_allocated)
+            free(scan->filename);
+        scan->filename = NULL;
+        return;
+    }
+
+    // Look up titles while earlier files are still being processed.
+    if (option_online && scan->error == 0) {
+        const char *content_id = get_param_sfo_value(scan->param_sfo,
+            "CONTENT_ID");
+        if (lookup_title_db(content_id) == NULL)
+            prefetch_online_title(content_id);
+    }
+
+    // Render the new name while earlier files are still being processed.
+    if (job->render && scan->error == 0)
+        scan->rendered = render_scan(scan);
+}
+
+// Returns the default number of concurrent probes for a device.
+static int get_default_probe_jobs(dev_t dev)
+{
+#ifdef __linux__
+    // Partitions don't have a queue directory; use their parent device's.
+    static const char *formats[] = {
+        "/sys/dev/block/%u:%u/queue/rotational",
+        "/sys/dev/block/%u:%u/../queue/rotational",
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(*formats); i++) {
+        char path[64];
+        snprintf(path, sizeof(path), formats[i], major(dev), minor(dev));
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+            continue;
+        int c = fgetc(file);
+        fclose(file);
+        if (c == '1')
+            return PROBE_JOBS_ROTATIONAL;
+        if (c == '0')
+            return PROBE_JOBS_NON_ROTATIONAL;
+    }
+#else
+    (void) dev;
+#endif
+
+    return PROBE_JOBS_UNKNOWN;
+}
+
+// Returns the number of concurrent probes set by option --probe-jobs for a
+// device, or 0 if it has not been set.
+static int get_probe_jobs(dev_t dev)
+{
+    // Later options take precedence.
+    for (int i = option_n_device_probe_jobs - 1; i >= 0; i--)
+        if (option_device_probe_jobs[i].dev == dev)
+            return option_device_probe_jobs[i].jobs;
+    return option_probe_jobs;
+}
+
+// Returns a job's probe device for <dev>, creating it if necessary.
+// The mutex must be locked.
+static struct probe_device *get_probe_device(struct scan_job *job, dev_t dev)
+{
+    struct probe_device *device;
+    for (device = job->devices; device; device = device->next)
+        if (device->dev == dev)
+            return device;
+
+    if ((device = calloc(1, sizeof(*device))) == NULL)
+        exit_err(errno, __func__, __LINE__);
+    device->dev = dev;
+    device->max_jobs = get_probe_jobs(dev);
+    if (device->max_jobs == 0)
+        device->max_jobs = get_default_probe_jobs(dev);
+    if (device->max_jobs > SCAN_PROBE_THREADS)
+        device->max_jobs = SCAN_PROBE_THREADS;
+
+    // Append, so that devices are served in the order they appear.
+    struct probe_device **p = &job->devices;
+    while (*p)
+        p = &(*p)->next;
+    *p = device;
+
+    return device;
+}
+
+// Claims the next unclaimed scan of a device that is below its probe limit.
+// The mutex must be locked.
+// Returns NULL if there is none; <pending> is set to true if there are
+// unclaimed scans that have to wait for their device.
+static struct scan *claim_scan(struct scan_job *job, _Bool *pending)
+{
+    *pending = 0;
+    for (struct probe_device *d = job->devices; d; d = d->next) {
+        struct scan *scan = d->next_unclaimed;
+        while (scan && scan->claimed)
+            scan = scan->probe_next;
+        d->next_unclaimed = scan;
+        if (scan == NULL)
+            continue;
+        if (d->n_running >= d->max_jobs) {
+            *pending = 1;
+            continue;
+        }
+
+        scan->claimed = 1;
+        d->next_unclaimed = scan->probe_next;
+        d->n_running++;
+        return scan;
+    }
+
+    return NULL;
+}
+
+// Probe thread that loads the PKG data of unclaimed scans, in queue order.
+static void *probe_scans(void *param)
+{
+    struct scan_job *job = (struct scan_job *) param;
+    struct report *report = option_report ? create_report() : NULL;
+
+    pthread_mutex_lock(&job->mutex);
+    for (;;) {
+        _Bool pending;
+        struct scan *scan = claim_scan(job, &pending);
+        if (scan == NULL) {
+            if (job->scan_list.finished && pending == 0)
+                break;
+            pthread_cond_wait(&job->probe_cond, &job->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&job->mutex);
+
+        probe_scan(job, scan, report);
+
+        pthread_mutex_lock(&job->mutex);
+        scan->probed = 1;
+        scan->device->n_running--;
+        pthread_cond_broadcast(&job->cond);
+        pthread_cond_broadcast(&job->probe_cond);
+    }
+    pthread_mutex_unlock(&job->mutex);
+
+    if (report)
+        merge_report(report);
+
+    return NULL;
+}
+
 // Initializes a scan job.
 // Returns 0 on success and -1 on error.
 int initialize_scan_job(struct scan_job *job, char **filenames, int n_filenames)
@@ -56,8 +254,29 @@ int initialize_scan_job(struct scan_job *job, char **filenames, int n_filenames)
         pthread_mutex_destroy(&job->mutex);
         return -1;
     }
+    if (pthread_cond_init(&job->probe_cond, NULL)) {
+        pthread_cond_destroy(&job->cond);
+        pthread_mutex_destroy(&job->mutex);
+        return -1;
+    }
+    job->devices = NULL;
     job->filenames = filenames;
     job->n_filenames = n_filenames;
+    job->operand = 0;
+    job->operand_len = 0;
+    job->render = 0;
+
+    for (job->n_probe_threads = 0; job->n_probe_threads < SCAN_PROBE_THREADS;
+        job->n_probe_threads++)
+    {
+        if (pthread_create(&job->probe_threads[job->n_probe_threads], NULL,
+            probe_scans, job))
+        {
+            if (job->n_probe_threads == 0)
+                return -1;
+            break;
+        }
+    }
 
     return 0;
 }
@@ -72,6 +291,7 @@ static inline struct scan *delete_scan(struct scan *scan)
         free(scan->param_sfo);
     if (scan->changelog)
         free(scan->changelog);
+    free_rendered_name(scan->rendered);
 
     if (scan->next)
         return scan->next;
@@ -103,17 +323,24 @@ static inline void destroy_scan_list(struct scan_list *scan_list)
 // Destroys a scan job.
 void destroy_scan_job(struct scan_job *job)
 {
+    for (int i = 0; i < job->n_probe_threads; i++)
+        pthread_join(job->probe_threads[i], NULL);
     destroy_scan_list(&job->scan_list);
+    while (job->devices) {
+        struct probe_device *next = job->devices->next;
+        free(job->devices);
+        job->devices = next;
+    }
+    pthread_cond_destroy(&job->probe_cond);
     pthread_mutex_destroy(&job->mutex);
     pthread_cond_destroy(&job->cond);
 }
 
-// Adds a scan result to a job's scan list.
-void add_scan_result(struct scan_job *job, char *filename,
+// Companion function for add_scan_result() and add_scan_results().
+// Appends a new node to a job's scan list. The mutex must be locked.
+static struct scan *append_scan(struct scan_job *job, char *filename,
     _Bool filename_allocated)
 {
-    pthread_mutex_lock(&job->mutex);
-
     struct scan_list *list = &job->scan_list;
     struct scan *scan;
 
@@ -132,18 +359,22 @@ void add_scan_result(struct scan_job *job, char *filename,
     }
     list->n_slots--;
 
-    pthread_mutex_unlock(&job->mutex);
-
     scan->filename = filename;
     scan->filename_allocated = filename_allocated;
     scan->param_sfo = NULL;
     scan->changelog = NULL;
-    scan->error = load_pkg_data(&scan->param_sfo, &scan->changelog,
-        &scan->fake_status, filename);
+    scan->rendered = NULL;
+    scan->fake_status = 0;
+    scan->error = 0;
+    scan->claimed = 0;
+    scan->probed = 0;
+    scan->filtered = 0;
+    scan->operand = job->operand;
+    scan->operand_len = job->operand_len;
     scan->next = NULL;
+    scan->probe_next = NULL;
 
     // Link new node.
-    pthread_mutex_lock(&job->mutex);
     if (list->head == NULL) {
         list->tail = scan;
         list->head = scan;
@@ -153,47 +384,243 @@ void add_scan_result(struct scan_job *job, char *filename,
         list->tail = scan;
     }
 
+    return scan;
+}
+
+// Companion function for add_scan_result() and add_scan_results().
+// Appends a node to a device's probe queue. The mutex must be locked.
+static void queue_probe(struct probe_device *device, struct scan *scan)
+{
+    scan->device = device;
+    if (device->probe_tail)
+        device->probe_tail->probe_next = scan;
+    device->probe_tail = scan;
+    if (device->next_unclaimed == NULL)
+        device->next_unclaimed = scan;
+}
+
+// Adds a file that is located on device <dev> to a job's scan list; its data
+// will be loaded in the background.
+void add_scan_result(struct scan_job *job, char *filename,
+    _Bool filename_allocated, dev_t dev)
+{
+    pthread_mutex_lock(&job->mutex);
+    queue_probe(get_probe_device(job, dev),
+        append_scan(job, filename, filename_allocated));
     pthread_mutex_unlock(&job->mutex);
 
+    pthread_cond_signal(&job->probe_cond);
     pthread_cond_signal(&job->cond);
 }
 
-// Prints a message that describes the value of struct scan's .error member.
-void print_scan_error(struct scan *scan)
+#ifndef _WIN32
+// A file's position on disk, used by option --disk-order.
+struct disk_position {
+    _Bool physical; // If false, <position> is the inode number.
+    uint64_t position;
+    size_t index;
+};
+
+// Companion function for add_scan_results().
+// Returns a file's physical start on disk or, if that is not available, its
+// inode number.
+static struct disk_position get_disk_position(const char *filename,
+    size_t index)
 {
-    set_color(BRIGHT_RED, stderr);
-    fprintf(stderr, "Error while scanning file \"%s\": ", scan->filename);
-    switch (scan->error) {
+    struct disk_position ret = { .index = index };
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return ret;
+
+#ifdef __linux__
+    uint64_t buf[(sizeof(struct fiemap) + sizeof(struct fiemap_extent))
+        / sizeof(uint64_t) + 1] = { 0 };
+    struct fiemap *fm = (struct fiemap *) buf;
+    fm->fm_length = FIEMAP_MAX_OFFSET;
+    fm->fm_extent_count = 1;
+    int block = 0;
+    if (ioctl(fd, FS_IOC_FIEMAP, fm) == 0 && fm->fm_mapped_extents) {
+        ret.physical = 1;
+        ret.position = fm->fm_extents[0].fe_physical;
+    } else if (ioctl(fd, FIBMAP, &block) == 0 && block > 0) {
+        ret.physical = 1;
+        ret.position = block;
+    }
+#endif
+
+    struct stat sb;
+    if (ret.physical == 0 && fstat(fd, &sb) == 0)
+        ret.position = sb.st_ino;
+
+    close(fd);
+    return ret;
+}
+
+// Companion function for qsort in add_scan_results().
+static int qsort_compare_disk_positions(const void *p, const void *q)
+{
+    const struct disk_position *a = p;
+    const struct disk_position *b = q;
+    if (a->physical != b->physical)
+        return a->physical ? -1 : 1;
+    return (a->position > b->position) - (a->position < b->position);
+}
+#endif
+
+// Adds multiple files that are located on device <dev> to a job's scan list,
+// in the given order. With option --disk-order, they are probed in the order of
+// their positions on disk.
+void add_scan_results(struct scan_job *job, char **filenames, size_t n,
+    dev_t dev)
+{
+    struct scan **scans = NULL;
+#ifndef _WIN32
+    struct disk_position *positions = NULL;
+    if (option_disk_order && n > 1) {
+        positions = malloc(n * sizeof(*positions));
+        scans = malloc(n * sizeof(*scans));
+        if (positions && scans) {
+            for (size_t i = 0; i < n; i++)
+                positions[i] = get_disk_position(filenames[i], i);
+            qsort(positions, n, sizeof(*positions),
+                qsort_compare_disk_positions);
+        } else {
+            free(scans);
+            scans = NULL;
+        }
+    }
+#endif
+
+    pthread_mutex_lock(&job->mutex);
+    struct probe_device *device = get_probe_device(job, dev);
+    for (size_t i = 0; i < n; i++) {
+        struct scan *scan = append_scan(job, filenames[i], 1);
+        if (scans)
+            scans[i] = scan;
+        else
+            queue_probe(device, scan);
+    }
+#ifndef _WIN32
+    if (scans)
+        for (size_t i = 0; i < n; i++)
+            queue_probe(device, scans[positions[i].index]);
+    free(positions);
+#endif
+    pthread_mutex_unlock(&job->mutex);
+    free(scans);
+
+    pthread_cond_broadcast(&job->probe_cond);
+    pthread_cond_broadcast(&job->cond);
+}
+
+// Waits until a scan's data has been loaded, loading it right away if no other
+// thread has started yet.
+void wait_for_scan(struct scan_job *job, struct scan *scan)
+{
+    pthread_mutex_lock(&job->mutex);
+    if (scan->claimed == 0 && option_disk_order == 0) {
+        scan->claimed = 1;
+        scan->device->n_running++;
+        pthread_mutex_unlock(&job->mutex);
+        probe_scan(job, scan, NULL);
+        pthread_mutex_lock(&job->mutex);
+        scan->probed = 1;
+        scan->device->n_running--;
+        pthread_cond_broadcast(&job->probe_cond);
+    } else {
+        while (scan->probed == 0)
+            pthread_cond_wait(&job->cond, &job->mutex);
+    }
+    pthread_mutex_unlock(&job->mutex);
+}
+
+// Frees the data of a scan that the caller is done with. Scans must be released
+// in list order, each after wait_for_scan() and after its .next member has been
+// read; memory chunks whose scans have all been released are freed, too.
+void release_scan(struct scan_job *job, struct scan *scan)
+{
+    if (scan->filename_allocated)
+        free(scan->filename);
+    scan->filename = NULL;
+    free(scan->param_sfo);
+    scan->param_sfo = NULL;
+    free(scan->changelog);
+    scan->changelog = NULL;
+    free_rendered_name(scan->rendered);
+    scan->rendered = NULL;
+
+    // With option --disk-order, the probe queues link the scans in a different
+    // order, so probe threads may still walk through any chunk.
+    if (option_disk_order)
+        return;
+
+    // The chunk is kept until its last scan's successor exists; until then,
+    // the next scan is added to the chunk's end.
+    struct scan_list *list = &job->scan_list;
+    if (++list->n_released < SCAN_LIST_CHUNK_SIZE || scan->next == NULL)
+        return;
+
+    pthread_mutex_lock(&job->mutex);
+    // No probe queue may point into the chunk. All of its scans have been
+    // probed, so a queue that still reaches them has no unclaimed scans left.
+    for (struct probe_device *d = job->devices; d; d = d->next) {
+        while (d->next_unclaimed && d->next_unclaimed->claimed)
+            d->next_unclaimed = d->next_unclaimed->probe_next;
+        if (d->next_unclaimed == NULL)
+            d->probe_tail = NULL;
+    }
+    struct scan *chunk = list->head;
+    list->head = scan->next;
+    pthread_mutex_unlock(&job->mutex);
+
+    free(chunk);
+    list->n_released = 0;
+}
+
+// Marks a job's scan list as finished.
+void finish_scan_list(struct scan_job *job)
+{
+    pthread_mutex_lock(&job->mutex);
+    job->scan_list.finished = 1;
+    pthread_mutex_unlock(&job->mutex);
+
+    pthread_cond_broadcast(&job->probe_cond);
+    pthread_cond_broadcast(&job->cond);
+}
+
+// Returns a message that describes the value of struct scan's .error member.
+const char *scan_error_string(int error)
+{
+    switch (error) {
         case SCAN_ERROR_NOT_A_PKG:
-            fputs("File is not a PS4 PKG file.\n", stderr);
-            break;
+            return "File is not a PS4 PKG file.";
         case SCAN_ERROR_OPEN_FILE:
-            fputs("Could not open file.\n", stderr);
-            break;
+            return "Could not open file.";
         case SCAN_ERROR_READ_FILE:
-            fputs("Could not read data.\n", stderr);
-            break;
+            return "Could not read data.";
         case SCAN_ERROR_OUT_OF_MEMORY:
-            fputs("Could not allocate memory for PKG content.\n", stderr);
-            break;
+            return "Could not allocate memory for PKG content.";
         case SCAN_ERROR_PARAM_SFO_INVALID_DATA:
-            fputs("Invalid data in PKG content \"param.sfo\".\n", stderr);
-            break;
+            return "Invalid data in PKG content \"param.sfo\".";
         case SCAN_ERROR_PARAM_SFO_INVALID_FORMAT:
-            fputs("Invalid file type of PKG content \"param.sfo\".\n", stderr);
-            break;
+            return "Invalid file type of PKG content \"param.sfo\".";
         case SCAN_ERROR_PARAM_SFO_INVALID_SIZE:
-            fputs("Invalid size of PKG content \"param.sfo\".\n", stderr);
-            break;
+            return "Invalid size of PKG content \"param.sfo\".";
         case SCAN_ERROR_PARAM_SFO_NOT_FOUND:
-            fputs("PKG content \"param.sfo\" not found.\n", stderr);
-            break;
+            return "PKG content \"param.sfo\" not found.";
         case SCAN_ERROR_CHANGELOG_INVALID_SIZE:
-            fputs("Invalid size of PKG content \"changelog.xml\".\n", stderr);
-            break;
+            return "Invalid size of PKG content \"changelog.xml\".";
         default:
-            fputs("Unkown error.\n", stderr);
+            return "Unkown error.";
     }
+}
+
+// Prints a message that describes the value of struct scan's .error member.
+void print_scan_error(struct scan *scan)
+{
+    set_color(BRIGHT_RED, stderr);
+    fprintf(stderr, "Error while scanning file \"%s\": %s\n", scan->filename,
+        scan_error_string(scan->error));
     set_color(RESET, stderr);
 }
 
@@ -210,35 +637,55 @@ inline static int is_root(const char *dir)
     return 0;
 }
 
-// Finds all .pkg files in a directory and runs a scan on them.
+// Where a directory search started (see parse_directory()).
+struct search_root {
+    size_t path_len; // Length of the path prefix that precedes relative paths.
+    dev_t dev;
+};
+
+// Appends a dynamically allocated string to a dynamically growing array.
 // Returns 0 on success and -1 on error.
-int parse_directory(char *cur_dir, struct scan_job *job)
+static int append_name(char ***names, size_t *count, size_t *count_max,
+    const char *name)
 {
-    int retval = 0;
-
-    DIR *dir;
-    struct dirent *dir_entry;
+    if (*count == *count_max) {
+        size_t new_max = *count_max ? *count_max * 2 : 100;
+        char **new_names = realloc(*names, sizeof(void *) * new_max);
+        if (new_names == NULL)
+            return -1;
+        *names = new_names;
+        *count_max = new_max;
+    }
+    if (((*names)[*count] = strdup(name)) == NULL)
+        return -1;
+    (*count)++;
+    return 0;
+}
 
-    size_t dir_count_max = 100;
-    size_t file_count_max = 100;
-    char **dir_names = malloc(sizeof(void *) * dir_count_max);
-    char **filenames = malloc(sizeof(void *) * file_count_max);
-    size_t dir_count = 0, file_count = 0;
+// Companion function for search_directory().
+// Compares a name with the first <len> characters of <component> like strcmp().
+static int compare_component(const char *name, const char *component,
+    size_t len)
+{
+    int cmp = strncmp(name, component, len);
+    if (cmp)
+        return cmp;
+    return name[len] != '\0';
+}
 
-    // Remove trailing directory separators.
-    {
-        int len = strlen(cur_dir);
-        while (len > 1 && cur_dir[len - 1] == DIR_SEPARATOR) {
-            cur_dir[len - 1] = '\0';
-            len--;
-        }
-    }
+// Companion function for search_directory().
+// Reads the names of a directory's subdirectories (except system directories)
+// and .pkg files into sorted, dynamically allocated lists.
+// Returns 0 on success and -1 on error.
+static int read_directory(const char *cur_dir, char ***dir_names,
+    size_t *dir_count, char ***filenames, size_t *file_count)
+{
+    size_t dir_count_max = 0, file_count_max = 0;
+    struct dirent *dir_entry;
 
-    dir = opendir(cur_dir); // TODO: better error handling.
-    if (dir == NULL) {
-        retval = -1;
-        goto cleanup;
-    }
+    DIR *dir = opendir(cur_dir); // TODO: better error handling.
+    if (dir == NULL)
+        return -1;
 
     // Read all directory entries to put them in lists.
     while ((dir_entry = readdir(dir)) != NULL) {
@@ -260,80 +707,199 @@ int parse_directory(char *cur_dir, struct scan_job *job)
         if (dir_entry->d_type == DT_DIR) {
 #endif
             // Save name in the directory list.
-            if (option_recursive == 1
-                && dir_entry->d_name[0] != '.'
-                && dir_entry->d_name[0] != '$') // Exclude system dirs.
-            {
-                size_t size;
-                if (is_root(cur_dir))
-                    size = 1 + strlen(dir_entry->d_name) + 1;
-                else
-                    size = strlen(cur_dir) + 1 + strlen(dir_entry->d_name) + 1;
-                if ((dir_names[dir_count] = malloc(size)) == NULL) {
-                    retval = -1;
-                    goto cleanup;
-                }
-
-                sprintf(dir_names[dir_count], "%s%c%s", is_root(cur_dir) ? ""
-                    : cur_dir, DIR_SEPARATOR, dir_entry->d_name);
-                dir_count++;
-                if (dir_count == dir_count_max) {
-                    dir_count_max *= 2;
-                    dir_names = realloc(dir_names, sizeof(void *)
-                        * dir_count_max);
-                }
-            }
+            if (dir_entry->d_name[0] != '.'
+                && dir_entry->d_name[0] != '$' // Exclude system dirs.
+                && append_name(dir_names, dir_count, &dir_count_max,
+                    dir_entry->d_name))
+                goto error;
         // Entry is .pkg file.
         } else {
             char *file_extension = strrchr(dir_entry->d_name, '.');
             if (file_extension != NULL
-                && strcasecmp(file_extension, ".pkg") == 0)
-            {
-                // Save name in the file list.
-                size_t size;
-                if (is_root(cur_dir))
-                    size = 1 + strlen(dir_entry->d_name) + 1;
-                else
-                    size = strlen(cur_dir) + 1 + strlen(dir_entry->d_name) + 1;
-                if ((filenames[file_count] = malloc(size)) == NULL) {
-                    retval = -1;
-                    goto cleanup;
-                }
-
-                sprintf(filenames[file_count], "%s%c%s", is_root(cur_dir) ?  ""
-                    : cur_dir, DIR_SEPARATOR,  dir_entry->d_name);
-                file_count++;
-                if (file_count == file_count_max) {
-                    file_count_max *= 2;
-                    filenames = realloc(filenames, sizeof(void *)
-                        * file_count_max);
-                }
-            }
+                && strcasecmp(file_extension, ".pkg") == 0
+                && append_name(filenames, file_count, &file_count_max,
+                    dir_entry->d_name))
+                goto error;
         }
     }
+    closedir(dir);
 
     // Sort the final lists.
-    qsort(dir_names, dir_count, sizeof(char *),
-        qsort_compare_strings);
-    qsort(filenames, file_count, sizeof(char *), qsort_compare_strings);
+    qsort(*dir_names, *dir_count, sizeof(char *), qsort_compare_strings);
+    qsort(*filenames, *file_count, sizeof(char *), qsort_compare_strings);
+
+    return 0;
+
+error:
+    closedir(dir);
+    return -1;
+}
+
+// Companion function for parse_directory().
+// Searches a directory at depth <depth> below the search root. Option
+// --resume: <resume> is the path, relative to this directory, of the last file
+// that has been completed, or NULL. As directories are searched in sorted order,
+// everything before it has been completed, too.
+static int search_directory(char *cur_dir, struct scan_job *job,
+    const struct search_root *root, int depth, const char *resume)
+{
+    int retval = 0;
+
+    // Split the resume path into its first component and the rest; if there is
+    // no rest, the component is a file in this directory.
+    size_t resume_len = 0;
+    const char *resume_rest = NULL;
+    if (resume) {
+        const char *sep = strchr(resume, DIR_SEPARATOR);
+        resume_len = sep ? (size_t) (sep - resume) : strlen(resume);
+        resume_rest = sep ? sep + 1 : NULL;
+    }
+
+    char **dir_names = NULL;
+    char **filenames = NULL;
+    size_t dir_count = 0, file_count = 0;
+    _Bool from_state = 0;
+
+    struct stat dir_stat;
+    if (stat(cur_dir, &dir_stat) != 0)
+        return -1;
+#ifndef _WIN32
+    // Option --one-file-system: prune the subtree before it is opened.
+    if (option_one_file_system && depth > 0 && dir_stat.st_dev != root->dev)
+        return 0;
+#endif
+
+    // Option --view: don't search views, which link to the files themselves.
+    if (option_n_views && is_view_directory(&dir_stat))
+        return 0;
+
+    // Option --state: serve unchanged directories without reading them.
+    struct dir_state *state = option_state ? find_dir_state(cur_dir) : NULL;
+    if (state && is_dir_unchanged(state, &dir_stat)) {
+        from_state = 1;
+        dir_names = state->subdirs;
+        dir_count = state->n_subdirs;
+        if (state->n_files
+            && (filenames = malloc(sizeof(void *) * state->n_files)) == NULL)
+            return -1;
+        for (size_t i = 0; i < state->n_files; i++)
+            filenames[i] = state->files[i].name;
+        file_count = state->n_files;
+    } else if (read_directory(cur_dir, &dir_names, &dir_count, &filenames,
+        &file_count))
+    {
+        retval = -1;
+        goto cleanup;
+    }
+    if (option_state)
+        record_dir_state(cur_dir, &dir_stat, dir_names, dir_count, filenames,
+            file_count, state);
 
     // Use the filenames to create new scan results.
-    for (size_t i = 0; i < file_count; i++)
-        add_scan_result(job, filenames[i], 1);
+    char **paths = file_count ? malloc(sizeof(void *) * file_count) : NULL;
+    size_t path_count = 0;
+    if (file_count && paths == NULL) {
+        retval = -1;
+        goto cleanup;
+    }
+    for (size_t i = 0; i < file_count; i++) {
+        // Option --resume: skip completed files.
+        if (resume && (resume_rest
+            || compare_component(filenames[i], resume, resume_len) <= 0))
+            continue;
 
-    // Parse sorted directories recursively.
-    if (option_recursive == 1) {
-        for (size_t i = 0; i < dir_count; i++) {
-            parse_directory(dir_names[i], job);
-            free(dir_names[i]);
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s%c%s", is_root(cur_dir) ? "" : cur_dir,
+            DIR_SEPARATOR, filenames[i]);
+        if (is_excluded_file(filenames[i], path + root->path_len))
+            continue;
+        if (option_shard && !is_in_shard(path + root->path_len))
+            continue;
+
+        // Option --resume: skip completed files that have been renamed.
+        if (option_resume && is_file_completed(path))
+            continue;
+
+        // Option --since: skip files that have been seen before.
+        struct stat sb;
+        if (option_since && state && stat(path, &sb) == 0
+            && is_file_unchanged(state, filenames[i], &sb))
+            continue;
+
+        if ((paths[path_count] = strdup(path)) == NULL) {
+            retval = -1;
+            break;
         }
+        path_count++;
+
+        // Option --watch: don't scan the file again for its events.
+        if (option_watch)
+            remember_scanned_file(path);
     }
+    add_scan_results(job, paths, path_count, dir_stat.st_dev);
+    free(paths);
+    if (retval)
+        goto cleanup;
 
-    closedir(dir);
+    // Parse sorted directories recursively; pruned subtrees are never opened.
+    if (option_recursive == 1
+        && (option_max_depth < 0 || depth < option_max_depth))
+    {
+        for (size_t i = 0; i < dir_count; i++) {
+            // Option --resume: skip completed subdirectories.
+            const char *subdir_resume = NULL;
+            if (resume_rest) {
+                int cmp = compare_component(dir_names[i], resume, resume_len);
+                if (cmp < 0)
+                    continue;
+                if (cmp == 0)
+                    subdir_resume = resume_rest;
+            }
+
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s%c%s",
+                is_root(cur_dir) ? "" : cur_dir, DIR_SEPARATOR, dir_names[i]);
+            if (!is_excluded_directory(dir_names[i], path + root->path_len))
+                search_directory(path, job, root, depth + 1, subdir_resume);
+        }
+    }
 
 cleanup:
-    free(dir_names);
+    if (from_state == 0) {
+        for (size_t i = 0; i < dir_count; i++)
+            free(dir_names[i]);
+        for (size_t i = 0; i < file_count; i++)
+            free(filenames[i]);
+        free(dir_names);
+    }
     free(filenames);
 
     return retval;
 }
+
+// Finds all .pkg files in a directory and runs a scan on them. With option
+// --resume, <resume> is the path, relative to the directory, of the last file
+// that has been completed; it and all files before it are skipped.
+// Returns 0 on success and -1 on error.
+int parse_directory(char *cur_dir, struct scan_job *job, const char *resume)
+{
+    // Remove trailing directory separators.
+    {
+        int len = strlen(cur_dir);
+        while (len > 1 && cur_dir[len - 1] == DIR_SEPARATOR) {
+            cur_dir[len - 1] = '\0';
+            len--;
+        }
+    }
+
+    struct search_root root = {
+        .path_len = is_root(cur_dir) ? 1 : strlen(cur_dir) + 1,
+    };
+    struct stat sb;
+    if (stat(cur_dir, &sb) == 0)
+        root.dev = sb.st_dev;
+    job->operand_len = strlen(cur_dir);
+
+    return search_directory(cur_dir, job, &root, 0, resume);
+}
+
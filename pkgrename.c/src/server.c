@@ -0,0 +1,572 @@
+#define _FILE_OFFSET_BITS 64
+
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/pkg.h"
+#include "../include/render.h"
+#include "../include/scan.h"
+#include "../include/server.h"
+#include "../include/strings.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+int serve(const char *socket_path)
+{
+    (void) socket_path;
+    fputs("Option --serve is not supported on this system.\n", stderr);
+    return -1;
+}
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_WORKERS 8
+#define MAX_WORKERS 64
+#define MAX_CONNECTIONS 1024
+#define IDLE_TIMEOUT 600 // Seconds without a request before disconnecting.
+#define MAX_REQUEST_LEN (PATH_MAX + 16)
+
+// A cached scan result, valid as long as the file is unchanged.
+struct cache_entry {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    char *name_response;
+    char *sfo_response;
+};
+
+static struct cache_entry cache[SERVE_CACHE_SLOTS];
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// A client connection. All connections are served by the main thread's poll
+// loop; only single requests are handed to the worker threads, so idle clients
+// don't occupy workers.
+struct connection {
+    int fd;
+    char *in; // Received data that has not been handled yet.
+    size_t in_len;
+    char *out; // Response that is being sent.
+    size_t out_len;
+    size_t out_pos;
+    _Bool busy; // A request is being handled by a worker.
+    _Bool closing; // The client has stopped sending.
+    _Bool broken; // The connection has failed.
+    struct timespec last_active;
+};
+
+// A request line, handed to the workers and back with its response.
+struct request {
+    struct connection *conn;
+    char *line;
+    char *response;
+    struct request *next;
+};
+
+static struct {
+    struct request *pending_head, *pending_tail; // For the workers.
+    struct request *done; // Answered, for the poll loop.
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // "A request is pending."
+    int wake_fd[2]; // Wakes up the poll loop when a request is done.
+} requests = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static struct {
+    uint64_t requests;
+    uint64_t cache_hits;
+    pthread_mutex_t mutex;
+} stats = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static char *response(const char *status, const char *message)
+{
+    char *p = malloc(strlen(status) + 1 + strlen(message) + 2);
+    if (p == NULL)
+        return NULL;
+    sprintf(p, "%s %s\n", status, message);
+    return p;
+}
+
+// Creates the "sfo" response for a param.sfo buffer.
+static char *create_sfo_response(const unsigned char *param_sfo)
+{
+    char *buf;
+    size_t size;
+    FILE *stream = open_memstream(&buf, &size);
+    if (stream == NULL)
+        return NULL;
+
+    fputs("ok ", stream);
+    print_param_sfo(stream, param_sfo);
+    fclose(stream);
+
+    // Put all pairs on a single line.
+    for (size_t i = 3; i < size; i++)
+        if (buf[i] == '\n' || buf[i] == '\t' || buf[i] == '\r')
+            buf[i] = i == size - 1 ? '\n' : '\t';
+
+    return buf;
+}
+
+// Scans a file and creates its responses, without touching the cache.
+static void load_cache_entry(struct cache_entry *entry)
+{
+    struct scan scan = { .filename = entry->path };
+
+    scan.error = load_pkg_data(&scan.param_sfo, &scan.changelog,
+        &scan.fake_status, scan.filename, NULL);
+    if (scan.error) {
+        entry->name_response = response("error",
+            scan_error_string(scan.error));
+        entry->sfo_response = strdup(entry->name_response);
+        goto cleanup;
+    }
+
+    char new_basename[MAX_FORMAT_STRING_LEN];
+    struct pattern_vars vars;
+
+    int err = load_pattern_vars(&render_context, &vars, &scan);
+    if (err == 0) {
+        if (option_mixed_case)
+            mixed_case(vars.title);
+        build_filename(&render_context, new_basename, &vars, NULL, NULL);
+    }
+
+    entry->name_response = err ? response("error", "Could not read file.")
+        : response("ok", new_basename);
+    entry->sfo_response = create_sfo_response(scan.param_sfo);
+
+cleanup:
+    free(scan.param_sfo);
+    free(scan.changelog);
+}
+
+static void free_cache_entry(struct cache_entry *entry)
+{
+    free(entry->path);
+    free(entry->name_response);
+    free(entry->sfo_response);
+}
+
+// Returns a response for a "name" or "sfo" request; the result must be freed.
+static char *query_file(const char *path, _Bool sfo)
+{
+    struct stat sb;
+    if (stat(path, &sb))
+        return response("error", strerror(errno));
+    if (!S_ISREG(sb.st_mode))
+        return response("error", "Not a regular file.");
+
+    struct cache_entry *slot =
+        &cache[hash_string(HASH_INIT, path) % SERVE_CACHE_SLOTS];
+    char *retval = NULL;
+
+    // Cache hit?
+    pthread_mutex_lock(&cache_mutex);
+    if (slot->path && strcmp(slot->path, path) == 0 && slot->dev == sb.st_dev
+        && slot->ino == sb.st_ino && slot->size == sb.st_size
+        && slot->mtime.tv_sec == sb.st_mtim.tv_sec
+        && slot->mtime.tv_nsec == sb.st_mtim.tv_nsec)
+    {
+        char *cached = sfo ? slot->sfo_response : slot->name_response;
+        if (cached)
+            retval = strdup(cached);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (retval) {
+        pthread_mutex_lock(&stats.mutex);
+        stats.cache_hits++;
+        pthread_mutex_unlock(&stats.mutex);
+        return retval;
+    }
+
+    // Cache miss; load the file without holding the lock.
+    struct cache_entry entry = {
+        .path = strdup(path),
+        .dev = sb.st_dev,
+        .ino = sb.st_ino,
+        .size = sb.st_size,
+        .mtime = sb.st_mtim,
+    };
+    if (entry.path == NULL)
+        return NULL;
+    load_cache_entry(&entry);
+    char *new_response = sfo ? entry.sfo_response : entry.name_response;
+    retval = new_response ? strdup(new_response) : NULL;
+
+    pthread_mutex_lock(&cache_mutex);
+    free_cache_entry(slot);
+    *slot = entry;
+    pthread_mutex_unlock(&cache_mutex);
+
+    return retval;
+}
+
+// Returns a response for a request line; the result must be freed.
+static char *handle_request(char *line)
+{
+    pthread_mutex_lock(&stats.mutex);
+    stats.requests++;
+    pthread_mutex_unlock(&stats.mutex);
+
+    char *arg = strchr(line, ' ');
+    if (arg)
+        *arg++ = '\0';
+
+    if (strcmp(line, "name") == 0 && arg && *arg)
+        return query_file(arg, 0);
+    if (strcmp(line, "sfo") == 0 && arg && *arg)
+        return query_file(arg, 1);
+    if (strcmp(line, "stats") == 0) {
+        char buf[128];
+        pthread_mutex_lock(&stats.mutex);
+        snprintf(buf, sizeof(buf), "requests=%llu cache_hits=%llu",
+            (unsigned long long) stats.requests,
+            (unsigned long long) stats.cache_hits);
+        pthread_mutex_unlock(&stats.mutex);
+        return response("ok", buf);
+    }
+
+    return response("error", "Unknown request.");
+}
+
+static void *worker_thread(void *arg)
+{
+    (void) arg;
+
+    while (1) {
+        pthread_mutex_lock(&requests.mutex);
+        while (requests.pending_head == NULL)
+            pthread_cond_wait(&requests.cond, &requests.mutex);
+        struct request *req = requests.pending_head;
+        if ((requests.pending_head = req->next) == NULL)
+            requests.pending_tail = NULL;
+        pthread_mutex_unlock(&requests.mutex);
+
+        req->response = handle_request(req->line);
+        if (req->response == NULL)
+            req->response = response("error", "Out of memory.");
+
+        pthread_mutex_lock(&requests.mutex);
+        req->next = requests.done;
+        requests.done = req;
+        pthread_mutex_unlock(&requests.mutex);
+        char c = 0;
+        while (write(requests.wake_fd[1], &c, 1) == -1 && errno == EINTR)
+            ;
+    }
+
+    return NULL;
+}
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags == -1 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void close_connection(struct connection *conn)
+{
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+// Sends as much of a connection's response as the socket takes.
+// Returns 0 on success and -1 if the connection is broken.
+static int send_response(struct connection *conn)
+{
+    while (conn->out_pos < conn->out_len) {
+        ssize_t n = write(conn->fd, conn->out + conn->out_pos,
+            conn->out_len - conn->out_pos);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        conn->out_pos += n;
+    }
+    free(conn->out);
+    conn->out = NULL;
+    conn->out_len = conn->out_pos = 0;
+    return 0;
+}
+
+// Reads what a client has sent.
+// Returns 0 on success and -1 if the connection is broken.
+static int receive_data(struct connection *conn)
+{
+    char buf[4096];
+    while (1) {
+        ssize_t n = read(conn->fd, buf, sizeof(buf));
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        if (n == 0) {
+            conn->closing = 1;
+            return 0;
+        }
+        // A line that is too long can't be a valid request.
+        if (conn->in_len + n > MAX_REQUEST_LEN * 2)
+            return -1;
+        char *in = realloc(conn->in, conn->in_len + n);
+        if (in == NULL)
+            return -1;
+        conn->in = in;
+        memcpy(conn->in + conn->in_len, buf, n);
+        conn->in_len += n;
+    }
+}
+
+// Hands a connection's next complete request line to the workers.
+// Returns 1 if a request has been handed over, 0 if there is no complete line,
+// and -1 on error.
+static int dispatch_request(struct connection *conn)
+{
+    char *newline = conn->in ? memchr(conn->in, '\n', conn->in_len) : NULL;
+    size_t len;
+    if (newline)
+        len = newline - conn->in;
+    else if (conn->closing && conn->in_len) // Last line without newline.
+        len = conn->in_len;
+    else
+        return conn->in_len > MAX_REQUEST_LEN ? -1 : 0;
+    if (len > MAX_REQUEST_LEN)
+        return -1;
+
+    struct request *req = malloc(sizeof(*req));
+    if (req == NULL || (req->line = malloc(len + 1)) == NULL) {
+        free(req);
+        return -1;
+    }
+    memcpy(req->line, conn->in, len);
+    req->line[len] = '\0';
+    while (len > 0 && req->line[len - 1] == '\r')
+        req->line[--len] = '\0';
+    size_t used = newline ? (size_t) (newline - conn->in) + 1 : conn->in_len;
+    memmove(conn->in, conn->in + used, conn->in_len - used);
+    conn->in_len -= used;
+
+    req->conn = conn;
+    req->response = NULL;
+    req->next = NULL;
+    conn->busy = 1;
+
+    pthread_mutex_lock(&requests.mutex);
+    if (requests.pending_tail)
+        requests.pending_tail->next = req;
+    else
+        requests.pending_head = req;
+    requests.pending_tail = req;
+    pthread_cond_signal(&requests.cond);
+    pthread_mutex_unlock(&requests.mutex);
+    return 1;
+}
+
+// Companion function for serve().
+// Passes the workers' responses to their connections.
+static void collect_responses(void)
+{
+    char buf[256];
+    while (read(requests.wake_fd[0], buf, sizeof(buf)) > 0)
+        ;
+
+    pthread_mutex_lock(&requests.mutex);
+    struct request *req = requests.done;
+    requests.done = NULL;
+    pthread_mutex_unlock(&requests.mutex);
+
+    while (req) {
+        struct request *next = req->next;
+        struct connection *conn = req->conn;
+        conn->busy = 0;
+        conn->out = req->response;
+        conn->out_len = conn->out ? strlen(conn->out) : 0;
+        conn->out_pos = 0;
+        free(req->line);
+        free(req);
+        req = next;
+    }
+}
+
+// Companion function for serve().
+// Accepts new connections; clients beyond MAX_CONNECTIONS are turned away.
+static void accept_connections(int server_fd, struct connection **conns,
+    int *n_conns)
+{
+    while (1) {
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            return;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        struct connection *conn;
+        if (*n_conns == MAX_CONNECTIONS || set_nonblocking(fd)
+            || (conn = calloc(1, sizeof(*conn))) == NULL)
+        {
+            static const char busy[] = "error Too many connections.\n";
+            if (write(fd, busy, sizeof(busy) - 1) == -1) {
+                // Nothing else to do.
+            }
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        clock_gettime(CLOCK_MONOTONIC, &conn->last_active);
+        conns[(*n_conns)++] = conn;
+    }
+}
+
+// Answers file name and metadata queries on a Unix domain socket, using a
+// pool of worker threads and an in-memory cache of scan results.
+// Only returns on error, with -1.
+int serve(const char *socket_path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: \"%s\".\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    // Replace a stale socket, but nothing else.
+    struct stat sb;
+    if (lstat(socket_path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+        unlink(socket_path);
+
+    int server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server_fd == -1
+        || bind(server_fd, (struct sockaddr *) &addr, sizeof(addr))
+        || listen(server_fd, SOMAXCONN) || set_nonblocking(server_fd))
+    {
+        fprintf(stderr, "Could not listen on socket \"%s\" (%s).\n",
+            socket_path, strerror(errno));
+        return -1;
+    }
+    if (pipe(requests.wake_fd) || set_nonblocking(requests.wake_fd[0])
+        || set_nonblocking(requests.wake_fd[1]))
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    // Disconnecting clients must not terminate the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    long n_workers = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+    if (n_workers < MIN_WORKERS)
+        n_workers = MIN_WORKERS;
+    else if (n_workers > MAX_WORKERS)
+        n_workers = MAX_WORKERS;
+    for (long i = 0; i < n_workers; i++) {
+        pthread_t thread;
+        int err;
+        if ((err = pthread_create(&thread, NULL, worker_thread, NULL)))
+            exit_err(err, __func__, __LINE__);
+        pthread_detach(thread);
+    }
+
+    if (option_verbose)
+        fprintf(stderr, "Listening on \"%s\" with %ld worker threads.\n",
+            socket_path, n_workers);
+
+    static struct connection *conns[MAX_CONNECTIONS];
+    static struct pollfd fds[MAX_CONNECTIONS + 2];
+    static struct connection *polled[MAX_CONNECTIONS + 2];
+    int n_conns = 0;
+    while (1) {
+        // Connections that wait for a worker are not polled: a client that
+        // hangs up would otherwise wake up the loop until the response is
+        // ready.
+        fds[0] = (struct pollfd) { .fd = server_fd, .events = POLLIN };
+        fds[1] = (struct pollfd) { .fd = requests.wake_fd[0], .events = POLLIN };
+        int n_fds = 2;
+        for (int i = 0; i < n_conns; i++) {
+            if (conns[i]->busy)
+                continue;
+            fds[n_fds] = (struct pollfd) {
+                .fd = conns[i]->fd,
+                .events = conns[i]->out ? POLLOUT : POLLIN,
+            };
+            polled[n_fds++] = conns[i];
+        }
+
+        if (poll(fds, n_fds, 1000) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return -1;
+        }
+
+        if (fds[1].revents)
+            collect_responses();
+        if (fds[0].revents)
+            accept_connections(server_fd, conns, &n_conns);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (int i = 2; i < n_fds; i++) {
+            struct connection *conn = polled[i];
+            if (fds[i].revents == 0)
+                continue;
+            int err;
+            if (fds[i].revents & POLLOUT)
+                err = send_response(conn);
+            else if (fds[i].revents & (POLLIN | POLLHUP))
+                err = receive_data(conn);
+            else
+                err = -1;
+            if (err)
+                conn->broken = 1;
+            else
+                conn->last_active = now;
+        }
+
+        // Start the next requests and drop finished connections.
+        for (int i = 0; i < n_conns; i++) {
+            struct connection *conn = conns[i];
+            if (conn->busy)
+                continue;
+            if (conn->broken == 0 && conn->out && send_response(conn))
+                conn->broken = 1;
+            if (conn->broken == 0 && conn->out)
+                continue;
+
+            int ret = conn->broken ? -1 : dispatch_request(conn);
+            if (ret == 1)
+                continue;
+            if (ret == 0 && conn->closing == 0
+                && now.tv_sec - conn->last_active.tv_sec < IDLE_TIMEOUT)
+                continue;
+
+            close_connection(conn);
+            conns[i--] = conns[--n_conns];
+        }
+    }
+}
+#endif
@@ -0,0 +1,400 @@
+#define _FILE_OFFSET_BITS 64
+
+#include "../include/colors.h"
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/pkg.h"
+#include "../include/render.h"
+#include "../include/scan.h"
+#include "../include/sort.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#define MAX_SORT_KEYS 8
+
+enum sort_key {
+    KEY_APP_VER,
+    KEY_CATEGORY,
+    KEY_CONTENT_ID,
+    KEY_FIRMWARE,
+    KEY_PATH,
+    KEY_REGION,
+    KEY_SDK,
+    KEY_SIZE,
+    KEY_TITLE,
+    KEY_TITLE_ID,
+    KEY_VERSION,
+};
+
+static const char *key_names[] = {
+    "app_ver", "category", "content_id", "firmware", "path", "region", "sdk",
+    "size", "title", "title_id", "version"
+};
+
+static struct {
+    enum sort_key key;
+    _Bool descending;
+} keys[MAX_SORT_KEYS];
+static int n_keys;
+static _Bool title_needed; // Pattern variables must be loaded.
+
+// A compact scan result. <data> contains the sort keys and then the file name,
+// each terminated by a NUL character. Numbers are stored zero-padded, so that
+// all keys can be compared as strings.
+struct sort_record {
+    uint64_t seq; // Position in path order; breaks ties.
+    uint64_t dev;
+    uint64_t operand_len;
+    uint64_t size; // Size of <data>.
+    char data[];
+};
+
+static struct sort_record **records;
+static size_t n_records, records_size;
+static size_t memory_used;
+
+// Sorted runs that have been written to temporary files.
+struct sort_run {
+    FILE *file;
+    struct sort_record *head; // The run's next record, or NULL at its end.
+};
+static struct sort_run *runs;
+static size_t n_runs;
+static size_t next_record; // Option --sort-by's in-memory output position.
+
+int compile_sort_keys(const char *string)
+{
+    const char *p = string;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        _Bool descending = *p == '-';
+        const char *name = p + descending;
+        size_t name_len = len - descending;
+
+        size_t i;
+        for (i = 0; i < sizeof(key_names) / sizeof(*key_names); i++)
+            if (strlen(key_names[i]) == name_len
+                && strncmp(key_names[i], name, name_len) == 0)
+                break;
+        if (i == sizeof(key_names) / sizeof(*key_names)) {
+            fprintf(stderr, "Option --sort-by: unknown key \"%.*s\".\n",
+                (int) len, p);
+            return -1;
+        }
+        if (n_keys == MAX_SORT_KEYS) {
+            fprintf(stderr, "Option --sort-by: too many keys (max. %d).\n",
+                MAX_SORT_KEYS);
+            return -1;
+        }
+        keys[n_keys].key = i;
+        keys[n_keys].descending = descending;
+        n_keys++;
+        if (i == KEY_TITLE)
+            title_needed = 1;
+
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+
+    if (n_keys == 0) {
+        fputs("Option --sort-by: no keys given.\n", stderr);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Compares two records by their keys, then by their path order.
+static int compare_records(const struct sort_record *a,
+    const struct sort_record *b)
+{
+    const char *p = a->data;
+    const char *q = b->data;
+    for (int i = 0; i < n_keys; i++) {
+        int ret = keys[i].key == KEY_TITLE ? strcasecmp(p, q) : strcmp(p, q);
+        if (ret)
+            return keys[i].descending ? -ret : ret;
+        p += strlen(p) + 1;
+        q += strlen(q) + 1;
+    }
+
+    return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+// Companion function for qsort in write_run() and collect_sort_records().
+static int qsort_compare_records(const void *p, const void *q)
+{
+    return compare_records(*(struct sort_record * const *) p,
+        *(struct sort_record * const *) q);
+}
+
+// Reads a run's next record.
+// Returns the record or NULL at the end of the run.
+static struct sort_record *read_record(FILE *file)
+{
+    struct sort_record header;
+    if (fread(&header, sizeof(header), 1, file) != 1)
+        return NULL;
+
+    struct sort_record *record = malloc(sizeof(header) + header.size);
+    if (record == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    *record = header;
+    if (fread(record->data, header.size, 1, file) != 1) {
+        fputs("Option --sort-by: could not read temporary file.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    return record;
+}
+
+// Sorts the records in memory and writes them to a new temporary file.
+static void write_run(void)
+{
+    qsort(records, n_records, sizeof(*records), qsort_compare_records);
+
+    FILE *file = tmpfile();
+    if (file == NULL) {
+        fputs("Option --sort-by: could not create temporary file.\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n_records; i++) {
+        if (fwrite(records[i], sizeof(*records[i]) + records[i]->size, 1, file)
+            != 1)
+        {
+            fputs("Option --sort-by: could not write temporary file.\n",
+                stderr);
+            exit(EXIT_FAILURE);
+        }
+        free(records[i]);
+    }
+    n_records = 0;
+    memory_used = 0;
+
+    if ((runs = realloc(runs, (n_runs + 1) * sizeof(*runs))) == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    runs[n_runs].file = file;
+    runs[n_runs].head = NULL;
+    n_runs++;
+}
+
+// Appends a string to a buffer that grows as needed.
+static void append_key(char **buf, size_t *len, size_t *size, const char *s)
+{
+    if (s == NULL)
+        s = "";
+    size_t s_len = strlen(s) + 1;
+    if (*len + s_len > *size) {
+        while (*len + s_len > *size)
+            *size = *size ? *size * 2 : 256;
+        if ((*buf = realloc(*buf, *size)) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+    }
+    memcpy(*buf + *len, s, s_len);
+    *len += s_len;
+}
+
+// Creates a scan's record.
+static void add_record(const struct scan *scan, uint64_t seq)
+{
+    static char *buf;
+    static size_t size;
+    size_t len = 0;
+
+    struct pattern_vars vars;
+    if (title_needed && load_pattern_vars(&render_context, &vars, scan)) {
+        set_color(BRIGHT_RED, stderr);
+        fprintf(stderr, "Could not read the data of file \"%s\"; skipped.\n",
+            scan->filename);
+        set_color(RESET, stderr);
+        return;
+    }
+
+    const unsigned char *param_sfo = scan->param_sfo;
+    for (int i = 0; i < n_keys; i++) {
+        char number[21];
+        const char *value = NULL;
+        switch (keys[i].key) {
+            case KEY_APP_VER:
+                value = get_param_sfo_value(param_sfo, "APP_VER");
+                break;
+            case KEY_CATEGORY:
+                value = get_param_sfo_value(param_sfo, "CATEGORY");
+                break;
+            case KEY_CONTENT_ID:
+                value = get_param_sfo_value(param_sfo, "CONTENT_ID");
+                break;
+            case KEY_FIRMWARE:
+                ;
+                uint32_t *system_ver = get_param_sfo_value(param_sfo,
+                    "SYSTEM_VER");
+                if (system_ver) {
+                    snprintf(number, sizeof(number), "%08x", *system_ver);
+                    value = number;
+                }
+                break;
+            case KEY_PATH:
+                value = scan->filename;
+                break;
+            case KEY_REGION:
+                ;
+                const char *content_id = get_param_sfo_value(param_sfo,
+                    "CONTENT_ID");
+                if (content_id) {
+                    number[0] = content_id[0];
+                    number[1] = '\0';
+                    value = number;
+                }
+                break;
+            case KEY_SDK:
+                ;
+                const char *pubtoolinfo = get_param_sfo_value(param_sfo,
+                    "PUBTOOLINFO");
+                const char *sdk = pubtoolinfo
+                    ? strstr(pubtoolinfo, "sdk_ver=") : NULL;
+                if (sdk) {
+                    snprintf(number, sizeof(number), "%.8s", sdk + 8);
+                    value = number;
+                }
+                break;
+            case KEY_SIZE:
+                ;
+                struct stat sb;
+                if (stat(scan->filename, &sb) == 0) {
+                    snprintf(number, sizeof(number), "%020llu",
+                        (unsigned long long) sb.st_size);
+                    value = number;
+                }
+                break;
+            case KEY_TITLE:
+                value = vars.title;
+                break;
+            case KEY_TITLE_ID:
+                value = get_param_sfo_value(param_sfo, "TITLE_ID");
+                break;
+            case KEY_VERSION:
+                value = get_param_sfo_value(param_sfo, "VERSION");
+                break;
+        }
+        append_key(&buf, &len, &size, value);
+    }
+    append_key(&buf, &len, &size, scan->filename);
+
+    struct sort_record *record = malloc(sizeof(*record) + len);
+    if (record == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    record->seq = seq;
+    record->dev = scan->device ? scan->device->dev : 0;
+    record->operand_len = scan->operand_len;
+    record->size = len;
+    memcpy(record->data, buf, len);
+
+    if (n_records == records_size) {
+        records_size = records_size ? records_size * 2 : 1024;
+        if ((records = realloc(records, records_size * sizeof(*records)))
+            == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+    }
+    records[n_records++] = record;
+
+    memory_used += sizeof(*record) + len + sizeof(*records);
+    if (memory_used > SORT_MEMORY_LIMIT)
+        write_run();
+}
+
+void collect_sort_records(struct scan_job *job)
+{
+    uint64_t seq = 0;
+
+    pthread_mutex_lock(&job->mutex);
+    while (job->scan_list.head == NULL && job->scan_list.finished == 0)
+        pthread_cond_wait(&job->cond, &job->mutex);
+    struct scan *scan = job->scan_list.head;
+    pthread_mutex_unlock(&job->mutex);
+
+    while (scan) {
+        wait_for_scan(job, scan);
+        if (scan->error)
+            print_scan_error(scan);
+        else if (scan->filtered == 0)
+            add_record(scan, seq++);
+
+        pthread_mutex_lock(&job->mutex);
+        while (scan->next == NULL && job->scan_list.finished == 0)
+            pthread_cond_wait(&job->cond, &job->mutex);
+        struct scan *next = scan->next;
+        pthread_mutex_unlock(&job->mutex);
+
+        // Only the record is needed from now on.
+        release_scan(job, scan);
+        scan = next;
+    }
+
+    // Records that exceeded the memory limit are merged from their runs.
+    if (n_runs) {
+        if (n_records)
+            write_run();
+        for (size_t i = 0; i < n_runs; i++) {
+            rewind(runs[i].file);
+            runs[i].head = read_record(runs[i].file);
+        }
+    } else {
+        qsort(records, n_records, sizeof(*records), qsort_compare_records);
+    }
+}
+
+// Returns the next record in sorted order, or NULL if there are none left.
+// The record must be freed.
+static struct sort_record *get_next_record(void)
+{
+    if (n_runs == 0)
+        return next_record < n_records ? records[next_record++] : NULL;
+
+    // Merge the runs; there are few of them, so a linear search will do.
+    struct sort_run *min = NULL;
+    for (size_t i = 0; i < n_runs; i++)
+        if (runs[i].head
+            && (min == NULL || compare_records(runs[i].head, min->head) < 0))
+            min = &runs[i];
+    if (min == NULL)
+        return NULL;
+
+    struct sort_record *record = min->head;
+    min->head = read_record(min->file);
+    if (min->head == NULL)
+        fclose(min->file);
+    return record;
+}
+
+void *scan_sorted_files(void *param)
+{
+    struct scan_job *job = (struct scan_job *) param;
+
+    struct sort_record *record;
+    while ((record = get_next_record()) != NULL) {
+        // The file name comes after the keys.
+        const char *filename = record->data;
+        for (int i = 0; i < n_keys; i++)
+            filename += strlen(filename) + 1;
+
+        char *copy = strdup(filename);
+        if (copy == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        job->operand_len = record->operand_len;
+        add_scan_result(job, copy, 1, record->dev);
+        free(record);
+    }
+    free(records);
+    free(runs);
+
+    finish_scan_list(job);
+
+    return NULL;
+}
@@ -0,0 +1,379 @@
+#include "../include/colors.h"
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/state.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// State file format: a header line, followed by one line per directory, each
+// followed by one line per subdirectory and PKG file. Fields are separated by
+// tabs; names come last and are not escaped, so directories that contain
+// names with newline characters are not recorded.
+//
+// D <dev> <ino> <nlink> <mtime_sec> <mtime_nsec> <path>
+// S <name>
+// F <ino> <size> <mtime_sec> <mtime_nsec> <name>
+//
+// A file's <mtime_nsec> is -1 if it has not been examined (option --since).
+#define STATE_HEADER "pkgrename state 1"
+
+#ifdef _WIN32
+#define MTIME_NSEC(sb) 0L
+#else
+#define MTIME_NSEC(sb) ((long) (sb)->st_mtim.tv_nsec)
+#endif
+
+static const char *state_filename;
+static char *temp_filename;
+static FILE *new_state; // The next state file, written while searching.
+
+// Directories of the previous run, in a hash table.
+static struct dir_state **table;
+static size_t table_size; // A power of 2.
+
+// Reads a line of any length into a dynamically growing buffer, without the
+// newline character.
+// Returns the line's length or -1 at the end of the file.
+static long read_line(char **buf, size_t *size, FILE *stream)
+{
+    size_t len = 0;
+    int c;
+
+    while ((c = getc(stream)) != EOF && c != '\n') {
+        if (len + 1 >= *size) {
+            *size = *size ? *size * 2 : 256;
+            if ((*buf = realloc(*buf, *size)) == NULL)
+                exit_err(ENOMEM, __func__, __LINE__);
+        }
+        (*buf)[len++] = c;
+    }
+
+    if (c == EOF && len == 0)
+        return -1;
+    if (*buf == NULL && (*buf = malloc(*size = 1)) == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    (*buf)[len] = '\0';
+    return len;
+}
+
+// Splits a line into <n> tab-separated fields; the last one takes the rest.
+// Returns 0 on success and -1 if there are too few fields.
+static int split_fields(char *line, char *field[], int n)
+{
+    for (int i = 0; i < n - 1; i++) {
+        field[i] = line;
+        if ((line = strchr(line, '\t')) == NULL)
+            return -1;
+        *line++ = '\0';
+    }
+    field[n - 1] = line;
+    return 0;
+}
+
+static void *grow(void *array, size_t n, size_t element_size)
+{
+    // Grow in powers of 2.
+    if (n & (n - 1))
+        return array;
+    array = realloc(array, (n ? n * 2 : 8) * element_size);
+    if (array == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    return array;
+}
+
+static char *copy_string(const char *s)
+{
+    char *copy = strdup(s);
+    if (copy == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    return copy;
+}
+
+// Companion function for load_state().
+// Returns the directories found in a state file, as a linked list.
+static struct dir_state *read_state_file(FILE *file, size_t *n_dirs)
+{
+    struct dir_state *head = NULL, *dir = NULL;
+    char *line = NULL;
+    size_t size = 0;
+    char *field[7];
+
+    *n_dirs = 0;
+    if (read_line(&line, &size, file) == -1
+        || strcmp(line, STATE_HEADER) != 0)
+        goto done;
+
+    while (read_line(&line, &size, file) != -1) {
+        if (line[0] == 'D' && split_fields(line, field, 7) == 0) {
+            if ((dir = calloc(1, sizeof(*dir))) == NULL)
+                exit_err(ENOMEM, __func__, __LINE__);
+            dir->dev = strtoull(field[1], NULL, 10);
+            dir->ino = strtoull(field[2], NULL, 10);
+            dir->nlink = strtoull(field[3], NULL, 10);
+            dir->mtime_sec = strtoll(field[4], NULL, 10);
+            dir->mtime_nsec = strtol(field[5], NULL, 10);
+            dir->path = copy_string(field[6]);
+            dir->next = head;
+            head = dir;
+            (*n_dirs)++;
+        } else if (dir && line[0] == 'S' && split_fields(line, field, 2) == 0) {
+            dir->subdirs = grow(dir->subdirs, dir->n_subdirs,
+                sizeof(*dir->subdirs));
+            dir->subdirs[dir->n_subdirs++] = copy_string(field[1]);
+        } else if (dir && line[0] == 'F' && split_fields(line, field, 6) == 0) {
+            dir->files = grow(dir->files, dir->n_files, sizeof(*dir->files));
+            struct file_state *f = &dir->files[dir->n_files++];
+            f->ino = strtoull(field[1], NULL, 10);
+            f->size = strtoll(field[2], NULL, 10);
+            f->mtime_sec = strtoll(field[3], NULL, 10);
+            f->mtime_nsec = strtol(field[4], NULL, 10);
+            f->name = copy_string(field[5]);
+        }
+    }
+
+done:
+    free(line);
+    return head;
+}
+
+int load_state(const char *filename)
+{
+    state_filename = filename;
+
+    FILE *file = fopen(filename, "rb");
+    if (file) {
+        size_t n_dirs;
+        struct dir_state *dirs = read_state_file(file, &n_dirs);
+        fclose(file);
+
+        table_size = get_table_size(n_dirs);
+        if ((table = calloc(table_size, sizeof(*table))) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        while (dirs) {
+            struct dir_state *next = dirs->next;
+            unsigned int i = hash_string(HASH_INIT, dirs->path)
+                & (table_size - 1);
+            dirs->next = table[i];
+            table[i] = dirs;
+            dirs = next;
+        }
+    }
+
+    if ((temp_filename = malloc(strlen(filename) + 5)) == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    strcpy(temp_filename, filename);
+    strcat(temp_filename, ".tmp");
+    if ((new_state = fopen(temp_filename, "wb")) == NULL) {
+        fprintf(stderr, "Could not create state file \"%s\".\n",
+            temp_filename);
+        return -1;
+    }
+    fputs(STATE_HEADER "\n", new_state);
+
+    return 0;
+}
+
+// Writes a directory's state to the next state file.
+static void write_dir_state(const struct dir_state *dir)
+{
+    fprintf(new_state, "D\t%llu\t%llu\t%llu\t%lld\t%ld\t%s\n",
+        (unsigned long long) dir->dev, (unsigned long long) dir->ino,
+        (unsigned long long) dir->nlink, dir->mtime_sec, dir->mtime_nsec,
+        dir->path);
+    for (size_t i = 0; i < dir->n_subdirs; i++)
+        fprintf(new_state, "S\t%s\n", dir->subdirs[i]);
+    for (size_t i = 0; i < dir->n_files; i++) {
+        const struct file_state *f = &dir->files[i];
+        fprintf(new_state, "F\t%llu\t%lld\t%lld\t%ld\t%s\n",
+            (unsigned long long) f->ino, (long long) f->size, f->mtime_sec,
+            f->mtime_nsec, f->name);
+    }
+}
+
+int save_state(void)
+{
+    if (new_state == NULL)
+        return -1;
+
+    // Keep directories that have not been searched in this run.
+    for (size_t i = 0; i < table_size; i++)
+        for (struct dir_state *dir = table[i]; dir; dir = dir->next)
+            if (dir->visited == 0)
+                write_dir_state(dir);
+
+    int err = ferror(new_state);
+    if (fclose(new_state) != 0)
+        err = 1;
+#ifdef _WIN32
+    if (err == 0)
+        remove(state_filename); // Windows's rename() doesn't replace files.
+#endif
+    if (err || rename(temp_filename, state_filename) != 0) {
+        set_color(BRIGHT_RED, stderr);
+        fprintf(stderr, "Could not save state file \"%s\".\n",
+            state_filename);
+        set_color(RESET, stderr);
+        remove(temp_filename);
+        new_state = NULL;
+        return -1;
+    }
+
+    new_state = NULL;
+    return 0;
+}
+
+struct dir_state *find_dir_state(const char *path)
+{
+    if (table == NULL)
+        return NULL;
+
+    struct dir_state *dir =
+        table[hash_string(HASH_INIT, path) & (table_size - 1)];
+    while (dir && strcmp(dir->path, path) != 0)
+        dir = dir->next;
+    return dir;
+}
+
+int is_dir_unchanged(const struct dir_state *state, const struct stat *sb)
+{
+    return state->mtime_nsec != -1
+        && state->dev == sb->st_dev
+        && state->ino == sb->st_ino
+        && state->nlink == sb->st_nlink
+        && state->mtime_sec == (long long) sb->st_mtime
+        && state->mtime_nsec == MTIME_NSEC(sb);
+}
+
+static int compare_file_name(const void *key, const void *element)
+{
+    return strcmp(key, ((const struct file_state *) element)->name);
+}
+
+static int is_same_file(const struct file_state *f, const struct stat *sb)
+{
+    return f->mtime_nsec != -1
+        && f->ino == sb->st_ino
+        && f->size == sb->st_size
+        && f->mtime_sec == (long long) sb->st_mtime
+        && f->mtime_nsec == MTIME_NSEC(sb);
+}
+
+// Companion function for is_file_unchanged().
+// Puts a directory's examined files in a hash table, by inode number.
+static void build_ino_table(struct dir_state *state)
+{
+    state->ino_table_size = get_table_size(state->n_files);
+    state->ino_table = calloc(state->ino_table_size,
+        sizeof(*state->ino_table));
+    if (state->ino_table == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+
+    for (size_t i = 0; i < state->n_files; i++) {
+        struct file_state *f = &state->files[i];
+        if (f->mtime_nsec == -1)
+            continue;
+        unsigned int j = hash_number(HASH_INIT, f->ino)
+            & (state->ino_table_size - 1);
+        f->next_ino = state->ino_table[j];
+        state->ino_table[j] = f;
+    }
+}
+
+int is_file_unchanged(struct dir_state *state, const char *name,
+    const struct stat *sb)
+{
+    const struct file_state *f = bsearch(name, state->files, state->n_files,
+        sizeof(*state->files), compare_file_name);
+    if (f)
+        return is_same_file(f, sb);
+
+    // Renamed files keep their inode number.
+    if (state->ino_table == NULL)
+        build_ino_table(state);
+    f = state->ino_table[hash_number(HASH_INIT, sb->st_ino)
+        & (state->ino_table_size - 1)];
+    for (; f; f = f->next_ino)
+        if (is_same_file(f, sb))
+            return 1;
+    return 0;
+}
+
+void record_dir_state(const char *path, const struct stat *sb,
+    char **subdirs, size_t n_subdirs, char **files, size_t n_files,
+    struct dir_state *old)
+{
+    if (new_state == NULL)
+        return;
+
+    for (size_t i = 0; i < n_subdirs; i++)
+        if (strchr(subdirs[i], '\n'))
+            return;
+    for (size_t i = 0; i < n_files; i++)
+        if (strchr(files[i], '\n'))
+            return;
+    if (strchr(path, '\n'))
+        return;
+
+    struct dir_state dir = {
+        .path = (char *) path,
+        .dev = sb->st_dev,
+        .ino = sb->st_ino,
+        .nlink = sb->st_nlink,
+        .mtime_sec = sb->st_mtime,
+        .mtime_nsec = MTIME_NSEC(sb),
+        .subdirs = subdirs,
+        .n_subdirs = n_subdirs,
+    };
+
+    // A directory that is modified in the same second it is read might
+    // change again without its modification time changing.
+    if (dir.mtime_sec >= (long long) time(NULL))
+        dir.mtime_nsec = -1;
+
+    // Option --since examines all files, as their contents may have changed
+    // without the directory changing. Without it, the files' data is never
+    // used, so changed directories only record their files' names.
+    if (old && is_dir_unchanged(old, sb) && option_since == 0) {
+        dir.files = old->files;
+        dir.n_files = old->n_files;
+    } else if (n_files) {
+        if ((dir.files = malloc(n_files * sizeof(*dir.files))) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        for (size_t i = 0; i < n_files; i++) {
+            if (option_since == 0) {
+                dir.files[dir.n_files++] = (struct file_state) {
+                    .name = files[i],
+                    .mtime_nsec = -1,
+                };
+                continue;
+            }
+
+            char file_path[PATH_MAX];
+            snprintf(file_path, sizeof(file_path), "%s%c%s",
+                path[0] == DIR_SEPARATOR && path[1] == '\0' ? "" : path,
+                DIR_SEPARATOR, files[i]);
+            struct stat file_sb;
+            if (stat(file_path, &file_sb) != 0)
+                memset(&file_sb, 0, sizeof(file_sb));
+            dir.files[dir.n_files++] = (struct file_state) {
+                .name = files[i],
+                .ino = file_sb.st_ino,
+                .size = file_sb.st_size,
+                .mtime_sec = file_sb.st_mtime,
+                .mtime_nsec = MTIME_NSEC(&file_sb),
+            };
+        }
+    }
+
+    write_dir_state(&dir);
+
+    if (dir.files != (old ? old->files : NULL))
+        free(dir.files);
+    if (old)
+        old->visited = 1;
+}
@@ -0,0 +1,241 @@
+#include "../include/storepage.h"
+
+#include <string.h>
+
+#define SCRIPT_TYPE "application/ld+json"
+
+void init_store_page_parser(struct store_page_parser *parser)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->state = STORE_PAGE_SEEK_SCRIPT;
+}
+
+// Returns the number of characters of <pattern> that are matched after
+// character <c>, given that <match> characters had been matched before.
+static size_t match_next(const char *pattern, size_t match, char c)
+{
+    for (;;) {
+        if (pattern[match] == c)
+            return match + 1;
+        if (match == 0)
+            return 0;
+
+        // Fall back to the longest proper prefix that is also a suffix.
+        size_t k = match - 1;
+        while (k > 0 && strncmp(pattern, pattern + match - k, k) != 0)
+            k--;
+        match = k;
+    }
+}
+
+static void append_char(struct store_page_parser *parser, char c)
+{
+    if (parser->string_len < sizeof(parser->string) - 1)
+        parser->string[parser->string_len++] = c;
+}
+
+// Appends a Unicode code point as UTF-8.
+static void append_code_point(struct store_page_parser *parser,
+    unsigned long cp)
+{
+    if (cp < 0x80) {
+        append_char(parser, cp);
+    } else if (cp < 0x800) {
+        append_char(parser, 0xC0 | (cp >> 6));
+        append_char(parser, 0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        append_char(parser, 0xE0 | (cp >> 12));
+        append_char(parser, 0x80 | ((cp >> 6) & 0x3F));
+        append_char(parser, 0x80 | (cp & 0x3F));
+    } else {
+        append_char(parser, 0xF0 | (cp >> 18));
+        append_char(parser, 0x80 | ((cp >> 12) & 0x3F));
+        append_char(parser, 0x80 | ((cp >> 6) & 0x3F));
+        append_char(parser, 0x80 | (cp & 0x3F));
+    }
+}
+
+// Handles the code point of a finished "\u" escape sequence.
+static void end_unicode_escape(struct store_page_parser *parser)
+{
+    unsigned long cp = parser->code_point;
+
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+        parser->high_surrogate = cp;
+        return;
+    }
+    if (cp >= 0xDC00 && cp <= 0xDFFF) {
+        if (parser->high_surrogate == 0)
+            return; // Invalid; ignore.
+        cp = 0x10000 + ((parser->high_surrogate - 0xD800) << 10)
+            + (cp - 0xDC00);
+    }
+    parser->high_surrogate = 0;
+    append_code_point(parser, cp);
+}
+
+// Depth at which the members of the JSON-LD objects are found.
+static int member_depth(const struct store_page_parser *parser)
+{
+    return parser->root == '[' ? 2 : 1;
+}
+
+// Handles a finished JSON string.
+static void end_string(struct store_page_parser *parser)
+{
+    parser->string[parser->string_len] = '\0';
+
+    if (parser->depth != member_depth(parser))
+        return;
+
+    if (parser->expect_value == 0) {
+        if (parser->string_len < sizeof(parser->key))
+            strcpy(parser->key, parser->string);
+        else
+            parser->key[0] = '\0';
+    } else if (strcmp(parser->key, "@type") == 0) {
+        parser->is_product = strcmp(parser->string, "Product") == 0;
+    } else if (strcmp(parser->key, "name") == 0) {
+        strcpy(parser->name, parser->string);
+        parser->has_name = 1;
+    }
+
+    if (parser->is_product && parser->has_name)
+        parser->state = STORE_PAGE_DONE;
+}
+
+// Parses a character of JSON data.
+static void parse_json_char(struct store_page_parser *parser, char c)
+{
+    if (parser->in_string) {
+        if (parser->hex_digits) {
+            int digit;
+            if (c >= '0' && c <= '9')
+                digit = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                digit = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                digit = c - 'A' + 10;
+            else
+                digit = 0; // Invalid; ignore.
+            parser->code_point = parser->code_point * 16 + digit;
+            if (--parser->hex_digits == 0)
+                end_unicode_escape(parser);
+        } else if (parser->escape) {
+            parser->escape = 0;
+            switch (c) {
+                case 'u':
+                    parser->hex_digits = 4;
+                    parser->code_point = 0;
+                    break;
+                case 'b':
+                case 'f':
+                case 'n':
+                case 'r':
+                case 't':
+                    append_char(parser, ' ');
+                    break;
+                default: // '"', '\\', '/'
+                    append_char(parser, c);
+            }
+        } else if (c == '\\') {
+            parser->escape = 1;
+        } else if (c == '"') {
+            parser->in_string = 0;
+            end_string(parser);
+        } else {
+            append_char(parser, c);
+        }
+        return;
+    }
+
+    switch (c) {
+        case '"':
+            parser->in_string = 1;
+            parser->string_len = 0;
+            parser->high_surrogate = 0;
+            break;
+        case '{':
+        case '[':
+            if (parser->depth == 0)
+                parser->root = c;
+            parser->depth++;
+            if (c == '{' && parser->depth == member_depth(parser)) {
+                parser->key[0] = '\0';
+                parser->expect_value = 0;
+                parser->is_product = 0;
+                parser->has_name = 0;
+            }
+            break;
+        case '}':
+        case ']':
+            if (c == '}' && parser->depth == member_depth(parser)
+                && parser->is_product)
+                parser->found_product = 1;
+            if (--parser->depth <= 0) {
+                parser->depth = 0;
+                parser->state = STORE_PAGE_SEEK_SCRIPT;
+            }
+            break;
+        case ':':
+            if (parser->depth == member_depth(parser))
+                parser->expect_value = 1;
+            break;
+        case ',':
+            if (parser->depth == member_depth(parser))
+                parser->expect_value = 0;
+            break;
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+            break;
+        default:
+            // Numbers and literals are skipped; anything that is not JSON
+            // (e.g. "</script>") ends the JSON data.
+            if (c == '<' || (parser->depth == 0)) {
+                parser->depth = 0;
+                parser->state = STORE_PAGE_SEEK_SCRIPT;
+            }
+    }
+}
+
+int parse_store_page(struct store_page_parser *parser, const char *data,
+    size_t len)
+{
+    for (size_t i = 0; i < len && parser->state != STORE_PAGE_DONE; i++) {
+        char c = data[i];
+        switch (parser->state) {
+            case STORE_PAGE_SEEK_SCRIPT:
+                parser->match = match_next(SCRIPT_TYPE, parser->match, c);
+                if (parser->match == sizeof(SCRIPT_TYPE) - 1) {
+                    parser->match = 0;
+                    parser->state = STORE_PAGE_SEEK_JSON;
+                }
+                break;
+            case STORE_PAGE_SEEK_JSON:
+                if (c == '>') {
+                    parser->depth = 0;
+                    parser->in_string = 0;
+                    parser->escape = 0;
+                    parser->hex_digits = 0;
+                    parser->state = STORE_PAGE_JSON;
+                }
+                break;
+            case STORE_PAGE_JSON:
+                parse_json_char(parser, c);
+                break;
+            case STORE_PAGE_DONE:
+                break;
+        }
+    }
+
+    return parser->state == STORE_PAGE_DONE;
+}
+
+const char *get_store_page_title(const struct store_page_parser *parser)
+{
+    if (parser->state != STORE_PAGE_DONE || parser->name[0] == '\0')
+        return NULL;
+    return parser->name;
+}
@@ -10,6 +10,10 @@
 #endif
 
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // Removes leading and/or trailing characters from a string.
@@ -61,25 +65,6 @@ inline char *strwrd(const char *string, char *word)
     return NULL;
 }
 
-// Case-insensitively replaces all occurences of a word in a character array
-// "string" must be of length MAX_FILENAME_LEN
-static void replace_word(char *string, char *word, char *replace)
-{
-    char *p = string;
-    size_t word_len = strlen(word);
-    size_t replace_len = strlen(replace);
-
-    while ((p = strwrd(p, word))) {
-        // Abort if new string length would be too large
-        if (strlen(string) - word_len + replace_len > MAX_FILENAME_LEN) return;
-
-        memmove(p + replace_len, p + word_len, strlen(p + word_len) + 1);
-        memcpy(p, replace, replace_len);
-
-        p++;
-    }
-}
-
 // Removes unused curly braces expressions; returns 0 on success
 static int curlycrunch(char *string, int position)
 {
@@ -147,10 +132,385 @@ inline char *strreplace(char *string, char *search, char *replace)
     return p;
 }
 
+// Words and phrases whose spelling mixed_case() keeps. Where they overlap in a
+// title, the later one wins.
+static const char *builtin_special_words[] = {
+    // Roman numerals
+    "I", "II", "III", "IV", "V", "VI", "VII", "VIII", "IX", "X", "XI", "XII",
+    "XIII", "XIV", "XV", "XVI", "XVII", "XVIII", "XVIX", "XX",
+    // Games
+    "20XX",
+    "2Dark",
+    "2K",
+    "2K14",
+    "2K15",
+    "2K16",
+    "2K17",
+    "2K18",
+    "2K19",
+    "2K20",
+    "2K21",
+    "2K22",
+    "2X",
+    "3D",
+    "4K",
+    "ABC",
+    "ACA",
+    "ADR1FT",
+    "AER",
+    "AI",
+    "AO",
+    "ARK",
+    "ATV",
+    "AVICII",
+    "AdVenture",
+    "AereA",
+    "AeternoBlade",
+    "AnywhereVR",
+    "ArmaGallant",
+    "Avenger iX",
+    "BMX",
+    "BaZooka",
+    "BioHazard",
+    "BioShock",
+    "BlazBlue",
+    "BlazeRush",
+    "BloodRayne",
+    "BoxVR",
+    "CastleStorm",
+    "ChromaGun",
+    "CrossCode",
+    "CruisinMix",
+    "DC",
+    "DCL",
+    "DEX",
+    "DG2",
+    "DX",
+    "DJMax",
+    "DLC",
+    "DS",
+    "DUB",
+    "DWVR",
+    "DarkWatch",
+    "DayZ",
+    "DmC",
+    "DreamMix",
+    "DreamWorks",
+    "EA",
+    "EBKore",
+    "ECHO",
+    "EFootball",
+    "EP",
+    "ESP",
+    "ESPN",
+    "EVE",
+    "EX",
+    "EXA",
+    "EarthNight",
+    "FEZ",
+    "FIA",
+    "FIFA",
+    "F.I.S.T.",
+    "FX2",
+    "FX3",
+    "FantaVision",
+    "Fate/Extella",
+    "FightN",
+    "FighterZ",
+    "FlOw",
+    "FlatOut",
+    "GI",
+    "GODS",
+    "GP",
+    "Gris",
+    "GU",
+    "GoldenEye",
+    "GreedFall",
+    "HD",
+    "HOA",
+    "HiQ",
+    "Hitman GO",
+    "ICO",
+    "IF",
+    "InFamous",
+    "IxSHE",
+    "JJ",
+    "JoJos",
+    "JoyRide",
+    "JumpJet",
+    "KO",
+    "KOI",
+    "KeyWe",
+    "KickBeat",
+    "LA Cops",
+    "LittleBigPlanet",
+    "LocoRoco",
+    "LoveR Kiss",
+    "MLB",
+    "MS",
+    "MV",
+    "MX",
+    "MXGP",
+    "MalFunction",
+    "MasterCube",
+    "McIlroy",
+    "McMorris",
+    "MechWarrior",
+    "MediEvil",
+    "MegaDrive",
+    "MotoGP",
+    "MudRunner",
+    "NASCAR",
+    "NBA",
+    "N.E.R.O.",
+    "NESTS",
+    "NFL",
+    "NG",
+    "NHL",
+    "NT",
+    "NY",
+    "NecroDancer",
+    "NeoGeo",
+    "NeoWave",
+    "NeuroVoider",
+    "NieR",
+    "OG",
+    "OK",
+    "OMG",
+    "OhShape",
+    "OlliOlli",
+    "OutRun",
+    "OwlBoy",
+    "PAW",
+    "PES",
+    "PGA",
+    "PS2",
+    "PS4",
+    "PSN",
+    "PaRappa",
+    "PixARK",
+    "PixelJunk",
+    "PlayStation",
+    "Project CARS",
+    "ProStreet",
+    "QuiVr",
+    "RBI",
+    "REV",
+    "RICO",
+    "RIGS",
+    "RiME",
+    "RPG",
+    "RemiLore",
+    "RiMS",
+    "RollerCoaster",
+    "Romancing SaGa",
+    "RyoRaiRai",
+    "SD",
+    "SG/ZH",
+    "SH1FT3R",
+    "SNES",
+    "SNK",
+    "SSX",
+    "SVC",
+    "SaGa Frontier",
+    "SaGa Scarlet",
+    "SkullGirls",
+    "SkyScrappers",
+    "SmackDown",
+    "SnowRunner",
+    "SoulCalibur",
+    "SpeedRunners",
+    "SpinMaster",
+    "SquarePants",
+    "SteamWorld",
+    "SuperChargers",
+    "SuperEpic",
+    "TMNT",
+    "Tron RUN/r",
+    "TT",
+    "TV",
+    "ToeJam",
+    "TowerFall",
+    "TrackMania",
+    "TrainerVR",
+    "UEFA",
+    "UFC",
+    "UN",
+    "UNO",
+    "UglyDolls",
+    "UnMetal",
+    "VA",
+    "VFR",
+    "VIIR",
+    "VR",
+    "VRobot",
+    "VRog",
+    "VirZOOM",
+    "WMD",
+    "WRC",
+    "WWE",
+    "WWII",
+    "WindJammers",
+    "XCOM",
+    "XD",
+    "XL",
+    "XXL",
+    "YU-NO",
+    "YoRHa",
+    "ZX",
+    "eSports",
+    "eX+",
+    "pFBA",
+    "pNES",
+    "pSNES",
+    "reQuest",
+    "tRrLM();",
+    "theHunter",
+    "vs",
+    NULL
+};
+
+// The special words are looked up by their first token (leading letters and
+// digits) in a hash table, so each of a title's tokens is looked up once
+// instead of searching the title for every word.
+struct special_word {
+    const char *word;
+    size_t len;
+    int next; // Next word in the same hash table bucket, or -1.
+};
+
+static struct special_word *special_words;
+static int n_special_words, special_words_size;
+static int *special_words_table; // First word of each bucket, or -1.
+static unsigned int special_words_mask; // Table size - 1 (a power of 2).
+static int first_unhashed = -1; // First word that doesn't start with a token.
+static pthread_once_t special_words_once = PTHREAD_ONCE_INIT;
+
+// Returns the length of the token at the start of a string.
+static size_t token_len(const char *s)
+{
+    size_t len = 0;
+    while (isalnum((unsigned char) s[len]))
+        len++;
+    return len;
+}
+
+static unsigned int hash_token(const char *token, size_t len)
+{
+    unsigned int hash = HASH_INIT;
+    for (size_t i = 0; i < len; i++)
+        hash = hash_byte(hash, tolower((unsigned char) token[i]));
+    return hash;
+}
+
+// Companion function for add_special_word().
+// Links a word into the hash table, or into the list of words that can't be
+// hashed.
+static void link_special_word(int i)
+{
+    struct special_word *sw = &special_words[i];
+    size_t len = token_len(sw->word);
+    int *head = len ? &special_words_table[hash_token(sw->word, len)
+        & special_words_mask] : &first_unhashed;
+    sw->next = *head;
+    *head = i;
+}
+
+static void add_special_word(const char *word)
+{
+    if (n_special_words == special_words_size) {
+        special_words_size = special_words_size ? special_words_size * 2 : 512;
+        special_words = realloc(special_words,
+            special_words_size * sizeof(*special_words));
+        if (special_words == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+    }
+    special_words[n_special_words].word = word;
+    special_words[n_special_words].len = strlen(word);
+    n_special_words++;
+
+    // Keep the table at most half full.
+    if ((unsigned int) n_special_words * 2 > special_words_mask + 1) {
+        unsigned int size = special_words_mask ? (special_words_mask + 1) * 2
+            : 1024;
+        free(special_words_table);
+        if ((special_words_table = malloc(size * sizeof(int))) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        memset(special_words_table, -1, size * sizeof(int));
+        special_words_mask = size - 1;
+        first_unhashed = -1;
+        for (int i = 0; i < n_special_words; i++)
+            link_special_word(i);
+    } else {
+        link_special_word(n_special_words - 1);
+    }
+}
+
+static void initialize_special_words(void)
+{
+    for (int i = 0; builtin_special_words[i]; i++)
+        add_special_word(builtin_special_words[i]);
+}
+
+int load_special_words(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", filename);
+        return -1;
+    }
+
+    pthread_once(&special_words_once, initialize_special_words);
+
+    char buf[MAX_TITLE_LEN + 1];
+    while (fgets(buf, sizeof(buf), file)) {
+        size_t len = strcspn(buf, "\r\n");
+        if (buf[len] == '\0' && !feof(file)) {
+            // Longer than any title; skip the rest of the line.
+            int c;
+            while ((c = fgetc(file)) != EOF && c != '\n')
+                ;
+            continue;
+        }
+        buf[len] = '\0';
+        if (buf[0] == '\0' || buf[0] == '#')
+            continue;
+
+        char *word = strdup(buf);
+        if (word == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        add_special_word(word);
+    }
+
+    fclose(file);
+    return 0;
+}
+
+// Companion function for mixed_case().
+// Applies special word <i>'s spelling if it is found at <p>, unless a later
+// word has already been applied to the same characters.
+static void apply_special_word(char *title, char *p, int i, int *applied)
+{
+    const struct special_word *sw = &special_words[i];
+    if (strncasecmp(p, sw->word, sw->len) != 0
+        || isalnum((unsigned char) p[sw->len])
+        || (p != title && isalnum((unsigned char) p[-1])))
+        return;
+
+    for (size_t j = 0; j < sw->len; j++) {
+        if (applied[p - title + j] < i) {
+            p[j] = sw->word[j];
+            applied[p - title + j] = i;
+        }
+    }
+}
+
 // Converts a string (title, to be specific) to mixed-case style
 void mixed_case(char *title)
 {
     int len = strlen(title);
+    if (len == 0)
+        return;
 
     // Apply mixed-case style
     title[0] = toupper(title[0]);
@@ -163,243 +523,26 @@ void mixed_case(char *title)
     }
 
     // Make sure certain words are spelled correctly
-    char *special_words[] = {
-        // Roman numerals
-        "I", "II", "III", "IV", "V", "VI", "VII", "VIII", "IX", "X", "XI", "XII",
-        "XIII", "XIV", "XV", "XVI", "XVII", "XVIII", "XVIX", "XX",
-        // Games
-        "20XX",
-        "2Dark",
-        "2K",
-        "2K14",
-        "2K15",
-        "2K16",
-        "2K17",
-        "2K18",
-        "2K19",
-        "2K20",
-        "2K21",
-        "2K22",
-        "2X",
-        "3D",
-        "4K",
-        "ABC",
-        "ACA",
-        "ADR1FT",
-        "AER",
-        "AI",
-        "AO",
-        "ARK",
-        "ATV",
-        "AVICII",
-        "AdVenture",
-        "AereA",
-        "AeternoBlade",
-        "AnywhereVR",
-        "ArmaGallant",
-        "Avenger iX",
-        "BMX",
-        "BaZooka",
-        "BioHazard",
-        "BioShock",
-        "BlazBlue",
-        "BlazeRush",
-        "BloodRayne",
-        "BoxVR",
-        "CastleStorm",
-        "ChromaGun",
-        "CrossCode",
-        "CruisinMix",
-        "DC",
-        "DCL",
-        "DEX",
-        "DG2",
-        "DX",
-        "DJMax",
-        "DLC",
-        "DS",
-        "DUB",
-        "DWVR",
-        "DarkWatch",
-        "DayZ",
-        "DmC",
-        "DreamMix",
-        "DreamWorks",
-        "EA",
-        "EBKore",
-        "ECHO",
-        "EFootball",
-        "EP",
-        "ESP",
-        "ESPN",
-        "EVE",
-        "EX",
-        "EXA",
-        "EarthNight",
-        "FEZ",
-        "FIA",
-        "FIFA",
-        "F.I.S.T.",
-        "FX2",
-        "FX3",
-        "FantaVision",
-        "Fate/Extella",
-        "FightN",
-        "FighterZ",
-        "FlOw",
-        "FlatOut",
-        "GI",
-        "GODS",
-        "GP",
-        "Gris",
-        "GU",
-        "GoldenEye",
-        "GreedFall",
-        "HD",
-        "HOA",
-        "HiQ",
-        "Hitman GO",
-        "ICO",
-        "IF",
-        "InFamous",
-        "IxSHE",
-        "JJ",
-        "JoJos",
-        "JoyRide",
-        "JumpJet",
-        "KO",
-        "KOI",
-        "KeyWe",
-        "KickBeat",
-        "LA Cops",
-        "LittleBigPlanet",
-        "LocoRoco",
-        "LoveR Kiss",
-        "MLB",
-        "MS",
-        "MV",
-        "MX",
-        "MXGP",
-        "MalFunction",
-        "MasterCube",
-        "McIlroy",
-        "McMorris",
-        "MechWarrior",
-        "MediEvil",
-        "MegaDrive",
-        "MotoGP",
-        "MudRunner",
-        "NASCAR",
-        "NBA",
-        "N.E.R.O.",
-        "NESTS",
-        "NFL",
-        "NG",
-        "NHL",
-        "NT",
-        "NY",
-        "NecroDancer",
-        "NeoGeo",
-        "NeoWave",
-        "NeuroVoider",
-        "NieR",
-        "OG",
-        "OK",
-        "OMG",
-        "OhShape",
-        "OlliOlli",
-        "OutRun",
-        "OwlBoy",
-        "PAW",
-        "PES",
-        "PGA",
-        "PS2",
-        "PS4",
-        "PSN",
-        "PaRappa",
-        "PixARK",
-        "PixelJunk",
-        "PlayStation",
-        "Project CARS",
-        "ProStreet",
-        "QuiVr",
-        "RBI",
-        "REV",
-        "RICO",
-        "RIGS",
-        "RiME",
-        "RPG",
-        "RemiLore",
-        "RiMS",
-        "RollerCoaster",
-        "Romancing SaGa",
-        "RyoRaiRai",
-        "SD",
-        "SG/ZH",
-        "SH1FT3R",
-        "SNES",
-        "SNK",
-        "SSX",
-        "SVC",
-        "SaGa Frontier",
-        "SaGa Scarlet",
-        "SkullGirls",
-        "SkyScrappers",
-        "SmackDown",
-        "SnowRunner",
-        "SoulCalibur",
-        "SpeedRunners",
-        "SpinMaster",
-        "SquarePants",
-        "SteamWorld",
-        "SuperChargers",
-        "SuperEpic",
-        "TMNT",
-        "Tron RUN/r",
-        "TT",
-        "TV",
-        "ToeJam",
-        "TowerFall",
-        "TrackMania",
-        "TrainerVR",
-        "UEFA",
-        "UFC",
-        "UN",
-        "UNO",
-        "UglyDolls",
-        "UnMetal",
-        "VA",
-        "VFR",
-        "VIIR",
-        "VR",
-        "VRobot",
-        "VRog",
-        "VirZOOM",
-        "WMD",
-        "WRC",
-        "WWE",
-        "WWII",
-        "WindJammers",
-        "XCOM",
-        "XD",
-        "XL",
-        "XXL",
-        "YU-NO",
-        "YoRHa",
-        "ZX",
-        "eSports",
-        "eX+",
-        "pFBA",
-        "pNES",
-        "pSNES",
-        "reQuest",
-        "tRrLM();",
-        "theHunter",
-        "vs",
-        NULL
-    };
-    for (int i = 0; special_words[i]; i++) {
-        replace_word(title, special_words[i], special_words[i]);
+    pthread_once(&special_words_once, initialize_special_words);
+    int applied[len]; // Index of the special word applied to each character.
+    for (int i = 0; i < len; i++)
+        applied[i] = -1;
+
+    for (int i = 0; i < len; i++) {
+        // Look up each token.
+        if (i && isalnum((unsigned char) title[i - 1]))
+            continue;
+        size_t n = token_len(title + i);
+        if (n) {
+            unsigned int hash = hash_token(title + i, n);
+            for (int w = special_words_table[hash & special_words_mask];
+                w != -1; w = special_words[w].next)
+                apply_special_word(title, title + i, w, applied);
+        }
+
+        // Words that don't start with a token may start anywhere.
+        for (int w = first_unhashed; w != -1; w = special_words[w].next)
+            apply_special_word(title, title + i, w, applied);
     }
 }
 
@@ -0,0 +1,474 @@
+#define _FILE_OFFSET_BITS 64
+
+#include "../include/colors.h"
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/titledb.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define TITLE_DB_MAGIC "PKGRNTDB"
+#define TITLE_DB_VERSION 1
+#define MAX_CONTENT_ID_LEN 36
+#define BUCKET_SIZE 4 // Average number of keys per bucket.
+#define MAX_DISPLACEMENT 100000000
+#define EMPTY_SLOT UINT32_MAX
+
+// Compiled title database ("hash and displace" perfect hashing): a key's
+// bucket is selected by hash(key, 0); the bucket's displacement d then selects
+// the key's slot by hash(key, d). Displacements are chosen at compile time so
+// that no two keys share a slot.
+struct title_db_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_buckets;
+    uint32_t n_slots;
+    uint32_t n_entries;
+    uint64_t dump_size; // Size and modification time of the text file the
+    int64_t dump_mtime; // table has been compiled from.
+    uint64_t size; // Size of the whole table, in bytes.
+};
+// The header is followed by:
+// uint32_t displacements[n_buckets]; // 0: empty bucket.
+// uint32_t slots[n_slots]; // Entry offsets in the string area or EMPTY_SLOT.
+// char strings[]; // Entries, each "CONTENT_ID\0TITLE\0".
+
+static struct {
+    const struct title_db_header *header;
+    const uint32_t *displacements;
+    const uint32_t *slots;
+    const char *strings;
+    size_t strings_size;
+} db;
+
+struct entry {
+    const char *key;
+    const char *title;
+    size_t index; // Line order; later lines override earlier ones.
+    uint32_t bucket;
+};
+
+static uint32_t hash(const char *key, uint32_t seed)
+{
+    uint64_t h = 14695981039346656037ULL ^ (seed * 0x9E3779B97F4A7C15ULL);
+    for (; *key; key++) { // FNV-1a
+        h ^= (unsigned char) *key;
+        h *= 1099511628211ULL;
+    }
+
+    // Final mix (MurmurHash3's fmix64), as Content IDs differ in few bits.
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return (uint32_t) h;
+}
+
+const char *lookup_title_db(const char *content_id)
+{
+    if (db.header == NULL || content_id == NULL)
+        return NULL;
+
+    uint32_t d = db.displacements[hash(content_id, 0) % db.header->n_buckets];
+    if (d == 0)
+        return NULL;
+    uint32_t offset = db.slots[hash(content_id, d) % db.header->n_slots];
+    if (offset >= db.strings_size)
+        return NULL;
+
+    const char *key = db.strings + offset;
+    if (strcmp(key, content_id) != 0)
+        return NULL;
+    const char *title = key + strlen(key) + 1;
+    return title < db.strings + db.strings_size ? title : NULL;
+}
+
+// Sets up the global database for a compiled table in memory.
+// Returns 0 on success and -1 if the table is invalid.
+static int use_table(const void *table, size_t size)
+{
+    const struct title_db_header *header = table;
+
+    if (size < sizeof(*header)
+        || memcmp(header->magic, TITLE_DB_MAGIC, sizeof(header->magic)) != 0
+        || header->version != TITLE_DB_VERSION
+        || header->size != size
+        || header->n_buckets == 0 || header->n_slots == 0)
+        return -1;
+
+    uint64_t arrays_size = ((uint64_t) header->n_buckets + header->n_slots)
+        * sizeof(uint32_t);
+    if (arrays_size > size - sizeof(*header))
+        return -1;
+    size_t strings_size = size - sizeof(*header) - arrays_size;
+    const char *strings = (const char *) table + sizeof(*header) + arrays_size;
+    if (strings_size == 0 || strings[strings_size - 1] != '\0')
+        return -1;
+
+    db.header = header;
+    db.displacements = (const uint32_t *) (header + 1);
+    db.slots = db.displacements + header->n_buckets;
+    db.strings = strings;
+    db.strings_size = strings_size;
+    return 0;
+}
+
+// Reads or memory-maps a whole file.
+// Returns a pointer to the file's contents or NULL on error.
+static void *map_file(const char *filename, size_t *size)
+{
+#ifdef _WIN32
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return NULL;
+    void *data = NULL;
+    if (fseeko(file, 0, SEEK_END) == 0) {
+        off_t len = ftello(file);
+        if (len > 0 && fseeko(file, 0, SEEK_SET) == 0
+            && (data = malloc(len)) != NULL
+            && fread(data, 1, len, file) != (size_t) len)
+        {
+            free(data);
+            data = NULL;
+        }
+        *size = len;
+    }
+    fclose(file);
+    return data;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    struct stat sb;
+    void *data = NULL;
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+        data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+        *size = sb.st_size;
+    }
+    close(fd);
+    return data;
+#endif
+}
+
+static void unmap_file(void *data, size_t size)
+{
+#ifdef _WIN32
+    (void) size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct entry *x = a;
+    const struct entry *y = b;
+    int ret = strcmp(x->key, y->key);
+    if (ret)
+        return ret;
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+// Parses a text file's contents (modified in place) into an array of entries,
+// sorted by key, with duplicate keys removed.
+// Returns the number of entries or -1 on error.
+static ssize_t parse_dump(char *text, size_t size, struct entry **entries)
+{
+    size_t n = 0;
+    size_t capacity = 1024;
+    struct entry *e = malloc(capacity * sizeof(*e));
+    if (e == NULL)
+        return -1;
+
+    char *p = text;
+    char *end = text + size;
+    while (p < end) {
+        char *line = p;
+        char *nl = memchr(p, '\n', end - p);
+        if (nl) {
+            *nl = '\0';
+            p = nl + 1;
+        } else {
+            p = end;
+            *end = '\0';
+        }
+
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] == '\r')
+            line[--len] = '\0';
+        if (line[0] == '#' || line[0] == '\0')
+            continue;
+
+        char *title = line + strcspn(line, "\t ");
+        if (*title == '\0' || title - line > MAX_CONTENT_ID_LEN)
+            continue;
+        *title++ = '\0';
+        title += strspn(title, "\t ");
+        if (*title == '\0')
+            continue;
+
+        if (n == capacity) {
+            capacity *= 2;
+            struct entry *new_e = realloc(e, capacity * sizeof(*e));
+            if (new_e == NULL) {
+                free(e);
+                return -1;
+            }
+            e = new_e;
+        }
+        e[n].key = line;
+        e[n].title = title;
+        e[n].index = n;
+        n++;
+    }
+
+    // Remove duplicates, keeping the last one.
+    qsort(e, n, sizeof(*e), compare_entries);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i + 1 < n && strcmp(e[i].key, e[i + 1].key) == 0)
+            continue;
+        e[unique++] = e[i];
+    }
+
+    *entries = e;
+    return unique;
+}
+
+// Compiles a title database from a text file's entries.
+// Returns a dynamically allocated table (its size is stored in the header) or
+// NULL on error.
+static struct title_db_header *compile_table(struct entry *entries, size_t n)
+{
+    struct title_db_header *header = NULL;
+    uint32_t n_buckets = n / BUCKET_SIZE + 1;
+    uint32_t n_slots = n + n / 4 + 1;
+    size_t strings_size = 1; // The string area must not be empty.
+    for (size_t i = 0; i < n; i++)
+        strings_size += strlen(entries[i].key) + strlen(entries[i].title) + 2;
+    uint64_t size = sizeof(*header)
+        + ((uint64_t) n_buckets + n_slots) * sizeof(uint32_t) + strings_size;
+    if (n >= EMPTY_SLOT / 2 || strings_size >= EMPTY_SLOT || size > SIZE_MAX)
+        return NULL;
+
+    uint32_t *bucket_start = calloc(n_buckets + 1, sizeof(uint32_t));
+    uint32_t *order = malloc(n_buckets * sizeof(uint32_t));
+    struct entry *sorted = malloc((n ? n : 1) * sizeof(*sorted));
+    uint32_t *positions = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (bucket_start == NULL || order == NULL || sorted == NULL
+        || positions == NULL || (header = calloc(1, size)) == NULL)
+        goto cleanup;
+
+    memcpy(header->magic, TITLE_DB_MAGIC, sizeof(header->magic));
+    header->version = TITLE_DB_VERSION;
+    header->n_buckets = n_buckets;
+    header->n_slots = n_slots;
+    header->n_entries = n;
+    header->size = size;
+    uint32_t *displacements = (uint32_t *) (header + 1);
+    uint32_t *slots = displacements + n_buckets;
+    char *strings = (char *) (slots + n_slots);
+    for (uint32_t i = 0; i < n_slots; i++)
+        slots[i] = EMPTY_SLOT;
+
+    // Group entries by bucket (counting sort).
+    for (size_t i = 0; i < n; i++) {
+        entries[i].bucket = hash(entries[i].key, 0) % n_buckets;
+        bucket_start[entries[i].bucket + 1]++;
+    }
+    for (uint32_t i = 0; i < n_buckets; i++)
+        bucket_start[i + 1] += bucket_start[i];
+    for (size_t i = 0; i < n; i++)
+        positions[i] = bucket_start[entries[i].bucket]++;
+    for (size_t i = 0; i < n; i++)
+        sorted[positions[i]] = entries[i];
+    for (uint32_t i = n_buckets; i > 0; i--)
+        bucket_start[i] = bucket_start[i - 1];
+    bucket_start[0] = 0;
+
+    // Place the largest buckets first, while most slots are still free.
+    uint32_t max_bucket_size = 0;
+    for (uint32_t i = 0; i < n_buckets; i++) {
+        uint32_t bucket_size = bucket_start[i + 1] - bucket_start[i];
+        if (bucket_size > max_bucket_size)
+            max_bucket_size = bucket_size;
+    }
+    uint32_t n_ordered = 0;
+    for (uint32_t s = max_bucket_size; s > 0; s--)
+        for (uint32_t i = 0; i < n_buckets; i++)
+            if (bucket_start[i + 1] - bucket_start[i] == s)
+                order[n_ordered++] = i;
+
+    size_t strings_len = 1;
+    for (uint32_t i = 0; i < n_ordered; i++) {
+        uint32_t b = order[i];
+        struct entry *bucket = sorted + bucket_start[b];
+        uint32_t bucket_size = bucket_start[b + 1] - bucket_start[b];
+
+        uint32_t d;
+        for (d = 1; d < MAX_DISPLACEMENT; d++) {
+            uint32_t j;
+            for (j = 0; j < bucket_size; j++) {
+                positions[j] = hash(bucket[j].key, d) % n_slots;
+                if (slots[positions[j]] != EMPTY_SLOT)
+                    break;
+                uint32_t k;
+                for (k = 0; k < j && positions[k] != positions[j]; k++)
+                    ;
+                if (k < j)
+                    break;
+            }
+            if (j == bucket_size)
+                break;
+        }
+        if (d == MAX_DISPLACEMENT) {
+            free(header);
+            header = NULL;
+            goto cleanup;
+        }
+
+        displacements[b] = d;
+        for (uint32_t j = 0; j < bucket_size; j++) {
+            slots[positions[j]] = strings_len;
+            size_t key_len = strlen(bucket[j].key) + 1;
+            size_t title_len = strlen(bucket[j].title) + 1;
+            memcpy(strings + strings_len, bucket[j].key, key_len);
+            memcpy(strings + strings_len + key_len, bucket[j].title,
+                title_len);
+            strings_len += key_len + title_len;
+        }
+    }
+
+cleanup:
+    free(bucket_start);
+    free(order);
+    free(sorted);
+    free(positions);
+    return header;
+}
+
+// Saves a compiled table.
+// Returns 0 on success and -1 on error.
+static int save_table(const struct title_db_header *header,
+    const char *filename)
+{
+    size_t len = strlen(filename);
+    char *temp_name = malloc(len + 5);
+    if (temp_name == NULL)
+        return -1;
+    memcpy(temp_name, filename, len);
+    strcpy(temp_name + len, ".tmp");
+
+    int ret = -1;
+    FILE *file = fopen(temp_name, "wb");
+    if (file) {
+        size_t written = fwrite(header, 1, header->size, file);
+        if (fclose(file) == 0 && written == header->size
+            && rename(temp_name, filename) == 0)
+            ret = 0;
+        else
+            remove(temp_name);
+    }
+
+    free(temp_name);
+    return ret;
+}
+
+int load_title_db(const char *filename)
+{
+    size_t size;
+    char *data = map_file(filename, &size);
+    if (data == NULL) {
+        fprintf(stderr, "Could not read title database \"%s\".\n", filename);
+        return -1;
+    }
+
+    // Already compiled?
+    if (size >= sizeof(struct title_db_header)
+        && memcmp(data, TITLE_DB_MAGIC, strlen(TITLE_DB_MAGIC)) == 0)
+    {
+        if (use_table(data, size) == 0)
+            return 0;
+        fprintf(stderr, "Invalid title database \"%s\".\n", filename);
+        unmap_file(data, size);
+        return -1;
+    }
+
+    struct stat sb;
+    if (stat(filename, &sb) == -1) {
+        unmap_file(data, size);
+        return -1;
+    }
+
+    // Use the text file's compiled table if it is up to date.
+    char *db_name = malloc(strlen(filename) + 4);
+    if (db_name == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    strcpy(db_name, filename);
+    strcat(db_name, ".db");
+    size_t db_size;
+    void *db_data = map_file(db_name, &db_size);
+    if (db_data) {
+        const struct title_db_header *header = db_data;
+        if (use_table(db_data, db_size) == 0
+            && header->dump_size == (uint64_t) sb.st_size
+            && header->dump_mtime == (int64_t) sb.st_mtime)
+        {
+            unmap_file(data, size);
+            free(db_name);
+            return 0;
+        }
+        db.header = NULL;
+        unmap_file(db_data, db_size);
+    }
+
+    // Compile the text file.
+    char *text = malloc(size + 1);
+    if (text == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    memcpy(text, data, size);
+    unmap_file(data, size);
+
+    struct entry *entries;
+    ssize_t n = parse_dump(text, size, &entries);
+    if (n == -1)
+        exit_err(ENOMEM, __func__, __LINE__);
+    struct title_db_header *header = compile_table(entries, n);
+    free(entries);
+    free(text);
+    if (header == NULL) {
+        fprintf(stderr, "Could not compile title database \"%s\".\n",
+            filename);
+        free(db_name);
+        return -1;
+    }
+    header->dump_size = sb.st_size;
+    header->dump_mtime = sb.st_mtime;
+
+    // If the table can't be saved, it is used from memory for this run only.
+    if (save_table(header, db_name) != 0) {
+        set_color(BRIGHT_YELLOW, stderr);
+        fprintf(stderr, "Warning: could not save compiled title database"
+            " \"%s\".\n", db_name);
+        set_color(RESET, stderr);
+    }
+    free(db_name);
+
+    use_table(header, header->size);
+    return 0;
+}
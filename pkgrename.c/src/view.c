@@ -0,0 +1,524 @@
+#define _FILE_OFFSET_BITS 64
+
+#include "../include/colors.h"
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/organize.h"
+#include "../include/render.h"
+#include "../include/view.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+int initialize_views(void)
+{
+    fputs("Option --view is not supported on this system.\n", stderr);
+    return -1;
+}
+
+int is_view_directory(const struct stat *sb)
+{
+    (void) sb;
+    return 0;
+}
+
+struct view_file *add_view_file(const char *old_filename,
+    const char *new_filename, const struct pattern_vars *vars, _Bool queued)
+{
+    (void) old_filename;
+    (void) new_filename;
+    (void) vars;
+    (void) queued;
+    return NULL;
+}
+
+void finish_queued_view_file(struct view_file *file, const char *new_basename)
+{
+    (void) file;
+    (void) new_basename;
+}
+
+void update_views(int dry_run)
+{
+    (void) dry_run;
+}
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define FILE_TABLE_SIZE 4096 // A power of 2.
+#define LINK_TABLE_SIZE 4096 // A power of 2.
+
+// A PKG file that has been processed.
+struct view_file {
+    char *old_filename;
+    char *new_filename;
+    const char *filename; // The one of both that has been found, or NULL.
+    _Bool pending; // Its queued rename has not been run or has been skipped.
+    dev_t dev;
+    ino_t ino;
+    char **names; // Its path in each view, or NULL if it is too long.
+    struct view_file *next; // Next file with the same old name's hash.
+    struct view_file *inode_next; // Next file with the same identity's hash.
+    struct view_file *list_next; // Next file in the order of processing.
+};
+
+// A link that a view must contain.
+struct view_link {
+    const char *name; // Path relative to the view's directory.
+    struct view_file *file;
+    _Bool present; // The link already exists.
+    struct view_link *next;
+};
+
+struct view {
+    char *dir;
+    const char *dir_pattern; // The pattern's directory part; may be empty.
+    const char *file_pattern; // The pattern's last component; may be empty.
+    _Bool found; // The directory exists; .dev and .ino are valid.
+    dev_t dev;
+    ino_t ino;
+    struct view_link *links[LINK_TABLE_SIZE];
+    size_t n_created;
+    size_t n_removed;
+    size_t n_kept;
+};
+
+static struct view *views;
+static int n_views;
+
+// Processed files, hashed by old file name and, after update_views() has found
+// them, by identity.
+static struct view_file *files_by_name[FILE_TABLE_SIZE];
+static struct view_file *files_by_inode[FILE_TABLE_SIZE];
+static struct view_file *file_list, *file_list_tail;
+static pthread_mutex_t files_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int hash_inode(dev_t dev, ino_t ino)
+{
+    return hash_number(hash_number(HASH_INIT, dev), ino);
+}
+
+int initialize_views(void)
+{
+    if ((views = calloc(option_n_views, sizeof(*views))) == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    n_views = option_n_views;
+
+    for (int i = 0; i < n_views; i++) {
+        struct view *view = &views[i];
+        char *arg = strdup(option_views[i]);
+        if (arg == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        char *equals = strchr(arg, '=');
+        if (equals == NULL || equals == arg) {
+            fprintf(stderr, "Option --view: \"%s\" is not of the form"
+                " DIR=PATTERN.\n", arg);
+            return -1;
+        }
+        *equals = '\0';
+        view->dir = arg;
+        size_t len = strlen(view->dir);
+        while (len > 1 && view->dir[len - 1] == DIR_SEPARATOR)
+            view->dir[--len] = '\0';
+
+        char *pattern = equals + 1;
+        if (*pattern == DIR_SEPARATOR) {
+            fprintf(stderr, "Option --view: PATTERN \"%s\" must be a relative"
+                " path.\n", pattern);
+            return -1;
+        }
+        char *sep = strrchr(pattern, DIR_SEPARATOR);
+        if (sep) {
+            *sep = '\0';
+            view->dir_pattern = pattern;
+            view->file_pattern = sep + 1;
+        } else {
+            view->dir_pattern = "";
+            view->file_pattern = pattern;
+        }
+
+        struct stat sb;
+        if (stat(view->dir, &sb) == 0) {
+            if (!S_ISDIR(sb.st_mode)) {
+                fprintf(stderr, "Option --view: \"%s\" is not a directory.\n",
+                    view->dir);
+                return -1;
+            }
+            view->found = 1;
+            view->dev = sb.st_dev;
+            view->ino = sb.st_ino;
+        }
+    }
+
+    return 0;
+}
+
+int is_view_directory(const struct stat *sb)
+{
+    for (int i = 0; i < n_views; i++)
+        if (views[i].found && views[i].dev == sb->st_dev
+            && views[i].ino == sb->st_ino)
+            return 1;
+    return 0;
+}
+
+// Builds a file's path in a view, relative to the view's directory.
+// Returns 0 on success and -1 if the path is too long.
+static int build_view_name(char *name, size_t size, const struct view *view,
+    const char *new_filename, const struct pattern_vars *vars)
+{
+    size_t len = 0;
+    name[0] = '\0';
+    if (append_pattern_directories(name, size, &len, view->dir_pattern, vars))
+        return -1;
+
+    // Without a file name pattern, the file's new name is used.
+    char basename[MAX_FORMAT_STRING_LEN];
+    if (view->file_pattern[0]) {
+        build_directory_name(&render_context, basename,
+            view->file_pattern, vars);
+        if (basename[0] == '\0' || strcmp(basename, ".") == 0
+            || strcmp(basename, "..") == 0)
+            strcpy(basename, "_");
+        strcat(basename, ".pkg");
+    } else {
+        const char *p = strrchr(new_filename, DIR_SEPARATOR);
+        snprintf(basename, sizeof(basename), "%s", p ? p + 1 : new_filename);
+    }
+
+    if (len + strlen(basename) >= size)
+        return -1;
+    strcpy(name + len, basename);
+    return 0;
+}
+
+struct view_file *add_view_file(const char *old_filename,
+    const char *new_filename, const struct pattern_vars *vars, _Bool queued)
+{
+    pthread_mutex_lock(&files_mutex);
+
+    // A file that is processed again (e.g. after going back with backspace)
+    // replaces its previous entry.
+    unsigned int i = hash_string(HASH_INIT, old_filename)
+        & (FILE_TABLE_SIZE - 1);
+    struct view_file *file = files_by_name[i];
+    while (file && strcmp(file->old_filename, old_filename) != 0)
+        file = file->next;
+    if (file) {
+        free(file->new_filename);
+        for (int v = 0; v < n_views; v++)
+            free(file->names[v]);
+    } else {
+        if ((file = calloc(1, sizeof(*file))) == NULL
+            || (file->old_filename = strdup(old_filename)) == NULL
+            || (file->names = calloc(n_views, sizeof(*file->names))) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        file->next = files_by_name[i];
+        files_by_name[i] = file;
+        if (file_list_tail)
+            file_list_tail->list_next = file;
+        else
+            file_list = file;
+        file_list_tail = file;
+    }
+
+    if ((file->new_filename = strdup(new_filename)) == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    for (int v = 0; v < n_views; v++) {
+        char name[PATH_MAX];
+        if (build_view_name(name, sizeof(name), &views[v], new_filename,
+            vars))
+        {
+            fprintf(stderr, "Option --view: path too long for file \"%s\".\n",
+                old_filename);
+            file->names[v] = NULL;
+        } else if ((file->names[v] = strdup(name)) == NULL) {
+            exit_err(ENOMEM, __func__, __LINE__);
+        }
+    }
+    file->pending = queued;
+
+    pthread_mutex_unlock(&files_mutex);
+    return file;
+}
+
+// Companion function for finish_queued_view_file().
+// Replaces the last component of a dynamically allocated path.
+static char *replace_basename(char *path, const char *basename)
+{
+    char *p = strrchr(path, DIR_SEPARATOR);
+    size_t len = p ? (size_t) (p + 1 - path) : 0;
+    char *new_path = malloc(len + strlen(basename) + 1);
+    if (new_path == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    memcpy(new_path, path, len);
+    strcpy(new_path + len, basename);
+    free(path);
+    return new_path;
+}
+
+void finish_queued_view_file(struct view_file *file, const char *new_basename)
+{
+    if (new_basename == NULL) // Skipped; the file keeps its old name.
+        return;
+
+    pthread_mutex_lock(&files_mutex);
+
+    // The executor may have picked a different name (option --collision).
+    const char *p = strrchr(file->new_filename, DIR_SEPARATOR);
+    if (strcmp(p ? p + 1 : file->new_filename, new_basename) != 0) {
+        file->new_filename = replace_basename(file->new_filename,
+            new_basename);
+        for (int v = 0; v < n_views; v++)
+            if (views[v].file_pattern[0] == '\0' && file->names[v])
+                file->names[v] = replace_basename(file->names[v],
+                    new_basename);
+    }
+    file->pending = 0;
+
+    pthread_mutex_unlock(&files_mutex);
+}
+
+// Finds each processed file and hashes it by identity. Files are found under
+// their new names, except in dry runs, which have not renamed them.
+static void find_files(int dry_run)
+{
+    for (struct view_file *file = file_list; file; file = file->list_next) {
+        if (file->pending)
+            continue;
+        struct stat sb;
+        const char *filename = dry_run ? file->old_filename
+            : file->new_filename;
+        if (stat(filename, &sb) != 0) {
+            fprintf(stderr, "Option --view: could not find file \"%s\".\n",
+                filename);
+            continue;
+        }
+        file->filename = filename;
+        file->dev = sb.st_dev;
+        file->ino = sb.st_ino;
+        unsigned int i = hash_inode(sb.st_dev, sb.st_ino) & (FILE_TABLE_SIZE - 1);
+        file->inode_next = files_by_inode[i];
+        files_by_inode[i] = file;
+    }
+}
+
+static struct view_file *find_file_by_inode(dev_t dev, ino_t ino)
+{
+    struct view_file *file =
+        files_by_inode[hash_inode(dev, ino) & (FILE_TABLE_SIZE - 1)];
+    while (file && (file->dev != dev || file->ino != ino))
+        file = file->inode_next;
+    return file;
+}
+
+static struct view_link *find_link(const struct view *view, const char *name)
+{
+    struct view_link *link =
+        view->links[hash_string(HASH_INIT, name) & (LINK_TABLE_SIZE - 1)];
+    while (link && strcmp(link->name, name) != 0)
+        link = link->next;
+    return link;
+}
+
+// Adds the links a view must contain to its hash table.
+static void add_links(struct view *view, int v)
+{
+    for (struct view_file *file = file_list; file; file = file->list_next) {
+        if (file->filename == NULL || file->names[v] == NULL)
+            continue;
+
+        struct view_link *link = find_link(view, file->names[v]);
+        if (link) {
+            if (link->file->dev != file->dev || link->file->ino != file->ino) {
+                set_color(BRIGHT_YELLOW, stderr);
+                fprintf(stderr, "Option --view: \"%s%c%s\" is built for"
+                    " multiple files; skipping file \"%s\".\n", view->dir,
+                    DIR_SEPARATOR, file->names[v], file->filename);
+                set_color(RESET, stderr);
+            }
+            continue;
+        }
+
+        if ((link = malloc(sizeof(*link))) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        link->name = file->names[v];
+        link->file = file;
+        link->present = 0;
+        unsigned int i = hash_string(HASH_INIT, link->name)
+            & (LINK_TABLE_SIZE - 1);
+        link->next = view->links[i];
+        view->links[i] = link;
+    }
+}
+
+static int has_pkg_extension(const char *name)
+{
+    size_t len = strlen(name);
+    return len >= 4 && strcasecmp(name + len - 4, ".pkg") == 0;
+}
+
+// Searches a view's directory <path>, whose length is <len> and whose path
+// relative to the view's directory starts at <rel>. Keeps the links that point
+// to the right file and removes outdated ones.
+// Returns the number of removed links.
+static size_t prune_directory(struct view *view, char *path, size_t len,
+    size_t rel, int dry_run)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "Option --view: could not open directory \"%s\".\n",
+            path);
+        return 0;
+    }
+
+    size_t n_removed = 0; // Including subdirectories.
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        size_t name_len = strlen(entry->d_name);
+        if (len + 1 + name_len >= PATH_MAX)
+            continue;
+        path[len] = DIR_SEPARATOR;
+        memcpy(path + len + 1, entry->d_name, name_len + 1);
+
+        struct stat sb;
+        if (lstat(path, &sb) != 0)
+            continue;
+        if (S_ISDIR(sb.st_mode)) {
+            n_removed += prune_directory(view, path, len + 1 + name_len, rel,
+                dry_run);
+            continue;
+        }
+        if (!has_pkg_extension(entry->d_name)
+            || !(S_ISLNK(sb.st_mode) || S_ISREG(sb.st_mode)))
+            continue;
+
+        // Keep correct links.
+        struct stat target;
+        int found = stat(path, &target) == 0;
+        struct view_link *link = find_link(view, path + rel);
+        if (found && link && link->file->dev == target.st_dev
+            && link->file->ino == target.st_ino)
+        {
+            link->present = 1;
+            view->n_kept++;
+            continue;
+        }
+
+        // Remove dangling symbolic links and links to processed files that
+        // belong elsewhere. A hard link that is the last one to its file is
+        // kept.
+        int outdated = found
+            ? find_file_by_inode(target.st_dev, target.st_ino) != NULL
+                && (S_ISLNK(sb.st_mode) || sb.st_nlink > 1)
+            : S_ISLNK(sb.st_mode);
+        if (outdated == 0)
+            continue;
+        if (dry_run == 0 && unlink(path) != 0) {
+            fprintf(stderr, "Option --view: could not remove \"%s\" (%s).\n",
+                path, strerror(errno));
+            continue;
+        }
+        n_removed++;
+        view->n_removed++;
+    }
+    closedir(dir);
+
+    // Remove directories that have become empty.
+    path[len] = '\0';
+    if (n_removed && dry_run == 0 && len > rel - 1)
+        rmdir(path);
+
+    return n_removed;
+}
+
+// Creates a link to <file> at <path>: a hard link if possible, else a symbolic
+// link.
+// Returns 0 on success and -1 on error.
+static int create_link(const char *path, const struct view_file *file)
+{
+    if (link(file->filename, path) == 0)
+        return 0;
+    if (errno != EXDEV && errno != EPERM && errno != ENOTSUP
+        && errno != EMLINK)
+        return -1;
+
+    char target[PATH_MAX];
+    if (realpath(file->filename, target) == NULL)
+        return -1;
+    return symlink(target, path);
+}
+
+// Creates a view's missing links.
+static void create_links(struct view *view, int dry_run)
+{
+    char path[PATH_MAX];
+    for (int i = 0; i < LINK_TABLE_SIZE; i++) {
+        for (struct view_link *link = view->links[i]; link; link = link->next) {
+            if (link->present)
+                continue;
+            if (dry_run) {
+                view->n_created++;
+                continue;
+            }
+
+            if (snprintf(path, sizeof(path), "%s%c%s", view->dir,
+                DIR_SEPARATOR, link->name) >= (int) sizeof(path))
+                continue;
+            char *sep = strrchr(path, DIR_SEPARATOR);
+            *sep = '\0';
+            int err = create_directory(path);
+            *sep = DIR_SEPARATOR;
+            if (err)
+                continue;
+
+            if (create_link(path, link->file) != 0) {
+                set_color(BRIGHT_RED, stderr);
+                fprintf(stderr, "Option --view: could not create link \"%s\""
+                    " (%s).\n", path, strerror(errno));
+                set_color(RESET, stderr);
+                continue;
+            }
+            view->n_created++;
+        }
+    }
+}
+
+void update_views(int dry_run)
+{
+    find_files(dry_run);
+
+    for (int v = 0; v < n_views; v++) {
+        struct view *view = &views[v];
+        add_links(view, v);
+
+        char path[PATH_MAX];
+        size_t len = strlen(view->dir);
+        struct stat sb;
+        if (len < sizeof(path) && stat(view->dir, &sb) == 0) {
+            memcpy(path, view->dir, len + 1);
+            prune_directory(view, path, len, len + 1, dry_run);
+        }
+
+        create_links(view, dry_run);
+
+        set_color(GRAY, stdout);
+        if (dry_run)
+            printf("View \"%s\": would create %zu links and remove %zu.\n",
+                view->dir, view->n_created, view->n_removed);
+        else
+            printf("View \"%s\": created %zu links, removed %zu, kept %zu.\n",
+                view->dir, view->n_created, view->n_removed, view->n_kept);
+        set_color(RESET, stdout);
+    }
+}
+#endif
@@ -0,0 +1,491 @@
+#include "../include/colors.h"
+#include "../include/common.h"
+#include "../include/options.h"
+#include "../include/scan.h"
+#include "../include/watch.h"
+
+#include <stdio.h>
+
+#ifndef __linux__
+int start_watching(char **dirs, int n_dirs)
+{
+    (void) dirs;
+    (void) n_dirs;
+    fputs("Option --watch is not supported on this system.\n", stderr);
+    return -1;
+}
+
+void remember_scanned_file(const char *path)
+{
+    (void) path;
+}
+
+int watch_directories(struct scan_job *job)
+{
+    (void) job;
+    return -1;
+}
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE \
+    | IN_DELETE_SELF | IN_ONLYDIR)
+
+// Watched directory.
+struct watched_dir {
+    int wd;
+    char *path;
+};
+
+// File that waits to settle before it is scanned.
+struct pending_file {
+    char *path;
+    long long deadline; // In milliseconds, see get_time().
+    off_t size;
+    struct timespec mtime;
+};
+
+// File that a directory search has added while its directory was watched, in
+// a hash table. Events for it are dropped if it hasn't changed since.
+#define SCANNED_TABLE_SIZE 4096 // Must be a power of 2.
+struct scanned_file {
+    char *path;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct scanned_file *next;
+};
+
+static int inotify_fd;
+static char **root_dirs; // As passed to start_watching().
+static size_t n_root_dirs, root_dirs_size;
+static struct watched_dir *watched_dirs;
+static size_t n_watched_dirs, watched_dirs_size;
+static struct pending_file *pending_files;
+static size_t n_pending_files, pending_files_size;
+static struct scanned_file *scanned_files[SCANNED_TABLE_SIZE];
+
+// Makes sure an array has space for at least one more element.
+static void *grow_array(void *array, size_t *size, size_t n, size_t elem_size)
+{
+    if (n < *size)
+        return array;
+
+    *size = *size ? *size * 2 : 16;
+    array = realloc(array, *size * elem_size);
+    if (array == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    return array;
+}
+
+static int has_pkg_extension(const char *name)
+{
+    char *ext = strrchr(name, '.');
+    return ext && strcasecmp(ext, ".pkg") == 0;
+}
+
+// Concatenates a directory and a file name; the result must be freed.
+static char *join_path(const char *dir, const char *name)
+{
+    size_t dir_len = strlen(dir);
+    while (dir_len > 1 && dir[dir_len - 1] == DIR_SEPARATOR)
+        dir_len--;
+
+    char *path = malloc(dir_len + 1 + strlen(name) + 1);
+    if (path == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    sprintf(path, "%.*s%c%s", (int) dir_len, dir, DIR_SEPARATOR, name);
+    return path;
+}
+
+// Updates the paths of a watched directory that has been moved from <old_path>
+// to <new_path> and of its watched subdirectories.
+static void move_watched_paths(const char *old_path, const char *new_path)
+{
+    char *old = strdup(old_path);
+    if (old == NULL)
+        exit_err(ENOMEM, __func__, __LINE__);
+    size_t old_len = strlen(old);
+
+    for (size_t i = 0; i < n_watched_dirs; i++) {
+        char *path = watched_dirs[i].path;
+        if (strncmp(path, old, old_len)
+            || (path[old_len] != '\0' && path[old_len] != DIR_SEPARATOR))
+            continue;
+        char *moved = malloc(strlen(new_path) + strlen(path + old_len) + 1);
+        if (moved == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        sprintf(moved, "%s%s", new_path, path + old_len);
+        free(path);
+        watched_dirs[i].path = moved;
+    }
+    free(old);
+}
+
+// Adds an inotify watch for a directory and, with option_recursive, for its
+// subdirectories.
+// Returns 0 on success and -1 on error.
+static int watch_directory(const char *path)
+{
+    int wd = inotify_add_watch(inotify_fd, path, WATCH_EVENTS);
+    if (wd == -1) {
+        set_color(BRIGHT_RED, stderr);
+        fprintf(stderr, "Could not watch directory \"%s\" (%s).\n", path,
+            strerror(errno));
+        set_color(RESET, stderr);
+        return -1;
+    }
+
+    // Watch descriptors are reused if the same directory is added twice, e.g.
+    // after it has been moved inside a watched tree. Its subdirectories are
+    // still walked, as some may not have been seen before.
+    size_t i;
+    for (i = 0; i < n_watched_dirs; i++) {
+        if (watched_dirs[i].wd == wd) {
+            if (strcmp(watched_dirs[i].path, path))
+                move_watched_paths(watched_dirs[i].path, path);
+            break;
+        }
+    }
+    if (i == n_watched_dirs) {
+        watched_dirs = grow_array(watched_dirs, &watched_dirs_size,
+            n_watched_dirs, sizeof(*watched_dirs));
+        watched_dirs[n_watched_dirs].wd = wd;
+        if ((watched_dirs[n_watched_dirs].path = strdup(path)) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        n_watched_dirs++;
+    }
+
+    if (option_recursive == 0)
+        return 0;
+
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_type != DT_DIR || entry->d_name[0] == '.'
+            || entry->d_name[0] == '$') // Exclude system dirs.
+            continue;
+        char *subdir = join_path(path, entry->d_name);
+        watch_directory(subdir);
+        free(subdir);
+    }
+    closedir(dir);
+    return 0;
+}
+
+static void unwatch_directory(int wd)
+{
+    for (size_t i = 0; i < n_watched_dirs; i++) {
+        if (watched_dirs[i].wd == wd) {
+            free(watched_dirs[i].path);
+            watched_dirs[i] = watched_dirs[--n_watched_dirs];
+            return;
+        }
+    }
+}
+
+// Remembers a file that a directory search has added to the scan list, so
+// that events that arrive for it later are not taken for a new file.
+void remember_scanned_file(const char *path)
+{
+    struct stat sb;
+    if (inotify_fd <= 0 || stat(path, &sb))
+        return;
+
+    // Files are searched again after an event queue overflow.
+    unsigned int i = hash_string(HASH_INIT, path) & (SCANNED_TABLE_SIZE - 1);
+    struct scanned_file *file = scanned_files[i];
+    while (file && strcmp(file->path, path))
+        file = file->next;
+    if (file == NULL) {
+        file = malloc(sizeof(*file));
+        if (file == NULL || (file->path = strdup(path)) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        file->next = scanned_files[i];
+        scanned_files[i] = file;
+    }
+    file->ino = sb.st_ino;
+    file->size = sb.st_size;
+    file->mtime = sb.st_mtim;
+}
+
+// Returns 1 if a settled file has already been scanned in its current state,
+// otherwise 0. Either way, the file is forgotten.
+static int forget_scanned_file(const char *path, const struct stat *sb)
+{
+    struct scanned_file **p =
+        &scanned_files[hash_string(HASH_INIT, path) & (SCANNED_TABLE_SIZE - 1)];
+    while (*p && strcmp((*p)->path, path))
+        p = &(*p)->next;
+    if (*p == NULL)
+        return 0;
+
+    struct scanned_file *file = *p;
+    int unchanged = file->ino == sb->st_ino && file->size == sb->st_size
+        && file->mtime.tv_sec == sb->st_mtim.tv_sec
+        && file->mtime.tv_nsec == sb->st_mtim.tv_nsec;
+    *p = file->next;
+    free(file->path);
+    free(file);
+    return unchanged;
+}
+
+// Returns the time of a monotonic clock in milliseconds.
+static long long get_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+static const char *get_watched_path(int wd)
+{
+    for (size_t i = 0; i < n_watched_dirs; i++)
+        if (watched_dirs[i].wd == wd)
+            return watched_dirs[i].path;
+    return NULL;
+}
+
+// Schedules a file to be scanned once it has settled; takes ownership of
+// <path>.
+static void add_pending_file(char *path)
+{
+    struct stat sb;
+    if (stat(path, &sb)) { // Already deleted or moved away.
+        free(path);
+        return;
+    }
+
+    struct pending_file *file = NULL;
+    for (size_t i = 0; i < n_pending_files; i++) {
+        if (strcmp(pending_files[i].path, path) == 0) {
+            file = &pending_files[i];
+            free(path);
+            break;
+        }
+    }
+    if (file == NULL) {
+        pending_files = grow_array(pending_files, &pending_files_size,
+            n_pending_files, sizeof(*pending_files));
+        file = &pending_files[n_pending_files++];
+        file->path = path;
+    }
+
+    file->deadline = get_time() + WATCH_SETTLE_TIME;
+    file->size = sb.st_size;
+    file->mtime = sb.st_mtim;
+}
+
+// Hands all settled files over to the scan job.
+// Returns the number of milliseconds until the next file may settle or -1 if
+// no files are pending.
+static int process_pending_files(struct scan_job *job)
+{
+    long long now = get_time();
+    long long next_deadline = -1;
+
+    for (size_t i = 0; i < n_pending_files; i++) {
+        struct pending_file *file = &pending_files[i];
+        if (file->deadline > now)
+            goto keep;
+
+        // Files that have been written to again have to wait longer.
+        struct stat sb;
+        if (stat(file->path, &sb)) { // Deleted or moved away.
+            free(file->path);
+            goto remove;
+        }
+        if (sb.st_size != file->size
+            || sb.st_mtim.tv_sec != file->mtime.tv_sec
+            || sb.st_mtim.tv_nsec != file->mtime.tv_nsec)
+        {
+            file->deadline = now + WATCH_SETTLE_TIME;
+            file->size = sb.st_size;
+            file->mtime = sb.st_mtim;
+            goto keep;
+        }
+
+        if (forget_scanned_file(file->path, &sb))
+            free(file->path);
+        else
+            add_scan_result(job, file->path, 1, sb.st_dev);
+remove:
+        pending_files[i--] = pending_files[--n_pending_files];
+        continue;
+keep:
+        if (next_deadline == -1 || file->deadline < next_deadline)
+            next_deadline = file->deadline;
+    }
+
+    if (next_deadline == -1)
+        return -1;
+    return next_deadline - now;
+}
+
+// The kernel's event queue has overflowed and events have been lost: searches
+// the watched directories again, like at the start, and watches subdirectories
+// that have been missed. Files that have been searched already and have not
+// changed since are not scanned again.
+static void rescan_watched_dirs(struct scan_job *job)
+{
+    set_color(BRIGHT_YELLOW, stderr);
+    fputs("Too many file system events; searching the watched directories"
+        " again.\n", stderr);
+    set_color(RESET, stderr);
+
+    for (size_t i = 0; i < n_root_dirs; i++) {
+        watch_directory(root_dirs[i]);
+        char *dir = strdup(root_dirs[i]);
+        if (dir == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+        parse_directory(dir, job, NULL);
+        free(dir);
+    }
+}
+
+// Starts watching directories (the current directory if <n_dirs> is 0) and,
+// with option_recursive, their subdirectories. Must be called before the
+// directories are searched, so that no file that arrives during the search is
+// missed.
+// Returns 0 on success and -1 on error.
+int start_watching(char **dirs, int n_dirs)
+{
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        perror("inotify_init1");
+        return -1;
+    }
+
+    char *current_dir = ".";
+    if (n_dirs == 0) {
+        dirs = &current_dir;
+        n_dirs = 1;
+    }
+    for (int i = 0; i < n_dirs; i++) {
+        if (watch_directory(dirs[i]))
+            continue;
+        root_dirs = grow_array(root_dirs, &root_dirs_size, n_root_dirs,
+            sizeof(*root_dirs));
+        if ((root_dirs[n_root_dirs++] = strdup(dirs[i])) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+    }
+    if (n_watched_dirs == 0)
+        return -1;
+
+    if (option_verbose) {
+        set_color(GRAY, stderr);
+        fprintf(stderr, "Watching %zu director%s for new PKG files.\n",
+            n_watched_dirs, n_watched_dirs == 1 ? "y" : "ies");
+        set_color(RESET, stderr);
+    }
+
+    return 0;
+}
+
+// Watches the directories passed to start_watching() for new or completely
+// written .pkg files and adds them to a scan job's scan list, after they have
+// settled. With option_recursive, new subdirectories are watched and searched,
+// too. If events have been lost, the directories are searched again. Only
+// returns on error, with -1.
+int watch_directories(struct scan_job *job)
+{
+    // Renames of existing PKGs (e.g. by pkgrename itself) are not new files,
+    // and directories moved inside the tree have been searched already.
+    uint32_t pkg_move_cookie = 0;
+    uint32_t dir_move_cookie = 0;
+
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+    while (1) {
+        int timeout = process_pending_files(job);
+        int ret = poll(&pfd, 1, timeout);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return -1;
+        }
+        if (ret == 0)
+            continue;
+
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len == -1) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror("read");
+            return -1;
+        }
+
+        int overflow = 0;
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = 1;
+                continue;
+            }
+
+            if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+                unwatch_directory(event->wd);
+                continue;
+            }
+
+            const char *dir = get_watched_path(event->wd);
+            if (dir == NULL || event->len == 0)
+                continue;
+
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & IN_MOVED_FROM)
+                    dir_move_cookie = event->cookie;
+                if (option_recursive && (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    && event->name[0] != '.' && event->name[0] != '$')
+                {
+                    // Watch first, so that no file is missed in between.
+                    char *subdir = join_path(dir, event->name);
+                    watch_directory(subdir);
+                    if ((event->mask & IN_MOVED_TO) == 0
+                        || event->cookie != dir_move_cookie)
+                        parse_directory(subdir, job, NULL);
+                    free(subdir);
+                }
+                continue;
+            }
+
+            if (event->mask & IN_MOVED_FROM) {
+                pkg_move_cookie = has_pkg_extension(event->name)
+                    ? event->cookie : 0;
+                continue;
+            }
+
+            if (!has_pkg_extension(event->name)
+                || (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) == 0)
+                continue;
+            if ((event->mask & IN_MOVED_TO) && pkg_move_cookie
+                && event->cookie == pkg_move_cookie)
+                continue;
+
+            add_pending_file(join_path(dir, event->name));
+        }
+
+        if (overflow) {
+            pkg_move_cookie = dir_move_cookie = 0;
+            rescan_watched_dirs(job);
+        }
+    }
+}
+#endif
@@ -0,0 +1,149 @@
+// Benchmark for mixed_case(), the implementation of option --mixed-case.
+// Compares it with the previous implementation, which searched each title for
+// every special word, and checks that both produce the same results.
+//
+// Compile: gcc -Wall -Wextra -pedantic tools/mixed_case_bench.c -o mixed_case_bench -pthread -O2
+// Usage:   mixed_case_bench FILE [ROUNDS]
+//          FILE contains one title per line (e.g. the titles of a --title-db
+//          file: cut -f 2- FILE). Each implementation converts all titles
+//          ROUNDS times (default: 100).
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
+// The benchmark needs the special words, which are private to strings.c.
+#include "../src/characters.c"
+#include "../src/common.c"
+#include "../src/strings.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static char **titles;
+static size_t n_titles;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The previous implementation's replace_word().
+static void replace_word(char *string, const char *word, const char *replace)
+{
+    char *p = string;
+    size_t word_len = strlen(word);
+    size_t replace_len = strlen(replace);
+
+    while ((p = strwrd(p, (char *) word))) {
+        if (strlen(string) - word_len + replace_len > MAX_FILENAME_LEN)
+            return;
+        memmove(p + replace_len, p + word_len, strlen(p + word_len) + 1);
+        memcpy(p, replace, replace_len);
+        p++;
+    }
+}
+
+// The previous implementation of mixed_case().
+static void mixed_case_reference(char *title)
+{
+    int len = strlen(title);
+
+    title[0] = toupper(title[0]);
+    for (int i = 1; i < len; i++) {
+        if (isspace(title[i - 1]) || is_in_set(title[i - 1], ":-;~_1234567890"))
+            title[i] = toupper(title[i]);
+        else
+            title[i] = tolower(title[i]);
+    }
+
+    for (int i = 0; builtin_special_words[i]; i++)
+        replace_word(title, builtin_special_words[i], builtin_special_words[i]);
+}
+
+static void load_titles(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t size = 0;
+    char buf[MAX_TITLE_LEN];
+    while (fgets(buf, sizeof(buf), file)) {
+        buf[strcspn(buf, "\r\n")] = '\0';
+        if (buf[0] == '\0')
+            continue;
+        if (n_titles == size) {
+            size = size ? size * 2 : 1024;
+            if ((titles = realloc(titles, size * sizeof(*titles))) == NULL)
+                exit_err(ENOMEM, __func__, __LINE__);
+        }
+        if ((titles[n_titles++] = strdup(buf)) == NULL)
+            exit_err(ENOMEM, __func__, __LINE__);
+    }
+    fclose(file);
+
+    if (n_titles == 0) {
+        fprintf(stderr, "File \"%s\" contains no titles.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Runs an implementation on all titles <rounds> times.
+// Returns the elapsed time in seconds.
+static double run(void (*function)(char *), int rounds)
+{
+    char title[MAX_FILENAME_LEN];
+    double start = now();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n_titles; i++) {
+            strcpy(title, titles[i]);
+            function(title);
+        }
+    }
+    return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s FILE [ROUNDS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int rounds = argc == 3 ? atoi(argv[2]) : 100;
+    if (rounds < 1)
+        rounds = 1;
+    load_titles(argv[1]);
+
+    // Compare the results.
+    size_t n_different = 0;
+    for (size_t i = 0; i < n_titles; i++) {
+        char a[MAX_FILENAME_LEN], b[MAX_FILENAME_LEN];
+        strcpy(a, titles[i]);
+        strcpy(b, titles[i]);
+        mixed_case_reference(a);
+        mixed_case(b);
+        if (strcmp(a, b) != 0) {
+            if (n_different++ < 10)
+                printf("Different: \"%s\" => \"%s\" (previous: \"%s\")\n",
+                    titles[i], b, a);
+        }
+    }
+
+    double reference = run(mixed_case_reference, rounds);
+    double current = run(mixed_case, rounds);
+    double n = (double) n_titles * rounds;
+    printf("Titles: %zu x %d rounds, %zu different results.\n", n_titles,
+        rounds, n_different);
+    printf("Previous: %8.3f s, %10.0f titles/s\n", reference, n / reference);
+    printf("Current:  %8.3f s, %10.0f titles/s (%.1fx)\n", current,
+        n / current, reference / current);
+
+    return n_different ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,507 @@
+// Offline test harness for the online lookup engine (option --online).
+// Serves canned store pages on 127.0.0.1 and checks titles, missing titles,
+// retries of failed lookups, transfer timeouts, and that no more than
+// --online-jobs lookups run at the same time when more are queued, that
+// duplicate lookups of a Content ID share one request, and that --online-rate
+// spaces out the starts of requests. Runs in
+// separate processes check the cache file (option --online-cache): that cached
+// titles are not fetched again, that expired ones are revalidated with their
+// ETag and Last-Modified validators, and that --offline uses the cache.
+//
+// Compile: gcc -Wall -Wextra -pedantic tools/online_test.c -o online_test -lcurl -pthread -O2
+//          (add -DTEST_PORT=N if port 18431 is taken)
+// Usage:   online_test
+//          Takes about 6 seconds, most of it waiting for the timeout check.
+
+#define _GNU_SOURCE
+
+#ifndef TEST_PORT
+#define TEST_PORT 18431
+#endif
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+#define STORE_URL "http://127.0.0.1:" TO_STRING(TEST_PORT) "/"
+
+// The checks need the engine's internals, which are private to onlinesearch.c.
+#include "../src/common.c"
+#include "../src/onlinesearch.c"
+#include "../src/storepage.c"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define ONLINE_JOBS 3
+#define N_QUEUED 12 // Lookups queued at once, more than ONLINE_JOBS.
+#define SLOW_RESPONSE 7 // Seconds; longer than the engine's 5-second timeout.
+#define N_RATED 5 // Lookups started under the --online-rate limit.
+#define RATE 10 // Requests per second.
+#define CACHED_ID "UP0000-TEST00000_00-CACHED0000000000"
+#define ETAG "\"v1\""
+#define LAST_MODIFIED "Wed, 01 Jan 2025 00:00:00 GMT"
+
+// The engine's options.
+int option_offline;
+char *option_online_cache;
+int option_online_jobs = ONLINE_JOBS;
+int option_online_rate;
+int option_online_ttl = 30;
+
+// Server state.
+static pthread_mutex_t server_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int n_active, max_active; // Concurrent requests.
+static int n_flaky_requests;
+static int n_cached_requests, n_cached_fetches; // Fetches: full responses.
+static int n_validators; // Revalidations that sent both validators.
+static int n_counted_requests;
+static double rated_starts[N_RATED]; // When the server got the requests.
+static int n_rated_requests;
+
+static int n_failed;
+
+static void check(int condition, const char *description)
+{
+    printf("%-6s %s\n", condition ? "ok" : "FAILED", description);
+    if (!condition)
+        n_failed++;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return;
+        data += n;
+        len -= n;
+    }
+}
+
+// Sends a store page; <headers> are additional header lines.
+static void send_page_with_headers(int fd, int status, const char *title,
+    const char *headers)
+{
+    char body[1024], response[1536];
+    if (title)
+        snprintf(body, sizeof(body), "<html><head>"
+            "<script type=\"application/ld+json\">{\"@context\":"
+            "\"http://schema.org\",\"@type\":\"Product\",\"name\":\"%s\","
+            "\"sku\":\"canned\"}</script></head><body></body></html>", title);
+    else
+        snprintf(body, sizeof(body), "<html><head><title>Not found</title>"
+            "</head><body>This product does not exist.</body></html>");
+    int len = snprintf(response, sizeof(response), "HTTP/1.1 %d %s\r\n"
+        "Content-Type: text/html\r\nContent-Length: %zu\r\n%s"
+        "Connection: close\r\n\r\n%s", status, status == 200 ? "OK"
+        : "Not Found", strlen(body), headers, body);
+    send_all(fd, response, len);
+}
+
+static void send_page(int fd, int status, const char *title)
+{
+    send_page_with_headers(fd, status, title, "");
+}
+
+// Answers a request for a page that has validators: with "304 Not Modified"
+// if the request has a matching ETag, otherwise with the full page.
+static void send_cached_page(int fd, const char *request)
+{
+    _Bool not_modified = strstr(request, "If-None-Match: " ETAG "\r\n")
+        != NULL;
+    pthread_mutex_lock(&server_mutex);
+    n_cached_requests++;
+    if (!not_modified)
+        n_cached_fetches++;
+    else if (strstr(request, "If-Modified-Since: " LAST_MODIFIED "\r\n"))
+        n_validators++;
+    pthread_mutex_unlock(&server_mutex);
+
+    if (not_modified) {
+        static const char response[] = "HTTP/1.1 304 Not Modified\r\n"
+            "ETag: " ETAG "\r\nConnection: close\r\n\r\n";
+        send_all(fd, response, sizeof(response) - 1);
+    } else {
+        send_page_with_headers(fd, 200, "Cached Title", "ETag: " ETAG "\r\n"
+            "Last-Modified: " LAST_MODIFIED "\r\n");
+    }
+}
+
+// Answers a single request. The Content ID's label (the part after "_00-")
+// selects the canned response.
+static void *serve_connection(void *arg)
+{
+    int fd = (int) (long) arg;
+
+    pthread_mutex_lock(&server_mutex);
+    if (++n_active > max_active)
+        max_active = n_active;
+    pthread_mutex_unlock(&server_mutex);
+
+    char request[4096];
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(request) - 1
+        && (n = recv(fd, request + len, sizeof(request) - 1 - len, 0)) > 0)
+    {
+        len += n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n"))
+            break;
+    }
+    request[len] = '\0';
+
+    char label[17] = "";
+    char *id = strstr(request, "/product/");
+    if (id && (id = strstr(id, "_00-")))
+        sscanf(id + 4, "%16[A-Z0-9]", label);
+
+    if (strncmp(label, "OK", 2) == 0) {
+        char title[64];
+        snprintf(title, sizeof(title), "Canned Title %s", label + 2);
+        send_page(fd, 200, title);
+    } else if (strncmp(label, "DELAY", 5) == 0) {
+        usleep(200000);
+        char title[64];
+        snprintf(title, sizeof(title), "Delayed Title %s", label + 5);
+        send_page(fd, 200, title);
+    } else if (strncmp(label, "FLAKY", 5) == 0) {
+        pthread_mutex_lock(&server_mutex);
+        int first = n_flaky_requests++ == 0;
+        pthread_mutex_unlock(&server_mutex);
+        if (!first)
+            send_page(fd, 200, "Flaky Title");
+        // The first request gets no response at all.
+    } else if (strncmp(label, "COUNT", 5) == 0) {
+        pthread_mutex_lock(&server_mutex);
+        n_counted_requests++;
+        pthread_mutex_unlock(&server_mutex);
+        usleep(200000); // Keep the request in flight for duplicates.
+        send_page(fd, 200, "Counted Title");
+    } else if (strncmp(label, "RATE", 4) == 0) {
+        pthread_mutex_lock(&server_mutex);
+        if (n_rated_requests < N_RATED)
+            rated_starts[n_rated_requests++] = now();
+        pthread_mutex_unlock(&server_mutex);
+        send_page(fd, 200, "Rated Title");
+    } else if (strncmp(label, "CACHED", 6) == 0) {
+        send_cached_page(fd, request);
+    } else if (strncmp(label, "SLOW", 4) == 0) {
+        sleep(SLOW_RESPONSE);
+        send_page(fd, 200, "Slow Title");
+    } else {
+        send_page(fd, 404, NULL);
+    }
+
+    close(fd);
+    pthread_mutex_lock(&server_mutex);
+    n_active--;
+    pthread_mutex_unlock(&server_mutex);
+    return NULL;
+}
+
+static void *run_server(void *arg)
+{
+    int server_fd = (int) (long) arg;
+    for (;;) {
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd == -1)
+            continue;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, (void *) (long) fd))
+            close(fd);
+        else
+            pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static void start_server(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(TEST_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (fd == -1 || bind(fd, (struct sockaddr *) &addr, sizeof(addr))
+        || listen(fd, 64))
+    {
+        fprintf(stderr, "Could not listen on 127.0.0.1:%d.\n", TEST_PORT);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, run_server, (void *) (long) fd)) {
+        fprintf(stderr, "Could not start the server thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread);
+}
+
+static int get_counter(const int *counter)
+{
+    pthread_mutex_lock(&server_mutex);
+    int value = *counter;
+    pthread_mutex_unlock(&server_mutex);
+    return value;
+}
+
+// Looks up a Content ID like pkgrename does and returns the lookup's result.
+static CURLcode lookup_title(const char *content_id, char title[MAX_TITLE_LEN])
+{
+    char id[MAX_CONTENT_ID_LEN + 1];
+    strcpy(id, content_id);
+    title[0] = '\0';
+    search_online(id, title, 1);
+
+    pthread_mutex_lock(&engine.mutex);
+    struct lookup *lookup = find_lookup(content_id);
+    CURLcode result = lookup ? lookup->result : CURLE_FAILED_INIT;
+    pthread_mutex_unlock(&engine.mutex);
+    return result;
+}
+
+static void *lookup_thread(void *arg)
+{
+    char title[MAX_TITLE_LEN];
+    lookup_title(arg, title);
+    return strcmp(title, "Counted Title") == 0 ? arg : NULL;
+}
+
+// Looks up a Content ID in a new process, like a separate run of pkgrename
+// with option --online-cache <cache> (and --offline if <offline> is true), and
+// returns its title. The child process saves the cache file when it exits.
+static void run_lookup(const char *content_id, const char *cache,
+    int offline, char title[MAX_TITLE_LEN])
+{
+    int fds[2];
+    if (pipe(fds)) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        option_online_cache = (char *) cache;
+        option_offline = offline;
+        lookup_title(content_id, title);
+        if (write(fds[1], title, strlen(title)) == -1)
+            exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    size_t len = 0;
+    ssize_t n;
+    while (len < MAX_TITLE_LEN - 1
+        && (n = read(fds[0], title + len, MAX_TITLE_LEN - 1 - len)) > 0)
+        len += n;
+    title[len] = '\0';
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+}
+
+// Returns the time a cache file says a Content ID's title has been fetched, or
+// -1 if the file has no entry for it. With <new_time> other than -1, the time
+// is changed to <new_time>.
+static long long get_fetch_time(const char *cache, const char *content_id,
+    long long new_time)
+{
+    char lines[4096] = "";
+    FILE *file = fopen(cache, "r");
+    if (file == NULL)
+        return -1;
+    size_t len = fread(lines, 1, sizeof(lines) - 1, file);
+    lines[len] = '\0';
+    fclose(file);
+
+    char *line = strstr(lines, content_id);
+    if (line == NULL || (line != lines && line[-1] != '\n')
+        || line[strlen(content_id)] != '\t')
+        return -1;
+    char *field = line + strlen(content_id) + 1;
+    char *end;
+    long long fetched = strtoll(field, &end, 10);
+    if (new_time == -1)
+        return fetched;
+
+    if ((file = fopen(cache, "w")) == NULL)
+        return -1;
+    fprintf(file, "%.*s%lld%s", (int) (field - lines), lines, new_time, end);
+    fclose(file);
+    return fetched;
+}
+
+// Checks the cache file in separate runs, which must come before the engine is
+// started in this process.
+static void check_cache(void)
+{
+    char cache[] = "/tmp/online_test-XXXXXX";
+    int fd = mkstemp(cache);
+    if (fd == -1) {
+        perror("mkstemp");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    char title[MAX_TITLE_LEN];
+    run_lookup(CACHED_ID, cache, 0, title);
+    check(strcmp(title, "Cached Title") == 0
+        && get_counter(&n_cached_fetches) == 1
+        && get_fetch_time(cache, CACHED_ID, -1) > 0,
+        "A fetched title is saved in the cache file.");
+
+    run_lookup(CACHED_ID, cache, 0, title);
+    check(strcmp(title, "Cached Title") == 0
+        && get_counter(&n_cached_requests) == 1,
+        "A cached title is not fetched again in the next run.");
+
+    // Let the title expire: --online-ttl is 30 days.
+    long long expired = time(NULL) - 31 * 86400LL;
+    get_fetch_time(cache, CACHED_ID, expired);
+    run_lookup(CACHED_ID, cache, 0, title);
+    check(strcmp(title, "Cached Title") == 0
+        && get_counter(&n_cached_requests) == 2
+        && get_counter(&n_cached_fetches) == 1,
+        "An expired title is revalidated without a full fetch (304).");
+    check(get_counter(&n_validators) == 1,
+        "The revalidation sends both ETag and Last-Modified.");
+    check(get_fetch_time(cache, CACHED_ID, -1) > expired,
+        "A revalidated title is valid for another --online-ttl days.");
+
+    get_fetch_time(cache, CACHED_ID, expired);
+    run_lookup(CACHED_ID, cache, 1, title);
+    check(strcmp(title, "Cached Title") == 0
+        && get_counter(&n_cached_requests) == 2,
+        "--offline takes even expired titles from the cache.");
+    run_lookup("UP0000-TEST00000_00-OK00000000000002", cache, 1, title);
+    check(title[0] == '\0', "--offline does not go online for other titles.");
+
+    remove(cache);
+}
+
+int main(void)
+{
+    setvbuf(stdout, NULL, _IOLBF, 0); // Keep results in order with errors.
+    option_disable_colors = 1;
+    signal(SIGPIPE, SIG_IGN);
+    start_server();
+
+    check_cache();
+
+    char title[MAX_TITLE_LEN];
+
+    CURLcode result = lookup_title("UP0000-TEST00000_00-OK00000000000001",
+        title);
+    check(result == CURLE_OK && strcmp(title, "Canned Title 00000000000001")
+        == 0, "A store page's title is found.");
+
+    result = lookup_title("UP0000-TEST00000_00-NOTFOUND00000000", title);
+    check(result == CURLE_OK && title[0] == '\0',
+        "A page without a product gives no title.");
+
+    result = lookup_title("UP0000-TEST00000_00-FLAKY00000000000", title);
+    check(result != CURLE_OK && title[0] == '\0',
+        "A failed transfer gives no title.");
+    result = lookup_title("UP0000-TEST00000_00-FLAKY00000000000", title);
+    check(result == CURLE_OK && strcmp(title, "Flaky Title") == 0
+        && get_counter(&n_flaky_requests) == 2, "A failed lookup is retried.");
+    result = lookup_title("UP0000-TEST00000_00-FLAKY00000000000", title);
+    check(get_counter(&n_flaky_requests) == 2
+        && strcmp(title, "Flaky Title") == 0,
+        "A successful lookup is not repeated.");
+
+    // More lookups than allowed to run at the same time.
+    char ids[N_QUEUED][MAX_CONTENT_ID_LEN + 1];
+    for (int i = 0; i < N_QUEUED; i++) {
+        sprintf(ids[i], "UP0000-TEST00000_00-DELAY%011d", i);
+        prefetch_online_title(ids[i]);
+    }
+    int n_correct = 0;
+    for (int i = 0; i < N_QUEUED; i++) {
+        char expected[64];
+        sprintf(expected, "Delayed Title %011d", i);
+        if (lookup_title(ids[i], title) == CURLE_OK
+            && strcmp(title, expected) == 0)
+            n_correct++;
+    }
+    check(n_correct == N_QUEUED, "All queued lookups get their titles.");
+    int max = get_counter(&max_active);
+    printf("       (at most %d requests at the same time, limit %d)\n", max,
+        ONLINE_JOBS);
+    check(max <= ONLINE_JOBS,
+        "No more than --online-jobs lookups run at once.");
+    check(max == ONLINE_JOBS, "Queued lookups run concurrently.");
+
+    // Duplicate lookups while the first one is in flight, from prefetches and
+    // from several threads.
+    const char *counted_id = "UP0000-TEST00000_00-COUNT0000000000";
+    for (int i = 0; i < 5; i++)
+        prefetch_online_title(counted_id);
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++)
+        pthread_create(&threads[i], NULL, lookup_thread, (void *) counted_id);
+    n_correct = 0;
+    for (int i = 0; i < 4; i++) {
+        void *ret;
+        pthread_join(threads[i], &ret);
+        if (ret)
+            n_correct++;
+    }
+    check(n_correct == 4, "Duplicate lookups all get the title.");
+    check(get_counter(&n_counted_requests) == 1,
+        "Duplicate lookups in flight share a single request.");
+
+    pthread_mutex_lock(&engine.mutex);
+    option_online_rate = RATE;
+    pthread_mutex_unlock(&engine.mutex);
+    char rated_ids[N_RATED][MAX_CONTENT_ID_LEN + 1];
+    for (int i = 0; i < N_RATED; i++) {
+        sprintf(rated_ids[i], "UP0000-TEST00000_00-RATE%012d", i);
+        prefetch_online_title(rated_ids[i]);
+    }
+    for (int i = 0; i < N_RATED; i++)
+        lookup_title(rated_ids[i], title);
+    pthread_mutex_lock(&engine.mutex);
+    option_online_rate = 0;
+    pthread_mutex_unlock(&engine.mutex);
+    double min_gap = 1e9;
+    pthread_mutex_lock(&server_mutex);
+    for (int i = 1; i < n_rated_requests; i++)
+        if (rated_starts[i] - rated_starts[i - 1] < min_gap)
+            min_gap = rated_starts[i] - rated_starts[i - 1];
+    int n_rated = n_rated_requests;
+    pthread_mutex_unlock(&server_mutex);
+    printf("       (requests at least %.0f ms apart, limit %d per second)\n",
+        min_gap * 1000, RATE);
+    check(n_rated == N_RATED && min_gap >= 0.9 / RATE,
+        "--online-rate spaces out the starts of requests.");
+
+    double start = now();
+    result = lookup_title("UP0000-TEST00000_00-SLOW000000000000", title);
+    double seconds = now() - start;
+    check(result == CURLE_OPERATION_TIMEDOUT && title[0] == '\0'
+        && seconds < SLOW_RESPONSE - 0.5,
+        "A server that does not respond in time is given up on.");
+
+    printf("\n%s\n", n_failed ? "Some checks have FAILED."
+        : "All checks passed.");
+    return n_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,494 @@
+// Generator of synthetic PKG corpora for benchmarking pkgrename.
+// Writes sparse PKG files with a valid header, entry table, entry keys,
+// param.sfo, and (for patches) changeinfo.xml; everything after the metadata
+// is a hole, so a corpus of 100000 multi-gigabyte files only takes about
+// 1 GiB of disk space. Files are named "%content_id%.pkg", which
+// lets a benchmark rename them back with pattern "%content_id%".
+//
+// Compile: gcc -Wall -Wextra -pedantic tools/pkg_corpus.c -o pkg_corpus -O2
+// Usage:   pkg_corpus [OPTIONS] DIRECTORY COUNT
+//          -c LIST     Category distribution (default: "gd:50,gp:35,ac:15")
+//          -d W[:D]    Directory fan-out: W subdirectories per level, D levels
+//                      (default: 0, all files in DIRECTORY)
+//          -f PERCENT  Share of fake PKGs; the rest are retail (default: 50)
+//          -l MIN-MAX  Size of patches' changeinfo.xml in bytes; 0-0 omits it
+//                      (default: 200-8000)
+//          -s MIN-MAX  Apparent file size, suffixes K, M, G, T (default: 1G-50G)
+//          -t MIN-MAX  Title length in characters (default: 8-60)
+//          -x SEED     Random seed (default: 1)
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+#define _FILE_OFFSET_BITS 64
+
+// Fake PKGs need the key checksum that pkg.c's is_fake() expects.
+#include "../src/checksums.c"
+#include "../src/sha256.c"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_CATEGORIES 16
+#define TABLE_OFFSET 0x400
+#define DATA_OFFSET 0x1000
+#define KEYS_SIZE 0x800
+#define MAX_CHANGELOG_SIZE 65536 // pkg.c's MAX_SIZE_CHANGELOG.
+#define MAX_TITLE_LEN 128
+
+struct range {
+    uint64_t min;
+    uint64_t max;
+};
+
+static struct {
+    char name[8];
+    unsigned int weight;
+} categories[MAX_CATEGORIES];
+static int n_categories;
+static unsigned int total_weight;
+
+static int fanout_width, fanout_depth;
+static unsigned int fake_percent = 50;
+static struct range changelog_size = { 200, 8000 };
+static struct range file_size = { 1ULL << 30, 50ULL << 30 };
+static struct range title_len = { 8, 60 };
+static uint64_t rng_state = 1;
+
+// xorshift64*, so that a seed gives the same corpus on every platform.
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static uint64_t rng_range(struct range r)
+{
+    return r.min + rng() % (r.max - r.min + 1);
+}
+
+static void put32(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void put64(unsigned char *p, uint64_t value)
+{
+    put32(p, value >> 32);
+    put32(p + 4, value);
+}
+
+static void put16le(unsigned char *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void put32le(unsigned char *p, uint32_t value)
+{
+    put16le(p, value);
+    put16le(p + 2, value >> 16);
+}
+
+static void die(const char *message, const char *argument)
+{
+    fprintf(stderr, "%s \"%s\".\n", message, argument);
+    exit(EXIT_FAILURE);
+}
+
+// Parses a size with an optional suffix K, M, G, or T.
+static uint64_t parse_size(const char *string, char **end)
+{
+    uint64_t size = strtoull(string, end, 10);
+    switch (**end) {
+        case 'T': case 't': size <<= 10; // Fall through.
+        case 'G': case 'g': size <<= 10; // Fall through.
+        case 'M': case 'm': size <<= 10; // Fall through.
+        case 'K': case 'k': size <<= 10; (*end)++;
+    }
+    return size;
+}
+
+static struct range parse_range(const char *string, _Bool sizes)
+{
+    struct range r;
+    char *end;
+    r.min = sizes ? parse_size(string, &end) : strtoull(string, &end, 10);
+    if (end == string || *end != '-')
+        die("Invalid range", string);
+    const char *max = end + 1;
+    r.max = sizes ? parse_size(max, &end) : strtoull(max, &end, 10);
+    if (end == max || *end != '\0' || r.max < r.min)
+        die("Invalid range", string);
+    return r;
+}
+
+static void parse_categories(const char *string)
+{
+    char buf[256];
+    if (strlen(string) >= sizeof(buf))
+        die("Invalid category list", string);
+    strcpy(buf, string);
+
+    n_categories = 0;
+    total_weight = 0;
+    for (char *p = strtok(buf, ","); p; p = strtok(NULL, ",")) {
+        char *colon = strchr(p, ':');
+        if (colon == NULL || colon - p == 0 || colon - p >= 8
+            || n_categories == MAX_CATEGORIES)
+            die("Invalid category list", string);
+        *colon = '\0';
+        strcpy(categories[n_categories].name, p);
+        categories[n_categories].weight = atoi(colon + 1);
+        total_weight += categories[n_categories++].weight;
+    }
+    if (total_weight == 0)
+        die("Invalid category list", string);
+}
+
+static const char *random_category(void)
+{
+    unsigned int n = rng() % total_weight;
+    for (int i = 0; i < n_categories; i++) {
+        if (n < categories[i].weight)
+            return categories[i].name;
+        n -= categories[i].weight;
+    }
+    return categories[0].name;
+}
+
+// Builds a title of exactly <len> characters from common title words.
+static void random_title(char *title, size_t len)
+{
+    static const char *words[] = { "Dark", "Legend", "of", "the", "Racing",
+        "II", "HD", "Remastered", "Edition", "Chronicles", "Tales", "Final",
+        "Saga", "Warriors", "Zero", "Origins", "Collection", "Deluxe",
+        "Ultimate", "Night", "Star", "Dragon", "Kingdom", "Battle", "Ninja",
+        "Space", "Knight", "Quest", "Drift", "Rpg", "VR", "GOTY", "DLC",
+        "Pack", "Season", "Pass", "Soundtrack", "Theme", "Avatar", "Costume" };
+    static const char *separators[] = { " ", " ", " ", " ", " ", ": ", " - ",
+        " & " };
+    size_t n_words = sizeof(words) / sizeof(*words);
+    size_t n_separators = sizeof(separators) / sizeof(*separators);
+
+    char buf[MAX_TITLE_LEN * 2] = "";
+    size_t buf_len = 0;
+    while (buf_len < len) {
+        if (buf_len)
+            buf_len += sprintf(buf + buf_len, "%s",
+                separators[rng() % n_separators]);
+        buf_len += sprintf(buf + buf_len, "%s", words[rng() % n_words]);
+    }
+    buf[len] = '\0';
+    // A title doesn't end in a separator.
+    while (len > 1 && strchr(" :-&", buf[len - 1]))
+        buf[--len] = '\0';
+    strcpy(title, buf);
+}
+
+// A param.sfo file under construction.
+struct sfo {
+    unsigned char entries[32 * 16];
+    char keys[512];
+    unsigned char data[1024];
+    size_t n_entries, keys_len, data_len;
+};
+
+// Appends a param.sfo entry; keys must be added in alphabetical order.
+static void sfo_add(struct sfo *sfo, const char *key, const char *string,
+    uint32_t integer, uint32_t max_len)
+{
+    unsigned char *entry = &sfo->entries[sfo->n_entries++ * 16];
+    uint32_t len = string ? strlen(string) + 1 : 4;
+    if (max_len < len)
+        max_len = (len + 3) & ~3U;
+
+    put16le(entry, sfo->keys_len);
+    put16le(entry + 2, string ? 0x0204 : 0x0404);
+    put32le(entry + 4, len);
+    put32le(entry + 8, max_len);
+    put32le(entry + 12, sfo->data_len);
+
+    strcpy(sfo->keys + sfo->keys_len, key);
+    sfo->keys_len += strlen(key) + 1;
+
+    memset(sfo->data + sfo->data_len, 0, max_len);
+    if (string)
+        memcpy(sfo->data + sfo->data_len, string, len);
+    else
+        put32le(sfo->data + sfo->data_len, integer);
+    sfo->data_len += max_len;
+}
+
+// Writes the finished param.sfo to <to>; returns its size.
+static size_t sfo_write(struct sfo *sfo, unsigned char *to)
+{
+    size_t keytable_offset = 20 + sfo->n_entries * 16;
+    size_t keys_len = (sfo->keys_len + 3) & ~3U;
+    size_t datatable_offset = keytable_offset + keys_len;
+
+    put32le(to, 0x46535000);
+    put32le(to + 4, 0x101);
+    put32le(to + 8, keytable_offset);
+    put32le(to + 12, datatable_offset);
+    put32le(to + 16, sfo->n_entries);
+    memcpy(to + 20, sfo->entries, sfo->n_entries * 16);
+    memset(to + keytable_offset, 0, keys_len);
+    memcpy(to + keytable_offset, sfo->keys, sfo->keys_len);
+    memcpy(to + datatable_offset, sfo->data, sfo->data_len);
+
+    // pkg.c requires data to end before the end of the file.
+    memset(to + datatable_offset + sfo->data_len, 0, 4);
+    return datatable_offset + sfo->data_len + 4;
+}
+
+// Writes a changelog of about <size> bytes with several patch versions.
+static size_t write_changelog(char *to, size_t size, const char *app_ver)
+{
+    size_t len = sprintf(to, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<changeinfo>\n");
+    int minor = 1;
+    while (len < size) {
+        len += sprintf(to + len, "  <changes app_ver=\"01.%02d\">\n",
+            minor++ % 100);
+        while (len < size && len % 512 < 448)
+            len += sprintf(to + len, "    - Fixed various issues.\n");
+        len += sprintf(to + len, "  </changes>\n");
+    }
+    len += sprintf(to + len, "  <changes app_ver=\"%s\">\n"
+        "    - Improved stability.\n  </changes>\n</changeinfo>\n", app_ver);
+    return len;
+}
+
+// Writes the 32-byte key checksum that makes pkg.c's is_fake() return true.
+static void fake_key_checksum(unsigned char *to, const char *content_id)
+{
+    unsigned char index_buf[4] = { 0 };
+    unsigned char content_id_buf[48] = { 0 };
+    memcpy(content_id_buf, content_id, strlen(content_id));
+    unsigned char data[96];
+    sha256(data, index_buf, sizeof(index_buf));
+    sha256(data + 32, content_id_buf, sizeof(content_id_buf));
+    memset(data + 64, '0', 32);
+
+    unsigned char key[32], checksum[32];
+    sha256(key, data, sizeof(data));
+    sha256(checksum, key, sizeof(key));
+    for (int i = 0; i < 32; i++)
+        to[i] = key[i] ^ checksum[i];
+}
+
+// Creates the parent directories of file <n> and stores its path.
+static void file_path(char *path, const char *directory, unsigned long n,
+    const char *content_id)
+{
+    size_t len = sprintf(path, "%s", directory);
+    unsigned long bucket = n;
+    for (int level = 0; level < fanout_depth; level++) {
+        len += sprintf(path + len, "/%03lu", bucket % fanout_width);
+        bucket /= fanout_width;
+        if (mkdir(path, 0755) && errno != EEXIST)
+            die("Could not create directory", path);
+    }
+    sprintf(path + len, "/%s.pkg", content_id);
+}
+
+// Writes PKG number <n> and adds its apparent and allocated sizes.
+static void write_pkg(const char *directory, unsigned long n,
+    uint64_t *apparent, uint64_t *allocated)
+{
+    static const char *regions[] = { "UP", "EP", "JP", "HP" };
+    static unsigned char buf[DATA_OFFSET + KEYS_SIZE + 8192
+        + MAX_CHANGELOG_SIZE + 1024];
+
+    const char *category = random_category();
+    _Bool is_patch = strstr(category, "gp") != NULL;
+    _Bool is_dlc = strcmp(category, "ac") == 0;
+    char title_id[10], content_id[37], app_ver[6] = "01.00", title[MAX_TITLE_LEN];
+    sprintf(title_id, "CUSA%05lu", n % 100000);
+    sprintf(content_id, "%s%04lu-%s_00-PKGCORPUS%07lu",
+        regions[rng() % 4], n % 10000, title_id, n);
+    if (is_patch)
+        sprintf(app_ver, "01.%02d", (int) (1 + rng() % 99));
+    random_title(title, rng_range(title_len));
+
+    memset(buf, 0, DATA_OFFSET);
+
+    // Entries: entry keys, param.sfo, changeinfo.xml, and the usual others,
+    // which pkgrename skips.
+    size_t offset = DATA_OFFSET;
+    size_t keys_offset = offset;
+    memset(buf + offset, 0, KEYS_SIZE);
+    if (rng() % 100 < fake_percent)
+        fake_key_checksum(buf + offset + 32, content_id);
+    else
+        for (int i = 0; i < 32; i++)
+            buf[offset + 32 + i] = rng();
+    offset += KEYS_SIZE;
+
+    struct sfo sfo = { .n_entries = 0 };
+    sfo_add(&sfo, "APP_TYPE", NULL, 1, 0);
+    sfo_add(&sfo, "APP_VER", app_ver, 0, 8);
+    sfo_add(&sfo, "ATTRIBUTE", NULL, 0, 0);
+    sfo_add(&sfo, "CATEGORY", category, 0, 4);
+    sfo_add(&sfo, "CONTENT_ID", content_id, 0, 48);
+    sfo_add(&sfo, "DOWNLOAD_DATA_SIZE", NULL, 0, 0);
+    sfo_add(&sfo, "FORMAT", "obs", 0, 4);
+    sfo_add(&sfo, "PARENTAL_LEVEL", NULL, 1, 0);
+    sfo_add(&sfo, "PUBTOOLINFO", is_patch
+        ? "c_date=20200101,sdk_ver=07508001,st_type=digital50,img0_l0_size=0"
+        : "c_date=20190101,sdk_ver=05050001,st_type=digital50,img0_l0_size=0",
+        0, 512);
+    sfo_add(&sfo, "PUBTOOLVER", NULL, 0x02890000, 0);
+    sfo_add(&sfo, "SYSTEM_VER", NULL, is_patch ? 0x07508001 : 0x05050001, 0);
+    sfo_add(&sfo, "TITLE", title, 0, 128);
+    sfo_add(&sfo, "TITLE_ID", title_id, 0, 12);
+    sfo_add(&sfo, "VERSION", "01.00", 0, 8);
+    size_t sfo_offset = offset;
+    size_t sfo_size = sfo_write(&sfo, buf + offset);
+    offset = (offset + sfo_size + 15) & ~15U;
+
+    size_t changelog_offset = offset, changelog_len = 0;
+    if (is_patch && changelog_size.max) {
+        changelog_len = write_changelog((char *) buf + offset,
+            rng_range(changelog_size), app_ver);
+        offset = (offset + changelog_len + 15) & ~15U;
+    }
+
+    struct {
+        uint32_t id;
+        size_t offset, size;
+    } entries[] = {
+        { 0x0001, 0, 0 },    // digests
+        { 0x0010, keys_offset, KEYS_SIZE }, // entry_keys
+        { 0x0020, 0, 0 },    // image_key
+        { 0x0080, 0, 0 },    // general_digests
+        { 0x0100, 0, 0 },    // metas
+        { 0x0200, 0, 0 },    // entry_names
+        { 0x0400, 0, 0 },    // license.dat
+        { 0x0401, 0, 0 },    // license.info
+        { 0x0409, 0, 0 },    // psreserved.dat
+        { 0x1000, sfo_offset, sfo_size }, // param.sfo
+        { 0x1200, 0, 0 },    // icon0.png
+        { 0x1260, changelog_offset, changelog_len }, // changeinfo.xml
+    };
+    int n_entries = sizeof(entries) / sizeof(*entries) - (changelog_len == 0);
+    for (int i = 0; i < n_entries; i++) {
+        unsigned char *entry = buf + TABLE_OFFSET + i * 32;
+        put32(entry, entries[i].id);
+        put32(entry + 16, entries[i].offset ? entries[i].offset : offset);
+        put32(entry + 20, entries[i].size);
+    }
+
+    uint64_t size = rng_range(file_size);
+    if (size < offset)
+        size = offset;
+
+    unsigned char *header = buf;
+    put32(header, 0x7f434e54);
+    put32(header + 4, 0x80000001);
+    put32(header + 12, n_entries);
+    put32(header + 16, n_entries);
+    put32(header + 24, TABLE_OFFSET);
+    put32(header + 28, offset - TABLE_OFFSET);
+    put64(header + 32, DATA_OFFSET);
+    put64(header + 40, offset - DATA_OFFSET);
+    put64(header + 48, offset);
+    put64(header + 56, size - offset);
+    memcpy(header + 64, content_id, 36);
+    put32(header + 112, 0x0F); // drm_type: PS4
+    put32(header + 116, is_dlc ? 0x1B : 0x1A);
+    put32(header + 120, 0x0A000000);
+
+    char path[4096];
+    file_path(path, directory, n, content_id);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        die("Could not create file", path);
+    if (write(fd, buf, offset) != (ssize_t) offset || ftruncate(fd, size))
+        die("Could not write file", path);
+
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+        *allocated += (uint64_t) st.st_blocks * 512;
+    *apparent += size;
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    parse_categories("gd:50,gp:35,ac:15");
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:f:l:s:t:x:")) != -1) {
+        char *end;
+        switch (opt) {
+            case 'c':
+                parse_categories(optarg);
+                break;
+            case 'd':
+                fanout_width = strtol(optarg, &end, 10);
+                fanout_depth = fanout_width > 0;
+                if (*end == ':')
+                    fanout_depth = strtol(end + 1, &end, 10);
+                if (*end != '\0' || fanout_width < 0 || fanout_depth < 0
+                    || fanout_depth > 8 || (fanout_width == 0) != (fanout_depth == 0))
+                    die("Invalid fan-out", optarg);
+                break;
+            case 'f':
+                fake_percent = strtoul(optarg, &end, 10);
+                if (*end != '\0' || fake_percent > 100)
+                    die("Invalid percentage", optarg);
+                break;
+            case 'l':
+                changelog_size = parse_range(optarg, 0);
+                if (changelog_size.max > MAX_CHANGELOG_SIZE - 512)
+                    die("Changelog sizes must be smaller than 65024 bytes:", optarg);
+                break;
+            case 's':
+                file_size = parse_range(optarg, 1);
+                break;
+            case 't':
+                title_len = parse_range(optarg, 0);
+                if (title_len.min < 1 || title_len.max >= MAX_TITLE_LEN)
+                    die("Title lengths must be between 1 and 127:", optarg);
+                break;
+            case 'x':
+                rng_state = strtoull(optarg, NULL, 10) | 1;
+                break;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "Usage: %s [-c LIST] [-d W[:D]] [-f PERCENT] "
+            "[-l MIN-MAX] [-s MIN-MAX] [-t MIN-MAX] [-x SEED] DIRECTORY COUNT\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *directory = argv[optind];
+    unsigned long count = strtoul(argv[optind + 1], NULL, 10);
+    if (count > 10000000) // Content IDs must be unique.
+        die("COUNT must not exceed 10000000:", argv[optind + 1]);
+    if (mkdir(directory, 0755) && errno != EEXIST)
+        die("Could not create directory", directory);
+
+    uint64_t apparent = 0, allocated = 0;
+    for (unsigned long n = 0; n < count; n++)
+        write_pkg(directory, n, &apparent, &allocated);
+
+    printf("Wrote %lu files to \"%s\": %.2f TiB apparent, %.1f MiB on disk.\n",
+        count, directory, apparent / 1099511627776.0, allocated / 1048576.0);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,285 @@
+// End-to-end benchmark of pkgrename's scanning and renaming, for corpora
+// written by tools/pkg_corpus.c. Runs, in this order:
+//   query    pkgrename --query --files-from LIST (every file in DIRECTORY)
+//   dry run  pkgrename -n -r DIRECTORY
+//   rename   pkgrename -y -r -p "%title% [%title_id%] [%content_id%]" DIRECTORY
+//   restore  pkgrename -y -r -p "%content_id%" DIRECTORY
+// The last two runs rename every file and then restore pkg_corpus's names, so
+// the benchmark can be repeated on the same corpus. For each run it reports
+// wall time, files per second, system calls per file (counted in a separate,
+// traced run of the same command), and peak RSS. Linux only.
+//
+// Compile: gcc -Wall -Wextra -pedantic tools/scan_bench.c -o scan_bench -O2
+// Usage:   scan_bench [-c] [-r ROUNDS] [-s] PKGRENAME DIRECTORY [OPTION...]
+//          -c         Drop the page cache before each run (requires root).
+//          -r ROUNDS  Run everything ROUNDS times and report the fastest runs
+//                     (default: 1).
+//          -s         Don't count system calls.
+//          OPTIONs are passed to every pkgrename run (e.g. --probe-jobs 8).
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ARGS 64
+
+struct result {
+    const char *name;
+    double seconds;
+    long max_rss; // In KiB.
+    double syscalls;
+    int status;
+};
+
+static const char *pkgrename;
+static char **extra_options;
+static int n_extra_options;
+static FILE *list;
+static long n_files;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int list_file(const char *path, const struct stat *st, int type,
+    struct FTW *ftw)
+{
+    (void) st;
+    (void) ftw;
+    size_t len = strlen(path);
+    if (type == FTW_F && len > 4 && strcasecmp(path + len - 4, ".pkg") == 0) {
+        fprintf(list, "%s\n", path);
+        n_files++;
+    }
+    return 0;
+}
+
+// Writes the paths of all PKG files in <directory> to a temporary file.
+static void write_list(char *list_path, const char *directory)
+{
+    strcpy(list_path, "/tmp/scan_bench.XXXXXX");
+    int fd = mkstemp(list_path);
+    if (fd == -1 || (list = fdopen(fd, "w")) == NULL) {
+        perror("mkstemp");
+        exit(EXIT_FAILURE);
+    }
+    n_files = 0;
+    if (nftw(directory, list_file, 64, FTW_PHYS)) {
+        fprintf(stderr, "Could not read directory \"%s\".\n", directory);
+        exit(EXIT_FAILURE);
+    }
+    fclose(list);
+}
+
+static void drop_caches(void)
+{
+    sync();
+    FILE *file = fopen("/proc/sys/vm/drop_caches", "w");
+    if (file == NULL || fputs("3\n", file) == EOF || fclose(file)) {
+        fprintf(stderr, "Could not drop the page cache.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static pid_t start(char **args, _Bool traced)
+{
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        if (traced) {
+            ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+            raise(SIGSTOP);
+        }
+        execv(args[0], args);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Runs a command while counting the system calls of all its threads.
+// Returns the number of system calls or -1 on error.
+static double count_syscalls(char **args)
+{
+    pid_t pid = start(args, 1);
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status))
+        return -1;
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD
+        | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK
+        | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+    // Each system call stops a thread twice: on entry and on exit.
+    unsigned long stops = 0;
+    pid_t tid;
+    while ((tid = waitpid(-1, &status, __WALL)) != -1) {
+        if (!WIFSTOPPED(status))
+            continue;
+        int signal = WSTOPSIG(status);
+        if (signal == (SIGTRAP | 0x80)) {
+            stops++;
+            signal = 0;
+        } else if (signal == SIGTRAP || signal == SIGSTOP) {
+            signal = 0; // Event stops and new threads' initial stops.
+        }
+        ptrace(PTRACE_SYSCALL, tid, NULL, (void *) (long) signal);
+    }
+    return errno == ECHILD ? stops / 2.0 : -1;
+}
+
+static struct result run(const char *name, char **args, _Bool cold,
+    _Bool syscalls)
+{
+    struct result result = { .name = name, .syscalls = -1 };
+    if (cold)
+        drop_caches();
+
+    double start_time = now();
+    pid_t pid = start(args, 0);
+    struct rusage usage;
+    if (wait4(pid, &result.status, 0, &usage) == -1) {
+        perror("wait4");
+        exit(EXIT_FAILURE);
+    }
+    result.seconds = now() - start_time;
+    result.max_rss = usage.ru_maxrss;
+
+    if (syscalls)
+        result.syscalls = count_syscalls(args);
+    return result;
+}
+
+// Builds a pkgrename command line from a NULL-terminated list of arguments.
+static char **command(char **args, ...)
+{
+    int n = 0;
+    args[n++] = (char *) pkgrename;
+    for (int i = 0; i < n_extra_options && n < MAX_ARGS - 8; i++)
+        args[n++] = extra_options[i];
+
+    va_list ap;
+    va_start(ap, args);
+    char *arg;
+    while ((arg = va_arg(ap, char *)) && n < MAX_ARGS - 1)
+        args[n++] = arg;
+    va_end(ap);
+    args[n] = NULL;
+    return args;
+}
+
+static void keep_fastest(struct result *best, struct result result)
+{
+    if (best->name == NULL || result.seconds < best->seconds)
+        *best = result;
+}
+
+int main(int argc, char *argv[])
+{
+    _Bool cold = 0, syscalls = 1;
+    int rounds = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "+cr:s")) != -1) {
+        switch (opt) {
+            case 'c':
+                cold = 1;
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                if (rounds < 1)
+                    rounds = 1;
+                break;
+            case 's':
+                syscalls = 0;
+                break;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind < 2) {
+        fprintf(stderr, "Usage: %s [-c] [-r ROUNDS] [-s] PKGRENAME DIRECTORY "
+            "[OPTION...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    pkgrename = argv[optind];
+    char *directory = argv[optind + 1];
+    extra_options = &argv[optind + 2];
+    n_extra_options = argc - optind - 2;
+
+    struct result best[4] = { { .name = NULL } };
+    for (int round = 0; round < rounds; round++) {
+        char list_path[32];
+        write_list(list_path, directory);
+        if (n_files == 0) {
+            fprintf(stderr, "No PKG files found in \"%s\".\n", directory);
+            unlink(list_path);
+            return EXIT_FAILURE;
+        }
+
+        char *args[MAX_ARGS];
+        keep_fastest(&best[0], run("query", command(args, "--query",
+            "--files-from", list_path, NULL), cold, syscalls));
+        unlink(list_path);
+        keep_fastest(&best[1], run("dry run", command(args, "-n", "-r",
+            directory, NULL), cold, syscalls));
+
+        // The traced run of "rename" would find the files already renamed,
+        // so each renaming run is traced after the other one has restored
+        // the names it expects.
+        struct result rename = run("rename", command(args, "-y", "-r", "-p",
+            "%title% [%title_id%] [%content_id%]", directory, NULL), cold, 0);
+        struct result restore = run("restore", command(args, "-y", "-r",
+            "-p", "%content_id%", directory, NULL), cold, 0);
+        if (syscalls) {
+            rename.syscalls = count_syscalls(command(args, "-y", "-r", "-p",
+                "%title% [%title_id%] [%content_id%]", directory, NULL));
+            restore.syscalls = count_syscalls(command(args, "-y", "-r", "-p",
+                "%content_id%", directory, NULL));
+        }
+        keep_fastest(&best[2], rename);
+        keep_fastest(&best[3], restore);
+    }
+
+    printf("%ld PKG files in \"%s\", %s cache, fastest of %d round%s:\n\n",
+        n_files, directory, cold ? "cold" : "warm", rounds,
+        rounds == 1 ? "" : "s");
+    printf("%-10s %10s %10s %14s %14s\n", "Run", "Seconds", "Files/s",
+        "Syscalls/file", "Peak RSS (MiB)");
+    int failed = 0;
+    for (int i = 0; i < 4; i++) {
+        printf("%-10s %10.3f %10.0f ", best[i].name, best[i].seconds,
+            n_files / best[i].seconds);
+        if (best[i].syscalls >= 0)
+            printf("%14.1f ", best[i].syscalls / n_files);
+        else
+            printf("%14s ", "-");
+        printf("%14.1f", best[i].max_rss / 1024.0);
+        if (!WIFEXITED(best[i].status) || WEXITSTATUS(best[i].status)) {
+            printf("  (failed)");
+            failed = 1;
+        }
+        printf("\n");
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
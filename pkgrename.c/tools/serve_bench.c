@@ -0,0 +1,128 @@
+// Load generator for "pkgrename --serve SOCKET".
+// Measures request latency and throughput of a running server.
+//
+// Compile: gcc -Wall -Wextra -pedantic tools/serve_bench.c -o serve_bench -pthread -O2
+// Usage:   serve_bench SOCKET CLIENTS REQUESTS FILE...
+//          Each of CLIENTS connections sends REQUESTS "name FILE" requests,
+//          cycling through the files, one request at a time.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *socket_path;
+static int n_requests;
+static char **files;
+static int n_files;
+
+struct client {
+    pthread_t thread;
+    int id;
+    double *latencies; // In microseconds.
+    int n_errors;
+};
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void *client_thread(void *arg)
+{
+    struct client *client = arg;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+    FILE *in = fdopen(fd, "r");
+
+    char request[4096];
+    char *line = NULL;
+    size_t line_size = 0;
+    for (int i = 0; i < n_requests; i++) {
+        const char *file = files[(client->id + i) % n_files];
+        int len = snprintf(request, sizeof(request), "name %s\n", file);
+
+        double start = now_us();
+        if (write(fd, request, len) != len
+            || getline(&line, &line_size, in) == -1)
+        {
+            fprintf(stderr, "Connection lost.\n");
+            exit(EXIT_FAILURE);
+        }
+        client->latencies[i] = now_us() - start;
+        if (strncmp(line, "ok ", 3) != 0)
+            client->n_errors++;
+    }
+
+    free(line);
+    fclose(in);
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double d1 = *(const double *) a;
+    double d2 = *(const double *) b;
+    return (d1 > d2) - (d1 < d2);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5) {
+        fprintf(stderr, "Usage: %s SOCKET CLIENTS REQUESTS FILE...\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+    socket_path = argv[1];
+    int n_clients = atoi(argv[2]);
+    n_requests = atoi(argv[3]);
+    files = argv + 4;
+    n_files = argc - 4;
+    if (n_clients < 1 || n_requests < 1) {
+        fprintf(stderr, "CLIENTS and REQUESTS must be positive numbers.\n");
+        return EXIT_FAILURE;
+    }
+
+    struct client *clients = calloc(n_clients, sizeof(*clients));
+    double *latencies = malloc(sizeof(double) * n_clients * n_requests);
+    if (clients == NULL || latencies == NULL)
+        return EXIT_FAILURE;
+
+    double start = now_us();
+    for (int i = 0; i < n_clients; i++) {
+        clients[i].id = i;
+        clients[i].latencies = latencies + (size_t) i * n_requests;
+        pthread_create(&clients[i].thread, NULL, client_thread, &clients[i]);
+    }
+    int n_errors = 0;
+    for (int i = 0; i < n_clients; i++) {
+        pthread_join(clients[i].thread, NULL);
+        n_errors += clients[i].n_errors;
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    size_t total = (size_t) n_clients * n_requests;
+    qsort(latencies, total, sizeof(double), compare_doubles);
+    printf("Requests:   %zu (%d errors)\n", total, n_errors);
+    printf("Time:       %.3f s\n", elapsed);
+    printf("Throughput: %.1f requests/s\n", total / elapsed);
+    printf("Latency:    p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+        latencies[total / 2], latencies[total * 90 / 100],
+        latencies[total * 99 / 100], latencies[total - 1]);
+
+    free(latencies);
+    free(clients);
+    return n_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
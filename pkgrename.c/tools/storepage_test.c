@@ -0,0 +1,126 @@
+// Test of the store page parser (src/storepage.c) against the fixture pages in
+// tools/storepage_fixtures. Each page is parsed as a whole and in chunks of
+// several sizes, as it would arrive from the network, and the results are
+// compared with the fixtures' expected.txt.
+//
+// Compile: gcc -Wall -Wextra -pedantic tools/storepage_test.c -o storepage_test -O2
+// Usage:   storepage_test [DIRECTORY]
+//          DIRECTORY contains the fixtures (default: tools/storepage_fixtures).
+
+#include "../src/storepage.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PAGE_SIZE 65536
+
+static int n_failed;
+
+// Reads a fixture into a buffer of size MAX_PAGE_SIZE.
+// Returns its size or -1 on error.
+static long read_page(const char *directory, const char *name, char *page)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+    long size = fread(page, 1, MAX_PAGE_SIZE, file);
+    fclose(file);
+    return size;
+}
+
+// Parses a page in chunks of <chunk_size> bytes and checks the result.
+static void check_page(const char *name, const char *page, size_t size,
+    size_t chunk_size, const char *expected_title, _Bool expected_product)
+{
+    struct store_page_parser parser;
+    init_store_page_parser(&parser);
+
+    size_t offset = 0;
+    _Bool stopped = 0;
+    while (offset < size) {
+        size_t len = size - offset < chunk_size ? size - offset : chunk_size;
+        stopped = parse_store_page(&parser, page + offset, len);
+        offset += len;
+        if (stopped)
+            break;
+    }
+
+    const char *title = get_store_page_title(&parser);
+    const char *error = NULL;
+    if (expected_title && title == NULL)
+        error = "no title found";
+    else if (expected_title && strcmp(title, expected_title) != 0)
+        error = "wrong title";
+    else if (expected_title && !stopped)
+        error = "parsing did not stop at the title";
+    else if (expected_title == NULL && title != NULL)
+        error = "unexpected title";
+    else if (expected_title == NULL && parser.found_product != expected_product)
+        error = expected_product ? "product without a name not reported"
+            : "unexpected product";
+
+    if (error) {
+        printf("FAILED %s (chunks of %zu bytes): %s", name, chunk_size, error);
+        if (title)
+            printf(" (\"%s\")", title);
+        printf(".\n");
+        n_failed++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *directory = argc > 1 ? argv[1] : "tools/storepage_fixtures";
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/expected.txt", directory);
+    FILE *expected = fopen(path, "r");
+    if (expected == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return EXIT_FAILURE;
+    }
+
+    static char page[MAX_PAGE_SIZE];
+    static const size_t chunk_sizes[] = { MAX_PAGE_SIZE, 4096, 7, 1 };
+    int n_pages = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), expected)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || line[0] == '\0')
+            continue;
+
+        char *name = strtok(line, "\t");
+        char *result = strtok(NULL, "\t");
+        char *title = strtok(NULL, "");
+        if (result == NULL || (strcmp(result, "title") == 0) != (title != NULL)
+            || (title == NULL && strcmp(result, "none")
+                && strcmp(result, "no-name")))
+        {
+            fprintf(stderr, "Invalid line in \"%s\": \"%s\".\n", path, name);
+            return EXIT_FAILURE;
+        }
+
+        long size = read_page(directory, name, page);
+        if (size < 0) {
+            printf("FAILED %s: could not read the file.\n", name);
+            n_failed++;
+            continue;
+        }
+
+        int n_failed_before = n_failed;
+        for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(*chunk_sizes); i++)
+            check_page(name, page, size, chunk_sizes[i], title,
+                strcmp(result, "no-name") == 0);
+        if (n_failed == n_failed_before)
+            printf("ok     %s\n", name);
+        n_pages++;
+    }
+    fclose(expected);
+
+    printf("\n%d pages, %s\n", n_pages, n_failed ? "some checks have FAILED."
+        : "all checks passed.");
+    return n_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}